@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Throughput of the batch paths, with the large batch memory optimizations
+ * at their defaults, forced off, and forced on.
+ *
+ *   sp_bench [large_mb]
+ *
+ * Each path runs on a small batch that stays in cache, repeated, and on a
+ * single large batch of large_mb megabytes (64 by default). The defaults
+ * should match the faster of off and on for both sizes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+
+struct tick {
+    uint64_t time;
+    int32_t price;
+    uint16_t size;
+    char venue[5];
+};
+static const char tick_fmt[] = ">Q i H 4s 'T'";
+static const char tick_le_fmt[] = "<Q i H 4s 'T'";
+#define TICK_SIZE 19
+#define SMALL_BYTES (64 * 1024)
+/* Bytes converted per measurement, so small batches are timed over many runs */
+#define MIN_WORK ((size_t)256 * 1024 * 1024)
+
+enum bench_path {BENCH_TRANSCODE, BENCH_APPEND, BENCH_HASH, BENCH_ARRAY, BENCH_PATHS};
+static const char* const path_names[BENCH_PATHS] = {"transcode", "pack append", "hash batch", "array unpack"};
+
+struct bench {
+    sp_plan* plan;
+    struct tick* ticks;
+    uint8_t* packed;
+    uint8_t* out;
+    uint64_t* hashes;
+    sp_buf buf;
+};
+
+static SPResult run_path(struct bench* b, enum bench_path path, int count) {
+    const int len = count * TICK_SIZE;
+    char fmt[32];
+    size_t off[1] = {0};
+    switch (path) {
+        case BENCH_TRANSCODE:
+            return sp_transcode(tick_fmt, tick_le_fmt, b->packed, len, b->out, len, count);
+        case BENCH_APPEND:
+            b->buf.len = 0;
+            return sp_plan_pack_batch_append(b->plan, b->ticks, sizeof b->ticks[0], count, &b->buf);
+        case BENCH_HASH:
+            return sp_hash_batch(b->plan, 0x5, b->packed, len, count, b->hashes);
+        default:
+            snprintf(fmt, sizeof fmt, ">[%d]I", len / 4);
+            return sp_unpack_bin_offset(fmt, 1, off, b->out, b->packed, len);
+    }
+}
+
+/* Megabytes of source per second */
+static double measure(struct bench* b, enum bench_path path, int count) {
+    const size_t bytes = (size_t)count * TICK_SIZE;
+    const size_t runs = bytes >= MIN_WORK ? 1 : MIN_WORK / bytes;
+    run_path(b, path, count);
+    double start = sp_seconds();
+    for (size_t i = 0; i < runs; i++) {
+        if (run_path(b, path, count) != SP_OK) {
+            fprintf(stderr, "%s failed\n", path_names[path]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double elapsed = sp_seconds() - start;
+    return elapsed > 0 ? (double)(bytes * runs) / (1024.0 * 1024.0) / elapsed : 0;
+}
+
+int main(int argc, char* argv[]) {
+    long large_mb = argc > 1 ? atol(argv[1]) : 64;
+    if (large_mb <= 0 || large_mb > 1024) {
+        fprintf(stderr, "Usage: sp_bench [large_mb], up to 1024\n");
+        return EXIT_FAILURE;
+    }
+    const int large = (int)(large_mb * 1024 * 1024 / TICK_SIZE);
+    const int small = SMALL_BYTES / TICK_SIZE;
+    struct bench b;
+    size_t offsets[4] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct tick, time, price, size, venue);
+    if (sp_plan_compile(tick_fmt, 4, offsets, &b.plan) != SP_OK) {
+        fprintf(stderr, "failure to compile plan\n");
+        return EXIT_FAILURE;
+    }
+    b.ticks = malloc((size_t)large * sizeof *b.ticks);
+    b.packed = malloc((size_t)large * TICK_SIZE);
+    b.out = malloc((size_t)large * TICK_SIZE);
+    b.hashes = malloc((size_t)large * sizeof *b.hashes);
+    sp_buf_init(&b.buf, NULL, NULL);
+    if (!b.ticks || !b.packed || !b.out || !b.hashes || sp_buf_reserve(&b.buf, (size_t)large * TICK_SIZE) != SP_OK) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < large; i++) {
+        memset(&b.ticks[i], 0, sizeof b.ticks[i]);
+        b.ticks[i].time = 1600000000000ull + (uint64_t)i * 977;
+        b.ticks[i].price = 10000 - (i & 1023);
+        b.ticks[i].size = (uint16_t)(i * 13);
+        memcpy(b.ticks[i].venue, i % 2 ? "XNYS" : "BATS", 4);
+        sp_plan_pack(b.plan, &b.ticks[i], b.packed + (size_t)i * TICK_SIZE, TICK_SIZE);
+    }
+
+    sp_tuning defaults;
+    sp_tuning_get(&defaults);
+    const sp_tuning never = {SIZE_MAX, 0, SIZE_MAX};
+    const sp_tuning always = {0, defaults.prefetch_ahead, 0};
+    printf("Prefetch from %zu bytes, %zu bytes ahead, streaming stores from %zu bytes\n",
+           defaults.prefetch_min, defaults.prefetch_ahead, defaults.stream_min);
+    printf("%-14s %10s %12s %12s %12s\n", "path", "batch", "default", "off", "on");
+    for (int p = 0; p < BENCH_PATHS; p++) {
+        const int sizes[2] = {small, large};
+        for (int s = 0; s < 2; s++) {
+            double rate[3];
+            sp_tuning_set(NULL);
+            rate[0] = measure(&b, (enum bench_path)p, sizes[s]);
+            sp_tuning_set(&never);
+            rate[1] = measure(&b, (enum bench_path)p, sizes[s]);
+            sp_tuning_set(&always);
+            rate[2] = measure(&b, (enum bench_path)p, sizes[s]);
+            printf("%-14s %8zuKB %9.0fMB/s %9.0fMB/s %9.0fMB/s\n", path_names[p], (size_t)sizes[s] * TICK_SIZE / 1024,
+                   rate[0], rate[1], rate[2]);
+        }
+    }
+    sp_tuning_set(NULL);
+
+    sp_buf_free(&b.buf);
+    free(b.hashes);
+    free(b.out);
+    free(b.packed);
+    free(b.ticks);
+    sp_plan_free(b.plan);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef VHD_H
+#define VHD_H
+
+/* VHD footer and sparse header layouts, shared by vhd_info and vhd_gen */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <structpack.h>
+
+#define VHD_SECTOR 512
+#define VHD_FOOTER_SIZE 512
+#define VHD_SPARSE_SIZE 1024
+#define VHD_TYPE_FIXED 2
+#define VHD_TYPE_DYNAMIC 3
+#define VHD_TYPE_DIFF 4
+/* Block Allocation Table entry of a block with no data */
+#define VHD_BAT_UNUSED 0xffffffffu
+/* Byte offsets of the checksum fields, which are summed as zero */
+#define VHD_FOOTER_CHECKSUM_OFF 64
+#define VHD_SPARSE_CHECKSUM_OFF 36
+
+struct vhd_footer {
+    int32_t features;
+    int32_t fi_fmt_vers;
+    int64_t data_offset;
+    uint32_t timestamp;
+    char cr_app[5];
+    uint32_t cr_vers;
+    char cr_host_os[5];
+    int64_t orig_sz;
+    int64_t curr_sz;
+    struct {
+        uint16_t cyl;
+        uint8_t heads;
+        uint8_t spt;
+    } geom;
+    int32_t disk_type;
+    uint32_t checksum;
+    uint8_t uuid[16];
+    uint8_t saved_st;
+};
+static const char foot_fmt_str[] = "> 'conectix' 2i q I [4]s I [4]s 2q HBB iI [16]B B @512";
+#define VHD_FOOTER_FIELDS 16
+
+struct vhd_sparse {
+    int64_t data_offset;
+    int64_t bat_offset;
+    int32_t head_vers;
+    int32_t max_bat_ent;
+    int32_t block_sz;
+    uint32_t checksum;
+    uint8_t par_uuid[16];
+    uint32_t par_timestamp;
+    int32_t reserved_1;
+    char par_name[256 * 3 + 1];
+    struct vhd_par_loc {
+        char plat_code[5];
+        int32_t plat_data_space;
+        int32_t plat_data_len;
+        int32_t reserved;
+        int64_t plat_data_offset;
+    } par_loc_entry[8];
+};
+static const char sparse_fmt_str[] = "> 'cxsparse' 2q 3i I [16]B Ii 256w:s 8{4s 3i q} @1024";
+#define VHD_SPARSE_FIELDS 17
+
+static inline void vhd_footer_offsets(size_t offsets[VHD_FOOTER_FIELDS]) {
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct vhd_footer, \
+        features, fi_fmt_vers, data_offset, timestamp, cr_app, cr_vers, cr_host_os, orig_sz, curr_sz);
+    SP_ADD_STRUCT_OFFSET(offsets, 9, struct vhd_footer, geom.cyl, geom.heads, geom.spt, disk_type, \
+        checksum, uuid, saved_st);
+}
+
+/* Parent locators are an array of structs, so only one element's offsets are needed */
+static inline void vhd_sparse_offsets(size_t offsets[VHD_SPARSE_FIELDS]) {
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct vhd_sparse, data_offset, bat_offset, head_vers, max_bat_ent, \
+        block_sz, checksum, par_uuid, par_timestamp, reserved_1, par_name);
+    SP_ADD_STRIDE(offsets, 10, struct vhd_sparse, par_loc_entry);
+    SP_ADD_STRUCT_OFFSET(offsets, 12, struct vhd_par_loc, plat_code, plat_data_space, plat_data_len, \
+        reserved, plat_data_offset);
+}
+
+/* One's complement of the byte sum of a packed header, skipping its checksum field */
+static inline uint32_t vhd_checksum(const uint8_t* buf, size_t len, size_t checksum_off) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (i < checksum_off || i >= checksum_off + 4) {
+            sum += buf[i];
+        }
+    }
+    return ~sum;
+}
+
+/* Bytes of sector bitmap in front of each block's data, padded to a whole sector */
+static inline size_t vhd_bitmap_size(int32_t block_sz) {
+    size_t bits = (size_t)block_sz / VHD_SECTOR;
+    return (bits / 8 + VHD_SECTOR - 1) / VHD_SECTOR * VHD_SECTOR;
+}
+
+#endif // VHD_H
@@ -0,0 +1,172 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Write a synthetic dynamic VHD, to benchmark vhd_info without a real disk image.
+ *
+ *   vhd_gen output size_mb [percent_allocated]
+ *
+ * Blocks are allocated at random. Within an allocated block most sectors are
+ * marked in use, and a few of those hold only zeros. The expected totals are
+ * printed, to compare against what vhd_info reports.
+ */
+
+#if !defined(_WIN32)
+    #define _POSIX_C_SOURCE 200808L
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <structpack.h>
+#include "vhd.h"
+
+#define VHD_GEN_BLOCK_SZ (2 * 1024 * 1024)
+#define VHD_GEN_BAT_OFFSET (VHD_FOOTER_SIZE + VHD_SPARSE_SIZE)
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int gen_fail(const char* msg) {
+    fprintf(stderr, "%s\n", msg);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: vhd_gen output size_mb [percent_allocated]\n");
+        return EXIT_FAILURE;
+    }
+    long long size_mb = atoll(argv[2]);
+    int percent = argc == 4 ? atoi(argv[3]) : 50;
+    if (size_mb <= 0 || size_mb > 2040 * 1024 || percent < 0 || percent > 100) {
+        fprintf(stderr, "Size must be 1 MB to 2040 GB, and the percentage 0 to 100\n");
+        return EXIT_FAILURE;
+    }
+    const int64_t disk_sz = size_mb * 1024 * 1024;
+    const int32_t num_blocks = (int32_t)((disk_sz + VHD_GEN_BLOCK_SZ - 1) / VHD_GEN_BLOCK_SZ);
+    const size_t bat_sz = ((size_t)num_blocks * 4 + VHD_SECTOR - 1) / VHD_SECTOR * VHD_SECTOR;
+    const size_t bitmap_sz = vhd_bitmap_size(VHD_GEN_BLOCK_SZ);
+    const int sectors = VHD_GEN_BLOCK_SZ / VHD_SECTOR;
+
+    /* Footer, copied to the start of the file as well as the end */
+    struct vhd_footer footer;
+    memset(&footer, 0, sizeof footer);
+    footer.features = 2;
+    footer.fi_fmt_vers = 0x00010000;
+    footer.data_offset = VHD_FOOTER_SIZE;
+    strcpy(footer.cr_app, "spgn");
+    footer.cr_vers = 0x00010000;
+    strcpy(footer.cr_host_os, "Wi2k");
+    footer.orig_sz = disk_sz;
+    footer.curr_sz = disk_sz;
+    int64_t cyl = disk_sz / VHD_SECTOR / (16 * 63);
+    footer.geom.cyl = (uint16_t)(cyl > 65535 ? 65535 : cyl);
+    footer.geom.heads = 16;
+    footer.geom.spt = 63;
+    footer.disk_type = VHD_TYPE_DYNAMIC;
+    for (int i = 0; i < 16; i++) {
+        footer.uuid[i] = (uint8_t)rng_next();
+    }
+    size_t footer_offsets[VHD_FOOTER_FIELDS] = {0};
+    vhd_footer_offsets(footer_offsets);
+    uint8_t footer_buf[VHD_FOOTER_SIZE] = {0};
+    if (sp_pack_bin_offset(foot_fmt_str, VHD_FOOTER_FIELDS, footer_offsets, &footer, footer_buf, VHD_FOOTER_SIZE) != SP_OK) {
+        return gen_fail("failure to pack footer");
+    }
+    footer.checksum = vhd_checksum(footer_buf, VHD_FOOTER_SIZE, VHD_FOOTER_CHECKSUM_OFF);
+    sp_pack_bin_offset(foot_fmt_str, VHD_FOOTER_FIELDS, footer_offsets, &footer, footer_buf, VHD_FOOTER_SIZE);
+
+    struct vhd_sparse sparse;
+    memset(&sparse, 0, sizeof sparse);
+    sparse.data_offset = -1;
+    sparse.bat_offset = VHD_GEN_BAT_OFFSET;
+    sparse.head_vers = 0x00010000;
+    sparse.max_bat_ent = num_blocks;
+    sparse.block_sz = VHD_GEN_BLOCK_SZ;
+    size_t sparse_offsets[VHD_SPARSE_FIELDS] = {0};
+    vhd_sparse_offsets(sparse_offsets);
+    uint8_t sparse_buf[VHD_SPARSE_SIZE] = {0};
+    if (sp_pack_bin_offset(sparse_fmt_str, VHD_SPARSE_FIELDS, sparse_offsets, &sparse, sparse_buf, VHD_SPARSE_SIZE) != SP_OK) {
+        return gen_fail("failure to pack sparse header");
+    }
+    sparse.checksum = vhd_checksum(sparse_buf, VHD_SPARSE_SIZE, VHD_SPARSE_CHECKSUM_OFF);
+    sp_pack_bin_offset(sparse_fmt_str, VHD_SPARSE_FIELDS, sparse_offsets, &sparse, sparse_buf, VHD_SPARSE_SIZE);
+
+    /* Blocks are laid out in table order after the table, so the table is known up front */
+    uint32_t* bat = malloc(bat_sz);
+    uint8_t* bat_buf = malloc(bat_sz);
+    uint8_t* block = malloc(bitmap_sz + VHD_GEN_BLOCK_SZ);
+    if (!bat || !bat_buf || !block) {
+        free(bat);
+        free(bat_buf);
+        free(block);
+        return gen_fail("out of memory");
+    }
+    memset(bat, 0xff, bat_sz);
+    uint64_t next_sector = (VHD_GEN_BAT_OFFSET + bat_sz) / VHD_SECTOR;
+    uint64_t allocated = 0;
+    for (int32_t i = 0; i < num_blocks; i++) {
+        if ((int)(rng_next() % 100) < percent) {
+            bat[i] = (uint32_t)next_sector;
+            next_sector += (bitmap_sz + VHD_GEN_BLOCK_SZ) / VHD_SECTOR;
+            allocated++;
+        }
+    }
+    size_t bat_offsets[1] = {0};
+    char bat_fmt[32];
+    snprintf(bat_fmt, sizeof bat_fmt, ">[%d]I", (int)(bat_sz / 4));
+    SPResult res = sp_pack_bin_offset(bat_fmt, 1, bat_offsets, bat, bat_buf, (int)bat_sz);
+    free(bat);
+    if (res != SP_OK) {
+        free(bat_buf);
+        free(block);
+        return gen_fail("failure to pack block table");
+    }
+
+    FILE* f = fopen(argv[1], "wb");
+    if (!f) {
+        free(bat_buf);
+        free(block);
+        return gen_fail("unable to open output");
+    }
+    int ok = fwrite(footer_buf, VHD_FOOTER_SIZE, 1, f) == 1 && fwrite(sparse_buf, VHD_SPARSE_SIZE, 1, f) == 1 &&
+             fwrite(bat_buf, bat_sz, 1, f) == 1;
+    uint64_t used = 0, zeroed = 0;
+    for (uint64_t b = 0; ok && b < allocated; b++) {
+        uint8_t* bitmap = block;
+        uint8_t* data = block + bitmap_sz;
+        memset(block, 0, bitmap_sz + VHD_GEN_BLOCK_SZ);
+        for (int s = 0; s < sectors; s++) {
+            uint64_t r = rng_next();
+            if ((r & 7) == 0) {
+                continue;
+            }
+            bitmap[s / 8] |= (uint8_t)(0x80 >> (s % 8));
+            used++;
+            if (((r >> 3) & 15) == 0) {
+                zeroed++;
+                continue;
+            }
+            memset(data + (size_t)s * VHD_SECTOR, (int)(r >> 8) | 1, VHD_SECTOR);
+        }
+        ok = fwrite(block, bitmap_sz + VHD_GEN_BLOCK_SZ, 1, f) == 1;
+    }
+    ok = ok && fwrite(footer_buf, VHD_FOOTER_SIZE, 1, f) == 1;
+    free(bat_buf);
+    free(block);
+    if (fclose(f) != 0 || !ok) {
+        return gen_fail("failure to write output");
+    }
+    printf("Blocks: %d, allocated: %llu, used sectors: %llu, zeroed sectors: %llu\n", (int)num_blocks,
+           (unsigned long long)allocated, (unsigned long long)used, (unsigned long long)zeroed);
+    return EXIT_SUCCESS;
+}
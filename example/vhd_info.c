@@ -9,15 +9,19 @@
 #include <stdint.h>
 #include <string.h>
 #include <structpack.h>
+#include "sp_os.h"
+#include "vhd.h"
 
 #if defined(_WIN32)
     #define vhd_main() wmain(int argc, wchar_t *argv[])
+    typedef wchar_t vhd_char;
     #define vhd_printf wprintf
     #define fopen _wfopen
     #define _L(str) L ## str
     #define vhd_fseek _fseeki64
 #else
     #define vhd_main() main(int argc, char *argv[])
+    typedef char vhd_char;
     #define vhd_printf printf
     #define _L(str) str
     #define vhd_fseek fseeko
@@ -25,65 +29,18 @@
 
 #define VHD_FAIL(str, file) fclose(file); vhd_printf(str); return EXIT_FAILURE;
 
-struct vhd_footer {
-    char cookie[9];
-    int32_t features;
-    int32_t fi_fmt_vers;
-    int64_t data_offset;
-    uint32_t timestamp;
-    char cr_app[5];
-    uint32_t cr_vers;
-    char cr_host_os[5];
-    int64_t orig_sz;
-    int64_t curr_sz;
-    struct {
-        uint16_t cyl;
-        uint8_t heads;
-        uint8_t spt;
-    } geom;
-    int32_t disk_type;
-    uint32_t checksum;
-    uint8_t uuid[16];
-    uint8_t saved_st;
-    uint8_t reserved[427];
-};
-const char* foot_fmt_str = "> [8]s 2i q I [4]s I [4]s 2q HBB iI [16]B B [427]B";
-
-struct vhd_sparse {
-    char cookie[9];
-    int64_t data_offset;
-    int64_t bat_offset;
-    int32_t head_vers;
-    int32_t max_bat_ent;
-    int32_t block_sz;
-    uint32_t checksum;
-    uint8_t par_uuid[16];
-    uint32_t par_timestamp;
-    int32_t reserved_1;
-    uint16_t par_utf16_name[257];
-    struct {
-        char plat_code[5];
-        int32_t plat_data_space;
-        int32_t plat_data_len;
-        int32_t reserved;
-        int64_t plat_data_offset;
-    } par_loc_entry[8];
-    uint8_t reserved_2[256];
-};
-const char* sparse_fmt_str = "> 8s 2q 3i I [16]B Ii [256]u 8(4s 3i q) [256]B";
-
 #define VHD_PRINT_ROW(label, val, ...) vhd_printf(_L("%-29s : "), label); vhd_printf(val, __VA_ARGS__); vhd_printf(_L("\n"));
 #define VHD_PRINT_ROW_A(label, val) vhd_printf(_L("%-29s : "), label); printf("%s", val); vhd_printf(_L("\n"));
 
 const char* disk_type(int32_t type) {
     switch (type) {
-        case 2:
+        case VHD_TYPE_FIXED:
             return "fixed";
             break;
-        case 3:
+        case VHD_TYPE_DYNAMIC:
             return "sparse";
             break;
-        case 4:
+        case VHD_TYPE_DIFF:
             return "differencing";
             break;
         default:
@@ -91,13 +48,165 @@ const char* disk_type(int32_t type) {
     }
 }
 
+/* Totals for one share of the Block Allocation Table */
+struct vhd_scan_part {
+    uint64_t blocks;
+    uint64_t used_sectors;
+    uint64_t zero_sectors;
+    uint64_t bad_blocks;
+};
+
+struct vhd_scan {
+    const uint8_t* data;
+    uint64_t data_len;
+    const uint32_t* bat;
+    int32_t num_entries;
+    int32_t block_sz;
+    int num_parts;
+    struct vhd_scan_part* parts;
+};
+
+static int vhd_sector_is_zero(const uint8_t* p) {
+    uint64_t acc = 0, w;
+    for (int i = 0; i < VHD_SECTOR; i += 8) {
+        memcpy(&w, p + i, 8);
+        acc |= w;
+    }
+    return acc == 0;
+}
+
+/* Check every block in one share of the table: each must lie within the file, and every sector
+   its bitmap marks as in use is read to count those that hold only zeros */
+static void vhd_scan_part(void* ctx, int part) {
+    struct vhd_scan* scan = ctx;
+    struct vhd_scan_part* totals = &scan->parts[part];
+    const size_t bitmap_sz = vhd_bitmap_size(scan->block_sz);
+    const int sectors = scan->block_sz / VHD_SECTOR;
+    const int32_t first = (int32_t)((int64_t)scan->num_entries * part / scan->num_parts);
+    const int32_t last = (int32_t)((int64_t)scan->num_entries * (part + 1) / scan->num_parts);
+    memset(totals, 0, sizeof *totals);
+    for (int32_t i = first; i < last; i++) {
+        if (scan->bat[i] == VHD_BAT_UNUSED) {
+            continue;
+        }
+        uint64_t off = (uint64_t)scan->bat[i] * VHD_SECTOR;
+        if (off + bitmap_sz + (uint64_t)scan->block_sz > scan->data_len) {
+            totals->bad_blocks++;
+            continue;
+        }
+        totals->blocks++;
+        const uint8_t* bitmap = scan->data + off;
+        const uint8_t* block = bitmap + bitmap_sz;
+        for (int s = 0; s < sectors; s++) {
+            if (bitmap[s / 8] & (0x80 >> (s % 8))) {
+                totals->used_sectors++;
+                totals->zero_sectors += (uint64_t)vhd_sector_is_zero(block + (size_t)s * VHD_SECTOR);
+            }
+        }
+    }
+}
+
+/* Walk the Block Allocation Table and the sector bitmap of every allocated block. The file is
+   mapped, the table is unpacked with a single '[n]I' array field, and blocks are checked in
+   parallel */
+static int vhd_scan(const vhd_char* vhd_path, const struct vhd_sparse* sparse) {
+#if defined(_WIN32)
+    char path[MAX_PATH * 3];
+    if (WideCharToMultiByte(CP_ACP, 0, vhd_path, -1, path, (int)sizeof path, NULL, NULL) == 0) {
+        vhd_printf(_L("unable to convert path"));
+        return EXIT_FAILURE;
+    }
+#else
+    const char* path = vhd_path;
+#endif
+    if (sparse->max_bat_ent <= 0 || sparse->block_sz < VHD_SECTOR * 8 || sparse->block_sz % VHD_SECTOR != 0) {
+        vhd_printf(_L("invalid sparse header"));
+        return EXIT_FAILURE;
+    }
+    struct sp_file_map map;
+    if (sp_map_file(path, &map) != SP_OK) {
+        vhd_printf(_L("unable to map VHD file"));
+        return EXIT_FAILURE;
+    }
+    const uint64_t bat_len = (uint64_t)sparse->max_bat_ent * 4;
+    if (sparse->bat_offset < 0 || (uint64_t)sparse->bat_offset + bat_len > map.len || bat_len > INT32_MAX) {
+        sp_unmap_file(&map);
+        vhd_printf(_L("block table outside of file"));
+        return EXIT_FAILURE;
+    }
+
+    double start = sp_seconds();
+    char bat_fmt[32];
+    snprintf(bat_fmt, sizeof bat_fmt, ">[%d]I", (int)sparse->max_bat_ent);
+    size_t bat_offsets[1] = {0};
+    sp_plan* bat_plan = NULL;
+    uint32_t* bat = malloc((size_t)bat_len);
+    SPResult res = bat ? sp_plan_compile(bat_fmt, 1, bat_offsets, &bat_plan) : SP_ERR_ALLOC;
+    if (res == SP_OK) {
+        res = sp_plan_unpack(bat_plan, bat, (void*)(map.data + sparse->bat_offset), (int)bat_len);
+    }
+    sp_plan_free(bat_plan);
+    if (res != SP_OK) {
+        free(bat);
+        sp_unmap_file(&map);
+        vhd_printf(_L("failure to unpack block table"));
+        return EXIT_FAILURE;
+    }
+
+    /* Several shares per thread, so uneven allocation still spreads across threads */
+    struct vhd_scan scan;
+    scan.data = map.data;
+    scan.data_len = map.len - VHD_FOOTER_SIZE;
+    scan.bat = bat;
+    scan.num_entries = sparse->max_bat_ent;
+    scan.block_sz = sparse->block_sz;
+    scan.num_parts = sp_cpu_count() * 8 < scan.num_entries ? sp_cpu_count() * 8 : scan.num_entries;
+    scan.parts = malloc((size_t)scan.num_parts * sizeof *scan.parts);
+    if (!scan.parts) {
+        free(bat);
+        sp_unmap_file(&map);
+        vhd_printf(_L("out of memory"));
+        return EXIT_FAILURE;
+    }
+    sp_run_tasks(vhd_scan_part, &scan, scan.num_parts, sp_cpu_count());
+    double elapsed = sp_seconds() - start;
+
+    struct vhd_scan_part total = {0, 0, 0, 0};
+    for (int i = 0; i < scan.num_parts; i++) {
+        total.blocks += scan.parts[i].blocks;
+        total.used_sectors += scan.parts[i].used_sectors;
+        total.zero_sectors += scan.parts[i].zero_sectors;
+        total.bad_blocks += scan.parts[i].bad_blocks;
+    }
+    /* Bytes actually read: the table, every allocated block's bitmap, and every sector in use */
+    double scanned_mb = ((double)bat_len + (double)total.blocks * (double)vhd_bitmap_size(scan.block_sz) +
+                         (double)total.used_sectors * VHD_SECTOR) / 1e6;
+    if (elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+    VHD_PRINT_ROW(_L("Allocated Blocks"), _L("%llu"), (unsigned long long)total.blocks);
+    VHD_PRINT_ROW(_L("Allocated Space (MB)"), _L("%.1f"), (double)total.blocks * scan.block_sz / 1e6);
+    VHD_PRINT_ROW(_L("Used Space (MB)"), _L("%.1f"), (double)total.used_sectors * VHD_SECTOR / 1e6);
+    VHD_PRINT_ROW(_L("Used Sectors"), _L("%llu"), (unsigned long long)total.used_sectors);
+    VHD_PRINT_ROW(_L("Zeroed Sectors"), _L("%llu"), (unsigned long long)total.zero_sectors);
+    VHD_PRINT_ROW(_L("Bad Blocks"), _L("%llu"), (unsigned long long)total.bad_blocks);
+    VHD_PRINT_ROW(_L("Scanned (MB)"), _L("%.1f"), scanned_mb);
+    VHD_PRINT_ROW(_L("Scan Time (s)"), _L("%.3f"), elapsed);
+    VHD_PRINT_ROW(_L("Scan Rate (MB/s)"), _L("%.1f"), scanned_mb / elapsed);
+
+    free(scan.parts);
+    free(bat);
+    sp_unmap_file(&map);
+    return total.bad_blocks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 #if defined(_MSC_VER)
 #pragma warning(push)
 #pragma warning( disable : 4996)
 #endif
 int vhd_main() {
     char footer_buf[512] = {0};
-    //char sparse_buf[1024] = {0};
+    char sparse_buf[1024] = {0};
     if (argc != 2) {
         vhd_printf(_L("Expected one argument: path to a VHD file.\n"));
         return EXIT_FAILURE;
@@ -110,21 +219,17 @@ int vhd_main() {
     }
     vhd_fseek(vhd_file, -512ll, SEEK_END);
     fread(footer_buf, 512, 1, vhd_file);
-    if (strncmp(footer_buf, "conectix", 8) != 0) {
-        VHD_FAIL(_L("cookie string not found. Is file a VHD?"), vhd_file);
-    }
-    size_t footer_offsets[18] = {0};
-    SP_ADD_STRUCT_OFFSET(footer_offsets, 0, struct vhd_footer, cookie, \
-        features, fi_fmt_vers, data_offset, timestamp, cr_app, cr_vers, cr_host_os, orig_sz, curr_sz);
-    SP_ADD_STRUCT_OFFSET(footer_offsets, 10, struct vhd_footer, geom.cyl, geom.heads, geom.spt, disk_type, \
-        checksum, uuid, saved_st, reserved);
+    size_t footer_offsets[VHD_FOOTER_FIELDS] = {0};
+    vhd_footer_offsets(footer_offsets);
 
     struct vhd_footer footer = {0};
-    if (sp_unpack_bin_offset(foot_fmt_str, 18, footer_offsets, &footer, footer_buf, (int)sizeof footer_buf) != SP_OK) {
+    SPResult res = sp_unpack_bin_offset(foot_fmt_str, VHD_FOOTER_FIELDS, footer_offsets, &footer, footer_buf, (int)sizeof footer_buf);
+    if (res == SP_ERR_MISMATCH) {
+        VHD_FAIL(_L("cookie string not found. Is file a VHD?"), vhd_file);
+    } else if (res != SP_OK) {
         VHD_FAIL(_L("failure to unpack vhd"), vhd_file);
     }
     vhd_printf(_L("\n"));
-    VHD_PRINT_ROW_A(_L("Cookie"), footer.cookie);
     VHD_PRINT_ROW(_L("Features"), _L("%d"), footer.features);
     VHD_PRINT_ROW(_L("File Format Vers."), _L("%d"), footer.fi_fmt_vers);
     VHD_PRINT_ROW(_L("Sparse Header Offset"), _L("%lld"), (long long)footer.data_offset);
@@ -139,10 +244,33 @@ int vhd_main() {
     VHD_PRINT_ROW(_L("[Geom] spt"), _L("%hhu"), footer.geom.spt);
     VHD_PRINT_ROW_A(_L("VHD type"), disk_type(footer.disk_type));
     VHD_PRINT_ROW(_L("Checksum"), _L("%u"), footer.checksum);
+    VHD_PRINT_ROW_A(_L("Checksum Valid"),
+        vhd_checksum((const uint8_t*)footer_buf, VHD_FOOTER_SIZE, VHD_FOOTER_CHECKSUM_OFF) == footer.checksum ? "yes" : "no");
 
-    fclose(vhd_file);
+    /* Dynamic and differencing disks have a sparse header */
+    if (footer.disk_type == VHD_TYPE_DYNAMIC || footer.disk_type == VHD_TYPE_DIFF) {
+        size_t sparse_offsets[VHD_SPARSE_FIELDS] = {0};
+        vhd_sparse_offsets(sparse_offsets);
 
-    //VHD_PRINT_ROW_A(_L("Cookie"), f)
+        struct vhd_sparse sparse = {0};
+        if (vhd_fseek(vhd_file, footer.data_offset, SEEK_SET) != 0 || fread(sparse_buf, 1024, 1, vhd_file) != 1) {
+            VHD_FAIL(_L("failure to read sparse header"), vhd_file);
+        }
+        res = sp_unpack_bin_offset(sparse_fmt_str, VHD_SPARSE_FIELDS, sparse_offsets, &sparse, sparse_buf, (int)sizeof sparse_buf);
+        if (res != SP_OK) {
+            VHD_FAIL(_L("failure to unpack sparse header"), vhd_file);
+        }
+        VHD_PRINT_ROW(_L("Block Table Offset"), _L("%lld"), (long long)sparse.bat_offset);
+        VHD_PRINT_ROW(_L("Block Table Entries"), _L("%d"), sparse.max_bat_ent);
+        VHD_PRINT_ROW(_L("Block Size"), _L("%d"), sparse.block_sz);
+        if (footer.disk_type == VHD_TYPE_DIFF) {
+            VHD_PRINT_ROW_A(_L("Parent Name"), sparse.par_name);
+        }
+        fclose(vhd_file);
+        return vhd_scan(argv[1], &sparse);
+    }
+
+    fclose(vhd_file);
     return EXIT_SUCCESS;
 }
 
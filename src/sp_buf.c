@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+/* Smallest capacity allocated, to avoid many tiny reallocations at the start */
+#define SP_BUF_MIN_CAP 64
+
+static void* sp_default_realloc(void* ctx, void* ptr, size_t size) {
+    (void)ctx;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+void sp_buf_init(sp_buf* buf, sp_realloc_fn realloc_fn, void* alloc_ctx) {
+    if (!buf) {
+        return;
+    }
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+    buf->realloc_fn = realloc_fn ? realloc_fn : sp_default_realloc;
+    buf->alloc_ctx = alloc_ctx;
+}
+
+void sp_buf_free(sp_buf* buf) {
+    if (!buf) {
+        return;
+    }
+    if (buf->data) {
+        buf->realloc_fn(buf->alloc_ctx, buf->data, 0);
+    }
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+SPResult sp_buf_reserve(sp_buf* buf, size_t additional) {
+    if (!buf || !buf->realloc_fn) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (additional > SIZE_MAX - buf->len) {
+        return SP_ERR_ALLOC;
+    }
+    size_t need = buf->len + additional;
+    if (need <= buf->cap) {
+        return SP_OK;
+    }
+    /* Grow geometrically, so a series of appends costs O(1) amortized allocations */
+    size_t cap = buf->cap ? buf->cap : SP_BUF_MIN_CAP;
+    while (cap < need) {
+        cap = (cap > SIZE_MAX / 2) ? need : cap * 2;
+    }
+    unsigned char* data = buf->realloc_fn(buf->alloc_ctx, buf->data, cap);
+    if (!data) {
+        return SP_ERR_ALLOC;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return SP_OK;
+}
+
+SPResult sp_packed_size(const char* fmt_str, int* size) {
+    if (!fmt_str || !size) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    return sp_format_size(fmt_str, -1, NULL, size);
+}
+
+SPResult sp_pack_bin_offset_append(const char* fmt_str,
+                                   int num_fields,
+                                   const size_t* offset_list,
+                                   void* offset_base,
+                                   sp_buf* buf)
+{
+    if (!fmt_str || num_fields <= 0 || !offset_list || !offset_base || !buf) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    /* The parse checking the format also sizes the record, so only packing parses it again */
+    int size, used = 0;
+    SPResult res = sp_format_size(fmt_str, num_fields, NULL, &size);
+    if (res != SP_OK) {
+        return res;
+    }
+    if ((res = sp_buf_reserve(buf, (size_t)size)) != SP_OK) {
+        return res;
+    }
+    /* Packing never writes padding, which would otherwise be left as stale heap memory */
+    memset(buf->data + buf->len, 0, (size_t)size);
+    res = sp_pack_unpack_fields(SP_PACK, fmt_str, NULL, offset_list, offset_base, buf->data + buf->len, size, &used);
+    if (res == SP_OK) {
+        buf->len += (size_t)used;
+    }
+    return res;
+}
+
+SPResult sp_plan_pack_append(const sp_plan* plan, void* offset_base, sp_buf* buf) {
+    return sp_plan_pack_batch_append(plan, offset_base, 0, 1, buf);
+}
+
+/* Structs of a batch being appended */
+struct sp_append_batch {
+    const sp_plan* plan;
+    const uint8_t* bases;
+    size_t stride;
+    size_t ahead;
+    size_t count;
+};
+
+static SPResult sp_append_record(void* ctx, size_t i, uint8_t* dst) {
+    const struct sp_append_batch* b = ctx;
+    if (b->ahead && i + b->ahead < b->count) {
+        SP_PREFETCH(b->bases + (i + b->ahead) * b->stride);
+    }
+    return sp_plan_pack(b->plan, (void*)(b->bases + i * b->stride), dst, (int)b->plan->size);
+}
+
+SPResult sp_plan_pack_batch_append(const sp_plan* plan,
+                                   void* offset_bases,
+                                   size_t stride,
+                                   int count,
+                                   sp_buf* buf)
+{
+    if (!plan || !offset_bases || count <= 0 || !buf) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size > 0 && (size_t)count > SIZE_MAX / plan->size) {
+        return SP_ERR_ALLOC;
+    }
+    /* Reserved once for the whole batch */
+    SPResult res = sp_buf_reserve(buf, plan->size * (size_t)count);
+    if (res != SP_OK) {
+        return res;
+    }
+    /* sp_stream_records zeroes each record, padding included, before it is packed */
+    struct sp_append_batch b;
+    b.plan = plan;
+    b.bases = offset_bases;
+    b.stride = stride;
+    b.ahead = sp_prefetch_records((size_t)count, stride);
+    b.count = (size_t)count;
+    size_t built = 0;
+    res = sp_stream_records(sp_append_record, &b, (size_t)count, plan->size,
+                            sp_stream_wanted(plan->size * (size_t)count), buf->data + buf->len, &built);
+    buf->len += plan->size * built;
+    return res;
+}
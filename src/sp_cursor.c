@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Sequential reading and writing of back to back records. Each call works on
+ * the bytes from the cursor position to its limit, and moves the position
+ * past the record it handled, so the caller never computes record sizes.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+
+#include <structpack.h>
+#include "sp_internal.h"
+#include "sp_plan.h"
+
+/* Bytes left after the cursor, capped to the int lengths used by the rest of the API */
+static int sp_cursor_remaining(const sp_cursor* cur) {
+    size_t left = cur->limit - cur->pos;
+    return left > INT_MAX ? INT_MAX : (int)left;
+}
+
+static bool sp_cursor_valid(const sp_cursor* cur) {
+    return cur && cur->buf && cur->pos <= cur->limit;
+}
+
+void sp_cursor_init(sp_cursor* cur, void* buff, size_t buff_len) {
+    if (!cur) {
+        return;
+    }
+    cur->buf = buff;
+    cur->pos = 0;
+    cur->limit = buff ? buff_len : 0;
+}
+
+SPResult sp_cursor_skip(sp_cursor* cur, size_t len) {
+    if (!sp_cursor_valid(cur)) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (len > cur->limit - cur->pos) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    cur->pos += len;
+    return SP_OK;
+}
+
+static SPResult sp_cursor_fmt(sp_cursor* cur, enum sp_action action, const char* fmt_str, int num_fields,
+                              const size_t* offset_list, void* offset_base)
+{
+    if (!sp_cursor_valid(cur) || !fmt_str || num_fields < 0 || (num_fields > 0 && (!offset_list || !offset_base))) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    int used = 0;
+    SPResult res = sp_pack_unpack_bin(action, fmt_str, num_fields, NULL, offset_list, offset_base,
+                                      cur->buf + cur->pos, sp_cursor_remaining(cur), &used);
+    if (res == SP_OK) {
+        cur->pos += (size_t)used;
+    }
+    return res;
+}
+
+SPResult sp_cursor_unpack(sp_cursor* cur, const char* fmt_str, int num_fields, const size_t* offset_list, void* offset_base) {
+    return sp_cursor_fmt(cur, SP_UNPACK, fmt_str, num_fields, offset_list, offset_base);
+}
+
+SPResult sp_cursor_pack(sp_cursor* cur, const char* fmt_str, int num_fields, const size_t* offset_list, void* offset_base) {
+    return sp_cursor_fmt(cur, SP_PACK, fmt_str, num_fields, offset_list, offset_base);
+}
+
+SPResult sp_cursor_plan_unpack(sp_cursor* cur, const sp_plan* plan, void* offset_base) {
+    if (!sp_cursor_valid(cur) || !plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size > cur->limit - cur->pos) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    SPResult res = sp_plan_unpack(plan, offset_base, cur->buf + cur->pos, sp_cursor_remaining(cur));
+    if (res == SP_OK) {
+        cur->pos += plan->size;
+    }
+    return res;
+}
+
+SPResult sp_cursor_plan_pack(sp_cursor* cur, const sp_plan* plan, void* offset_base) {
+    if (!sp_cursor_valid(cur) || !plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size > cur->limit - cur->pos) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    SPResult res = sp_plan_pack(plan, offset_base, cur->buf + cur->pos, sp_cursor_remaining(cur));
+    if (res == SP_OK) {
+        cur->pos += plan->size;
+    }
+    return res;
+}
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Delta encoding of a struct against a previous version of itself.
+ *
+ * A delta is a presence bitmap with one bit per field, bit 'i % 8' of byte
+ * 'i / 8' for field 'i', followed by each field whose bit is set, in field
+ * order and in the same wire format a full pack would use. Constants are not
+ * included.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+static bool sp_bytes_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint64_t x, y;
+    for (; n >= sizeof x; n -= sizeof x, a += sizeof x, b += sizeof x) {
+        memcpy(&x, a, sizeof x);
+        memcpy(&y, b, sizeof y);
+        if (x != y) {
+            return false;
+        }
+    }
+    return n == 0 || memcmp(a, b, n) == 0;
+}
+
+/* Whether a field's struct member holds the same value in both structs */
+static bool sp_member_equal(const struct sp_op* op, const uint8_t* a, const uint8_t* b) {
+    a += op->struct_off;
+    b += op->struct_off;
+    if (op->utf8) {
+        size_t cap = (size_t)op->len * (op->type == 'w' ? 3 : 4) + 1;
+        return strncmp((const char*)a, (const char*)b, cap) == 0;
+    }
+    int width = op->dest_width ? op->dest_width : sp_type_size(op->type);
+    return sp_bytes_equal(a, b, (size_t)op->len * width);
+}
+
+static size_t sp_bitmap_len(const sp_plan* plan) {
+    return ((size_t)plan->num_ops + 7) / 8;
+}
+
+SPResult sp_plan_delta_pack(const sp_plan* plan, void* prev, void* cur, void* dest_buff, int buff_len, int* delta_len) {
+    if (!plan || !cur || !dest_buff || !delta_len) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->no_offsets) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    size_t map_len = sp_bitmap_len(plan);
+    if (buff_len < 0 || (size_t)buff_len < map_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    uint8_t* out = dest_buff;
+    size_t pos = map_len;
+    memset(out, 0, map_len);
+    for (int i = 0; i < plan->num_ops; i++) {
+        const struct sp_op* op = &plan->ops[i];
+        if (prev && sp_member_equal(op, prev, cur)) {
+            continue;
+        }
+        size_t size = (size_t)op->len * sp_type_size(op->type);
+        if (pos + size > (size_t)buff_len) {
+            return SP_ERR_BUFF_OVERRUN;
+        }
+        SPResult res = sp_plan_field(plan, op, SP_PACK, cur, out + pos);
+        if (res != SP_OK) {
+            return res;
+        }
+        out[i / 8] |= (uint8_t)(1u << (i % 8));
+        pos += size;
+    }
+    *delta_len = (int)pos;
+    return SP_OK;
+}
+
+SPResult sp_plan_delta_apply(const sp_plan* plan, void* offset_base, void* src_buff, int buff_len, int* consumed) {
+    if (!plan || !offset_base || !src_buff || !consumed) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->no_offsets) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    size_t map_len = sp_bitmap_len(plan);
+    if (buff_len < 0 || (size_t)buff_len < map_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    uint8_t* in = src_buff;
+    /* Bits past the last field mean the delta was made with a different plan */
+    if (plan->num_ops % 8 != 0 && (in[map_len - 1] >> (plan->num_ops % 8)) != 0) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    /* Size up the whole delta first, so a truncated one leaves the struct untouched */
+    size_t pos = map_len;
+    for (int i = 0; i < plan->num_ops; i++) {
+        if ((in[i / 8] >> (i % 8)) & 1) {
+            pos += (size_t)plan->ops[i].len * sp_type_size(plan->ops[i].type);
+        }
+    }
+    if (pos > (size_t)buff_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    pos = map_len;
+    for (int i = 0; i < plan->num_ops; i++) {
+        if (((in[i / 8] >> (i % 8)) & 1) == 0) {
+            continue;
+        }
+        const struct sp_op* op = &plan->ops[i];
+        SPResult res = sp_plan_field(plan, op, SP_UNPACK, offset_base, in + pos);
+        if (res != SP_OK) {
+            return res;
+        }
+        pos += (size_t)op->len * sp_type_size(op->type);
+    }
+    *consumed = (int)pos;
+    return SP_OK;
+}
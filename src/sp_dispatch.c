@@ -0,0 +1,138 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+#define SP_NUM_TAGS 256
+
+struct sp_dispatch {
+    /* Indexed directly by tag byte. NULL for unknown tags */
+    sp_plan* plans[SP_NUM_TAGS];
+};
+
+SPResult sp_dispatch_new(const sp_dispatch_entry* entries, int num_entries, sp_dispatch** dispatch) {
+    if (!entries || num_entries <= 0 || !dispatch) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_dispatch* d = calloc(1, sizeof *d);
+    if (!d) {
+        return SP_ERR_ALLOC;
+    }
+    SPResult res = SP_OK;
+    int i;
+    for (i = 0; i < num_entries && res == SP_OK; i++) {
+        const sp_dispatch_entry* e = &entries[i];
+        if (e->tag < 0 || e->tag >= SP_NUM_TAGS || d->plans[e->tag]) {
+            res = SP_ERR_INVALID_PARAMS;
+            break;
+        }
+        res = sp_plan_compile(e->fmt_str, e->num_fields, e->offset_list, &d->plans[e->tag]);
+    }
+    if (res != SP_OK) {
+        sp_dispatch_free(d);
+        return res;
+    }
+    *dispatch = d;
+    return SP_OK;
+}
+
+void sp_dispatch_free(sp_dispatch* dispatch) {
+    int i;
+    if (!dispatch) {
+        return;
+    }
+    for (i = 0; i < SP_NUM_TAGS; i++) {
+        sp_plan_free(dispatch->plans[i]);
+    }
+    free(dispatch);
+}
+
+const sp_plan* sp_dispatch_plan(const sp_dispatch* dispatch, int tag) {
+    if (!dispatch || tag < 0 || tag >= SP_NUM_TAGS) {
+        return NULL;
+    }
+    return dispatch->plans[tag];
+}
+
+SPResult sp_dispatch_unpack(const sp_dispatch* dispatch,
+                            void* offset_base,
+                            void* src_buff,
+                            int buff_len,
+                            int* tag,
+                            int* consumed)
+{
+    if (!dispatch || !offset_base || !src_buff || buff_len <= 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    uint8_t t = *(uint8_t*)src_buff;
+    const sp_plan* plan = dispatch->plans[t];
+    if (tag) {
+        *tag = t;
+    }
+    if (!plan) {
+        return SP_ERR_TAG;
+    }
+    if ((size_t)buff_len - 1 < plan->size) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    SPResult res = sp_plan_unpack(plan, offset_base, (uint8_t*)src_buff + 1, buff_len - 1);
+    if (res == SP_OK && consumed) {
+        *consumed = 1 + (int)plan->size;
+    }
+    return res;
+}
+
+SPResult sp_dispatch_unpack_batch(const sp_dispatch* dispatch,
+                                  void* out,
+                                  size_t out_stride,
+                                  int* tags,
+                                  int max_msgs,
+                                  void* src_buff,
+                                  int buff_len,
+                                  int* num_msgs,
+                                  int* consumed)
+{
+    if (!dispatch || !out || !tags || max_msgs <= 0 || !src_buff || buff_len <= 0 || !num_msgs || !consumed) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    const uint8_t* buff = (const uint8_t*)src_buff;
+    uint8_t* out_ptr = (uint8_t*)out;
+    size_t pos = 0;
+    int n = 0;
+    SPResult res = SP_OK;
+    /* Messages vary in size, so the distance is counted in bytes */
+    const size_t ahead = sp_prefetch_records((size_t)buff_len, 1);
+    while (n < max_msgs && pos < (size_t)buff_len) {
+        if (ahead && pos + ahead < (size_t)buff_len) {
+            SP_PREFETCH(buff + pos + ahead);
+        }
+        const sp_plan* plan = dispatch->plans[buff[pos]];
+        if (!plan) {
+            tags[n] = buff[pos];
+            res = SP_ERR_TAG;
+            break;
+        }
+        /* A partial message is left for the next call */
+        if ((size_t)buff_len - pos - 1 < plan->size) {
+            break;
+        }
+        tags[n] = buff[pos];
+        res = sp_plan_unpack(plan, out_ptr, (uint8_t*)src_buff + pos + 1, (int)plan->size);
+        if (res != SP_OK) {
+            break;
+        }
+        pos += 1 + plan->size;
+        out_ptr += out_stride;
+        n++;
+    }
+    *num_msgs = n;
+    *consumed = (int)pos;
+    return res;
+}
@@ -0,0 +1,194 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+struct sp_framer {
+    const sp_plan* payload;
+    enum sp_endian len_endian;
+    char len_type;
+    int len_size;
+    /* Ring storage. Capacity is a power of two, so positions wrap with a mask */
+    uint8_t* ring;
+    size_t capacity;
+    size_t mask;
+    /* Free running read and write positions. Their difference is the number of buffered bytes */
+    size_t read_pos;
+    size_t write_pos;
+    /* Linear copy of a payload that wraps around the end of the ring */
+    uint8_t* scratch;
+};
+
+SPResult sp_framer_new(const char* len_fmt, const sp_plan* payload, int capacity, sp_framer** framer) {
+    if (!len_fmt || !payload || capacity <= 0 || !framer) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_plan* len_plan = NULL;
+    SPResult res = sp_plan_build(len_fmt, 1, NULL, &len_plan);
+    if (res != SP_OK) {
+        return res;
+    }
+    char len_type = len_plan->ops[0].type;
+    bool valid = len_plan->ops[0].len == 1 && len_plan->size == (size_t)sp_type_size(len_type) &&
+                 len_type != 's' && len_type != 'w' && len_type != 'u';
+    enum sp_endian len_endian = len_plan->endian;
+    sp_plan_free(len_plan);
+    if (!valid) {
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    size_t cap = 1;
+    while (cap < (size_t)capacity) {
+        cap <<= 1;
+    }
+    struct sp_framer* f = calloc(1, sizeof *f);
+    if (!f) {
+        return SP_ERR_ALLOC;
+    }
+    f->ring = malloc(cap);
+    f->scratch = malloc(payload->size > 0 ? payload->size : 1);
+    if (!f->ring || !f->scratch) {
+        sp_framer_free(f);
+        return SP_ERR_ALLOC;
+    }
+    f->payload = payload;
+    f->len_type = len_type;
+    f->len_endian = len_endian;
+    f->len_size = sp_type_size(len_type);
+    f->capacity = cap;
+    f->mask = cap - 1;
+    *framer = f;
+    return SP_OK;
+}
+
+void sp_framer_free(sp_framer* framer) {
+    if (!framer) {
+        return;
+    }
+    free(framer->ring);
+    free(framer->scratch);
+    free(framer);
+}
+
+int sp_framer_pending(const sp_framer* framer) {
+    return framer ? (int)(framer->write_pos - framer->read_pos) : 0;
+}
+
+/* Size of the contiguous free region starting at write_pos */
+static size_t sp_framer_free_region(const sp_framer* framer) {
+    size_t free_bytes = framer->capacity - (framer->write_pos - framer->read_pos);
+    size_t to_end = framer->capacity - (framer->write_pos & framer->mask);
+    return (free_bytes < to_end) ? free_bytes : to_end;
+}
+
+void* sp_framer_reserve(sp_framer* framer, int* len) {
+    if (!framer || !len) {
+        return NULL;
+    }
+    *len = (int)sp_framer_free_region(framer);
+    return framer->ring + (framer->write_pos & framer->mask);
+}
+
+void sp_framer_commit(sp_framer* framer, int len) {
+    if (!framer || len <= 0) {
+        return;
+    }
+    /* Committing more than was reserved would overwrite bytes not yet decoded */
+    size_t region = sp_framer_free_region(framer);
+    framer->write_pos += ((size_t)len < region) ? (size_t)len : region;
+}
+
+int sp_framer_write(sp_framer* framer, const void* data, int len) {
+    if (!framer || !data || len <= 0) {
+        return 0;
+    }
+    const uint8_t* src = (const uint8_t*)data;
+    int written = 0;
+    int chunk;
+    /* At most two chunks, before and after the end of the ring */
+    while (written < len) {
+        uint8_t* dst = sp_framer_reserve(framer, &chunk);
+        if (chunk == 0) {
+            break;
+        }
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+        memcpy(dst, src + written, (size_t)chunk);
+        sp_framer_commit(framer, chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+/* Copy n bytes starting at ring position pos, which may wrap around the end */
+static void sp_ring_copy(const sp_framer* f, size_t pos, uint8_t* dst, size_t n) {
+    size_t start = pos & f->mask;
+    size_t first = f->capacity - start;
+    if (first > n) {
+        first = n;
+    }
+    memcpy(dst, f->ring + start, first);
+    memcpy(dst + first, f->ring, n - first);
+}
+
+SPResult sp_framer_decode(sp_framer* framer,
+                          void* out,
+                          size_t out_stride,
+                          int max_frames,
+                          int* num_frames)
+{
+    if (!framer || !out || max_frames <= 0 || !num_frames) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    const sp_plan* plan = framer->payload;
+    uint8_t* out_ptr = (uint8_t*)out;
+    uint8_t len_buf[8];
+    SPResult res = SP_OK;
+    int n = 0;
+    while (n < max_frames) {
+        size_t avail = framer->write_pos - framer->read_pos;
+        if (avail < (size_t)framer->len_size) {
+            break;
+        }
+        sp_ring_copy(framer, framer->read_pos, len_buf, (size_t)framer->len_size);
+        uint64_t frame_len = sp_load_uint(len_buf, framer->len_size, framer->len_endian);
+        if (framer->len_type == 'b' || framer->len_type == 'h' || framer->len_type == 'i' || framer->len_type == 'q') {
+            /* Negative lengths are never valid */
+            if (frame_len >> (8 * framer->len_size - 1)) {
+                res = SP_ERR_FRAME;
+                break;
+            }
+        }
+        /* Payloads may carry trailing bytes the plan does not describe, but never fewer */
+        if (frame_len < plan->size || frame_len > framer->capacity - (size_t)framer->len_size) {
+            res = SP_ERR_FRAME;
+            break;
+        }
+        if (avail - (size_t)framer->len_size < frame_len) {
+            break;
+        }
+        size_t start = (framer->read_pos + (size_t)framer->len_size) & framer->mask;
+        if (start + plan->size <= framer->capacity) {
+            res = sp_plan_unpack(plan, out_ptr, framer->ring + start, (int)plan->size);
+        } else {
+            sp_ring_copy(framer, start, framer->scratch, plan->size);
+            res = sp_plan_unpack(plan, out_ptr, framer->scratch, (int)plan->size);
+        }
+        if (res != SP_OK) {
+            break;
+        }
+        framer->read_pos += (size_t)framer->len_size + (size_t)frame_len;
+        out_ptr += out_stride;
+        n++;
+    }
+    *num_frames = n;
+    return res;
+}
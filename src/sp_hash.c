@@ -0,0 +1,161 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Hashing and comparison of selected fields of packed records.
+ *
+ * A field is hashed as if its elements were stored little endian, eight bytes
+ * at a time with the last word zero padded. Little endian and byte sized
+ * fields are read straight from the record. Only multi-byte elements of big
+ * endian records are swapped first, so the same values hash the same way
+ * whatever the byte order or padding of the format holding them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+#define SP_HASH_SEED UINT64_C(0x2d358dccaa6c78a5)
+#define SP_HASH_MUL UINT64_C(0x9e3779b97f4a7c15)
+/* Only the first 64 fields of a plan can be selected by a mask */
+#define SP_MASK_FIELDS 64
+
+static uint64_t sp_hash_word(uint64_t h, uint64_t w) {
+    h = (h ^ w) * SP_HASH_MUL;
+    return h ^ (h >> 29);
+}
+
+static uint64_t sp_hash_final(uint64_t h) {
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static bool sp_field_selected(uint64_t field_mask, int i) {
+    return i < SP_MASK_FIELDS && ((field_mask >> i) & 1) != 0;
+}
+
+static uint64_t sp_hash_op(uint64_t h, const struct sp_op* op, enum sp_endian endian, const uint8_t* rec) {
+    const int width = sp_type_size(op->type);
+    const bool swap = endian == SP_BIG_ENDIAN && width > 1;
+    const uint8_t* p = rec + op->buf_off;
+    size_t n = (size_t)op->len * width;
+    /* A single integer, or a short run of bytes, is a single word */
+    if (n <= 8 && (op->len == 1 || !swap)) {
+        return sp_hash_word(h, sp_load_uint(p, (int)n, op->len == 1 ? endian : SP_LITTLE_ENDIAN));
+    }
+    uint8_t tmp[64];
+    while (n > 0) {
+        size_t take = n < sizeof tmp ? n : sizeof tmp;
+        const uint8_t* src = p;
+        size_t i;
+        if (swap) {
+            sp_swap_array(tmp, p, take / width, width);
+            src = tmp;
+        }
+        for (i = 0; i + 8 <= take; i += 8) {
+            h = sp_hash_word(h, sp_load_uint(src + i, 8, SP_LITTLE_ENDIAN));
+        }
+        if (i < take) {
+            h = sp_hash_word(h, sp_load_uint(src + i, (int)(take - i), SP_LITTLE_ENDIAN));
+        }
+        p += take;
+        n -= take;
+    }
+    return h;
+}
+
+uint64_t sp_hash(const sp_plan* plan, uint64_t field_mask, const void* record) {
+    if (!plan || !record) {
+        return 0;
+    }
+    uint64_t h = SP_HASH_SEED;
+    for (int i = 0; i < plan->num_ops; i++) {
+        if (sp_field_selected(field_mask, i)) {
+            h = sp_hash_op(h, &plan->ops[i], plan->endian, record);
+        }
+    }
+    return sp_hash_final(h);
+}
+
+SPResult sp_hash_batch(const sp_plan* plan, uint64_t field_mask, const void* src_buff, int buff_len, int count, uint64_t* hashes) {
+    if (!plan || !src_buff || !hashes) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (count < 0 || buff_len < 0) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    if ((size_t)count * plan->size > (size_t)buff_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    const uint8_t* recs = src_buff;
+    const size_t stride = plan->size;
+    /* Each pass reads one field from every record, so upcoming records are prefetched field by field */
+    const size_t ahead = sp_prefetch_records((size_t)count, stride);
+    int r;
+    for (r = 0; r < count; r++) {
+        hashes[r] = SP_HASH_SEED;
+    }
+    /* Field by field, so the inner loop does the same work for every record */
+    for (int i = 0; i < plan->num_ops; i++) {
+        if (!sp_field_selected(field_mask, i)) {
+            continue;
+        }
+        const struct sp_op* op = &plan->ops[i];
+        const int width = sp_type_size(op->type);
+        if (op->len == 1) {
+            const uint8_t* p = recs + op->buf_off;
+            for (r = 0; r < count; r++, p += stride) {
+                if (ahead && (size_t)r + ahead < (size_t)count) {
+                    SP_PREFETCH(p + ahead * stride);
+                }
+                hashes[r] = sp_hash_word(hashes[r], sp_load_uint(p, width, plan->endian));
+            }
+        } else {
+            for (r = 0; r < count; r++) {
+                if (ahead && (size_t)r + ahead < (size_t)count) {
+                    SP_PREFETCH(recs + ((size_t)r + ahead) * stride + op->buf_off);
+                }
+                hashes[r] = sp_hash_op(hashes[r], op, plan->endian, recs + (size_t)r * stride);
+            }
+        }
+    }
+    for (r = 0; r < count; r++) {
+        hashes[r] = sp_hash_final(hashes[r]);
+    }
+    return SP_OK;
+}
+
+int sp_equal(const sp_plan* plan, uint64_t field_mask, const void* a, const void* b) {
+    if (!plan || !a || !b) {
+        return 0;
+    }
+    const uint8_t* x = a;
+    const uint8_t* y = b;
+    /* Adjacent selected fields are compared as one run of bytes */
+    size_t run_off = 0, run_len = 0;
+    for (int i = 0; i < plan->num_ops; i++) {
+        if (!sp_field_selected(field_mask, i)) {
+            continue;
+        }
+        const struct sp_op* op = &plan->ops[i];
+        size_t len = (size_t)op->len * sp_type_size(op->type);
+        if (run_len > 0 && op->buf_off == run_off + run_len) {
+            run_len += len;
+            continue;
+        }
+        if (run_len > 0 && memcmp(x + run_off, y + run_off, run_len) != 0) {
+            return 0;
+        }
+        run_off = op->buf_off;
+        run_len = len;
+    }
+    return run_len == 0 || memcmp(x + run_off, y + run_off, run_len) == 0;
+}
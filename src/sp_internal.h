@@ -7,9 +7,74 @@
 #ifndef SP_INTERNAL_H
 #define SP_INTERNAL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <structpack.h>
+
 #define SP_MAX_GRP_DEPTH 11
 
 enum sp_endian {SP_BIG_ENDIAN, SP_LITTLE_ENDIAN};
 enum sp_action {SP_PACK, SP_UNPACK};
 
+/* Size in bytes of a single element of the given format type */
+int sp_type_size(char type);
+bool sp_host_little_endian(void);
+/* Load or store a single unsigned integer of width bytes, in the given byte order */
+uint64_t sp_load_uint(const uint8_t* p, int width, enum sp_endian endian);
+void sp_store_uint(uint8_t* p, uint64_t v, int width, enum sp_endian endian);
+/* Byte swap n elements of width bytes from src to dst. dst may be the same as src */
+void sp_swap_array(void* dst, const void* src, size_t n, int width);
+/* Copy len elements of type between struct and buffer. Returns the number of buffer bytes used */
+int sp_copy_field(char type, int len, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr);
+/* As sp_copy_field, for integer fields whose struct member is dest_width bytes wide. Values are sign or
+   zero extended as the type dictates, and SP_ERR_RANGE is returned if one does not fit when narrowing */
+SPResult sp_resize_field(char type, int len, int dest_width, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr);
+/* Copy a 'w' or 'u' field of len code units to or from a null terminated UTF-8 char member. Invalid
+   code units become U+FFFD on unpack. Packing returns SP_ERR_ENCODING for invalid UTF-8, and
+   SP_ERR_RANGE if the string needs more than len code units */
+SPResult sp_utf8_field(char type, int len, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr);
+/* Pack or unpack a record described by a format string, using either ptr_list or offset_list. When
+   used is not NULL, it is set to the number of buffer bytes the record spans on success */
+SPResult sp_pack_unpack_bin(enum sp_action action, const char* fmt_str, int num_fields, void** ptr_list,
+                            const size_t* offset_list, void* offset_base, void* buff, int buff_len, int* used);
+/* Check a format string with a single parse that allocates nothing. A negative num_fields skips the
+   field count check. strided, if not NULL, is set if the format has strided groups, and size, if not
+   NULL, to the packed size of a record */
+SPResult sp_format_size(const char* fmt_str, int num_fields, bool* strided, int* size);
+/* The packing or unpacking pass of sp_pack_unpack_bin, for a format already checked with sp_format_size */
+SPResult sp_pack_unpack_fields(enum sp_action action, const char* fmt_str, void** ptr_list, const size_t* offset_list,
+                               void* offset_base, void* buff, int buff_len, int* used);
+
+/* Hint that the cache line holding p will be read soon */
+#if defined(__GNUC__) || defined(__clang__)
+#define SP_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define SP_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define SP_PREFETCH(p) ((void)(p))
+#endif
+
+/* Outputs smaller than this are never streamed, so small fields need not check the thresholds */
+#define SP_STREAM_FLOOR 4096
+
+/* Number of records ahead to prefetch in a batch of count records, stride bytes apart, or 0 not to */
+size_t sp_prefetch_records(size_t count, size_t stride);
+/* Whether len bytes of output should be written with streaming stores */
+bool sp_stream_wanted(size_t len);
+/* Copy n bytes with stores that bypass the cache where supported, fenced before returning */
+void sp_stream_copy(void* dst, const void* src, size_t n);
+/* As sp_stream_copy, byte swapping n elements of width bytes */
+void sp_stream_swap(void* dst, const void* src, size_t n, int width);
+/* Build record index of a batch at dst */
+typedef SPResult (*sp_record_fn)(void* ctx, size_t index, uint8_t* dst);
+/* Build count records of size bytes at out, by calling fn for each in order. Each record is zeroed
+   before fn builds it, so bytes fn skips are 0. When stream is set, as sp_stream_wanted decides for
+   the whole batch, records are built a block at a time in scratch space and then streamed out.
+   Stops at the first error, with the records before it written. When built is not NULL, it is set
+   to the number of records written */
+SPResult sp_stream_records(sp_record_fn fn, void* ctx, size_t count, size_t size, bool stream, uint8_t* out, size_t* built);
+
 #endif // SP_INTERNAL_H
@@ -0,0 +1,337 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Native code generation for compiled plans.
+ *
+ * Each plan is lowered to two straight line functions, one to unpack and one
+ * to pack. Every field becomes a load from a constant offset, an optional
+ * byte swap, and a store to a constant offset. Arrays needing a byte swap are
+ * handled 16 bytes at a time with pshufb where SSSE3 is available.
+ *
+ * Code is written to an anonymous mapping, which is made executable (and no
+ * longer writable) before use. Only x86-64 with the System V calling
+ * convention is supported. Define SP_NO_JIT to leave it out entirely.
+ */
+
+#if !defined(SP_NO_JIT) && defined(__x86_64__) && !defined(_WIN32) && defined(__GNUC__)
+#define SP_JIT_X64
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+#ifdef SP_JIT_X64
+
+#include <cpuid.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Plans generating more code than this are left to the interpreter */
+#define SP_JIT_MAX_CODE (1024 * 1024)
+
+/* ModRM bytes addressing [rsi + disp32] and [rdi + disp32], with rax/xmm0 as the register operand */
+#define SP_MODRM_SRC 0x86
+#define SP_MODRM_DST 0x87
+
+/* Generated functions take (dst, src) in rdi and rsi */
+typedef void (*sp_jit_fn)(void* dst, const void* src);
+
+struct sp_jit {
+    void* mem;
+    size_t mem_len;
+    sp_jit_fn unpack;
+    sp_jit_fn pack;
+};
+
+struct sp_code {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+    bool failed;
+};
+
+static const uint8_t sp_shuf_masks[3][16] = {
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}
+};
+
+static void emit(struct sp_code* c, const uint8_t* bytes, size_t n) {
+    if (c->failed) {
+        return;
+    }
+    if (c->len + n > c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        uint8_t* data;
+        if (cap > SP_JIT_MAX_CODE || !(data = realloc(c->data, cap))) {
+            c->failed = true;
+            return;
+        }
+        c->data = data;
+        c->cap = cap;
+    }
+    memcpy(c->data + c->len, bytes, n);
+    c->len += n;
+}
+
+static void emit_disp32(struct sp_code* c, int32_t disp) {
+    uint32_t d = (uint32_t)disp;
+    uint8_t b[4] = {(uint8_t)d, (uint8_t)(d >> 8), (uint8_t)(d >> 16), (uint8_t)(d >> 24)};
+    emit(c, b, sizeof b);
+}
+
+static void patch_disp32(struct sp_code* c, size_t at, int32_t disp) {
+    uint32_t d = (uint32_t)disp;
+    if (c->failed) {
+        return;
+    }
+    c->data[at] = (uint8_t)d;
+    c->data[at + 1] = (uint8_t)(d >> 8);
+    c->data[at + 2] = (uint8_t)(d >> 16);
+    c->data[at + 3] = (uint8_t)(d >> 24);
+}
+
+static void emit_mem(struct sp_code* c, const uint8_t* opcode, size_t n, uint8_t modrm, int32_t disp) {
+    emit(c, opcode, n);
+    emit(c, &modrm, 1);
+    emit_disp32(c, disp);
+}
+
+/* Load width bytes from [rsi + disp] into rax, or xmm0 for 16 bytes */
+static void emit_load(struct sp_code* c, int width, int32_t disp) {
+    static const uint8_t ld1[] = {0x0f, 0xb6};
+    static const uint8_t ld2[] = {0x0f, 0xb7};
+    static const uint8_t ld4[] = {0x8b};
+    static const uint8_t ld8[] = {0x48, 0x8b};
+    static const uint8_t ld16[] = {0xf3, 0x0f, 0x6f};
+    switch (width) {
+        case 1: emit_mem(c, ld1, sizeof ld1, SP_MODRM_SRC, disp); break;
+        case 2: emit_mem(c, ld2, sizeof ld2, SP_MODRM_SRC, disp); break;
+        case 4: emit_mem(c, ld4, sizeof ld4, SP_MODRM_SRC, disp); break;
+        case 8: emit_mem(c, ld8, sizeof ld8, SP_MODRM_SRC, disp); break;
+        case 16: emit_mem(c, ld16, sizeof ld16, SP_MODRM_SRC, disp); break;
+    }
+}
+
+/* Store width bytes of rax, or xmm0 for 16 bytes, to [rdi + disp] */
+static void emit_store(struct sp_code* c, int width, int32_t disp) {
+    static const uint8_t st1[] = {0x88};
+    static const uint8_t st2[] = {0x66, 0x89};
+    static const uint8_t st4[] = {0x89};
+    static const uint8_t st8[] = {0x48, 0x89};
+    static const uint8_t st16[] = {0xf3, 0x0f, 0x7f};
+    switch (width) {
+        case 1: emit_mem(c, st1, sizeof st1, SP_MODRM_DST, disp); break;
+        case 2: emit_mem(c, st2, sizeof st2, SP_MODRM_DST, disp); break;
+        case 4: emit_mem(c, st4, sizeof st4, SP_MODRM_DST, disp); break;
+        case 8: emit_mem(c, st8, sizeof st8, SP_MODRM_DST, disp); break;
+        case 16: emit_mem(c, st16, sizeof st16, SP_MODRM_DST, disp); break;
+    }
+}
+
+/* Store a zero element of width bytes to [rdi + disp] */
+static void emit_store_zero(struct sp_code* c, int width, int32_t disp) {
+    static const uint8_t st1[] = {0xc6};
+    static const uint8_t st2[] = {0x66, 0xc7};
+    static const uint8_t st4[] = {0xc7};
+    static const uint8_t zero[4] = {0};
+    switch (width) {
+        case 1: emit_mem(c, st1, sizeof st1, SP_MODRM_DST, disp); break;
+        case 2: emit_mem(c, st2, sizeof st2, SP_MODRM_DST, disp); break;
+        case 4: emit_mem(c, st4, sizeof st4, SP_MODRM_DST, disp); break;
+    }
+    emit(c, zero, (size_t)width);
+}
+
+/* Byte swap an element of width bytes in rax */
+static void emit_bswap(struct sp_code* c, int width) {
+    static const uint8_t rol16[] = {0x66, 0xc1, 0xc0, 0x08};
+    static const uint8_t bswap32[] = {0x0f, 0xc8};
+    static const uint8_t bswap64[] = {0x48, 0x0f, 0xc8};
+    switch (width) {
+        case 2: emit(c, rol16, sizeof rol16); break;
+        case 4: emit(c, bswap32, sizeof bswap32); break;
+        case 8: emit(c, bswap64, sizeof bswap64); break;
+    }
+}
+
+/* Byte swap every element of width bytes in xmm0, using the mask in xmm1, xmm2 or xmm3 */
+static void emit_pshufb(struct sp_code* c, int width) {
+    uint8_t pshufb[] = {0x66, 0x0f, 0x38, 0x00, 0xc1};
+    pshufb[4] = (uint8_t)(0xc0 | ((width == 2) ? 1 : (width == 4) ? 2 : 3));
+    emit(c, pshufb, sizeof pshufb);
+}
+
+static void emit_copy(struct sp_code* c, int32_t src, int32_t dst, size_t n) {
+    static const int chunks[] = {16, 8, 4, 2, 1};
+    size_t i;
+    int32_t off = 0;
+    for (i = 0; i < sizeof chunks / sizeof chunks[0]; i++) {
+        while (n >= (size_t)chunks[i]) {
+            emit_load(c, chunks[i], src + off);
+            emit_store(c, chunks[i], dst + off);
+            off += chunks[i];
+            n -= (size_t)chunks[i];
+        }
+    }
+}
+
+static void emit_swap_array(struct sp_code* c, int32_t src, int32_t dst, int len, int width, bool ssse3) {
+    int32_t off = 0;
+    int32_t total = len * width;
+    if (ssse3) {
+        for (; total - off >= 16; off += 16) {
+            emit_load(c, 16, src + off);
+            emit_pshufb(c, width);
+            emit_store(c, 16, dst + off);
+        }
+    }
+    for (; off < total; off += width) {
+        emit_load(c, width, src + off);
+        emit_bswap(c, width);
+        emit_store(c, width, dst + off);
+    }
+}
+
+static void jit_gen(struct sp_code* c, const struct sp_plan* plan, enum sp_action action, bool ssse3) {
+    size_t mask_fix[3] = {0};
+    int i;
+    if (ssse3) {
+        /* movdqu xmm1..xmm3, [rip + disp32], patched once the mask location is known */
+        for (i = 0; i < 3; i++) {
+            uint8_t ld[] = {0xf3, 0x0f, 0x6f, (uint8_t)(0x0d + 8 * i)};
+            emit(c, ld, sizeof ld);
+            mask_fix[i] = c->len;
+            emit_disp32(c, 0);
+        }
+    }
+    bool swap = (plan->endian == SP_BIG_ENDIAN);
+    const struct sp_op* op;
+    for (op = plan->ops; op < plan->ops + plan->num_ops; op++) {
+        int width = sp_type_size(op->type);
+        int32_t src = (int32_t)((action == SP_UNPACK) ? op->buf_off : op->struct_off);
+        int32_t dst = (int32_t)((action == SP_UNPACK) ? op->struct_off : op->buf_off);
+        if (swap && width > 1) {
+            emit_swap_array(c, src, dst, op->len, width, ssse3);
+        } else {
+            emit_copy(c, src, dst, (size_t)op->len * width);
+        }
+        if (action == SP_UNPACK && (op->type == 's' || op->type == 'w' || op->type == 'u')) {
+            emit_store_zero(c, width, dst + op->len * width);
+        }
+    }
+    static const uint8_t ret[] = {0xc3};
+    emit(c, ret, sizeof ret);
+    if (ssse3) {
+        for (i = 0; i < 3; i++) {
+            patch_disp32(c, mask_fix[i], (int32_t)(c->len - (mask_fix[i] + 4)));
+            emit(c, sp_shuf_masks[i], sizeof sp_shuf_masks[i]);
+        }
+    }
+}
+
+static bool jit_supported(const struct sp_plan* plan) {
+    const struct sp_op* op;
+    for (op = plan->ops; op < plan->ops + plan->num_ops; op++) {
+        /* Conversions may fail, which generated code has no way to report */
+        if (op->dest_width || op->utf8) {
+            return false;
+        }
+        /* One extra element for the null terminator of strings */
+        size_t end = (size_t)(op->len + 1) * sp_type_size(op->type);
+        if (op->buf_off + end > INT32_MAX || op->struct_off + end > INT32_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SPResult sp_jit_compile(const struct sp_plan* plan, struct sp_jit** jit) {
+    if (!jit_supported(plan)) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    unsigned int eax, ebx, ecx, edx;
+    bool ssse3 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3);
+    struct sp_code c = {0};
+    jit_gen(&c, plan, SP_UNPACK, ssse3);
+    size_t pack_entry = c.len;
+    jit_gen(&c, plan, SP_PACK, ssse3);
+    if (c.failed) {
+        free(c.data);
+        return SP_ERR_UNSUPPORTED;
+    }
+    struct sp_jit* j = calloc(1, sizeof *j);
+    if (!j) {
+        free(c.data);
+        return SP_ERR_ALLOC;
+    }
+    /* Never writable and executable at the same time */
+    j->mem_len = c.len;
+    j->mem = mmap(NULL, j->mem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (j->mem == MAP_FAILED) {
+        free(c.data);
+        free(j);
+        return SP_ERR_UNSUPPORTED;
+    }
+    memcpy(j->mem, c.data, c.len);
+    free(c.data);
+    if (mprotect(j->mem, j->mem_len, PROT_READ | PROT_EXEC) != 0) {
+        munmap(j->mem, j->mem_len);
+        free(j);
+        return SP_ERR_UNSUPPORTED;
+    }
+    /* ISO C has no conversion between object and function pointers */
+    uint8_t* pack_mem = (uint8_t*)j->mem + pack_entry;
+    memcpy(&j->unpack, &j->mem, sizeof j->unpack);
+    memcpy(&j->pack, &pack_mem, sizeof j->pack);
+    *jit = j;
+    return SP_OK;
+}
+
+void sp_jit_run(const struct sp_jit* jit, enum sp_action action, void* struct_ptr, void* buff_ptr) {
+    if (action == SP_UNPACK) {
+        jit->unpack(struct_ptr, buff_ptr);
+    } else {
+        jit->pack(buff_ptr, struct_ptr);
+    }
+}
+
+void sp_jit_free(struct sp_jit* jit) {
+    if (!jit) {
+        return;
+    }
+    munmap(jit->mem, jit->mem_len);
+    free(jit);
+}
+
+#else
+
+SPResult sp_jit_compile(const struct sp_plan* plan, struct sp_jit** jit) {
+    (void)plan;
+    (void)jit;
+    return SP_ERR_UNSUPPORTED;
+}
+
+void sp_jit_run(const struct sp_jit* jit, enum sp_action action, void* struct_ptr, void* buff_ptr) {
+    (void)jit;
+    (void)action;
+    (void)struct_ptr;
+    (void)buff_ptr;
+}
+
+void sp_jit_free(struct sp_jit* jit) {
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Alternative kernels for compiled plans, and the autotuner choosing between them.
+ *
+ * The interpreter handles each field on its own, and swaps array elements
+ * one at a time. The SIMD kernel turns plain integer arrays into runs that
+ * are copied or byte swapped in bulk with sp_swap_array. The copy kernel
+ * goes further, turning every plain field into a run and coalescing runs
+ * that are adjacent in both the buffer and the struct, so a record laid out
+ * like its struct is a single memcpy. Fields the runs cannot express, such
+ * as strings and resized or UTF-8 fields, fall back to sp_plan_field.
+ *
+ * Which kernel is fastest depends on the format and the processor, so
+ * sp_plan_autotune times each one on a scratch record and keeps the winner.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_plan.h"
+
+/* Buffer bytes handled per timing round, so small records are timed over many runs */
+#define SP_TUNE_WORK (64 * 1024)
+#define SP_TUNE_ROUNDS 3
+
+/* A span copied or byte swapped in one go, or a single op run by sp_plan_field */
+struct sp_run {
+    size_t buf_off;
+    size_t struct_off;
+    /* Number of elements of width bytes */
+    size_t len;
+    int width;
+    bool swap;
+    /* Index of the op to run instead, or -1 */
+    int op;
+};
+
+struct sp_runs {
+    int num;
+    struct sp_run* runs;
+};
+
+struct sp_kernels {
+    struct sp_runs simd;
+    struct sp_runs copy;
+    double ns[SP_NUM_KERNELS];
+};
+
+static const char* const sp_kernel_names[SP_NUM_KERNELS] = {"interp", "simd", "copy", "jit"};
+
+const char* sp_kernel_name(sp_kernel kernel) {
+    return ((unsigned)kernel < SP_NUM_KERNELS) ? sp_kernel_names[kernel] : "unknown";
+}
+
+/* Whether an op is a plain integer field, whose member holds exactly the buffer bytes in host order.
+   Fields large enough to be streamed are left to sp_copy_field */
+static bool sp_kernel_plain(const struct sp_op* op) {
+    return !op->dest_width && !op->utf8 && op->type != 's' && op->type != 'w' && op->type != 'u' &&
+           (size_t)op->len * (size_t)sp_type_size(op->type) < SP_STREAM_FLOOR;
+}
+
+/* Build the runs of a kernel into runs, which has room for one per op or is NULL to only count them.
+   Sets num to the number of runs, and returns how many are copies or swaps rather than a fallback op */
+static int sp_kernel_build(const struct sp_plan* plan, sp_kernel kernel, struct sp_run* runs, int* num_runs) {
+    const bool swap_order = (plan->endian == SP_LITTLE_ENDIAN) != sp_host_little_endian();
+    struct sp_run prev = {0, 0, 0, 0, false, 0};
+    int num = 0, copies = 0;
+    for (int i = 0; i < plan->num_ops; i++) {
+        const struct sp_op* op = &plan->ops[i];
+        const bool plain = sp_kernel_plain(op) && (kernel == SP_KERNEL_COPY || op->len > 1);
+        struct sp_run r = {op->buf_off, op->struct_off, (size_t)op->len, sp_type_size(op->type), false, plain ? -1 : i};
+        if (plain) {
+            r.swap = swap_order && r.width > 1;
+            if (!r.swap) {
+                r.len *= (size_t)r.width;
+                r.width = 1;
+            }
+            if (kernel == SP_KERNEL_COPY && num > 0 && prev.op < 0 && prev.swap == r.swap && prev.width == r.width &&
+                prev.buf_off + prev.len * (size_t)prev.width == r.buf_off &&
+                prev.struct_off + prev.len * (size_t)prev.width == r.struct_off) {
+                prev.len += r.len;
+                if (runs) {
+                    runs[num - 1] = prev;
+                }
+                continue;
+            }
+            copies++;
+        }
+        prev = r;
+        if (runs) {
+            runs[num] = r;
+        }
+        num++;
+    }
+    *num_runs = num;
+    return copies;
+}
+
+void sp_kernels_free(struct sp_kernels* kernels) {
+    if (kernels) {
+        free(kernels->simd.runs);
+        free(kernels->copy.runs);
+        free(kernels);
+    }
+}
+
+/* Make sure the run tables exist. Only called by the thread tuning or forcing a kernel */
+static SPResult sp_kernels_build(struct sp_plan* plan) {
+    if (plan->kernels) {
+        return SP_OK;
+    }
+    struct sp_kernels* k = calloc(1, sizeof *k);
+    if (!k) {
+        return SP_ERR_ALLOC;
+    }
+    const size_t n = plan->num_ops > 0 ? (size_t)plan->num_ops : 1;
+    k->simd.runs = malloc(n * sizeof *k->simd.runs);
+    k->copy.runs = malloc(n * sizeof *k->copy.runs);
+    if (!k->simd.runs || !k->copy.runs) {
+        sp_kernels_free(k);
+        return SP_ERR_ALLOC;
+    }
+    sp_kernel_build(plan, SP_KERNEL_SIMD, k->simd.runs, &k->simd.num);
+    sp_kernel_build(plan, SP_KERNEL_COPY, k->copy.runs, &k->copy.num);
+    plan->kernels = k;
+    return SP_OK;
+}
+
+/* Whether a kernel other than the interpreter does anything differently for a plan */
+static bool sp_kernel_useful(const struct sp_plan* plan, sp_kernel kernel) {
+    int num;
+    switch (kernel) {
+        case SP_KERNEL_INTERP:
+            return true;
+        case SP_KERNEL_JIT:
+            return plan->jit != NULL;
+        default:
+            return sp_kernel_build(plan, kernel, NULL, &num) > 0;
+    }
+}
+
+SPResult sp_kernel_exec(const struct sp_plan* plan, sp_kernel kernel, enum sp_action action, void* offset_base, void* buff) {
+    const struct sp_runs* runs = (kernel == SP_KERNEL_SIMD) ? &plan->kernels->simd : &plan->kernels->copy;
+    const struct sp_run* r = runs->runs;
+    const struct sp_run* end = r + runs->num;
+    for (; r < end; r++) {
+        uint8_t* member = (uint8_t*)offset_base + r->struct_off;
+        uint8_t* field = (uint8_t*)buff + r->buf_off;
+        if (r->op >= 0) {
+            SPResult res = sp_plan_field(plan, &plan->ops[r->op], action, offset_base, field);
+            if (res != SP_OK) {
+                return res;
+            }
+            continue;
+        }
+        uint8_t* dst = (action == SP_UNPACK) ? member : field;
+        const uint8_t* src = (action == SP_UNPACK) ? field : member;
+        if (r->swap) {
+            sp_swap_array(dst, src, r->len, r->width);
+        } else {
+            memcpy(dst, src, r->len);
+        }
+    }
+    return SP_OK;
+}
+
+/* Best time over several rounds of packing and unpacking a scratch record, in nanoseconds per record */
+static SPResult sp_kernel_time(const struct sp_plan* plan, sp_kernel kernel, void* base, uint8_t* buff, double* ns) {
+    const size_t iters = SP_TUNE_WORK / (plan->size ? plan->size : 1) + 1;
+    double best = 0;
+    for (int round = 0; round < SP_TUNE_ROUNDS; round++) {
+        double start = sp_seconds();
+        for (size_t i = 0; i < iters; i++) {
+            SPResult res = sp_plan_exec(plan, kernel, SP_PACK, base, buff);
+            if (res == SP_OK) {
+                res = sp_plan_exec(plan, kernel, SP_UNPACK, base, buff);
+            }
+            if (res != SP_OK) {
+                return res;
+            }
+        }
+        double elapsed = (sp_seconds() - start) * 1e9 / (double)iters;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    *ns = best;
+    return SP_OK;
+}
+
+/* Time every kernel that can run the plan, then publish the fastest. Only called by the thread that
+   moved tune_state to SP_TUNE_RUNNING */
+static SPResult sp_kernel_tune(struct sp_plan* plan) {
+    SPResult res = sp_kernels_build(plan);
+    if (res != SP_OK) {
+        return res;
+    }
+    if (!plan->jit) {
+        /* Generated code is optional, and the other kernels are timed without it */
+        sp_jit_compile(plan, &plan->jit);
+    }
+    /* Zeroed members pack and unpack without error whatever their type. Strings need room for their
+       terminator, and UTF-8 members for up to four bytes per code unit */
+    size_t struct_size = 1;
+    for (int i = 0; i < plan->num_ops; i++) {
+        const struct sp_op* op = &plan->ops[i];
+        size_t end = op->struct_off + ((size_t)op->len + 1) * 8;
+        if (end > struct_size) {
+            struct_size = end;
+        }
+    }
+    void* base = calloc(1, struct_size);
+    uint8_t* buff = calloc(1, plan->size ? plan->size : 1);
+    if (!base || !buff) {
+        free(base);
+        free(buff);
+        return SP_ERR_ALLOC;
+    }
+    struct sp_kernels* k = plan->kernels;
+    sp_kernel best = SP_KERNEL_INTERP;
+    memset(k->ns, 0, sizeof k->ns);
+    for (int kernel = 0; kernel < SP_NUM_KERNELS && res == SP_OK; kernel++) {
+        if (!sp_kernel_useful(plan, (sp_kernel)kernel)) {
+            continue;
+        }
+        res = sp_kernel_time(plan, (sp_kernel)kernel, base, buff, &k->ns[kernel]);
+        /* Ties go to the simpler kernel */
+        if (res == SP_OK && k->ns[kernel] < k->ns[best]) {
+            best = (sp_kernel)kernel;
+        }
+    }
+    free(base);
+    free(buff);
+    if (res == SP_OK) {
+        sp_store_release(&plan->kernel, best);
+    }
+    return res;
+}
+
+void sp_kernel_first_use(struct sp_plan* plan) {
+    if (sp_cas(&plan->tune_state, SP_TUNE_PENDING, SP_TUNE_RUNNING)) {
+        /* A plan that cannot be tuned keeps its kernel, and is not tried again */
+        sp_kernel_tune(plan);
+        sp_store_release(&plan->tune_state, SP_TUNE_DONE);
+    }
+}
+
+SPResult sp_plan_autotune(sp_plan* plan, int on_first_use) {
+    if (!plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->no_offsets) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    if (on_first_use) {
+        sp_cas(&plan->tune_state, SP_TUNE_IDLE, SP_TUNE_PENDING);
+        return SP_OK;
+    }
+    if (!sp_cas(&plan->tune_state, SP_TUNE_IDLE, SP_TUNE_RUNNING) &&
+        !sp_cas(&plan->tune_state, SP_TUNE_PENDING, SP_TUNE_RUNNING)) {
+        /* Already tuned, or being tuned by another thread */
+        return SP_OK;
+    }
+    SPResult res = sp_kernel_tune(plan);
+    sp_store_release(&plan->tune_state, res == SP_OK ? SP_TUNE_DONE : SP_TUNE_IDLE);
+    return res;
+}
+
+SPResult sp_plan_set_kernel(sp_plan* plan, sp_kernel kernel) {
+    if (!plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if ((unsigned)kernel >= SP_NUM_KERNELS) {
+        return SP_ERR_RANGE;
+    }
+    if (plan->no_offsets) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    SPResult res = SP_OK;
+    if (kernel == SP_KERNEL_JIT) {
+        res = plan->jit ? SP_OK : sp_jit_compile(plan, &plan->jit);
+    } else if (kernel != SP_KERNEL_INTERP) {
+        res = sp_kernels_build(plan);
+    }
+    if (res != SP_OK) {
+        return res;
+    }
+    if (plan->kernels) {
+        /* Timings from earlier tuning no longer describe the kernel in use */
+        memset(plan->kernels->ns, 0, sizeof plan->kernels->ns);
+    }
+    sp_store_release(&plan->kernel, kernel);
+    sp_store_release(&plan->tune_state, SP_TUNE_DONE);
+    return SP_OK;
+}
+
+void sp_plan_kernel_info(const sp_plan* plan, sp_kernel_info* info) {
+    if (!info) {
+        return;
+    }
+    memset(info, 0, sizeof *info);
+    if (!plan) {
+        return;
+    }
+    const size_t state = sp_load_acquire(&plan->tune_state);
+    info->kernel = (sp_kernel)sp_load_acquire(&plan->kernel);
+    for (int kernel = 0; kernel < SP_NUM_KERNELS; kernel++) {
+        if (state == SP_TUNE_RUNNING) {
+            /* The tuning thread may be generating code or filling in timings */
+            info->available[kernel] = kernel == SP_KERNEL_INTERP || kernel == (int)info->kernel;
+            continue;
+        }
+        info->available[kernel] = !plan->no_offsets && sp_kernel_useful(plan, (sp_kernel)kernel);
+        if (state == SP_TUNE_DONE && plan->kernels) {
+            info->ns[kernel] = plan->kernels->ns[kernel];
+            info->tuned |= info->ns[kernel] > 0;
+        }
+    }
+}
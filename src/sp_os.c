@@ -0,0 +1,486 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Thin wrappers over the platform facilities that the rest of the library
+ * uses: threads, timing, file mapping and 64 bit file offsets. Windows and POSIX are
+ * supported. */
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <structpack.h>
+#include "sp_os.h"
+
+#if defined(_WIN32)
+
+SPResult sp_map_file(const char* path, struct sp_file_map* map) {
+    LARGE_INTEGER size;
+    map->data = NULL;
+    map->len = 0;
+    map->file = NULL;
+    map->mapping = NULL;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return SP_ERR_IO;
+    }
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return SP_ERR_IO;
+    }
+    map->file = file;
+    map->len = (uint64_t)size.QuadPart;
+    if (map->len == 0) {
+        return SP_OK;
+    }
+    if ((uint64_t)(SIZE_T)map->len != map->len) {
+        sp_unmap_file(map);
+        return SP_ERR_UNSUPPORTED;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        sp_unmap_file(map);
+        return SP_ERR_UNSUPPORTED;
+    }
+    map->mapping = mapping;
+    map->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map->data) {
+        sp_unmap_file(map);
+        return SP_ERR_UNSUPPORTED;
+    }
+    return SP_OK;
+}
+
+void sp_unmap_file(struct sp_file_map* map) {
+    if (map->data) {
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mapping) {
+        CloseHandle((HANDLE)map->mapping);
+    }
+    if (map->file) {
+        CloseHandle((HANDLE)map->file);
+    }
+    map->data = NULL;
+    map->file = NULL;
+    map->mapping = NULL;
+}
+
+SPResult sp_map_file_out(const char* path, uint64_t len, struct sp_file_out* map) {
+    map->data = NULL;
+    map->len = len;
+    map->file = NULL;
+    map->mapping = NULL;
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return SP_ERR_IO;
+    }
+    map->file = file;
+    if (len == 0) {
+        return SP_OK;
+    }
+    if ((uint64_t)(SIZE_T)len != len) {
+        sp_unmap_file_out(map);
+        return SP_ERR_UNSUPPORTED;
+    }
+    /* Creating the mapping extends the file to its full size */
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(len >> 32), (DWORD)len, NULL);
+    if (!mapping) {
+        sp_unmap_file_out(map);
+        return SP_ERR_IO;
+    }
+    map->mapping = mapping;
+    map->data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (!map->data) {
+        sp_unmap_file_out(map);
+        return SP_ERR_UNSUPPORTED;
+    }
+    return SP_OK;
+}
+
+SPResult sp_unmap_file_out(struct sp_file_out* map) {
+    SPResult res = SP_OK;
+    if (map->data) {
+        if (!FlushViewOfFile(map->data, 0)) {
+            res = SP_ERR_IO;
+        }
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mapping) {
+        CloseHandle((HANDLE)map->mapping);
+    }
+    if (map->file) {
+        if (map->data && !FlushFileBuffers((HANDLE)map->file)) {
+            res = SP_ERR_IO;
+        }
+        CloseHandle((HANDLE)map->file);
+    }
+    map->data = NULL;
+    map->file = NULL;
+    map->mapping = NULL;
+    return res;
+}
+
+int sp_file_seek(FILE* f, uint64_t off) {
+    return _fseeki64(f, (__int64)off, SEEK_SET);
+}
+
+SPResult sp_file_size(FILE* f, uint64_t* size) {
+    if (_fseeki64(f, 0, SEEK_END) != 0) {
+        return SP_ERR_IO;
+    }
+    __int64 end = _ftelli64(f);
+    if (end < 0) {
+        return SP_ERR_IO;
+    }
+    *size = (uint64_t)end;
+    return SP_OK;
+}
+
+double sp_seconds(void) {
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+}
+
+void sp_yield(void) {
+    SwitchToThread();
+}
+
+int sp_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+size_t sp_cache_size(int level) {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = NULL;
+    DWORD len = 0;
+    size_t size = 0;
+    if (GetLogicalProcessorInformation(NULL, &len) || GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        return 0;
+    }
+    info = malloc(len);
+    if (info && GetLogicalProcessorInformation(info, &len)) {
+        for (DWORD i = 0; i < len / sizeof *info; i++) {
+            if (info[i].Relationship == RelationCache && info[i].Cache.Level == level &&
+                info[i].Cache.Type != CacheInstruction) {
+                size = info[i].Cache.Size;
+                break;
+            }
+        }
+    }
+    free(info);
+    return size;
+}
+
+#else
+
+SPResult sp_map_file(const char* path, struct sp_file_map* map) {
+    struct stat st;
+    map->data = NULL;
+    map->len = 0;
+    map->file = NULL;
+    map->mapping = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return SP_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return SP_ERR_IO;
+    }
+    map->len = (uint64_t)st.st_size;
+    if (map->len == 0) {
+        close(fd);
+        return SP_OK;
+    }
+    if ((uint64_t)(size_t)map->len != map->len) {
+        close(fd);
+        return SP_ERR_UNSUPPORTED;
+    }
+    void* data = mmap(NULL, (size_t)map->len, PROT_READ, MAP_SHARED, fd, 0);
+    /* The mapping holds its own reference to the file */
+    close(fd);
+    if (data == MAP_FAILED) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    map->data = data;
+    return SP_OK;
+}
+
+void sp_unmap_file(struct sp_file_map* map) {
+    if (map->data) {
+        munmap((void*)map->data, (size_t)map->len);
+    }
+    map->data = NULL;
+}
+
+/* Reserving the blocks up front avoids a sparse file, and reports a full disk now rather than as a
+   fault while writing through the mapping. Not every file system can, so only running out of space
+   is an error */
+static bool sp_reserve_space(int fd, uint64_t len) {
+#if defined(__APPLE__)
+    (void)fd;
+    (void)len;
+    return true;
+#else
+    return posix_fallocate(fd, 0, (off_t)len) != ENOSPC;
+#endif
+}
+
+SPResult sp_map_file_out(const char* path, uint64_t len, struct sp_file_out* map) {
+    map->data = NULL;
+    map->len = len;
+    map->file = NULL;
+    map->mapping = NULL;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return SP_ERR_IO;
+    }
+    if (len == 0) {
+        close(fd);
+        return SP_OK;
+    }
+    if ((uint64_t)(size_t)len != len || (uint64_t)(off_t)len != len) {
+        close(fd);
+        return SP_ERR_UNSUPPORTED;
+    }
+    if (ftruncate(fd, (off_t)len) != 0 || !sp_reserve_space(fd, len)) {
+        close(fd);
+        return SP_ERR_IO;
+    }
+    void* data = mmap(NULL, (size_t)len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    map->data = data;
+    return SP_OK;
+}
+
+SPResult sp_unmap_file_out(struct sp_file_out* map) {
+    SPResult res = SP_OK;
+    if (map->data) {
+        if (msync(map->data, (size_t)map->len, MS_SYNC) != 0) {
+            res = SP_ERR_IO;
+        }
+        munmap(map->data, (size_t)map->len);
+    }
+    map->data = NULL;
+    return res;
+}
+
+int sp_file_seek(FILE* f, uint64_t off) {
+    return fseeko(f, (off_t)off, SEEK_SET);
+}
+
+SPResult sp_file_size(FILE* f, uint64_t* size) {
+    if (fseeko(f, 0, SEEK_END) != 0) {
+        return SP_ERR_IO;
+    }
+    off_t end = ftello(f);
+    if (end < 0) {
+        return SP_ERR_IO;
+    }
+    *size = (uint64_t)end;
+    return SP_OK;
+}
+
+double sp_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void sp_yield(void) {
+    sched_yield();
+}
+
+int sp_cpu_count(void) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+size_t sp_cache_size(int level) {
+    long n = -1;
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    if (level == 2) {
+        n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    } else if (level == 3) {
+        n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    }
+#else
+    (void)level;
+#endif
+    return n > 0 ? (size_t)n : 0;
+}
+
+#endif
+
+/* Each worker takes every num_workers'th task, starting from its own index */
+struct sp_worker {
+    sp_task_fn fn;
+    void* ctx;
+    int first;
+    int num_tasks;
+    int num_workers;
+};
+
+static void sp_worker_run(const struct sp_worker* w) {
+    for (int task = w->first; task < w->num_tasks; task += w->num_workers) {
+        w->fn(w->ctx, task);
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI sp_worker_main(LPVOID arg) {
+    sp_worker_run((const struct sp_worker*)arg);
+    return 0;
+}
+#else
+static void* sp_worker_main(void* arg) {
+    sp_worker_run((const struct sp_worker*)arg);
+    return NULL;
+}
+#endif
+
+void sp_run_tasks(sp_task_fn fn, void* ctx, int num_tasks, int num_threads) {
+    int n = num_threads < num_tasks ? num_threads : num_tasks;
+    if (n < 1) {
+        n = 1;
+    }
+    struct sp_worker* workers = malloc((size_t)n * sizeof *workers);
+#if defined(_WIN32)
+    HANDLE* threads = malloc((size_t)n * sizeof *threads);
+#else
+    pthread_t* threads = malloc((size_t)n * sizeof *threads);
+#endif
+    bool* started = calloc((size_t)n, sizeof *started);
+    if (n == 1 || !workers || !threads || !started) {
+        for (int task = 0; task < num_tasks; task++) {
+            fn(ctx, task);
+        }
+        free(workers);
+        free(threads);
+        free(started);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        workers[i].fn = fn;
+        workers[i].ctx = ctx;
+        workers[i].first = i;
+        workers[i].num_tasks = num_tasks;
+        workers[i].num_workers = n;
+    }
+    for (int i = 1; i < n; i++) {
+#if defined(_WIN32)
+        threads[i] = CreateThread(NULL, 0, sp_worker_main, &workers[i], 0, NULL);
+        started[i] = threads[i] != NULL;
+#else
+        started[i] = pthread_create(&threads[i], NULL, sp_worker_main, &workers[i]) == 0;
+#endif
+    }
+    sp_worker_run(&workers[0]);
+    for (int i = 1; i < n; i++) {
+        if (!started[i]) {
+            sp_worker_run(&workers[i]);
+            continue;
+        }
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    free(workers);
+    free(threads);
+    free(started);
+}
+
+struct sp_thread {
+    sp_task_fn fn;
+    void* ctx;
+    int task;
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI sp_thread_main(LPVOID arg) {
+    struct sp_thread* t = arg;
+    t->fn(t->ctx, t->task);
+    return 0;
+}
+#else
+static void* sp_thread_main(void* arg) {
+    struct sp_thread* t = arg;
+    t->fn(t->ctx, t->task);
+    return NULL;
+}
+#endif
+
+SPResult sp_thread_start(struct sp_thread** thread, sp_task_fn fn, void* ctx, int task) {
+    struct sp_thread* t = malloc(sizeof *t);
+    if (!t) {
+        return SP_ERR_ALLOC;
+    }
+    t->fn = fn;
+    t->ctx = ctx;
+    t->task = task;
+#if defined(_WIN32)
+    t->handle = CreateThread(NULL, 0, sp_thread_main, t, 0, NULL);
+    if (!t->handle) {
+#else
+    if (pthread_create(&t->handle, NULL, sp_thread_main, t) != 0) {
+#endif
+        free(t);
+        return SP_ERR_ALLOC;
+    }
+    *thread = t;
+    return SP_OK;
+}
+
+void sp_thread_join(struct sp_thread* thread) {
+    if (!thread) {
+        return;
+    }
+#if defined(_WIN32)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+    free(thread);
+}
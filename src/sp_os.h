@@ -0,0 +1,105 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SP_OS_H
+#define SP_OS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <structpack.h>
+
+/* Read only view of a whole file */
+struct sp_file_map {
+    const uint8_t* data;
+    uint64_t len;
+    void* file;
+    void* mapping;
+};
+
+/* Map a file for reading. Returns SP_ERR_IO if it cannot be opened, and SP_ERR_UNSUPPORTED if it
+   cannot be mapped, in which case buffered reads should be used instead. An empty file maps to NULL */
+SPResult sp_map_file(const char* path, struct sp_file_map* map);
+void sp_unmap_file(struct sp_file_map* map);
+
+/* Writable view of a whole file */
+struct sp_file_out {
+    uint8_t* data;
+    uint64_t len;
+    void* file;
+    void* mapping;
+};
+
+/* Create or truncate a file of len bytes, reserve its disk space, and map it for writing. Returns
+   SP_ERR_IO if it cannot be created or sized, and SP_ERR_UNSUPPORTED if it cannot be mapped. An empty
+   file maps to NULL */
+SPResult sp_map_file_out(const char* path, uint64_t len, struct sp_file_out* map);
+/* Flush a writable mapping to disk and unmap it. Returns SP_ERR_IO if the flush fails */
+SPResult sp_unmap_file_out(struct sp_file_out* map);
+
+/* 64 bit seek and size, for files beyond the range of long */
+int sp_file_seek(FILE* f, uint64_t off);
+SPResult sp_file_size(FILE* f, uint64_t* size);
+
+/* Number of online processors, at least 1 */
+int sp_cpu_count(void);
+/* Size in bytes of the level 2 or level 3 data cache, or 0 if it cannot be determined */
+size_t sp_cache_size(int level);
+
+typedef void (*sp_task_fn)(void* ctx, int task);
+
+/* Run fn for each task from 0 to num_tasks - 1, spread across up to num_threads threads, and wait
+   for all of them to finish. The calling thread takes a share of the tasks, and any that cannot be
+   started on a new thread are run on the calling thread */
+void sp_run_tasks(sp_task_fn fn, void* ctx, int num_tasks, int num_threads);
+
+/* A single thread running fn(ctx, task), for long running stages that must all run at once.
+   sp_thread_start returns SP_ERR_ALLOC if the thread cannot be created */
+struct sp_thread;
+SPResult sp_thread_start(struct sp_thread** thread, sp_task_fn fn, void* ctx, int task);
+void sp_thread_join(struct sp_thread* thread);
+/* Give up the rest of the time slice to another thread */
+void sp_yield(void);
+
+/* Monotonic wall clock time in seconds, from an arbitrary starting point */
+double sp_seconds(void);
+
+/* Acquire loads and release stores of a counter shared between threads, for single producer, single
+   consumer handoffs. MSVC targets x86 and x64, where plain accesses already have these semantics and
+   only the compiler needs fencing. sp_cas sets *p to desired if it holds expect, returning whether it did */
+#if defined(__GNUC__) || defined(__clang__)
+static inline size_t sp_load_acquire(const volatile size_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void sp_store_release(volatile size_t* p, size_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static inline bool sp_cas(volatile size_t* p, size_t expect, size_t desired) {
+    return __atomic_compare_exchange_n(p, &expect, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static inline size_t sp_load_acquire(const volatile size_t* p) {
+    size_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+static inline void sp_store_release(volatile size_t* p, size_t v) {
+    _ReadWriteBarrier();
+    *p = v;
+}
+static inline bool sp_cas(volatile size_t* p, size_t expect, size_t desired) {
+#if defined(_WIN64)
+    return (size_t)_InterlockedCompareExchange64((volatile __int64*)p, (__int64)desired, (__int64)expect) == expect;
+#else
+    return (size_t)_InterlockedCompareExchange((volatile long*)p, (long)desired, (long)expect) == expect;
+#endif
+}
+#endif
+
+#endif // SP_OS_H
@@ -4,14 +4,18 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
 #include "sp_parser.h"
+#include "sp_internal.h"
 
 static const char* advance_fmt_str(const char** c);
+static SPResult parse_field(struct fmt_str_parser* parser);
 
 static bool is_fmt_char(char fmt) {
     switch (fmt) {
@@ -33,6 +37,22 @@ static bool is_fmt_char(char fmt) {
     }
 }
 
+static bool is_int_char(char fmt) {
+    switch (fmt) {
+        case 'b':
+        case 'B':
+        case 'h':
+        case 'H':
+        case 'i':
+        case 'I':
+        case 'q':
+        case 'Q':
+            return true;
+        default:
+            return false;
+    }
+}
+
 static bool is_endian_char(char end) {
     if (end == '<' || end == '>') {
         return true;
@@ -48,7 +68,7 @@ static bool is_arr_char(char arr) {
 }
 
 static bool is_group_char(char grp) {
-    if (grp == '(' || grp == ')') {
+    if (grp == '(' || grp == ')' || grp == '{' || grp == '}') {
         return true;
     }
     return false;
@@ -68,6 +88,45 @@ static bool is_whitespace_char(char ws) {
     return false;
 }
 
+/* Whether the digit at format_str[i] belongs to the number of a ':', '@' or '%' directive */
+static bool is_directive_digit(const char* format_str, size_t i) {
+    while (i > 0 && is_digit_char(format_str[i - 1])) {
+        i--;
+    }
+    while (i > 0 && is_whitespace_char(format_str[i - 1])) {
+        i--;
+    }
+    return i > 0 && (format_str[i - 1] == ':' || format_str[i - 1] == '@' || format_str[i - 1] == '%');
+}
+
+/* Number of characters taken by a constant at s, either a quoted literal or '=' followed by an
+   integer. 0 if s does not start a constant. An unterminated literal takes the rest of the string */
+static size_t const_len(const char* s) {
+    size_t n = 1;
+    if (s[0] == '\'') {
+        const char* end = strchr(s + 1, '\'');
+        return end ? (size_t)(end - s) + 1 : strlen(s);
+    }
+    if (s[0] == '=') {
+        if (s[n] == '-' || s[n] == '+') {
+            n++;
+        }
+        /* The number ends at the first character that cannot continue it, so 'I=5B' needs no space */
+        if (s[n] == '0' && (s[n + 1] == 'x' || s[n + 1] == 'X')) {
+            n += 2;
+            while (isxdigit((unsigned char)s[n])) {
+                n++;
+            }
+            return n;
+        }
+        while (isdigit((unsigned char)s[n])) {
+            n++;
+        }
+        return n;
+    }
+    return 0;
+}
+
 const char* advance_fmt_str(const char** c) {
     *c += 1;
     while (is_whitespace_char(**c)) {
@@ -100,50 +159,80 @@ void reset_parser(struct fmt_str_parser* parser) {
     }
     parser->current.type = '\0';
     parser->current.arr_len = 0;
+    parser->current.repeat = 0;
+    parser->current.dest_width = 0;
+    parser->current.utf8 = false;
+    parser->current.constant = false;
+    parser->current.literal = NULL;
+    parser->current.slot = 0;
+    parser->groups.depth = 0;
+    parser->offset = 0;
+    parser->num_slots = 0;
+    parser->has_strided = false;
 }
 
 SPResult validate_format_str(const char* format_str) {
     size_t fmt_len = strlen(format_str);
-    size_t i;
-    /* Check for invalid characters */
+    size_t i, c;
+    bool ends_with_const = false;
+    /* Check for invalid characters. Constants are checked when parsing, and skipped by every
+       check that follows */
     char fmt;
     for (i = 0; i < fmt_len; i++) {
         fmt = format_str[i];
-        if (!(is_fmt_char(fmt) || is_endian_char(fmt) || is_arr_char(fmt) || is_group_char(fmt) || is_digit_char(fmt) || is_whitespace_char(fmt))) {
+        if ((c = const_len(format_str + i)) > 0) {
+            if (fmt == '\'' && (c < 3 || format_str[i + c - 1] != '\'')) {
+                return SP_ERR_INVALID_FMT_STR;
+            }
+            i += c - 1;
+            ends_with_const = (i == fmt_len - 1);
+            continue;
+        }
+        if (!(is_fmt_char(fmt) || is_endian_char(fmt) || is_arr_char(fmt) || is_group_char(fmt) || is_digit_char(fmt) || is_whitespace_char(fmt) || fmt == ':' || fmt == '@' || fmt == '%')) {
             return SP_ERR_INVALID_FMT_STR;
         }
     }
     /* Check that endian character only at beginning */
     for (i = 0; i < fmt_len; i++) {
+        if ((c = const_len(format_str + i)) > 0) {
+            i += c - 1;
+            continue;
+        }
         if (is_endian_char(format_str[i]) && i > 0) {
             return SP_ERR_INVALID_FMT_STR;
         }
     }
-    /* Check the string doesn't start with a '(' */
-    if (format_str[0] == '(') {
+    /* Check the string doesn't start with a group */
+    if (format_str[0] == '(' || format_str[0] == '{') {
         return SP_ERR_INVALID_FMT_STR;
     }
     /* Make sure the format string ends with a valid character */
     fmt = format_str[fmt_len - 1];
-    if (fmt != ')' && !is_fmt_char(fmt) && !is_whitespace_char(fmt)) {
+    bool is_directive = is_digit_char(fmt) && is_directive_digit(format_str, fmt_len - 1);
+    if (fmt != ')' && fmt != '}' && !is_fmt_char(fmt) && !is_whitespace_char(fmt) && !is_directive && !ends_with_const) {
         return SP_ERR_INVALID_FMT_STR;
     }
-    /* Ensure groups are balanced and do not exceed maximum depth */
+    /* Ensure groups are balanced, closed with the matching bracket, and do not exceed maximum depth */
+    char open[SP_MAX_GRP_DEPTH];
     int depth = 0;
     for (i = 0; i < fmt_len; i++) {
+        if ((c = const_len(format_str + i)) > 0) {
+            i += c - 1;
+            continue;
+        }
         fmt = format_str[i];
         if (depth >= SP_MAX_GRP_DEPTH) {
             return SP_ERR_INVALID_FMT_STR;
         }
-        if (fmt == '(') {
-            depth++;
-        } else if (fmt == ')') {
+        if (fmt == '(' || fmt == '{') {
+            open[depth++] = fmt;
+        } else if (fmt == ')' || fmt == '}') {
+            /* if depth is 0, it means we started with a closing bracket */
+            if (depth == 0 || open[depth - 1] != (fmt == ')' ? '(' : '{')) {
+                return SP_ERR_INVALID_FMT_STR;
+            }
             depth--;
         }
-        /* if depth < 0, it means we started with a closing parenthesis */
-        if (depth < 0) {
-            return SP_ERR_INVALID_FMT_STR;
-        }
     }
     if (depth != 0) {
         return SP_ERR_INVALID_FMT_STR;
@@ -151,6 +240,10 @@ SPResult validate_format_str(const char* format_str) {
     /* Ensure correct array syntax */
     bool arr_open = false;
     for (i = 0; i < fmt_len; i++) {
+        if ((c = const_len(format_str + i)) > 0) {
+            i += c - 1;
+            continue;
+        }
         fmt = format_str[i];
         if ((fmt == ']' && !arr_open) || (fmt == '[' && arr_open)) {
             return SP_ERR_INVALID_FMT_STR;
@@ -162,11 +255,15 @@ SPResult validate_format_str(const char* format_str) {
             arr_open = false;
         }
     }
-    /* Ensure no spaces between digits */
+    /* Ensure no spaces between digits. A directive may be followed by a number */
     const char *tmp_fmt;
     for (i = 0; i < fmt_len; i++) {
+        if ((c = const_len(format_str + i)) > 0) {
+            i += c - 1;
+            continue;
+        }
         fmt = format_str[i];
-        if (is_digit_char(fmt) && is_whitespace_char(format_str[i + 1])) {
+        if (is_digit_char(fmt) && is_whitespace_char(format_str[i + 1]) && !is_directive_digit(format_str, i)) {
             tmp_fmt = (format_str + i);
             advance_fmt_str(&tmp_fmt);
             if (is_digit_char(*tmp_fmt)) {
@@ -178,19 +275,137 @@ SPResult validate_format_str(const char* format_str) {
     return SP_OK;
 }
 
-SPResult parse_next(struct fmt_str_parser* parser) {
+/* Parse the '=value' following a single integer format character. The field becomes a skip of
+   the integer's width, which is checked against the value on unpack and written on pack */
+static SPResult parse_int_const(struct fmt_str_parser* parser) {
+    char type = parser->current.type;
+    int width = sp_type_size(type);
+    bool is_signed = (type == 'b' || type == 'h' || type == 'i' || type == 'q');
+    if (!is_int_char(type) || parser->current.repeat != 0 || parser->current.arr_len != 0) {
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    const char* start = parser->curr_pos + 1;
+    size_t n = const_len(parser->curr_pos);
     char *end_pos;
-    long num;
-    if (parser->curr_pos[0] == '\0') {
-        return SP_NULL_CHAR;
+    uint64_t value;
+    /* Decimal, or hexadecimal with a 0x prefix. A leading zero does not mean octal */
+    const char* digits = (*start == '-' || *start == '+') ? start + 1 : start;
+    int base = (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) ? 16 : 10;
+    errno = 0;
+    if (is_signed) {
+        long long v = strtoll(start, &end_pos, base);
+        if (width < 8 && (v < -(1LL << (8 * width - 1)) || v > (1LL << (8 * width - 1)) - 1)) {
+            errno = ERANGE;
+        }
+        value = (uint64_t)v;
+    } else {
+        unsigned long long v = strtoull(start, &end_pos, base);
+        if (*start == '-' || (width < 8 && v > (1ULL << (8 * width)) - 1)) {
+            errno = ERANGE;
+        }
+        value = (uint64_t)v;
+    }
+    if (end_pos == start || end_pos != parser->curr_pos + n) {
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    if (errno == ERANGE) {
+        return SP_ERR_INT;
+    }
+    parser->curr_pos = end_pos - 1;
+    advance_fmt_str(&parser->curr_pos);
+    parser->current.type = 'x';
+    parser->current.arr_len = width;
+    parser->current.constant = true;
+    parser->current.value = value;
+    return SP_OK;
+}
+
+/* Advance past a format character, and the optional ':n' destination width or ':s' UTF-8
+   conversion following it */
+static SPResult parse_type_suffix(struct fmt_str_parser* parser) {
+    parser->current.dest_width = 0;
+    parser->current.utf8 = false;
+    parser->current.constant = false;
+    parser->current.literal = NULL;
+    advance_fmt_str(&parser->curr_pos);
+    if (parser->curr_pos[0] == '=') {
+        return parse_int_const(parser);
+    }
+    if (parser->curr_pos[0] != ':') {
+        return SP_OK;
+    }
+    char width = *advance_fmt_str(&parser->curr_pos);
+    if (width == 's' && (parser->current.type == 'w' || parser->current.type == 'u')) {
+        parser->current.utf8 = true;
+        advance_fmt_str(&parser->curr_pos);
+        return SP_OK;
+    }
+    if (!is_int_char(parser->current.type) || (width != '1' && width != '2' && width != '4' && width != '8')) {
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    /* A width matching the field needs no conversion */
+    if (width - '0' != sp_type_size(parser->current.type)) {
+        parser->current.dest_width = width - '0';
+    }
+    advance_fmt_str(&parser->curr_pos);
+    return SP_OK;
+}
+
+/* Resolve an '@' offset or '%' alignment directive to a single skip from the current offset */
+static SPResult parse_skip(struct fmt_str_parser* parser) {
+    char directive = parser->curr_pos[0];
+    char *end_pos;
+    if (!is_digit_char(*advance_fmt_str(&parser->curr_pos))) {
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    long num = strtol(parser->curr_pos, &end_pos, 10);
+    if (num > INT_MAX) {
+        return SP_ERR_INT;
     }
+    if (is_whitespace_char(*end_pos)) {
+        advance_fmt_str((const char**)&end_pos);
+    }
+    parser->curr_pos = (const char*)end_pos;
+    size_t target = (size_t)num;
+    size_t gap;
+    if (directive == '@') {
+        /* Seeking backwards would read or write the same bytes twice */
+        if (target < parser->offset) {
+            return SP_ERR_INVALID_FMT_STR;
+        }
+        gap = target - parser->offset;
+    } else {
+        if (target == 0) {
+            return SP_ERR_INVALID_FMT_STR;
+        }
+        gap = (target - parser->offset % target) % target;
+    }
+    if (gap == 0) {
+        return parse_field(parser);
+    }
+    parser->current.type = 'x';
+    parser->current.arr_len = (int)gap;
+    parser->current.repeat = 0;
+    parser->current.dest_width = 0;
+    parser->current.utf8 = false;
+    parser->current.constant = false;
+    parser->current.literal = NULL;
+    return SP_OK;
+}
+
+static SPResult parse_field(struct fmt_str_parser* parser) {
+    char *end_pos;
+    long num;
     if (parser->current.repeat > 0) {
         parser->current.repeat--;
+        return SP_OK;
+    } else if (parser->curr_pos[0] == '\0') {
+        return SP_NULL_CHAR;
     } else if (is_fmt_char(parser->curr_pos[0])) {
         parser->current.type = parser->curr_pos[0];
         parser->current.arr_len = 0;
         parser->current.repeat = 0;
-        advance_fmt_str(&parser->curr_pos);
+        return parse_type_suffix(parser);
     } else if (parser->curr_pos[0] == '[') {
         num = strtol(advance_fmt_str(&parser->curr_pos), &end_pos, 10);
         if (is_whitespace_char(*end_pos)) {
@@ -203,7 +418,7 @@ SPResult parse_next(struct fmt_str_parser* parser) {
         parser->current.arr_len = (int)num;
         parser->current.repeat = 0;
         parser->current.type = parser->curr_pos[0];
-        advance_fmt_str(&parser->curr_pos);
+        return parse_type_suffix(parser);
     } else if (is_digit_char(parser->curr_pos[0])) {
         num = strtol(parser->curr_pos, &end_pos, 10);
         if (num > INT_MAX) {
@@ -218,21 +433,37 @@ SPResult parse_next(struct fmt_str_parser* parser) {
             parser->current.repeat = 0;
             parser->current.arr_len = (int)num;
             parser->current.type = parser->curr_pos[0];
-            advance_fmt_str(&parser->curr_pos);
+            return parse_type_suffix(parser);
+        } else if (*end_pos == 'x') {
+            /* A run of skipped bytes is a single skip */
+            parser->curr_pos = (const char*)end_pos;
+            parser->current.repeat = 0;
+            parser->current.arr_len = (int)num;
+            parser->current.type = 'x';
+            return parse_type_suffix(parser);
         } else if (is_fmt_char(*end_pos)) {
             parser->curr_pos = (const char*)end_pos;
             parser->current.repeat = (int)num - 1;
             parser->current.type = parser->curr_pos[0];
             parser->current.arr_len = 0;
-            advance_fmt_str(&parser->curr_pos);
-        } else if (*end_pos == '(') {
+            return parse_type_suffix(parser);
+        } else if (*end_pos == '(' || *end_pos == '{') {
+            int d = ++parser->groups.depth;
+            parser->groups.strided[d] = (*end_pos == '{');
             parser->curr_pos = advance_fmt_str((const char**)&end_pos);
-            parser->groups.depth++;
-            parser->groups.start[parser->groups.depth] = parser->curr_pos;
-            parser->groups.repeat[parser->groups.depth] = (int)num - 1;
-            return parse_next(parser);
+            parser->groups.start[d] = parser->curr_pos;
+            parser->groups.repeat[d] = (int)num - 1;
+            if (parser->groups.strided[d]) {
+                parser->groups.base_slot[d] = parser->num_slots;
+                parser->num_slots += 2;
+                parser->groups.body_slot[d] = parser->num_slots;
+                parser->groups.index[d] = 0;
+                parser->has_strided = true;
+            }
+            return parse_field(parser);
         }
-    } else if (parser->curr_pos[0] == ')') {
+        return SP_ERR_INVALID_FMT_STR;
+    } else if (parser->curr_pos[0] == ')' || parser->curr_pos[0] == '}') {
         if (parser->groups.repeat[parser->groups.depth] == 0) {
             parser->groups.start[parser->groups.depth] = NULL;
             parser->groups.depth--;
@@ -240,12 +471,74 @@ SPResult parse_next(struct fmt_str_parser* parser) {
                 return SP_ERR_INVALID_FMT_STR;
             }
             advance_fmt_str(&parser->curr_pos);
-            return parse_next(parser);
+            return parse_field(parser);
         } else {
-            parser->groups.repeat[parser->groups.depth]--;
-            parser->curr_pos = parser->groups.start[parser->groups.depth];
-            return parse_next(parser);
+            int d = parser->groups.depth;
+            parser->groups.repeat[d]--;
+            parser->curr_pos = parser->groups.start[d];
+            /* The next element of a strided group reuses the body's offsets */
+            if (parser->groups.strided[d]) {
+                parser->groups.index[d]++;
+                parser->num_slots = parser->groups.body_slot[d];
+            }
+            return parse_field(parser);
         }
+    } else if (parser->curr_pos[0] == '@' || parser->curr_pos[0] == '%') {
+        return parse_skip(parser);
+    } else if (parser->curr_pos[0] == '\'') {
+        /* Literal bytes, checked on unpack and written on pack */
+        const char* end = strchr(parser->curr_pos + 1, '\'');
+        if (!end || end == parser->curr_pos + 1) {
+            return SP_ERR_INVALID_FMT_STR;
+        }
+        if (end - (parser->curr_pos + 1) > INT_MAX) {
+            return SP_ERR_INT;
+        }
+        parser->current.type = 'x';
+        parser->current.arr_len = (int)(end - (parser->curr_pos + 1));
+        parser->current.repeat = 0;
+        parser->current.dest_width = 0;
+        parser->current.utf8 = false;
+        parser->current.constant = true;
+        parser->current.literal = parser->curr_pos + 1;
+        parser->curr_pos = end;
+        advance_fmt_str(&parser->curr_pos);
+        return SP_OK;
+    } else if (parser->curr_pos[0] == ':') {
+        /* A destination width must directly follow a format character */
+        return SP_ERR_INVALID_FMT_STR;
+    }
+    /* Anything else would leave the parser where it is, such as letters after a constant */
+    return SP_ERR_INVALID_FMT_STR;
+}
+
+SPResult parse_next(struct fmt_str_parser* parser) {
+    SPResult res = parse_field(parser);
+    if (res == SP_OK) {
+        if (parser->current.type != 'x') {
+            parser->current.slot = parser->num_slots++;
+        }
+        int len = (parser->current.arr_len > 0) ? parser->current.arr_len : 1;
+        parser->offset += (size_t)len * sp_type_size(parser->current.type);
+    }
+    return res;
+}
+
+size_t parse_struct_offset(const struct fmt_str_parser* parser, const size_t* offset_list) {
+    size_t base = 0;
+    for (int d = 1; d <= parser->groups.depth; d++) {
+        if (parser->groups.strided[d]) {
+            const size_t* arr = offset_list + parser->groups.base_slot[d];
+            base += arr[0] + (size_t)parser->groups.index[d] * arr[1];
+        }
+    }
+    return base + offset_list[parser->current.slot];
+}
+
+void parse_const_bytes(const struct fmt_str_parser* parser, uint8_t* out) {
+    if (parser->current.literal) {
+        memcpy(out, parser->current.literal, (size_t)parser->current.arr_len);
+    } else {
+        sp_store_uint(out, parser->current.value, parser->current.arr_len, parser->endian);
     }
-    return SP_OK;
 }
@@ -19,17 +19,44 @@ struct fmt_str_parser {
         int depth;
         int repeat[SP_MAX_GRP_DEPTH];
         const char* start[SP_MAX_GRP_DEPTH];
+        /* Strided groups map each repetition onto the next element of an array of structs. The
+           offset list holds the array's offset and stride at base_slot, followed by the offsets
+           of the body's fields within an element, which every repetition reuses */
+        bool strided[SP_MAX_GRP_DEPTH];
+        int base_slot[SP_MAX_GRP_DEPTH];
+        int body_slot[SP_MAX_GRP_DEPTH];
+        int index[SP_MAX_GRP_DEPTH];
     } groups;
     struct {
         int arr_len;
         int repeat;
+        /* Size of the struct member in bytes, if it differs from the field. 0 otherwise */
+        int dest_width;
+        /* Set for 'w' and 'u' fields copied to or from a UTF-8 char member */
+        bool utf8;
+        /* Set for expected constants, which are yielded as skips of arr_len bytes. The bytes are
+           either a literal within the format string, or an integer value of arr_len bytes */
+        bool constant;
+        const char* literal;
+        uint64_t value;
         char type;
+        /* Offset list index of the current field */
+        int slot;
     } current;
+    /* Offset list entries used so far. Once parsing is done, the length the offset list must have */
+    int num_slots;
+    bool has_strided;
+    /* Buffer offset of the end of the current field, used to resolve '@' and '%' directives */
+    size_t offset;
 };
 
 struct fmt_str_parser new_parser(const char* fmt_str, SPResult* err);
 void reset_parser(struct fmt_str_parser* parser);
 SPResult validate_format_str(const char* format_str);
 SPResult parse_next(struct fmt_str_parser* parser);
+/* Struct offset of the current field, from an offset list laid out as described for strided groups */
+size_t parse_struct_offset(const struct fmt_str_parser* parser, const size_t* offset_list);
+/* Write the expected bytes of the current constant field to out, which holds arr_len bytes */
+void parse_const_bytes(const struct fmt_str_parser* parser, uint8_t* out);
 
 #endif // SP_PARSER_H
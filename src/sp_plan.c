@@ -0,0 +1,256 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_parser.h"
+#include "sp_plan.h"
+
+SPResult sp_plan_build(const char* fmt_str, int num_fields, const size_t* offset_list, struct sp_plan** plan) {
+    SPResult err = validate_format_str(fmt_str);
+    if (err != SP_OK) {
+        return err;
+    }
+    struct fmt_str_parser p = new_parser(fmt_str, &err);
+    if (err != SP_OK) {
+        return err;
+    }
+    SPResult res;
+    int parsed_count = 0, const_count = 0;
+    size_t const_size = 0;
+    while ((res = parse_next(&p)) == SP_OK) {
+        if (p.current.type != 'x') {
+            parsed_count++;
+        } else if (p.current.constant) {
+            const_count++;
+            const_size += (size_t)p.current.arr_len;
+        }
+    }
+    if (res != SP_NULL_CHAR) {
+        return res;
+    }
+    if (num_fields >= 0 && p.num_slots != num_fields) {
+        return SP_ERR_FIELD_CNT;
+    }
+    struct sp_plan* pl = calloc(1, sizeof *pl);
+    if (!pl) {
+        return SP_ERR_ALLOC;
+    }
+    pl->ops = calloc(parsed_count > 0 ? (size_t)parsed_count : 1, sizeof *pl->ops);
+    if (const_count > 0) {
+        pl->consts = calloc((size_t)const_count, sizeof *pl->consts);
+        pl->const_data = malloc(const_size);
+    }
+    if (!pl->ops || (const_count > 0 && (!pl->consts || !pl->const_data))) {
+        sp_plan_free(pl);
+        return SP_ERR_ALLOC;
+    }
+    reset_parser(&p);
+    pl->endian = p.endian;
+    pl->no_offsets = !offset_list;
+    const_size = 0;
+    int len;
+    while (parse_next(&p) == SP_OK) {
+        len = (p.current.arr_len > 0) ? p.current.arr_len : 1;
+        if (p.current.type != 'x') {
+            struct sp_op* op = &pl->ops[pl->num_ops];
+            op->type = p.current.type;
+            op->len = len;
+            op->dest_width = p.current.dest_width;
+            op->utf8 = p.current.utf8;
+            op->buf_off = pl->size;
+            op->struct_off = offset_list ? parse_struct_offset(&p, offset_list) : 0;
+            pl->num_ops++;
+        } else if (p.current.constant) {
+            struct sp_const* c = &pl->consts[pl->num_consts];
+            uint8_t* bytes = pl->const_data + const_size;
+            parse_const_bytes(&p, bytes);
+            c->buf_off = pl->size;
+            c->len = (size_t)len;
+            c->bytes = bytes;
+            const_size += (size_t)len;
+            pl->num_consts++;
+        }
+        pl->size += (size_t)len * sp_type_size(p.current.type);
+    }
+    if (pl->size > INT32_MAX) {
+        sp_plan_free(pl);
+        return SP_ERR_INT;
+    }
+    *plan = pl;
+    return SP_OK;
+}
+
+SPResult sp_plan_compile(const char* fmt_str,
+                         int num_fields,
+                         const size_t* offset_list,
+                         sp_plan** plan)
+{
+    if (!fmt_str || num_fields <= 0 || !plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    return sp_plan_build(fmt_str, num_fields, offset_list, plan);
+}
+
+void sp_plan_free(sp_plan* plan) {
+    if (!plan) {
+        return;
+    }
+    sp_jit_free(plan->jit);
+    sp_kernels_free(plan->kernels);
+    if (plan->is_static) {
+        plan->jit = NULL;
+        plan->kernels = NULL;
+        plan->kernel = SP_KERNEL_INTERP;
+        plan->tune_state = SP_TUNE_IDLE;
+        return;
+    }
+    free(plan->ops);
+    free(plan->consts);
+    free(plan->const_data);
+    free(plan);
+}
+
+int sp_plan_size(const sp_plan* plan) {
+    return plan ? (int)plan->size : 0;
+}
+
+SPResult sp_plan_consts(const struct sp_plan* plan, enum sp_action action, void* buff) {
+    const struct sp_const* c;
+    for (c = plan->consts; c < plan->consts + plan->num_consts; c++) {
+        uint8_t* p = (uint8_t*)buff + c->buf_off;
+        if (action == SP_PACK) {
+            memcpy(p, c->bytes, c->len);
+        } else if (memcmp(p, c->bytes, c->len) != 0) {
+            return SP_ERR_MISMATCH;
+        }
+    }
+    return SP_OK;
+}
+
+SPResult sp_plan_field(const struct sp_plan* plan, const struct sp_op* op, enum sp_action action, void* offset_base, void* field_buff) {
+    void* member = (char*)offset_base + op->struct_off;
+    if (op->dest_width) {
+        return sp_resize_field(op->type, op->len, op->dest_width, plan->endian, action, member, field_buff);
+    } else if (op->utf8) {
+        return sp_utf8_field(op->type, op->len, plan->endian, action, member, field_buff);
+    }
+    sp_copy_field(op->type, op->len, plan->endian, action, member, field_buff);
+    return SP_OK;
+}
+
+static SPResult sp_plan_run(const sp_plan* plan, enum sp_action action, void* offset_base, void* buff, int buff_len) {
+    if (!plan || !offset_base || !buff || buff_len <= 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->no_offsets) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    if ((size_t)buff_len < plan->size) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    /* Constants are checked before anything is copied, so a mismatched record leaves the struct untouched */
+    SPResult res = sp_plan_consts(plan, action, buff);
+    if (res != SP_OK) {
+        return res;
+    }
+    if (sp_load_acquire(&plan->tune_state) == SP_TUNE_PENDING) {
+        /* The only change a run makes to a plan, see sp_plan_autotune */
+        sp_kernel_first_use((struct sp_plan*)plan);
+    }
+    return sp_plan_exec(plan, (sp_kernel)sp_load_acquire(&plan->kernel), action, offset_base, buff);
+}
+
+SPResult sp_plan_exec(const struct sp_plan* plan, sp_kernel kernel, enum sp_action action, void* offset_base, void* buff) {
+    if (kernel == SP_KERNEL_JIT) {
+        sp_jit_run(plan->jit, action, offset_base, buff);
+        return SP_OK;
+    } else if (kernel != SP_KERNEL_INTERP) {
+        return sp_kernel_exec(plan, kernel, action, offset_base, buff);
+    }
+    SPResult res;
+    const struct sp_op* op = plan->ops;
+    const struct sp_op* end = op + plan->num_ops;
+    for (; op < end; op++) {
+        res = sp_plan_field(plan, op, action, offset_base, (char*)buff + op->buf_off);
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    return SP_OK;
+}
+
+SPResult sp_plan_unpack(const sp_plan* plan, void* offset_base, void* src_buff, int buff_len) {
+    return sp_plan_run(plan, SP_UNPACK, offset_base, src_buff, buff_len);
+}
+
+SPResult sp_plan_pack(const sp_plan* plan, void* offset_base, void* dest_buff, int buff_len) {
+    return sp_plan_run(plan, SP_PACK, offset_base, dest_buff, buff_len);
+}
+
+SPResult sp_plan_jit(sp_plan* plan) {
+    if (!plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    SPResult res = plan->jit ? SP_OK : sp_jit_compile(plan, &plan->jit);
+    if (res == SP_OK) {
+        sp_store_release(&plan->kernel, SP_KERNEL_JIT);
+    }
+    return res;
+}
+
+/* Mark records whose bytes at one constant's offset differ from it. Constants of up to eight bytes
+   are compared as a single word, with the expected value held in a register across the batch. */
+static void sp_validate_const(const struct sp_const* c, const uint8_t* rec, size_t stride, int count, unsigned char* bad_records) {
+    uint64_t expect = 0, v = 0;
+    int r;
+    if (c->len <= sizeof v) {
+        memcpy(&expect, c->bytes, c->len);
+        for (r = 0; r < count; r++, rec += stride) {
+            memcpy(&v, rec + c->buf_off, c->len);
+            bad_records[r / 8] |= (unsigned char)((v != expect) << (r % 8));
+        }
+    } else {
+        for (r = 0; r < count; r++, rec += stride) {
+            bad_records[r / 8] |= (unsigned char)((memcmp(rec + c->buf_off, c->bytes, c->len) != 0) << (r % 8));
+        }
+    }
+}
+
+SPResult sp_plan_validate(const sp_plan* plan,
+                          const void* src_buff,
+                          int buff_len,
+                          int count,
+                          unsigned char* bad_records,
+                          int* num_bad)
+{
+    if (!plan || !src_buff || buff_len <= 0 || count <= 0 || !bad_records || !num_bad) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size * (size_t)count > (size_t)buff_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    size_t bitmap_len = ((size_t)count + 7) / 8;
+    memset(bad_records, 0, bitmap_len);
+    const struct sp_const* c;
+    for (c = plan->consts; c < plan->consts + plan->num_consts; c++) {
+        sp_validate_const(c, (const uint8_t*)src_buff, plan->size, count, bad_records);
+    }
+    int bad = 0;
+    size_t i;
+    int b;
+    for (i = 0; i < bitmap_len; i++) {
+        for (b = 0; b < 8; b++) {
+            bad += (bad_records[i] >> b) & 1;
+        }
+    }
+    *num_bad = bad;
+    return SP_OK;
+}
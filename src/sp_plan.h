@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SP_PLAN_H
+#define SP_PLAN_H
+
+#include <stddef.h>
+#include <structpack.h>
+#include "sp_internal.h"
+
+/* A single field, with all repeats and groups expanded. Skipped bytes have
+   no op, and are only reflected in the buffer offsets of following ops.
+   Field order matters to the static initializers generated by sp_schema.h */
+struct sp_op {
+    char type;
+    int len;
+    /* Struct member width when it differs from the field width, otherwise 0 */
+    int dest_width;
+    /* Set for 'w' and 'u' fields copied to or from a UTF-8 char member */
+    bool utf8;
+    size_t buf_off;
+    size_t struct_off;
+};
+
+/* Expected bytes at a fixed buffer offset. Constants have no op, and are
+   checked or written separately from the fields around them. */
+struct sp_const {
+    size_t buf_off;
+    size_t len;
+    const uint8_t* bytes;
+};
+
+struct sp_jit;
+struct sp_kernels;
+
+/* Autotuning progress, held in sp_plan.tune_state */
+enum sp_tune_state {SP_TUNE_IDLE, SP_TUNE_PENDING, SP_TUNE_RUNNING, SP_TUNE_DONE};
+
+/* As with sp_op, sp_schema.h relies on the order of these fields */
+struct sp_plan {
+    enum sp_endian endian;
+    int num_ops;
+    size_t size;
+    struct sp_op* ops;
+    struct sp_jit* jit;
+    int num_consts;
+    struct sp_const* consts;
+    /* Storage for the bytes of every constant */
+    uint8_t* const_data;
+    /* Set for plans generated by sp_schema.h, whose tables are not allocated */
+    bool is_static;
+    /* Set for plans compiled without an offset list, which only ever read packed data */
+    bool no_offsets;
+    /* An sp_kernel, stored with release semantics once everything it needs is in place */
+    volatile size_t kernel;
+    /* An sp_tune_state, claimed by a single thread when tuning on first use */
+    volatile size_t tune_state;
+    /* Run tables of the SIMD and copy kernels, built when first needed */
+    struct sp_kernels* kernels;
+};
+
+/* Compile a plan. A negative num_fields skips the field count check, and a
+   NULL offset_list leaves all struct offsets at zero, for plans that only
+   ever look at packed data. */
+SPResult sp_plan_build(const char* fmt_str, int num_fields, const size_t* offset_list, struct sp_plan** plan);
+/* Check the constants of a record on unpack, returning SP_ERR_MISMATCH if any differ, or write them on pack */
+SPResult sp_plan_consts(const struct sp_plan* plan, enum sp_action action, void* buff);
+
+/* Copy a single field between its struct member and field_buff, the field's own bytes in a buffer */
+SPResult sp_plan_field(const struct sp_plan* plan, const struct sp_op* op, enum sp_action action, void* offset_base, void* field_buff);
+
+/* Pack or unpack a record with the given kernel, once constants have been handled */
+SPResult sp_plan_exec(const struct sp_plan* plan, sp_kernel kernel, enum sp_action action, void* offset_base, void* buff);
+
+/* Kernels other than the interpreter and generated code, implemented in sp_kernel.c */
+SPResult sp_kernel_exec(const struct sp_plan* plan, sp_kernel kernel, enum sp_action action, void* offset_base, void* buff);
+/* Tune a plan set to tune on first use, unless another thread already has */
+void sp_kernel_first_use(struct sp_plan* plan);
+void sp_kernels_free(struct sp_kernels* kernels);
+
+/* Native code generation, implemented in sp_jit.c */
+SPResult sp_jit_compile(const struct sp_plan* plan, struct sp_jit** jit);
+void sp_jit_run(const struct sp_jit* jit, enum sp_action action, void* struct_ptr, void* buff_ptr);
+void sp_jit_free(struct sp_jit* jit);
+
+#endif // SP_PLAN_H
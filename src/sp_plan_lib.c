@@ -0,0 +1,541 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Compiled plans saved to a single relocatable blob, and used straight from it.
+ *
+ * Every reference within the blob is a byte offset from its start, so it can
+ * be mapped anywhere. All integers are little endian. The blob is laid out as
+ *
+ *   header   "<4s H H I I"   "SPLB", version, 0, number of plans, blob length
+ *   entries  "<I I B 3x"     per plan: sequence offset, struct offsets offset, offset width
+ *   chunks                   sequences and struct offset arrays, each 4 byte aligned
+ *
+ * A sequence holds what the format string determines: "<I I H B x" size, number
+ * of ops, number of constants and byte order, then "<B B B x I I" per op (type,
+ * UTF-8 flag, member width, length, buffer offset), "<I I I" per constant (buffer
+ * offset, length, offset of its bytes from the start of the sequence), and the
+ * constant bytes. Struct offsets are 16 bit when every offset fits, and 32 bit
+ * otherwise, with a width of 0 for plans compiled without offsets. Identical
+ * chunks are stored once, so plans sharing a format share a sequence, and
+ * plans for the same struct share their offsets.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_plan.h"
+
+#define SP_LIB_VERSION 1
+#define SP_LIB_HEADER 16
+#define SP_LIB_ENTRY 12
+#define SP_LIB_SEQ 12
+#define SP_LIB_OP 12
+#define SP_LIB_CONST 12
+
+static const char sp_lib_magic[4] = {'S', 'P', 'L', 'B'};
+
+struct sp_plan_lib {
+    const uint8_t* data;
+    size_t len;
+    int num_plans;
+    struct sp_file_map map;
+    /* Blob read into memory when the file could not be mapped */
+    uint8_t* copy;
+};
+
+/* A plan's entry, with its sequence header decoded */
+struct sp_lib_plan {
+    const uint8_t* seq;
+    const uint8_t* offsets;
+    int off_width;
+    size_t size;
+    int num_ops;
+    int num_consts;
+    enum sp_endian endian;
+};
+
+static uint32_t sp_lib_u32(const uint8_t* p) {
+    return (uint32_t)sp_load_uint(p, 4, SP_LITTLE_ENDIAN);
+}
+
+static void sp_lib_entry(const struct sp_plan_lib* lib, int index, struct sp_lib_plan* e) {
+    const uint8_t* entry = lib->data + SP_LIB_HEADER + (size_t)index * SP_LIB_ENTRY;
+    e->seq = lib->data + sp_lib_u32(entry);
+    e->offsets = lib->data + sp_lib_u32(entry + 4);
+    e->off_width = entry[8];
+    e->size = sp_lib_u32(e->seq);
+    e->num_ops = (int)sp_lib_u32(e->seq + 4);
+    e->num_consts = (int)sp_load_uint(e->seq + 8, 2, SP_LITTLE_ENDIAN);
+    e->endian = e->seq[10] ? SP_LITTLE_ENDIAN : SP_BIG_ENDIAN;
+}
+
+static void sp_lib_op(const struct sp_lib_plan* e, int i, struct sp_op* op) {
+    const uint8_t* p = e->seq + SP_LIB_SEQ + (size_t)i * SP_LIB_OP;
+    op->type = (char)p[0];
+    op->utf8 = p[1] != 0;
+    op->dest_width = p[2];
+    op->len = (int)sp_lib_u32(p + 4);
+    op->buf_off = sp_lib_u32(p + 8);
+    op->struct_off = e->off_width ? (size_t)sp_load_uint(e->offsets + (size_t)i * e->off_width, e->off_width, SP_LITTLE_ENDIAN) : 0;
+}
+
+static void sp_lib_const(const struct sp_lib_plan* e, int i, struct sp_const* c) {
+    const uint8_t* p = e->seq + SP_LIB_SEQ + (size_t)e->num_ops * SP_LIB_OP + (size_t)i * SP_LIB_CONST;
+    c->buf_off = sp_lib_u32(p);
+    c->len = sp_lib_u32(p + 4);
+    c->bytes = e->seq + sp_lib_u32(p + 8);
+}
+
+/* Building */
+
+/* A chunk already in the blob, found by the hash of its bytes */
+struct sp_lib_chunk {
+    uint64_t hash;
+    size_t off;
+    size_t len;
+};
+
+struct sp_lib_builder {
+    sp_buf* out;
+    size_t start;
+    sp_buf chunk;
+    struct sp_lib_chunk* seen;
+    size_t mask;
+};
+
+static uint64_t sp_lib_hash(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static SPResult sp_lib_put(sp_buf* buf, uint64_t v, int width) {
+    SPResult res = sp_buf_reserve(buf, (size_t)width);
+    if (res == SP_OK) {
+        sp_store_uint(buf->data + buf->len, v, width, SP_LITTLE_ENDIAN);
+        buf->len += (size_t)width;
+    }
+    return res;
+}
+
+/* Append the builder's chunk to the blob unless an identical one is there, and set off to where it is */
+static SPResult sp_lib_intern(struct sp_lib_builder* b, uint32_t* off) {
+    while (b->chunk.len & 3) {
+        SPResult res = sp_lib_put(&b->chunk, 0, 1);
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    const uint64_t hash = sp_lib_hash(b->chunk.data, b->chunk.len);
+    size_t slot = (size_t)hash & b->mask;
+    for (; b->seen[slot].len; slot = (slot + 1) & b->mask) {
+        const struct sp_lib_chunk* c = &b->seen[slot];
+        if (c->hash == hash && c->len == b->chunk.len && memcmp(b->out->data + b->start + c->off, b->chunk.data, c->len) == 0) {
+            *off = (uint32_t)c->off;
+            return SP_OK;
+        }
+    }
+    const size_t at = b->out->len - b->start;
+    if (at > UINT32_MAX - b->chunk.len) {
+        return SP_ERR_RANGE;
+    }
+    SPResult res = sp_buf_reserve(b->out, b->chunk.len);
+    if (res != SP_OK) {
+        return res;
+    }
+    memcpy(b->out->data + b->out->len, b->chunk.data, b->chunk.len);
+    b->out->len += b->chunk.len;
+    b->seen[slot].hash = hash;
+    b->seen[slot].off = at;
+    b->seen[slot].len = b->chunk.len;
+    *off = (uint32_t)at;
+    return SP_OK;
+}
+
+static SPResult sp_lib_add_seq(struct sp_lib_builder* b, const struct sp_plan* plan, uint32_t* off) {
+    sp_buf* c = &b->chunk;
+    c->len = 0;
+    if (plan->num_consts > UINT16_MAX) {
+        return SP_ERR_RANGE;
+    }
+    SPResult res = sp_lib_put(c, plan->size, 4);
+    res = res == SP_OK ? sp_lib_put(c, (uint64_t)plan->num_ops, 4) : res;
+    res = res == SP_OK ? sp_lib_put(c, (uint64_t)plan->num_consts, 2) : res;
+    res = res == SP_OK ? sp_lib_put(c, plan->endian == SP_LITTLE_ENDIAN, 1) : res;
+    res = res == SP_OK ? sp_lib_put(c, 0, 1) : res;
+    for (int i = 0; i < plan->num_ops && res == SP_OK; i++) {
+        const struct sp_op* op = &plan->ops[i];
+        res = sp_lib_put(c, (uint8_t)op->type, 1);
+        res = res == SP_OK ? sp_lib_put(c, op->utf8, 1) : res;
+        res = res == SP_OK ? sp_lib_put(c, (uint64_t)op->dest_width, 1) : res;
+        res = res == SP_OK ? sp_lib_put(c, 0, 1) : res;
+        res = res == SP_OK ? sp_lib_put(c, (uint64_t)op->len, 4) : res;
+        res = res == SP_OK ? sp_lib_put(c, op->buf_off, 4) : res;
+    }
+    /* Constant bytes follow the table of constants, at offsets relative to the sequence */
+    size_t bytes_off = SP_LIB_SEQ + (size_t)plan->num_ops * SP_LIB_OP + (size_t)plan->num_consts * SP_LIB_CONST;
+    for (int i = 0; i < plan->num_consts && res == SP_OK; i++) {
+        const struct sp_const* k = &plan->consts[i];
+        res = sp_lib_put(c, k->buf_off, 4);
+        res = res == SP_OK ? sp_lib_put(c, k->len, 4) : res;
+        res = res == SP_OK ? sp_lib_put(c, bytes_off, 4) : res;
+        bytes_off += k->len;
+    }
+    for (int i = 0; i < plan->num_consts && res == SP_OK; i++) {
+        const struct sp_const* k = &plan->consts[i];
+        res = sp_buf_reserve(c, k->len);
+        if (res == SP_OK) {
+            memcpy(c->data + c->len, k->bytes, k->len);
+            c->len += k->len;
+        }
+    }
+    return res == SP_OK ? sp_lib_intern(b, off) : res;
+}
+
+static SPResult sp_lib_add_offsets(struct sp_lib_builder* b, const struct sp_plan* plan, uint32_t* off, int* width) {
+    size_t max_off = 0;
+    for (int i = 0; i < plan->num_ops; i++) {
+        if (plan->ops[i].struct_off > max_off) {
+            max_off = plan->ops[i].struct_off;
+        }
+    }
+    if (max_off > UINT32_MAX) {
+        return SP_ERR_RANGE;
+    }
+    *width = max_off <= UINT16_MAX ? 2 : 4;
+    b->chunk.len = 0;
+    SPResult res = SP_OK;
+    for (int i = 0; i < plan->num_ops && res == SP_OK; i++) {
+        res = sp_lib_put(&b->chunk, plan->ops[i].struct_off, *width);
+    }
+    return res == SP_OK ? sp_lib_intern(b, off) : res;
+}
+
+SPResult sp_plan_lib_build(const sp_plan* const* plans, int num_plans, sp_buf* out) {
+    if (!plans || num_plans <= 0 || !out) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    for (int i = 0; i < num_plans; i++) {
+        if (!plans[i]) {
+            return SP_ERR_MISSING_PARAMS;
+        }
+    }
+    struct sp_lib_builder b;
+    b.out = out;
+    b.start = out->len;
+    sp_buf_init(&b.chunk, NULL, NULL);
+    /* At most two chunks per plan, in a table kept under half full */
+    size_t cap = 16;
+    while (cap < (size_t)num_plans * 4) {
+        cap *= 2;
+    }
+    b.mask = cap - 1;
+    b.seen = calloc(cap, sizeof *b.seen);
+    if (!b.seen) {
+        return SP_ERR_ALLOC;
+    }
+    const size_t table_len = SP_LIB_HEADER + (size_t)num_plans * SP_LIB_ENTRY;
+    SPResult res = sp_buf_reserve(out, table_len);
+    if (res == SP_OK) {
+        memset(out->data + out->len, 0, table_len);
+        out->len += table_len;
+    }
+    for (int i = 0; i < num_plans && res == SP_OK; i++) {
+        uint32_t seq_off = 0, offsets_off = 0;
+        int width = 0;
+        res = sp_lib_add_seq(&b, plans[i], &seq_off);
+        if (res == SP_OK && !plans[i]->no_offsets) {
+            res = sp_lib_add_offsets(&b, plans[i], &offsets_off, &width);
+        }
+        /* The blob may have moved as it grew */
+        uint8_t* entry = out->data + b.start + SP_LIB_HEADER + (size_t)i * SP_LIB_ENTRY;
+        sp_store_uint(entry, seq_off, 4, SP_LITTLE_ENDIAN);
+        sp_store_uint(entry + 4, offsets_off, 4, SP_LITTLE_ENDIAN);
+        entry[8] = (uint8_t)width;
+    }
+    if (res == SP_OK && out->len - b.start > UINT32_MAX) {
+        res = SP_ERR_RANGE;
+    }
+    if (res == SP_OK) {
+        uint8_t* header = out->data + b.start;
+        memcpy(header, sp_lib_magic, sizeof sp_lib_magic);
+        sp_store_uint(header + 4, SP_LIB_VERSION, 2, SP_LITTLE_ENDIAN);
+        sp_store_uint(header + 8, (uint64_t)num_plans, 4, SP_LITTLE_ENDIAN);
+        sp_store_uint(header + 12, out->len - b.start, 4, SP_LITTLE_ENDIAN);
+    } else {
+        out->len = b.start;
+    }
+    free(b.seen);
+    sp_buf_free(&b.chunk);
+    return res;
+}
+
+/* Loading */
+
+static bool sp_lib_valid_type(char type) {
+    return type != '\0' && strchr("bBhHiIqQswu", type) != NULL;
+}
+
+/* Check that every entry of a plan stays within the blob and its record, so that running it needs no checks */
+static SPResult sp_lib_check_plan(const struct sp_plan_lib* lib, int index) {
+    const uint8_t* entry = lib->data + SP_LIB_HEADER + (size_t)index * SP_LIB_ENTRY;
+    const size_t seq_off = sp_lib_u32(entry);
+    const size_t offsets_off = sp_lib_u32(entry + 4);
+    const int width = entry[8];
+    if ((seq_off & 3) || seq_off > lib->len - SP_LIB_SEQ || (width != 0 && width != 2 && width != 4) ||
+        sp_lib_u32(lib->data + seq_off + 4) > INT32_MAX) {
+        return SP_ERR_CORRUPT;
+    }
+    struct sp_lib_plan e;
+    sp_lib_entry(lib, index, &e);
+    const size_t avail = lib->len - seq_off;
+    const size_t tables = (size_t)e.num_ops * SP_LIB_OP + (size_t)e.num_consts * SP_LIB_CONST;
+    if (e.size > INT32_MAX || (size_t)e.num_ops > (avail - SP_LIB_SEQ) / SP_LIB_OP || tables > avail - SP_LIB_SEQ) {
+        return SP_ERR_CORRUPT;
+    }
+    if (width && (offsets_off > lib->len || (size_t)e.num_ops > (lib->len - offsets_off) / (size_t)width)) {
+        return SP_ERR_CORRUPT;
+    }
+    struct sp_op op;
+    for (int i = 0; i < e.num_ops; i++) {
+        sp_lib_op(&e, i, &op);
+        const int type_width = sp_type_size(op.type);
+        if (!sp_lib_valid_type(op.type) || op.len <= 0 || op.buf_off > e.size ||
+            (size_t)op.len > (e.size - op.buf_off) / (size_t)type_width) {
+            return SP_ERR_CORRUPT;
+        }
+        if ((op.utf8 && op.type != 'w' && op.type != 'u') ||
+            (op.dest_width != 0 && op.dest_width != 1 && op.dest_width != 2 && op.dest_width != 4 && op.dest_width != 8)) {
+            return SP_ERR_CORRUPT;
+        }
+    }
+    struct sp_const c;
+    for (int i = 0; i < e.num_consts; i++) {
+        const uint8_t* p = e.seq + SP_LIB_SEQ + (size_t)e.num_ops * SP_LIB_OP + (size_t)i * SP_LIB_CONST;
+        const size_t bytes_off = sp_lib_u32(p + 8);
+        sp_lib_const(&e, i, &c);
+        if (c.buf_off > e.size || c.len > e.size - c.buf_off || bytes_off > avail || c.len > avail - bytes_off) {
+            return SP_ERR_CORRUPT;
+        }
+    }
+    return SP_OK;
+}
+
+static SPResult sp_lib_load(struct sp_plan_lib* lib, const uint8_t* data, size_t len) {
+    if (len < SP_LIB_HEADER || memcmp(data, sp_lib_magic, sizeof sp_lib_magic) != 0) {
+        return SP_ERR_CORRUPT;
+    }
+    if (sp_load_uint(data + 4, 2, SP_LITTLE_ENDIAN) != SP_LIB_VERSION) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    const size_t num_plans = sp_lib_u32(data + 8);
+    const size_t blob_len = sp_lib_u32(data + 12);
+    if (blob_len < SP_LIB_HEADER || blob_len > len || num_plans > INT32_MAX ||
+        num_plans > (blob_len - SP_LIB_HEADER) / SP_LIB_ENTRY) {
+        return SP_ERR_CORRUPT;
+    }
+    lib->data = data;
+    lib->len = blob_len;
+    lib->num_plans = (int)num_plans;
+    for (int i = 0; i < lib->num_plans; i++) {
+        SPResult res = sp_lib_check_plan(lib, i);
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    return SP_OK;
+}
+
+SPResult sp_plan_lib_open_mem(const void* data, size_t len, sp_plan_lib** lib) {
+    if (!data || !lib) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_plan_lib* l = calloc(1, sizeof *l);
+    if (!l) {
+        return SP_ERR_ALLOC;
+    }
+    SPResult res = sp_lib_load(l, data, len);
+    if (res != SP_OK) {
+        free(l);
+        return res;
+    }
+    *lib = l;
+    return SP_OK;
+}
+
+/* Read a whole file into memory, for when it cannot be mapped */
+static SPResult sp_lib_read_file(const char* path, struct sp_plan_lib* l, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    uint64_t size = 0;
+    if (!f || sp_file_size(f, &size) != SP_OK || sp_file_seek(f, 0) != 0) {
+        if (f) {
+            fclose(f);
+        }
+        return SP_ERR_IO;
+    }
+    if (size > SIZE_MAX || !(l->copy = malloc(size ? (size_t)size : 1))) {
+        fclose(f);
+        return SP_ERR_ALLOC;
+    }
+    *len = fread(l->copy, 1, (size_t)size, f);
+    fclose(f);
+    return *len == size ? SP_OK : SP_ERR_IO;
+}
+
+SPResult sp_plan_lib_open(const char* path, sp_plan_lib** lib) {
+    if (!path || !lib) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_plan_lib* l = calloc(1, sizeof *l);
+    if (!l) {
+        return SP_ERR_ALLOC;
+    }
+    const uint8_t* data = NULL;
+    size_t len = 0;
+    SPResult res = sp_map_file(path, &l->map);
+    if (res == SP_OK) {
+        data = l->map.data;
+        len = (size_t)l->map.len;
+    } else if (res == SP_ERR_UNSUPPORTED) {
+        res = sp_lib_read_file(path, l, &len);
+        data = l->copy;
+    }
+    if (res == SP_OK) {
+        res = data ? sp_lib_load(l, data, len) : SP_ERR_CORRUPT;
+    }
+    if (res != SP_OK) {
+        sp_plan_lib_close(l);
+        return res;
+    }
+    *lib = l;
+    return SP_OK;
+}
+
+void sp_plan_lib_close(sp_plan_lib* lib) {
+    if (!lib) {
+        return;
+    }
+    sp_unmap_file(&lib->map);
+    free(lib->copy);
+    free(lib);
+}
+
+int sp_plan_lib_count(const sp_plan_lib* lib) {
+    return lib ? lib->num_plans : 0;
+}
+
+int sp_plan_lib_size(const sp_plan_lib* lib, int index) {
+    if (!lib || index < 0 || index >= lib->num_plans) {
+        return 0;
+    }
+    struct sp_lib_plan e;
+    sp_lib_entry(lib, index, &e);
+    return (int)e.size;
+}
+
+static SPResult sp_lib_run(const sp_plan_lib* lib, int index, enum sp_action action, void* offset_base, void* buff, int buff_len) {
+    if (!lib || !offset_base || !buff || buff_len <= 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (index < 0 || index >= lib->num_plans) {
+        return SP_ERR_RANGE;
+    }
+    struct sp_lib_plan e;
+    sp_lib_entry(lib, index, &e);
+    if (!e.off_width) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    if ((size_t)buff_len < e.size) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    /* As with compiled plans, constants are checked before anything is copied */
+    struct sp_const c;
+    for (int i = 0; i < e.num_consts; i++) {
+        sp_lib_const(&e, i, &c);
+        uint8_t* p = (uint8_t*)buff + c.buf_off;
+        if (action == SP_PACK) {
+            memcpy(p, c.bytes, c.len);
+        } else if (memcmp(p, c.bytes, c.len) != 0) {
+            return SP_ERR_MISMATCH;
+        }
+    }
+    /* sp_plan_field only needs the byte order from the plan */
+    struct sp_plan plan;
+    memset(&plan, 0, sizeof plan);
+    plan.endian = e.endian;
+    struct sp_op op;
+    for (int i = 0; i < e.num_ops; i++) {
+        sp_lib_op(&e, i, &op);
+        SPResult res = sp_plan_field(&plan, &op, action, offset_base, (uint8_t*)buff + op.buf_off);
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    return SP_OK;
+}
+
+SPResult sp_plan_lib_unpack(const sp_plan_lib* lib, int index, void* offset_base, void* src_buff, int buff_len) {
+    return sp_lib_run(lib, index, SP_UNPACK, offset_base, src_buff, buff_len);
+}
+
+SPResult sp_plan_lib_pack(const sp_plan_lib* lib, int index, void* offset_base, void* dest_buff, int buff_len) {
+    return sp_lib_run(lib, index, SP_PACK, offset_base, dest_buff, buff_len);
+}
+
+SPResult sp_plan_lib_plan(const sp_plan_lib* lib, int index, sp_plan** plan) {
+    if (!lib || !plan) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (index < 0 || index >= lib->num_plans) {
+        return SP_ERR_RANGE;
+    }
+    struct sp_lib_plan e;
+    sp_lib_entry(lib, index, &e);
+    struct sp_plan* pl = calloc(1, sizeof *pl);
+    if (!pl) {
+        return SP_ERR_ALLOC;
+    }
+    size_t const_size = 0;
+    struct sp_const c;
+    for (int i = 0; i < e.num_consts; i++) {
+        sp_lib_const(&e, i, &c);
+        const_size += c.len;
+    }
+    pl->ops = calloc(e.num_ops > 0 ? (size_t)e.num_ops : 1, sizeof *pl->ops);
+    if (e.num_consts > 0) {
+        pl->consts = calloc((size_t)e.num_consts, sizeof *pl->consts);
+        pl->const_data = malloc(const_size ? const_size : 1);
+    }
+    if (!pl->ops || (e.num_consts > 0 && (!pl->consts || !pl->const_data))) {
+        sp_plan_free(pl);
+        return SP_ERR_ALLOC;
+    }
+    pl->endian = e.endian;
+    pl->size = e.size;
+    pl->no_offsets = !e.off_width;
+    pl->num_ops = e.num_ops;
+    for (int i = 0; i < e.num_ops; i++) {
+        sp_lib_op(&e, i, &pl->ops[i]);
+    }
+    /* Constant bytes are copied, so the plan may outlive the library */
+    const_size = 0;
+    for (int i = 0; i < e.num_consts; i++) {
+        sp_lib_const(&e, i, &c);
+        memcpy(pl->const_data + const_size, c.bytes, c.len);
+        c.bytes = pl->const_data + const_size;
+        pl->consts[i] = c;
+        const_size += c.len;
+    }
+    pl->num_consts = e.num_consts;
+    *plan = pl;
+    return SP_OK;
+}
@@ -0,0 +1,156 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SP_SCHEMA_H
+#define SP_SCHEMA_H
+
+/* Schema declarations that keep a struct, its format string, its offset list
+ * and a compiled plan in step, from a single list of fields.
+ *
+ * A schema is an X-macro taking a field macro F and the schema name S, and
+ * calling F(S, ctype, member, dims, type, count) once per field:
+ *
+ *   #define SENSOR_FIELDS(F, S)              \
+ *       F(S, uint32_t, id,     ,     I, 1)   \
+ *       F(S, int16_t,  temp,   ,     h, 1)   \
+ *       F(S, uint16_t, levels, [12], H, 12)  \
+ *       F(S, char,     name,   [9],  s, 8)
+ *
+ *   SP_SCHEMA(sensor, BIG, SENSOR_FIELDS);
+ *
+ * ctype and dims declare the struct member. type is a format character, and
+ * count is the number of elements, or the string length for 's', 'w' and 'u'.
+ * count must be an integer literal, or a macro expanding to one. The size of
+ * each member is checked against its type and count at compile time.
+ *
+ * SP_SCHEMA(S, endian, FIELDS) defines, for endian BIG or LITTLE:
+ *
+ *   struct S              : The struct itself
+ *   struct S_wire         : One byte array per field, laid out as the packed record
+ *   S_num_fields          : Number of fields
+ *   S_fmt                 : Equivalent format string
+ *   S_offsets             : Offset list
+ *   S_plan                : Plan, initialized at compile time
+ *
+ * The plan may be used like any other, including with sp_plan_jit. Freeing it
+ * only releases generated code. SP_SCHEMA_STRUCT and SP_SCHEMA_TABLES
+ * generate the types and the tables separately, so that the struct can live
+ * in a header and the tables in one source file.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+#if defined(__GNUC__)
+#define SP_SCHEMA_UNUSED __attribute__((unused))
+#else
+#define SP_SCHEMA_UNUSED
+#endif
+
+#define SP_SCHEMA_STR_(x) #x
+#define SP_SCHEMA_STR(x) SP_SCHEMA_STR_(x)
+
+#define SP_SCHEMA_ENDIAN_BIG SP_BIG_ENDIAN
+#define SP_SCHEMA_ENDIAN_LITTLE SP_LITTLE_ENDIAN
+#define SP_SCHEMA_ENDIAN_FMT_BIG ">"
+#define SP_SCHEMA_ENDIAN_FMT_LITTLE "<"
+
+/* Per format character: the type as a char, its size, the format of count
+   elements, and the number of elements its struct member holds */
+#define SP_SCHEMA_CHAR_b 'b'
+#define SP_SCHEMA_CHAR_B 'B'
+#define SP_SCHEMA_CHAR_h 'h'
+#define SP_SCHEMA_CHAR_H 'H'
+#define SP_SCHEMA_CHAR_i 'i'
+#define SP_SCHEMA_CHAR_I 'I'
+#define SP_SCHEMA_CHAR_q 'q'
+#define SP_SCHEMA_CHAR_Q 'Q'
+#define SP_SCHEMA_CHAR_s 's'
+#define SP_SCHEMA_CHAR_w 'w'
+#define SP_SCHEMA_CHAR_u 'u'
+
+#define SP_SCHEMA_SIZE_b 1
+#define SP_SCHEMA_SIZE_B 1
+#define SP_SCHEMA_SIZE_h 2
+#define SP_SCHEMA_SIZE_H 2
+#define SP_SCHEMA_SIZE_i 4
+#define SP_SCHEMA_SIZE_I 4
+#define SP_SCHEMA_SIZE_q 8
+#define SP_SCHEMA_SIZE_Q 8
+#define SP_SCHEMA_SIZE_s 1
+#define SP_SCHEMA_SIZE_w 2
+#define SP_SCHEMA_SIZE_u 4
+
+#define SP_SCHEMA_FMT_b(n) "[" SP_SCHEMA_STR(n) "]b"
+#define SP_SCHEMA_FMT_B(n) "[" SP_SCHEMA_STR(n) "]B"
+#define SP_SCHEMA_FMT_h(n) "[" SP_SCHEMA_STR(n) "]h"
+#define SP_SCHEMA_FMT_H(n) "[" SP_SCHEMA_STR(n) "]H"
+#define SP_SCHEMA_FMT_i(n) "[" SP_SCHEMA_STR(n) "]i"
+#define SP_SCHEMA_FMT_I(n) "[" SP_SCHEMA_STR(n) "]I"
+#define SP_SCHEMA_FMT_q(n) "[" SP_SCHEMA_STR(n) "]q"
+#define SP_SCHEMA_FMT_Q(n) "[" SP_SCHEMA_STR(n) "]Q"
+#define SP_SCHEMA_FMT_s(n) SP_SCHEMA_STR(n) "s"
+#define SP_SCHEMA_FMT_w(n) SP_SCHEMA_STR(n) "w"
+#define SP_SCHEMA_FMT_u(n) SP_SCHEMA_STR(n) "u"
+
+/* Strings are null terminated in the struct */
+#define SP_SCHEMA_LEN_b(n) (n)
+#define SP_SCHEMA_LEN_B(n) (n)
+#define SP_SCHEMA_LEN_h(n) (n)
+#define SP_SCHEMA_LEN_H(n) (n)
+#define SP_SCHEMA_LEN_i(n) (n)
+#define SP_SCHEMA_LEN_I(n) (n)
+#define SP_SCHEMA_LEN_q(n) (n)
+#define SP_SCHEMA_LEN_Q(n) (n)
+#define SP_SCHEMA_LEN_s(n) ((n) + 1)
+#define SP_SCHEMA_LEN_w(n) ((n) + 1)
+#define SP_SCHEMA_LEN_u(n) ((n) + 1)
+
+/* Field macros, one per generated item */
+#define SP_SCHEMA_MEMBER(S, ctype, member, dims, type, count) ctype member dims;
+#define SP_SCHEMA_WIRE_MEMBER(S, ctype, member, dims, type, count) unsigned char member[(count) * SP_SCHEMA_SIZE_##type];
+#define SP_SCHEMA_CHECK(S, ctype, member, dims, type, count) \
+    typedef char sp_schema_check_##S##_##member[(sizeof(((struct S*)0)->member) == SP_SCHEMA_LEN_##type(count) * SP_SCHEMA_SIZE_##type) ? 1 : -1];
+#define SP_SCHEMA_COUNT(S, ctype, member, dims, type, count) + 1
+#define SP_SCHEMA_FMT(S, ctype, member, dims, type, count) " " SP_SCHEMA_FMT_##type(count)
+#define SP_SCHEMA_OFFSET(S, ctype, member, dims, type, count) offsetof(struct S, member),
+#define SP_SCHEMA_OP(S, ctype, member, dims, type, count) \
+    {SP_SCHEMA_CHAR_##type, (count), 0, false, offsetof(struct S##_wire, member), offsetof(struct S, member)},
+
+/*!
+ * \brief Define struct S, and the wire layout struct S_wire, from a list of fields
+ */
+#define SP_SCHEMA_STRUCT(S, FIELDS)                                 \
+    struct S { FIELDS(SP_SCHEMA_MEMBER, S) };                       \
+    FIELDS(SP_SCHEMA_CHECK, S)                                      \
+    struct S##_wire { FIELDS(SP_SCHEMA_WIRE_MEMBER, S) }
+
+/*!
+ * \brief Define the field count, format string, offset list and plan of a schema
+ */
+#define SP_SCHEMA_TABLES(S, endian, FIELDS)                                                 \
+    enum { S##_num_fields = 0 FIELDS(SP_SCHEMA_COUNT, S) };                                 \
+    static const char S##_fmt[] SP_SCHEMA_UNUSED =                                          \
+        SP_SCHEMA_ENDIAN_FMT_##endian FIELDS(SP_SCHEMA_FMT, S);                             \
+    static const size_t S##_offsets[] SP_SCHEMA_UNUSED = { FIELDS(SP_SCHEMA_OFFSET, S) };   \
+    static struct sp_op S##_ops[] = { FIELDS(SP_SCHEMA_OP, S) };                            \
+    static struct sp_plan S##_plan_data = {                                                 \
+        SP_SCHEMA_ENDIAN_##endian, S##_num_fields, sizeof(struct S##_wire), S##_ops,        \
+        NULL, 0, NULL, NULL, true, false, SP_KERNEL_INTERP, SP_TUNE_IDLE, NULL              \
+    };                                                                                      \
+    static sp_plan* const S##_plan SP_SCHEMA_UNUSED = &S##_plan_data
+
+/*!
+ * \brief Define a schema's struct, format string, offset list and plan together
+ */
+#define SP_SCHEMA(S, endian, FIELDS)                                \
+    SP_SCHEMA_STRUCT(S, FIELDS);                                    \
+    SP_SCHEMA_TABLES(S, endian, FIELDS)
+
+#endif // SP_SCHEMA_H
@@ -0,0 +1,178 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Sorting packed records in place by one integer field, without unpacking them.
+ *
+ * The key of each record is read straight from its bytes, and mapped to an
+ * unsigned value of the field's width with the same order, by flipping the
+ * sign bit of signed fields. A least significant digit radix sort then
+ * orders (key, record number) pairs a byte at a time. Each pass is stable,
+ * so records with equal keys stay in their original order.
+ *
+ * Reading keys and counting the bytes of every key position is a single
+ * pass, split between threads by chunks of records. Passes where every key
+ * has the same byte are skipped. Finally whole records are moved into
+ * place by following the cycles of the permutation, so only one record of
+ * scratch space is needed beyond the pairs.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_plan.h"
+
+/* No point in a thread for fewer than a few thousand records */
+#define SP_SORT_CHUNK_MIN 4096
+#define SP_SORT_RADIX 256
+
+struct sp_sort_pair {
+    uint64_t key;
+    size_t index;
+};
+
+/* State shared by the histogram tasks */
+struct sp_sort {
+    const struct sp_plan* plan;
+    const struct sp_op* op;
+    const uint8_t* data;
+    int width;
+    /* Record number each chunk starts at, with one past the end in the last entry */
+    size_t* bounds;
+    struct sp_sort_pair* pairs;
+    /* Counts of each byte value at each key position, width * SP_SORT_RADIX per chunk */
+    size_t* hist;
+};
+
+static bool sp_sort_signed(char type) {
+    return type == 'b' || type == 'h' || type == 'i' || type == 'q';
+}
+
+static void sp_sort_hist_task(void* ctx, int task) {
+    struct sp_sort* s = ctx;
+    const size_t size = s->plan->size;
+    const int width = s->width;
+    const uint64_t flip = sp_sort_signed(s->op->type) ? UINT64_C(1) << (width * 8 - 1) : 0;
+    size_t* hist = s->hist + (size_t)task * (size_t)width * SP_SORT_RADIX;
+    const size_t lo = s->bounds[task], hi = s->bounds[task + 1];
+    const uint8_t* rec = s->data + lo * size + s->op->buf_off;
+    for (size_t i = lo; i < hi; i++, rec += size) {
+        uint64_t key = sp_load_uint(rec, width, s->plan->endian) ^ flip;
+        s->pairs[i].key = key;
+        s->pairs[i].index = i;
+        for (int b = 0; b < width; b++) {
+            hist[b * SP_SORT_RADIX + ((key >> (b * 8)) & 0xff)]++;
+        }
+    }
+}
+
+/* Stable sort of the pairs by one byte of their keys, into out */
+static void sp_sort_pass(const struct sp_sort_pair* in, struct sp_sort_pair* out, size_t count, int byte, const size_t* counts) {
+    size_t offsets[SP_SORT_RADIX];
+    size_t total = 0;
+    for (int v = 0; v < SP_SORT_RADIX; v++) {
+        offsets[v] = total;
+        total += counts[v];
+    }
+    const int shift = byte * 8;
+    for (size_t i = 0; i < count; i++) {
+        out[offsets[(in[i].key >> shift) & 0xff]++] = in[i];
+    }
+}
+
+/* Move each record to the position given by the sorted pairs, following one cycle at a time */
+static SPResult sp_sort_permute(uint8_t* data, size_t size, struct sp_sort_pair* pairs, size_t count) {
+    uint8_t* tmp = malloc(size);
+    if (!tmp) {
+        return SP_ERR_ALLOC;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pairs[i].index == i) {
+            continue;
+        }
+        memcpy(tmp, data + i * size, size);
+        size_t j = i, src;
+        while ((src = pairs[j].index) != i) {
+            memcpy(data + j * size, data + src * size, size);
+            /* A record in its final place marks the end of any later cycle through it */
+            pairs[j].index = j;
+            j = src;
+        }
+        memcpy(data + j * size, tmp, size);
+        pairs[j].index = j;
+    }
+    free(tmp);
+    return SP_OK;
+}
+
+SPResult sp_sort(const sp_plan* plan, int key_field, void* buff, size_t count, int num_threads) {
+    if (!plan || !buff) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (key_field < 0 || key_field >= plan->num_ops) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    const struct sp_op* op = &plan->ops[key_field];
+    if (op->len != 1 || op->type == 's' || op->type == 'w' || op->type == 'u') {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    if (plan->size > 0 && count > SIZE_MAX / plan->size) {
+        return SP_ERR_INT;
+    }
+    if (count < 2) {
+        return SP_OK;
+    }
+    if (num_threads <= 0) {
+        num_threads = sp_cpu_count();
+    }
+    size_t max_chunks = count / SP_SORT_CHUNK_MIN + 1;
+    int num_chunks = (size_t)num_threads < max_chunks ? num_threads : (int)max_chunks;
+
+    struct sp_sort s;
+    s.plan = plan;
+    s.op = op;
+    s.data = buff;
+    s.width = sp_type_size(op->type);
+    s.bounds = malloc(((size_t)num_chunks + 1) * sizeof *s.bounds);
+    s.pairs = malloc(count * sizeof *s.pairs);
+    s.hist = calloc((size_t)num_chunks * (size_t)s.width * SP_SORT_RADIX, sizeof *s.hist);
+    struct sp_sort_pair* tmp = malloc(count * sizeof *tmp);
+    SPResult res = SP_ERR_ALLOC;
+    if (s.bounds && s.pairs && s.hist && tmp) {
+        size_t per_chunk = count / num_chunks, extra = count % num_chunks;
+        for (int i = 0; i <= num_chunks; i++) {
+            s.bounds[i] = per_chunk * i + extra * i / num_chunks;
+        }
+        sp_run_tasks(sp_sort_hist_task, &s, num_chunks, num_threads);
+        /* Chunk histograms are summed into the first */
+        const size_t hist_len = (size_t)s.width * SP_SORT_RADIX;
+        for (int c = 1; c < num_chunks; c++) {
+            for (size_t v = 0; v < hist_len; v++) {
+                s.hist[v] += s.hist[(size_t)c * hist_len + v];
+            }
+        }
+        bool moved = false;
+        for (int b = 0; b < s.width; b++) {
+            const size_t* counts = s.hist + (size_t)b * SP_SORT_RADIX;
+            if (counts[(s.pairs[0].key >> (b * 8)) & 0xff] == count) {
+                continue;
+            }
+            sp_sort_pass(s.pairs, tmp, count, b, counts);
+            struct sp_sort_pair* swap = s.pairs;
+            s.pairs = tmp;
+            tmp = swap;
+            moved = true;
+        }
+        res = moved ? sp_sort_permute(buff, plan->size, s.pairs, count) : SP_OK;
+    }
+    free(s.bounds);
+    free(s.pairs);
+    free(s.hist);
+    free(tmp);
+    return res;
+}
@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sp_internal.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_SWAP_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Scalar fallback, also handling any tail shorter than a vector */
+static void sp_swap_scalar(uint8_t* dst, const uint8_t* src, size_t n, int width) {
+    uint8_t tmp[8];
+    size_t i;
+    int j;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < width; j++) {
+            tmp[j] = src[width - 1 - j];
+        }
+        memcpy(dst, tmp, (size_t)width);
+        src += width;
+        dst += width;
+    }
+}
+
+void sp_swap_array(void* dst, const void* src, size_t n, int width) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    if (width <= 1) {
+        if (d != s) {
+            memmove(d, s, n);
+        }
+        return;
+    }
+#ifdef SP_SWAP_SSE2
+    /* Swap bytes within each 16 bit lane, then reorder 16 bit lanes for wider elements */
+    size_t per_vec = 16 / (size_t)width;
+    for (; n >= per_vec; n -= per_vec) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if (width == 4) {
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+        } else if (width == 8) {
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1b), 0x1b);
+        }
+        _mm_storeu_si128((__m128i*)d, v);
+        s += 16;
+        d += 16;
+    }
+#endif
+    sp_swap_scalar(d, s, n, width);
+}
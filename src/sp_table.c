@@ -0,0 +1,542 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Random access to fixed size records, with an optional index on one key.
+ *
+ * Keys are normalized to unsigned 64 bit values that sort in the same order
+ * as the field, by sign extending signed fields and flipping their top bit.
+ *
+ * Index builds split the table into one chunk of records per thread. Each
+ * thread reads just the key of every record in its chunk. A sorted index then
+ * sorts each chunk, and merges pairs of chunks in parallel until one run is
+ * left. A hash index scatters keys into one partition per thread by the top
+ * bits of their hash, and each thread builds the hash table of its own
+ * partition, so no locking is needed. Both keep records with equal keys in
+ * record order, so lookups find the first of them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_plan.h"
+
+/* Records read at a time when reading keys through a buffer */
+#define SP_TABLE_BLOCK 65536
+
+struct sp_table_key {
+    uint64_t key;
+    /* Record number. In a hash table this is one more, so that 0 marks an empty slot */
+    size_t index;
+};
+
+struct sp_table {
+    const struct sp_plan* plan;
+    size_t count;
+    /* Mapped or caller owned records. NULL when reading through file */
+    const uint8_t* data;
+    struct sp_file_map map;
+    FILE* file;
+    char* path;
+    uint64_t offset;
+    uint8_t* scratch;
+    /* Index on the key field, if key_op is not negative */
+    int key_op;
+    sp_index_kind kind;
+    struct sp_table_key* keys;
+    /* Hash index partitions. Partition p holds part_mask[p] + 1 slots from part_base[p] */
+    int part_bits;
+    size_t* part_base;
+    size_t* part_mask;
+};
+
+static SPResult sp_table_new(const sp_plan* plan, sp_table** table) {
+    if (!plan || !table) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size == 0) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    struct sp_table* t = calloc(1, sizeof *t);
+    if (!t) {
+        return SP_ERR_ALLOC;
+    }
+    t->scratch = malloc(plan->size);
+    if (!t->scratch) {
+        free(t);
+        return SP_ERR_ALLOC;
+    }
+    t->plan = plan;
+    t->key_op = -1;
+    *table = t;
+    return SP_OK;
+}
+
+SPResult sp_table_open(const char* path, uint64_t offset, const sp_plan* plan, sp_table_mode mode, sp_table** table) {
+    if (!path) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_table* t = NULL;
+    SPResult res = sp_table_new(plan, &t);
+    if (res != SP_OK) {
+        return res;
+    }
+    uint64_t len = 0;
+    if (mode == SP_TABLE_MAP) {
+        res = sp_map_file(path, &t->map);
+        if (res == SP_OK) {
+            len = t->map.len;
+            t->data = t->map.data ? t->map.data + (offset < len ? offset : len) : NULL;
+        } else if (res != SP_ERR_UNSUPPORTED) {
+            sp_table_close(t);
+            return res;
+        }
+    }
+    if (!t->map.data) {
+        t->path = malloc(strlen(path) + 1);
+        if (!t->path) {
+            sp_table_close(t);
+            return SP_ERR_ALLOC;
+        }
+        strcpy(t->path, path);
+        t->file = fopen(path, "rb");
+        if (!t->file || sp_file_size(t->file, &len) != SP_OK) {
+            sp_table_close(t);
+            return SP_ERR_IO;
+        }
+    }
+    t->offset = offset;
+    t->count = offset < len ? (size_t)((len - offset) / plan->size) : 0;
+    *table = t;
+    return SP_OK;
+}
+
+SPResult sp_table_open_mem(const void* data, size_t len, const sp_plan* plan, sp_table** table) {
+    if (!data && len > 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_table* t = NULL;
+    SPResult res = sp_table_new(plan, &t);
+    if (res != SP_OK) {
+        return res;
+    }
+    t->data = data;
+    t->count = len / plan->size;
+    *table = t;
+    return SP_OK;
+}
+
+static void sp_table_drop_index(sp_table* t) {
+    free(t->keys);
+    free(t->part_base);
+    free(t->part_mask);
+    t->keys = NULL;
+    t->part_base = NULL;
+    t->part_mask = NULL;
+    t->key_op = -1;
+}
+
+void sp_table_close(sp_table* table) {
+    if (!table) {
+        return;
+    }
+    sp_table_drop_index(table);
+    if (table->file) {
+        fclose(table->file);
+    }
+    sp_unmap_file(&table->map);
+    free(table->path);
+    free(table->scratch);
+    free(table);
+}
+
+size_t sp_table_count(const sp_table* table) {
+    return table ? table->count : 0;
+}
+
+/* Bytes of record index, either in place or read into the scratch record */
+static const uint8_t* sp_table_record(sp_table* t, size_t index) {
+    size_t size = t->plan->size;
+    if (t->data) {
+        return t->data + index * size;
+    }
+    if (sp_file_seek(t->file, t->offset + (uint64_t)index * size) != 0 ||
+        fread(t->scratch, 1, size, t->file) != size) {
+        return NULL;
+    }
+    return t->scratch;
+}
+
+SPResult sp_table_read(sp_table* table, size_t index, void* offset_base) {
+    if (!table || !offset_base) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (index >= table->count) {
+        return SP_ERR_RANGE;
+    }
+    const uint8_t* rec = sp_table_record(table, index);
+    if (!rec) {
+        return SP_ERR_IO;
+    }
+    return sp_plan_unpack(table->plan, offset_base, (void*)rec, (int)table->plan->size);
+}
+
+static bool sp_is_signed(char type) {
+    return type == 'b' || type == 'h' || type == 'i' || type == 'q';
+}
+
+/* Map a key to an unsigned value with the same order as the field's type */
+static uint64_t sp_key_normalize(uint64_t key, char type) {
+    return sp_is_signed(type) ? key ^ (UINT64_C(1) << 63) : key;
+}
+
+static uint64_t sp_key_load(const uint8_t* rec, const struct sp_op* op, enum sp_endian endian) {
+    int width = sp_type_size(op->type);
+    uint64_t v = sp_load_uint(rec + op->buf_off, width, endian);
+    if (sp_is_signed(op->type) && width < 8 && (v >> (width * 8 - 1)) != 0) {
+        v |= ~UINT64_C(0) << (width * 8);
+    }
+    return sp_key_normalize(v, op->type);
+}
+
+/* Spread of a key over all 64 bits. The top bits pick a partition, the bottom bits a slot */
+static uint64_t sp_key_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= UINT64_C(0xff51afd7ed558ccd);
+    key ^= key >> 33;
+    key *= UINT64_C(0xc4ceb9fe1a85ec53);
+    key ^= key >> 33;
+    return key;
+}
+
+static int sp_key_partition(uint64_t hash, int part_bits) {
+    return part_bits ? (int)(hash >> (64 - part_bits)) : 0;
+}
+
+static int sp_key_cmp(const void* a, const void* b) {
+    const struct sp_table_key* x = a;
+    const struct sp_table_key* y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/* State shared by the tasks of an index build */
+struct sp_index_build {
+    sp_table* t;
+    const struct sp_op* op;
+    int num_chunks;
+    /* Record number each chunk starts at, with one past the end in the last entry */
+    size_t* bounds;
+    struct sp_table_key* keys;
+    struct sp_table_key* tmp;
+    SPResult* results;
+    /* Sorted index merge passes. Run r spans bounds[r * width] to bounds[(r + 1) * width] */
+    size_t width;
+    /* Hash index partitioning */
+    int num_parts;
+    size_t* hist;
+};
+
+static SPResult sp_read_keys(const struct sp_index_build* b, size_t lo, size_t hi) {
+    const sp_table* t = b->t;
+    const size_t size = t->plan->size;
+    const enum sp_endian endian = t->plan->endian;
+    if (lo == hi) {
+        return SP_OK;
+    }
+    if (t->data) {
+        const uint8_t* rec = t->data + lo * size;
+        for (size_t i = lo; i < hi; i++, rec += size) {
+            b->keys[i].key = sp_key_load(rec, b->op, endian);
+            b->keys[i].index = i;
+        }
+        return SP_OK;
+    }
+    /* Each task reads its own chunk through its own file handle */
+    SPResult res = SP_OK;
+    size_t per_block = SP_TABLE_BLOCK / size > 0 ? SP_TABLE_BLOCK / size : 1;
+    uint8_t* block = malloc(per_block * size);
+    FILE* f = fopen(t->path, "rb");
+    if (!block || !f) {
+        res = block ? SP_ERR_IO : SP_ERR_ALLOC;
+    } else if (sp_file_seek(f, t->offset + (uint64_t)lo * size) != 0) {
+        res = SP_ERR_IO;
+    }
+    for (size_t i = lo; res == SP_OK && i < hi;) {
+        size_t n = hi - i < per_block ? hi - i : per_block;
+        if (fread(block, size, n, f) != n) {
+            res = SP_ERR_IO;
+            break;
+        }
+        const uint8_t* rec = block;
+        for (size_t end = i + n; i < end; i++, rec += size) {
+            b->keys[i].key = sp_key_load(rec, b->op, endian);
+            b->keys[i].index = i;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    free(block);
+    return res;
+}
+
+static void sp_sort_chunk_task(void* ctx, int task) {
+    struct sp_index_build* b = ctx;
+    size_t lo = b->bounds[task], hi = b->bounds[task + 1];
+    b->results[task] = sp_read_keys(b, lo, hi);
+    if (b->results[task] == SP_OK) {
+        qsort(b->keys + lo, hi - lo, sizeof *b->keys, sp_key_cmp);
+    }
+}
+
+static void sp_merge_task(void* ctx, int task) {
+    struct sp_index_build* b = ctx;
+    size_t first = (size_t)task * 2 * b->width;
+    size_t last = (size_t)b->num_chunks;
+    size_t lo = b->bounds[first];
+    size_t mid = b->bounds[first + b->width < last ? first + b->width : last];
+    size_t hi = b->bounds[first + 2 * b->width < last ? first + 2 * b->width : last];
+    const struct sp_table_key* x = b->keys;
+    struct sp_table_key* out = b->tmp + lo;
+    size_t i = lo, j = mid;
+    while (i < mid && j < hi) {
+        /* Taking from the left run on a tie keeps equal keys in record order */
+        *out++ = (x[j].key < x[i].key) ? x[j++] : x[i++];
+    }
+    memcpy(out, x + i, (mid - i) * sizeof *out);
+    out += mid - i;
+    memcpy(out, x + j, (hi - j) * sizeof *out);
+}
+
+static SPResult sp_build_sorted(struct sp_index_build* b, int num_threads) {
+    sp_run_tasks(sp_sort_chunk_task, b, b->num_chunks, num_threads);
+    for (int i = 0; i < b->num_chunks; i++) {
+        if (b->results[i] != SP_OK) {
+            return b->results[i];
+        }
+    }
+    b->tmp = malloc((b->t->count > 0 ? b->t->count : 1) * sizeof *b->tmp);
+    if (!b->tmp) {
+        return SP_ERR_ALLOC;
+    }
+    for (b->width = 1; b->width < (size_t)b->num_chunks; b->width *= 2) {
+        size_t pairs = ((size_t)b->num_chunks + 2 * b->width - 1) / (2 * b->width);
+        sp_run_tasks(sp_merge_task, b, (int)pairs, num_threads);
+        struct sp_table_key* swap = b->keys;
+        b->keys = b->tmp;
+        b->tmp = swap;
+    }
+    free(b->tmp);
+    b->tmp = NULL;
+    return SP_OK;
+}
+
+static void sp_hash_count_task(void* ctx, int task) {
+    struct sp_index_build* b = ctx;
+    size_t lo = b->bounds[task], hi = b->bounds[task + 1];
+    size_t* hist = b->hist + (size_t)task * b->num_parts;
+    b->results[task] = sp_read_keys(b, lo, hi);
+    for (size_t i = lo; b->results[task] == SP_OK && i < hi; i++) {
+        hist[sp_key_partition(sp_key_hash(b->keys[i].key), b->t->part_bits)]++;
+    }
+}
+
+/* After counting, each chunk's histogram holds where its keys start in every partition */
+static void sp_hash_scatter_task(void* ctx, int task) {
+    struct sp_index_build* b = ctx;
+    size_t* pos = b->hist + (size_t)task * b->num_parts;
+    for (size_t i = b->bounds[task]; i < b->bounds[task + 1]; i++) {
+        b->tmp[pos[sp_key_partition(sp_key_hash(b->keys[i].key), b->t->part_bits)]++] = b->keys[i];
+    }
+}
+
+static void sp_hash_insert_task(void* ctx, int task) {
+    struct sp_index_build* b = ctx;
+    sp_table* t = b->t;
+    /* The partition's keys sit between the last chunk's end of the previous partition, and its own */
+    size_t* last = b->hist + (size_t)(b->num_chunks - 1) * b->num_parts;
+    size_t lo = task > 0 ? last[task - 1] : 0;
+    size_t hi = last[task];
+    struct sp_table_key* slots = t->keys + t->part_base[task];
+    size_t mask = t->part_mask[task];
+    for (size_t i = lo; i < hi; i++) {
+        size_t s = (size_t)sp_key_hash(b->tmp[i].key) & mask;
+        while (slots[s].index != 0) {
+            s = (s + 1) & mask;
+        }
+        slots[s].key = b->tmp[i].key;
+        slots[s].index = b->tmp[i].index + 1;
+    }
+}
+
+static SPResult sp_build_hash(struct sp_index_build* b, int num_threads) {
+    sp_table* t = b->t;
+    b->num_parts = 1;
+    t->part_bits = 0;
+    while (b->num_parts < num_threads) {
+        b->num_parts *= 2;
+        t->part_bits++;
+    }
+    b->hist = calloc((size_t)b->num_chunks * b->num_parts, sizeof *b->hist);
+    b->tmp = malloc((t->count > 0 ? t->count : 1) * sizeof *b->tmp);
+    t->part_base = malloc((size_t)b->num_parts * sizeof *t->part_base);
+    t->part_mask = malloc((size_t)b->num_parts * sizeof *t->part_mask);
+    if (!b->hist || !b->tmp || !t->part_base || !t->part_mask) {
+        return SP_ERR_ALLOC;
+    }
+    sp_run_tasks(sp_hash_count_task, b, b->num_chunks, num_threads);
+    for (int i = 0; i < b->num_chunks; i++) {
+        if (b->results[i] != SP_OK) {
+            return b->results[i];
+        }
+    }
+    /* Turn counts into scatter positions, partition by partition, and size each partition's
+       table to at most half full */
+    size_t pos = 0, slots = 0;
+    for (int p = 0; p < b->num_parts; p++) {
+        size_t part_len = 0;
+        for (int c = 0; c < b->num_chunks; c++) {
+            size_t* h = &b->hist[(size_t)c * b->num_parts + p];
+            size_t n = *h;
+            *h = pos;
+            pos += n;
+            part_len += n;
+        }
+        size_t cap = 2;
+        while (cap < part_len * 2) {
+            cap *= 2;
+        }
+        t->part_base[p] = slots;
+        t->part_mask[p] = cap - 1;
+        slots += cap;
+    }
+    sp_run_tasks(sp_hash_scatter_task, b, b->num_chunks, num_threads);
+    free(b->keys);
+    b->keys = calloc(slots, sizeof *b->keys);
+    if (!b->keys) {
+        return SP_ERR_ALLOC;
+    }
+    t->keys = b->keys;
+    sp_run_tasks(sp_hash_insert_task, b, b->num_parts, num_threads);
+    return SP_OK;
+}
+
+SPResult sp_table_index(sp_table* table, int field, sp_index_kind kind, int num_threads) {
+    if (!table) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    const struct sp_plan* plan = table->plan;
+    if (field < 0 || field >= plan->num_ops || (kind != SP_INDEX_SORTED && kind != SP_INDEX_HASH)) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    const struct sp_op* op = &plan->ops[field];
+    if (op->len != 1 || op->type == 's' || op->type == 'w' || op->type == 'u') {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    sp_table_drop_index(table);
+    if (num_threads <= 0) {
+        num_threads = sp_cpu_count();
+    }
+    /* No point in a thread for fewer than a few thousand records */
+    size_t max_chunks = table->count / 4096 + 1;
+    int num_chunks = (size_t)num_threads < max_chunks ? num_threads : (int)max_chunks;
+
+    struct sp_index_build b;
+    memset(&b, 0, sizeof b);
+    b.t = table;
+    b.op = op;
+    b.num_chunks = num_chunks;
+    b.bounds = malloc(((size_t)num_chunks + 1) * sizeof *b.bounds);
+    b.results = malloc((size_t)num_chunks * sizeof *b.results);
+    b.keys = malloc((table->count > 0 ? table->count : 1) * sizeof *b.keys);
+    SPResult res = SP_ERR_ALLOC;
+    if (b.bounds && b.results && b.keys) {
+        size_t per_chunk = table->count / num_chunks, extra = table->count % num_chunks;
+        for (int i = 0; i <= num_chunks; i++) {
+            b.bounds[i] = per_chunk * i + extra * i / num_chunks;
+        }
+        table->kind = kind;
+        if (kind == SP_INDEX_SORTED) {
+            res = sp_build_sorted(&b, num_chunks);
+        } else {
+            res = sp_build_hash(&b, num_chunks);
+        }
+    }
+    free(b.bounds);
+    free(b.results);
+    free(b.tmp);
+    free(b.hist);
+    if (res != SP_OK) {
+        if (b.keys != table->keys) {
+            free(b.keys);
+        }
+        sp_table_drop_index(table);
+        return res;
+    }
+    table->keys = b.keys;
+    table->key_op = field;
+    return SP_OK;
+}
+
+SPResult sp_table_find(sp_table* table, uint64_t key, void* offset_base, size_t* index) {
+    if (!table) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (table->key_op < 0) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    const struct sp_op* op = &table->plan->ops[table->key_op];
+    int width = sp_type_size(op->type);
+    /* Keys that cannot be held by the field match nothing */
+    if (width < 8) {
+        uint64_t top = key >> (width * 8 - 1);
+        bool fits = sp_is_signed(op->type) ? (top == 0 || top == (UINT64_MAX >> (width * 8 - 1))) : (top >> 1) == 0;
+        if (!fits) {
+            return SP_ERR_NOT_FOUND;
+        }
+    }
+    uint64_t k = sp_key_normalize(key, op->type);
+    size_t found = 0;
+    bool match = false;
+    if (table->kind == SP_INDEX_SORTED) {
+        size_t lo = 0, hi = table->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (table->keys[mid].key < k) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        match = lo < table->count && table->keys[lo].key == k;
+        found = match ? table->keys[lo].index : 0;
+    } else {
+        uint64_t hash = sp_key_hash(k);
+        int p = sp_key_partition(hash, table->part_bits);
+        const struct sp_table_key* slots = table->keys + table->part_base[p];
+        size_t mask = table->part_mask[p];
+        for (size_t s = (size_t)hash & mask; slots[s].index != 0; s = (s + 1) & mask) {
+            if (slots[s].key == k) {
+                match = true;
+                found = slots[s].index - 1;
+                break;
+            }
+        }
+    }
+    if (!match) {
+        return SP_ERR_NOT_FOUND;
+    }
+    if (index) {
+        *index = found;
+    }
+    return offset_base ? sp_table_read(table, found, offset_base) : SP_OK;
+}
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+static bool sp_is_signed(char type) {
+    return type == 'b' || type == 'h' || type == 'i' || type == 'q';
+}
+
+/* Fields are compatible when they hold the same number of elements of the same kind */
+static bool sp_fields_compatible(const struct sp_op* s, const struct sp_op* d) {
+    return s->len == d->len && ((s->type == 's') == (d->type == 's'));
+}
+
+static SPResult sp_convert_field(const struct sp_op* s, enum sp_endian s_end, const uint8_t* src,
+                                 const struct sp_op* d, enum sp_endian d_end, uint8_t* dst)
+{
+    int s_width = sp_type_size(s->type);
+    int d_width = sp_type_size(d->type);
+    bool s_signed = sp_is_signed(s->type);
+    bool d_signed = sp_is_signed(d->type);
+    if (s_width == d_width && (s_signed == d_signed || s->type == 's')) {
+        if (s_width == 1 || s_end == d_end) {
+            memcpy(dst, src, (size_t)s->len * s_width);
+        } else {
+            sp_swap_array(dst, src, (size_t)s->len, s_width);
+        }
+        return SP_OK;
+    }
+    /* Widening, narrowing or a change of signedness, one element at a time */
+    int d_bits = 8 * d_width;
+    uint64_t d_max = d_signed ? (UINT64_MAX >> (65 - d_bits)) : (UINT64_MAX >> (64 - d_bits));
+    int i;
+    for (i = 0; i < s->len; i++) {
+        uint64_t v = sp_load_uint(src + i * s_width, s_width, s_end);
+        bool neg = false;
+        if (s_signed && s_width < 8 && (v >> (8 * s_width - 1))) {
+            v |= UINT64_MAX << (8 * s_width);
+        }
+        if (s_signed) {
+            neg = (int64_t)v < 0;
+        }
+        if (neg) {
+            /* Negative values only fit signed destinations, down to -(d_max + 1) */
+            if (!d_signed || (d_bits < 64 && (int64_t)v < -(int64_t)d_max - 1)) {
+                return SP_ERR_RANGE;
+            }
+        } else if (v > d_max) {
+            return SP_ERR_RANGE;
+        }
+        sp_store_uint(dst + i * d_width, v, d_width, d_end);
+    }
+    return SP_OK;
+}
+
+/* Source and destination of a batch being transcoded */
+struct sp_transcode_batch {
+    const struct sp_plan* s_plan;
+    const struct sp_plan* d_plan;
+    const uint8_t* src;
+    size_t ahead;
+    size_t count;
+};
+
+static SPResult sp_transcode_record(void* ctx, size_t r, uint8_t* dst) {
+    const struct sp_transcode_batch* b = ctx;
+    const struct sp_plan* s_plan = b->s_plan;
+    const struct sp_plan* d_plan = b->d_plan;
+    const uint8_t* src = b->src + r * s_plan->size;
+    if (b->ahead && r + b->ahead < b->count) {
+        SP_PREFETCH(src + b->ahead * s_plan->size);
+    }
+    size_t d_end = 0;
+    SPResult res = sp_plan_consts(s_plan, SP_UNPACK, (void*)src);
+    int i;
+    for (i = 0; i < s_plan->num_ops && res == SP_OK; i++) {
+        const struct sp_op* s = &s_plan->ops[i];
+        const struct sp_op* d = &d_plan->ops[i];
+        /* Padding in the destination is zeroed, so output never depends on its previous contents */
+        memset(dst + d_end, 0, d->buf_off - d_end);
+        res = sp_convert_field(s, s_plan->endian, src + s->buf_off, d, d_plan->endian, dst + d->buf_off);
+        d_end = d->buf_off + (size_t)d->len * sp_type_size(d->type);
+    }
+    memset(dst + d_end, 0, d_plan->size - d_end);
+    if (res == SP_OK) {
+        sp_plan_consts(d_plan, SP_PACK, dst);
+    }
+    return res;
+}
+
+SPResult sp_transcode(const char* src_fmt,
+                      const char* dest_fmt,
+                      void* src_buff,
+                      int src_len,
+                      void* dest_buff,
+                      int dest_len,
+                      int count)
+{
+    if (!src_fmt || !dest_fmt || !src_buff || src_len <= 0 || !dest_buff || dest_len <= 0 || count <= 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    struct sp_plan *s_plan = NULL, *d_plan = NULL;
+    SPResult res = sp_plan_build(src_fmt, -1, NULL, &s_plan);
+    if (res != SP_OK) {
+        return res;
+    }
+    res = sp_plan_build(dest_fmt, -1, NULL, &d_plan);
+    if (res != SP_OK) {
+        sp_plan_free(s_plan);
+        return res;
+    }
+    int i;
+    if (s_plan->num_ops != d_plan->num_ops) {
+        res = SP_ERR_FIELD_CNT;
+        goto cleanup;
+    }
+    for (i = 0; i < s_plan->num_ops; i++) {
+        if (!sp_fields_compatible(&s_plan->ops[i], &d_plan->ops[i])) {
+            res = SP_ERR_INVALID_PARAMS;
+            goto cleanup;
+        }
+    }
+    if (s_plan->size * (size_t)count > (size_t)src_len || d_plan->size * (size_t)count > (size_t)dest_len) {
+        res = SP_ERR_BUFF_OVERRUN;
+        goto cleanup;
+    }
+    struct sp_transcode_batch batch;
+    batch.s_plan = s_plan;
+    batch.d_plan = d_plan;
+    batch.src = src_buff;
+    batch.ahead = sp_prefetch_records((size_t)count, s_plan->size);
+    batch.count = (size_t)count;
+    res = sp_stream_records(sp_transcode_record, &batch, (size_t)count, d_plan->size,
+                            sp_stream_wanted(d_plan->size * (size_t)count), dest_buff, NULL);
+cleanup:
+    sp_plan_free(s_plan);
+    sp_plan_free(d_plan);
+    return res;
+}
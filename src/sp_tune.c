@@ -0,0 +1,207 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Memory optimizations for batches too large to stay in cache.
+ *
+ * Records are read sequentially or at a fixed stride, so the source can be
+ * prefetched a set distance ahead of the record being converted. Output is
+ * built a block at a time in scratch space that stays in the level 1 cache,
+ * then copied out with non temporal stores, so writing a large output does
+ * not evict the source still to be read. Both only pay off past a size that
+ * depends on the processor's caches, and small batches skip them entirely.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_internal.h"
+#include "sp_os.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_STREAM_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Scratch space records are built in before being streamed out */
+#define SP_STREAM_STAGE 4096
+/* Cache sizes assumed when the processor cannot be queried */
+#define SP_TUNE_L2_DEFAULT (256 * 1024)
+#define SP_TUNE_LLC_DEFAULT (8 * 1024 * 1024)
+/* Default prefetch distance, in 64 byte cache lines */
+#define SP_TUNE_PREFETCH_LINES 8
+
+/* Each value is loaded and stored atomically, so batches may read them while another thread sets them */
+static volatile size_t sp_tuned;
+static volatile size_t sp_prefetch_min;
+static volatile size_t sp_prefetch_ahead;
+static volatile size_t sp_stream_min;
+
+static void sp_tuning_default(sp_tuning* tuning) {
+    size_t l2 = sp_cache_size(2);
+    size_t llc = sp_cache_size(3);
+    if (!l2) {
+        l2 = SP_TUNE_L2_DEFAULT;
+    }
+    if (!llc) {
+        llc = l2 > SP_TUNE_LLC_DEFAULT ? l2 : SP_TUNE_LLC_DEFAULT;
+    }
+    /* Sources that fit in the level 2 cache are served well enough by the hardware prefetcher */
+    tuning->prefetch_min = l2;
+    tuning->prefetch_ahead = SP_TUNE_PREFETCH_LINES * 64;
+    /* Output larger than half the last level cache is evicted before it can be read back anyway */
+#ifdef SP_STREAM_SSE2
+    tuning->stream_min = llc / 2;
+#else
+    tuning->stream_min = SIZE_MAX;
+#endif
+}
+
+void sp_tuning_get(sp_tuning* tuning) {
+    if (!tuning) {
+        return;
+    }
+    if (!sp_load_acquire(&sp_tuned)) {
+        sp_tuning_set(NULL);
+    }
+    tuning->prefetch_min = sp_load_acquire(&sp_prefetch_min);
+    tuning->prefetch_ahead = sp_load_acquire(&sp_prefetch_ahead);
+    tuning->stream_min = sp_load_acquire(&sp_stream_min);
+}
+
+void sp_tuning_set(const sp_tuning* tuning) {
+    sp_tuning defaults;
+    if (!tuning) {
+        sp_tuning_default(&defaults);
+        tuning = &defaults;
+    }
+    sp_store_release(&sp_prefetch_min, tuning->prefetch_min);
+    sp_store_release(&sp_prefetch_ahead, tuning->prefetch_ahead);
+    sp_store_release(&sp_stream_min, tuning->stream_min);
+    sp_store_release(&sp_tuned, 1);
+}
+
+size_t sp_prefetch_records(size_t count, size_t stride) {
+    sp_tuning t;
+    if (stride == 0 || count < 2) {
+        return 0;
+    }
+    sp_tuning_get(&t);
+    if (t.prefetch_ahead == 0 || (count <= SIZE_MAX / stride && count * stride < t.prefetch_min)) {
+        return 0;
+    }
+    return (t.prefetch_ahead + stride - 1) / stride;
+}
+
+bool sp_stream_wanted(size_t len) {
+#ifdef SP_STREAM_SSE2
+    sp_tuning t;
+    if (len < SP_STREAM_FLOOR) {
+        return false;
+    }
+    sp_tuning_get(&t);
+    return len >= t.stream_min;
+#else
+    (void)len;
+    return false;
+#endif
+}
+
+/* Streams n bytes without the closing fence, for callers streaming several blocks */
+static void sp_stream_store(uint8_t* d, const uint8_t* s, size_t n) {
+#ifdef SP_STREAM_SSE2
+    /* Streaming stores need 16 byte aligned destinations, so the unaligned head and tail are stored normally */
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) {
+        head = n;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        _mm_stream_si128((__m128i*)d, a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
+        s += 64;
+        d += 64;
+    }
+    for (; n >= 16; n -= 16) {
+        _mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+        s += 16;
+        d += 16;
+    }
+#endif
+    memcpy(d, s, n);
+}
+
+static void sp_stream_fence(void) {
+#ifdef SP_STREAM_SSE2
+    /* Streaming stores are weakly ordered, and must be visible before the output is handed on */
+    _mm_sfence();
+#endif
+}
+
+void sp_stream_copy(void* dst, const void* src, size_t n) {
+    sp_stream_store(dst, src, n);
+    sp_stream_fence();
+}
+
+void sp_stream_swap(void* dst, const void* src, size_t n, int width) {
+    uint8_t stage[SP_STREAM_STAGE];
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    const size_t per_stage = SP_STREAM_STAGE / (size_t)width;
+    while (n > 0) {
+        size_t chunk = n < per_stage ? n : per_stage;
+        sp_swap_array(stage, s, chunk, width);
+        sp_stream_store(d, stage, chunk * (size_t)width);
+        s += chunk * (size_t)width;
+        d += chunk * (size_t)width;
+        n -= chunk;
+    }
+    sp_stream_fence();
+}
+
+SPResult sp_stream_records(sp_record_fn fn, void* ctx, size_t count, size_t size, bool stream, uint8_t* out, size_t* built) {
+    SPResult res = SP_OK;
+    size_t i = 0;
+    if (!stream || size == 0 || size > SP_STREAM_STAGE) {
+        for (; i < count; i++) {
+            /* Zeroed as in the staging block, so padding comes out the same either way */
+            memset(out + i * size, 0, size);
+            res = fn(ctx, i, out + i * size);
+            if (res != SP_OK) {
+                break;
+            }
+        }
+    } else {
+        uint8_t stage[SP_STREAM_STAGE];
+        const size_t per_stage = SP_STREAM_STAGE / size;
+        while (i < count && res == SP_OK) {
+            size_t first = i;
+            size_t end = count - i < per_stage ? count : i + per_stage;
+            memset(stage, 0, (end - first) * size);
+            for (; i < end; i++) {
+                res = fn(ctx, i, stage + (i - first) * size);
+                if (res != SP_OK) {
+                    break;
+                }
+            }
+            sp_stream_store(out + first * size, stage, (i - first) * size);
+        }
+        sp_stream_fence();
+    }
+    if (built) {
+        *built = i;
+    }
+    return res;
+}
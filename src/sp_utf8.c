@@ -0,0 +1,210 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_internal.h"
+
+#define SP_REPLACEMENT_CHAR 0xfffd
+
+/* Byte masks for a word of 'w' or 'u' code units as they appear in the buffer. The low byte of
+   each unit sits at a different position depending on byte order, so masks are built byte by
+   byte and work the same on any host. */
+struct sp_ascii_masks {
+    uint64_t not_ascii;   /* Set bits that must be clear in an ASCII unit */
+    uint64_t low_7f;      /* 0x7f in the low byte of each unit */
+    uint64_t low_80;      /* 0x80 in the low byte of each unit */
+    int low;              /* Position of the low byte within a unit */
+};
+
+static struct sp_ascii_masks sp_make_masks(int width, enum sp_endian endian) {
+    struct sp_ascii_masks m;
+    uint8_t not_ascii[8], low_7f[8], low_80[8];
+    int i;
+    m.low = (endian == SP_LITTLE_ENDIAN) ? 0 : width - 1;
+    for (i = 0; i < 8; i++) {
+        bool is_low = (i % width) == m.low;
+        not_ascii[i] = is_low ? 0x80 : 0xff;
+        low_7f[i] = is_low ? 0x7f : 0x00;
+        low_80[i] = is_low ? 0x80 : 0x00;
+    }
+    memcpy(&m.not_ascii, not_ascii, 8);
+    memcpy(&m.low_7f, low_7f, 8);
+    memcpy(&m.low_80, low_80, 8);
+    return m;
+}
+
+/* Whether a word of code units is all ASCII, with no null terminator. Adding 0x7f to a low byte
+   of at most 0x7f sets its top bit unless it was zero, without carrying into the next byte. */
+static bool sp_ascii_word(uint64_t w, const struct sp_ascii_masks* m) {
+    return (w & m->not_ascii) == 0 && (((w & m->low_7f) + m->low_7f) & m->low_80) == m->low_80;
+}
+
+static int sp_utf8_encode(char* dst, uint32_t cp) {
+    if (cp < 0x80) {
+        dst[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        dst[0] = (char)(0xc0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    } else if (cp < 0x10000) {
+        dst[0] = (char)(0xe0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        dst[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    dst[0] = (char)(0xf0 | (cp >> 18));
+    dst[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    dst[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    dst[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+/* Decode one code point from a null terminated string of at most max bytes. Returns the number
+   of bytes used, or 0 if the sequence is not valid UTF-8. Overlong forms and surrogates are
+   rejected. */
+static int sp_utf8_decode(const uint8_t* src, size_t max, uint32_t* cp) {
+    uint8_t b0 = src[0];
+    uint8_t lo = 0x80, hi = 0xbf;
+    int n, i;
+    if (b0 < 0x80) {
+        *cp = b0;
+        return 1;
+    } else if (b0 >= 0xc2 && b0 <= 0xdf) {
+        n = 2;
+        *cp = b0 & 0x1f;
+    } else if (b0 >= 0xe0 && b0 <= 0xef) {
+        n = 3;
+        *cp = b0 & 0x0f;
+        lo = (b0 == 0xe0) ? 0xa0 : 0x80;
+        hi = (b0 == 0xed) ? 0x9f : 0xbf;
+    } else if (b0 >= 0xf0 && b0 <= 0xf4) {
+        n = 4;
+        *cp = b0 & 0x07;
+        lo = (b0 == 0xf0) ? 0x90 : 0x80;
+        hi = (b0 == 0xf4) ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+    if ((size_t)n > max) {
+        return 0;
+    }
+    for (i = 1; i < n; i++) {
+        /* Only the first continuation byte has a narrower range. A null byte always fails */
+        if (src[i] < lo || src[i] > hi) {
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xbf;
+        *cp = (*cp << 6) | (src[i] & 0x3f);
+    }
+    return n;
+}
+
+static void sp_utf8_unpack(char* dst, const uint8_t* src, int len, int width, enum sp_endian endian) {
+    const struct sp_ascii_masks m = sp_make_masks(width, endian);
+    const int per_word = 8 / width;
+    size_t i = 0, n = (size_t)len, o = 0;
+    uint64_t w;
+    int k;
+    while (i < n) {
+        /* ASCII fast path, a word of code units at a time */
+        while (i + (size_t)per_word <= n) {
+            memcpy(&w, src + i * width, sizeof w);
+            if (!sp_ascii_word(w, &m)) {
+                break;
+            }
+            for (k = 0; k < per_word; k++) {
+                dst[o + k] = (char)src[(i + k) * width + m.low];
+            }
+            i += per_word;
+            o += per_word;
+        }
+        if (i >= n) {
+            break;
+        }
+        uint32_t cp = (uint32_t)sp_load_uint(src + i * width, width, endian);
+        i++;
+        if (cp == 0) {
+            break;
+        }
+        if (cp >= 0xd800 && cp <= 0xdbff && width == 2 && i < n) {
+            uint32_t low = (uint32_t)sp_load_uint(src + i * width, width, endian);
+            if (low >= 0xdc00 && low <= 0xdfff) {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                i++;
+            }
+        }
+        /* Unpaired surrogates and values beyond Unicode cannot be represented */
+        if ((cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) {
+            cp = SP_REPLACEMENT_CHAR;
+        }
+        o += (size_t)sp_utf8_encode(dst + o, cp);
+    }
+    dst[o] = '\0';
+}
+
+static SPResult sp_utf8_pack(uint8_t* dst, const uint8_t* src, int len, int width, enum sp_endian endian) {
+    const struct sp_ascii_masks m = sp_make_masks(width, endian);
+    const size_t max = (size_t)len * (width == 2 ? 3 : 4);
+    size_t i = 0, n = (size_t)len, units = 0;
+    uint64_t w;
+    int k;
+    while (i < max && src[i] != '\0') {
+        /* ASCII fast path, eight bytes at a time */
+        while (i + 8 <= max && units + 8 <= n) {
+            memcpy(&w, src + i, sizeof w);
+            if ((w & UINT64_C(0x8080808080808080)) != 0 ||
+                ((w - UINT64_C(0x0101010101010101)) & ~w & UINT64_C(0x8080808080808080)) != 0) {
+                break;
+            }
+            memset(dst + units * width, 0, (size_t)8 * width);
+            for (k = 0; k < 8; k++) {
+                dst[(units + k) * width + m.low] = src[i + k];
+            }
+            i += 8;
+            units += 8;
+        }
+        if (i >= max || src[i] == '\0') {
+            break;
+        }
+        uint32_t cp;
+        int used = sp_utf8_decode(src + i, max - i, &cp);
+        if (used == 0) {
+            return SP_ERR_ENCODING;
+        }
+        i += (size_t)used;
+        if (width == 2 && cp >= 0x10000) {
+            if (units + 2 > n) {
+                return SP_ERR_RANGE;
+            }
+            cp -= 0x10000;
+            sp_store_uint(dst + units * width, 0xd800 + (cp >> 10), width, endian);
+            sp_store_uint(dst + (units + 1) * width, 0xdc00 + (cp & 0x3ff), width, endian);
+            units += 2;
+        } else {
+            if (units + 1 > n) {
+                return SP_ERR_RANGE;
+            }
+            sp_store_uint(dst + units * width, cp, width, endian);
+            units++;
+        }
+    }
+    memset(dst + units * width, 0, (n - units) * width);
+    return SP_OK;
+}
+
+SPResult sp_utf8_field(char type, int len, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr) {
+    int width = sp_type_size(type);
+    if (action == SP_UNPACK) {
+        sp_utf8_unpack((char*)struct_ptr, (const uint8_t*)buff_ptr, len, width, endian);
+        return SP_OK;
+    }
+    return sp_utf8_pack((uint8_t*)buff_ptr, (const uint8_t*)struct_ptr, len, width, endian);
+}
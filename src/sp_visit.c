@@ -0,0 +1,154 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Streaming the fields of a packed record to callbacks, without a struct.
+ *
+ * Integers are converted a block at a time: the block is byte swapped (or
+ * copied) to native order with the same kernels as unpacking, then widened
+ * to 64 bits in a separate loop, into scratch space reused for every block.
+ * Plain strings are handed over straight from the buffer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_plan.h"
+
+/* Number of array elements passed to a callback at once */
+#define SP_VISIT_BLOCK 256
+/* UTF-8 fields up to this size are converted on the stack */
+#define SP_VISIT_UTF8_STACK 1024
+
+union sp_visit_native {
+    uint8_t u8[SP_VISIT_BLOCK * 8];
+    int8_t i8[SP_VISIT_BLOCK];
+    int16_t i16[SP_VISIT_BLOCK];
+    uint16_t u16[SP_VISIT_BLOCK];
+    int32_t i32[SP_VISIT_BLOCK];
+    uint32_t u32[SP_VISIT_BLOCK];
+    int64_t i64[SP_VISIT_BLOCK];
+    uint64_t u64[SP_VISIT_BLOCK];
+};
+
+union sp_visit_values {
+    int64_t s[SP_VISIT_BLOCK];
+    uint64_t u[SP_VISIT_BLOCK];
+};
+
+static void sp_visit_widen(char type, const union sp_visit_native* in, int n, union sp_visit_values* out) {
+    int i;
+    switch (type) {
+        case 'b':
+            for (i = 0; i < n; i++) out->s[i] = in->i8[i];
+            break;
+        case 'B':
+            for (i = 0; i < n; i++) out->u[i] = in->u8[i];
+            break;
+        case 'h':
+            for (i = 0; i < n; i++) out->s[i] = in->i16[i];
+            break;
+        case 'H':
+        case 'w':
+            for (i = 0; i < n; i++) out->u[i] = in->u16[i];
+            break;
+        case 'i':
+            for (i = 0; i < n; i++) out->s[i] = in->i32[i];
+            break;
+        case 'I':
+        case 'u':
+            for (i = 0; i < n; i++) out->u[i] = in->u32[i];
+            break;
+        case 'q':
+            memcpy(out->s, in->i64, (size_t)n * sizeof out->s[0]);
+            break;
+        default:
+            memcpy(out->u, in->u64, (size_t)n * sizeof out->u[0]);
+            break;
+    }
+}
+
+static SPResult sp_visit_ints(const sp_plan* plan, const struct sp_op* op, int field, const uint8_t* src,
+                              const sp_visitor* visitor, void* ctx)
+{
+    const bool is_signed = op->type == 'b' || op->type == 'h' || op->type == 'i' || op->type == 'q';
+    if (is_signed ? !visitor->on_signed : !visitor->on_unsigned) {
+        return SP_OK;
+    }
+    const int width = sp_type_size(op->type);
+    const bool swap = width > 1 && (plan->endian == SP_LITTLE_ENDIAN) != sp_host_little_endian();
+    union sp_visit_native native;
+    union sp_visit_values values;
+    for (int first = 0; first < op->len; first += SP_VISIT_BLOCK) {
+        int n = op->len - first < SP_VISIT_BLOCK ? op->len - first : SP_VISIT_BLOCK;
+        const uint8_t* p = src + (size_t)first * width;
+        if (swap) {
+            sp_swap_array(native.u8, p, (size_t)n, width);
+        } else {
+            memcpy(native.u8, p, (size_t)n * width);
+        }
+        sp_visit_widen(op->type, &native, n, &values);
+        SPResult res = is_signed ? visitor->on_signed(ctx, field, first, values.s, n)
+                                 : visitor->on_unsigned(ctx, field, first, values.u, n);
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    return SP_OK;
+}
+
+static SPResult sp_visit_utf8(const sp_plan* plan, const struct sp_op* op, int field, const uint8_t* src,
+                              const sp_visitor* visitor, void* ctx)
+{
+    char stack[SP_VISIT_UTF8_STACK];
+    size_t cap = (size_t)op->len * (op->type == 'w' ? 3 : 4) + 1;
+    char* str = cap <= sizeof stack ? stack : malloc(cap);
+    if (!str) {
+        return SP_ERR_ALLOC;
+    }
+    SPResult res = sp_utf8_field(op->type, op->len, plan->endian, SP_UNPACK, str, (void*)src);
+    if (res == SP_OK) {
+        res = visitor->on_string(ctx, field, str, (int)strlen(str));
+    }
+    if (str != stack) {
+        free(str);
+    }
+    return res;
+}
+
+SPResult sp_visit(const sp_plan* plan, const void* src_buff, int buff_len, const sp_visitor* visitor, void* ctx) {
+    if (!plan || !src_buff || !visitor) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (buff_len < 0 || (size_t)buff_len < plan->size) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    SPResult res = sp_plan_consts(plan, SP_UNPACK, (void*)src_buff);
+    if (res != SP_OK) {
+        return res;
+    }
+    const uint8_t* rec = src_buff;
+    for (int i = 0; i < plan->num_ops; i++) {
+        const struct sp_op* op = &plan->ops[i];
+        const uint8_t* src = rec + op->buf_off;
+        if (op->type == 's') {
+            if (visitor->on_string) {
+                const uint8_t* end = memchr(src, 0, (size_t)op->len);
+                res = visitor->on_string(ctx, i, (const char*)src, end ? (int)(end - src) : op->len);
+            }
+        } else if (op->utf8) {
+            if (visitor->on_string) {
+                res = sp_visit_utf8(plan, op, i, src, visitor, ctx);
+            }
+        } else {
+            res = sp_visit_ints(plan, op, i, src, visitor, ctx);
+        }
+        if (res != SP_OK) {
+            return res;
+        }
+    }
+    return SP_OK;
+}
@@ -0,0 +1,169 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Packing records straight into a memory mapped output file.
+ *
+ * The file is created at its final size, so every record has a fixed place
+ * in the mapping and can be packed there directly, in any order and from any
+ * number of threads, with no staging buffer and no write calls. Data reaches
+ * the disk when the writer is closed.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+#include "sp_plan.h"
+
+/* Smallest number of records worth handing to a thread of its own */
+#define SP_WRITER_MIN_TASK 4096
+
+struct sp_writer {
+    const struct sp_plan* plan;
+    struct sp_file_out map;
+    uint64_t offset;
+    size_t count;
+};
+
+/* One share of a batch, packed by one task */
+struct sp_writer_batch {
+    sp_writer* writer;
+    size_t first;
+    const uint8_t* bases;
+    size_t stride;
+    size_t count;
+    int num_tasks;
+    bool stream;
+    SPResult* results;
+};
+
+SPResult sp_writer_open(const char* path, uint64_t offset, const sp_plan* plan, size_t count, sp_writer** writer) {
+    if (!path || !plan || !writer) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (plan->size == 0) {
+        return SP_ERR_INVALID_PARAMS;
+    }
+    if (count > (UINT64_MAX - offset) / plan->size) {
+        return SP_ERR_INT;
+    }
+    struct sp_writer* w = calloc(1, sizeof *w);
+    if (!w) {
+        return SP_ERR_ALLOC;
+    }
+    SPResult res = sp_map_file_out(path, offset + (uint64_t)count * plan->size, &w->map);
+    if (res != SP_OK) {
+        sp_unmap_file_out(&w->map);
+        free(w);
+        return res;
+    }
+    w->plan = plan;
+    w->offset = offset;
+    w->count = count;
+    *writer = w;
+    return SP_OK;
+}
+
+void* sp_writer_data(sp_writer* writer) {
+    return writer ? writer->map.data : NULL;
+}
+
+SPResult sp_writer_pack(sp_writer* writer, size_t index, void* offset_base) {
+    if (!writer || !offset_base) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (index >= writer->count) {
+        return SP_ERR_RANGE;
+    }
+    const size_t size = writer->plan->size;
+    return sp_plan_pack(writer->plan, offset_base, writer->map.data + writer->offset + index * size, (int)size);
+}
+
+/* Records of one task's share, packed into the file through sp_stream_records */
+struct sp_writer_share {
+    const struct sp_writer_batch* batch;
+    const uint8_t* bases;
+    size_t ahead;
+    size_t count;
+};
+
+static SPResult sp_writer_record(void* ctx, size_t i, uint8_t* dst) {
+    const struct sp_writer_share* s = ctx;
+    const struct sp_writer_batch* b = s->batch;
+    if (s->ahead && i + s->ahead < s->count) {
+        SP_PREFETCH(s->bases + (i + s->ahead) * b->stride);
+    }
+    const sp_plan* plan = b->writer->plan;
+    return sp_plan_pack(plan, (void*)(s->bases + i * b->stride), dst, (int)plan->size);
+}
+
+static void sp_writer_task(void* ctx, int task) {
+    struct sp_writer_batch* b = ctx;
+    const size_t begin = b->count * (size_t)task / (size_t)b->num_tasks;
+    const size_t end = b->count * ((size_t)task + 1) / (size_t)b->num_tasks;
+    const size_t size = b->writer->plan->size;
+    struct sp_writer_share share;
+    share.batch = b;
+    share.bases = b->bases + begin * b->stride;
+    share.ahead = sp_prefetch_records(end - begin, b->stride);
+    share.count = end - begin;
+    uint8_t* dest = b->writer->map.data + b->writer->offset + (b->first + begin) * size;
+    b->results[task] = sp_stream_records(sp_writer_record, &share, share.count, size, b->stream, dest, NULL);
+}
+
+SPResult sp_writer_pack_batch(sp_writer* writer,
+                              size_t first,
+                              void* offset_bases,
+                              size_t stride,
+                              size_t count,
+                              int num_threads)
+{
+    if (!writer || !offset_bases) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    if (first > writer->count || count > writer->count - first) {
+        return SP_ERR_RANGE;
+    }
+    if (count == 0) {
+        return SP_OK;
+    }
+    if (num_threads <= 0) {
+        num_threads = sp_cpu_count();
+    }
+    size_t max_tasks = count / SP_WRITER_MIN_TASK + 1;
+    int num_tasks = max_tasks < (size_t)num_threads ? (int)max_tasks : num_threads;
+    struct sp_writer_batch b;
+    b.writer = writer;
+    b.first = first;
+    b.bases = offset_bases;
+    b.stride = stride;
+    b.count = count;
+    b.num_tasks = num_tasks;
+    /* Decided for the whole batch, as the shares together are what would displace the cache */
+    b.stream = sp_stream_wanted(count * writer->plan->size);
+    b.results = malloc((size_t)num_tasks * sizeof *b.results);
+    if (!b.results) {
+        return SP_ERR_ALLOC;
+    }
+    /* Each task packs its own contiguous range of records, so no two write the same bytes */
+    sp_run_tasks(sp_writer_task, &b, num_tasks, num_tasks);
+    SPResult res = SP_OK;
+    for (int i = 0; i < num_tasks && res == SP_OK; i++) {
+        res = b.results[i];
+    }
+    free(b.results);
+    return res;
+}
+
+SPResult sp_writer_close(sp_writer* writer) {
+    if (!writer) {
+        return SP_OK;
+    }
+    SPResult res = sp_unmap_file_out(&writer->map);
+    free(writer);
+    return res;
+}
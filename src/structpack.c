@@ -12,6 +12,45 @@
 #include "sp_parser.h"
 #include "sp_internal.h"
 
+/* Number of records to swap per pass over the format string in sp_swap_inplace */
+#define SP_SWAP_BLOCK 64
+/* Number of array elements converted per pass between differing field and member widths */
+#define SP_CONVERT_BLOCK 256
+
+/* Native order scratch space for a block of converted elements */
+union sp_block {
+    int8_t i8[SP_CONVERT_BLOCK];
+    uint8_t u8[SP_CONVERT_BLOCK];
+    int16_t i16[SP_CONVERT_BLOCK];
+    uint16_t u16[SP_CONVERT_BLOCK];
+    int32_t i32[SP_CONVERT_BLOCK];
+    uint32_t u32[SP_CONVERT_BLOCK];
+    uint64_t u64[SP_CONVERT_BLOCK];
+};
+
+bool sp_host_little_endian(void) {
+    const uint16_t probe = 1;
+    return *(const uint8_t*)&probe == 1;
+}
+
+int sp_type_size(char type) {
+    switch (type) {
+        case 'h':
+        case 'H':
+        case 'w':
+            return 2;
+        case 'i':
+        case 'I':
+        case 'u':
+            return 4;
+        case 'q':
+        case 'Q':
+            return 8;
+        default:
+            return 1;
+    }
+}
+
 /* endian conversion functions */
 static uint16_t sp_from_be16(uint16_t val) {
     uint8_t *tmp = (uint8_t*)&val;
@@ -141,6 +180,22 @@ static uint64_t sp_to_le64(uint64_t val) {
     return ret;
 }
 
+uint64_t sp_load_uint(const uint8_t* p, int width, enum sp_endian endian) {
+    uint64_t v = 0;
+    int i;
+    for (i = 0; i < width; i++) {
+        v |= (uint64_t)p[i] << (8 * ((endian == SP_LITTLE_ENDIAN) ? i : width - 1 - i));
+    }
+    return v;
+}
+
+void sp_store_uint(uint8_t* p, uint64_t v, int width, enum sp_endian endian) {
+    int i;
+    for (i = 0; i < width; i++) {
+        p[i] = (uint8_t)(v >> (8 * ((endian == SP_LITTLE_ENDIAN) ? i : width - 1 - i)));
+    }
+}
+
 static void sp_copy_8(void* struct_ptr, void* buff_ptr, int len, enum sp_action action, bool is_str) {
     if (action == SP_UNPACK) {
         memcpy(struct_ptr, buff_ptr, len);
@@ -218,18 +273,176 @@ static void sp_copy_64(void* struct_ptr, void* buff_ptr, int len, enum sp_endian
     }
 }
 
-static SPResult sp_pack_unpack_bin( enum sp_action action, 
-                                    const char* fmt_str, 
-                                    int num_fields,
-                                    void** ptr_list, 
-                                    size_t* offset_list, 
-                                    void* offset_base,
-                                    void* buff, 
-                                    int buff_len) 
-{
+int sp_copy_field(char type, int len, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr) {
+    /* Integer arrays too large to stay cached are written out with streaming stores */
+    const int width = sp_type_size(type);
+    const size_t bytes = (size_t)len * width;
+    if (bytes >= SP_STREAM_FLOOR && type != 's' && type != 'w' && type != 'u' && sp_stream_wanted(bytes)) {
+        void *src = (action == SP_UNPACK) ? buff_ptr : struct_ptr;
+        void *dst = (action == SP_UNPACK) ? struct_ptr : buff_ptr;
+        if (width > 1 && (endian == SP_LITTLE_ENDIAN) != sp_host_little_endian()) {
+            sp_stream_swap(dst, src, (size_t)len, width);
+        } else {
+            sp_stream_copy(dst, src, bytes);
+        }
+        return (int)bytes;
+    }
+    switch (type) {
+        case 'b':
+        case 'B':
+            sp_copy_8(struct_ptr, buff_ptr, len, action, false);
+            break;
+        case 'h':
+        case 'H':
+            sp_copy_16(struct_ptr, buff_ptr, len, endian, action, false);
+            break;
+        case 'i':
+        case 'I':
+            sp_copy_32(struct_ptr, buff_ptr, len, endian, action, false);
+            break;
+        case 'q':
+        case 'Q':
+            sp_copy_64(struct_ptr, buff_ptr, len, endian, action);
+            break;
+        case 's':
+            sp_copy_8(struct_ptr, buff_ptr, len, action, true);
+            break;
+        case 'w':
+            sp_copy_16(struct_ptr, buff_ptr, len, endian, action, true);
+            break;
+        case 'u':
+            sp_copy_32(struct_ptr, buff_ptr, len, endian, action, true);
+            break;
+    }
+    return (int)bytes;
+}
+
+/* Bring n elements of width bytes at p into native order, then sign or zero extend them to 64 bits.
+   Each loop works on a single type, so compilers are free to vectorize them */
+static void sp_extend_block(uint64_t* vals, union sp_block* blk, const void* p, size_t n, int width, bool is_signed, bool swap) {
+    size_t i;
+    if (swap) {
+        sp_swap_array(blk, p, n, width);
+    } else {
+        memcpy(blk, p, n * (size_t)width);
+    }
+    switch (width) {
+        case 1:
+            if (is_signed) {
+                for (i = 0; i < n; i++) vals[i] = (uint64_t)(int64_t)blk->i8[i];
+            } else {
+                for (i = 0; i < n; i++) vals[i] = blk->u8[i];
+            }
+            break;
+        case 2:
+            if (is_signed) {
+                for (i = 0; i < n; i++) vals[i] = (uint64_t)(int64_t)blk->i16[i];
+            } else {
+                for (i = 0; i < n; i++) vals[i] = blk->u16[i];
+            }
+            break;
+        case 4:
+            if (is_signed) {
+                for (i = 0; i < n; i++) vals[i] = (uint64_t)(int64_t)blk->i32[i];
+            } else {
+                for (i = 0; i < n; i++) vals[i] = blk->u32[i];
+            }
+            break;
+        default:
+            memcpy(vals, blk->u64, n * sizeof *vals);
+            break;
+    }
+}
 
-    SPResult err;
-    err = validate_format_str(fmt_str);
+/* Check that n extended values are representable in width bytes */
+static bool sp_block_fits(const uint64_t* vals, size_t n, int width, bool is_signed) {
+    size_t i;
+    bool bad = false;
+    if (width == 8) {
+        return true;
+    }
+    if (is_signed) {
+        const int64_t max = (INT64_C(1) << (8 * width - 1)) - 1;
+        const int64_t min = -max - 1;
+        for (i = 0; i < n; i++) {
+            bad |= ((int64_t)vals[i] < min) | ((int64_t)vals[i] > max);
+        }
+    } else {
+        const uint64_t max = (UINT64_C(1) << (8 * width)) - 1;
+        for (i = 0; i < n; i++) {
+            bad |= vals[i] > max;
+        }
+    }
+    return !bad;
+}
+
+/* Truncate n values to width bytes, and write them to p in the required byte order */
+static void sp_truncate_block(void* p, union sp_block* blk, const uint64_t* vals, size_t n, int width, bool swap) {
+    size_t i;
+    switch (width) {
+        case 1:
+            for (i = 0; i < n; i++) blk->u8[i] = (uint8_t)vals[i];
+            break;
+        case 2:
+            for (i = 0; i < n; i++) blk->u16[i] = (uint16_t)vals[i];
+            break;
+        case 4:
+            for (i = 0; i < n; i++) blk->u32[i] = (uint32_t)vals[i];
+            break;
+        default:
+            memcpy(blk->u64, vals, n * sizeof *vals);
+            break;
+    }
+    if (swap) {
+        sp_swap_array(p, blk, n, width);
+    } else {
+        memcpy(p, blk, n * (size_t)width);
+    }
+}
+
+SPResult sp_resize_field(char type, int len, int dest_width, enum sp_endian endian, enum sp_action action, void* struct_ptr, void* buff_ptr) {
+    const int field_width = sp_type_size(type);
+    const bool is_signed = (type == 'b' || type == 'h' || type == 'i' || type == 'q');
+    const bool swap = field_width > 1 && ((endian == SP_LITTLE_ENDIAN) != sp_host_little_endian());
+    const int src_width = (action == SP_UNPACK) ? field_width : dest_width;
+    const int dst_width = (action == SP_UNPACK) ? dest_width : field_width;
+    const uint8_t* src = (const uint8_t*)((action == SP_UNPACK) ? buff_ptr : struct_ptr);
+    uint8_t* dst = (uint8_t*)((action == SP_UNPACK) ? struct_ptr : buff_ptr);
+    union sp_block blk;
+    uint64_t vals[SP_CONVERT_BLOCK];
+    size_t done, n;
+    for (done = 0; done < (size_t)len; done += n) {
+        n = (size_t)len - done;
+        if (n > SP_CONVERT_BLOCK) {
+            n = SP_CONVERT_BLOCK;
+        }
+        sp_extend_block(vals, &blk, src + done * src_width, n, src_width, is_signed, action == SP_UNPACK && swap);
+        if (dst_width < src_width && !sp_block_fits(vals, n, dst_width, is_signed)) {
+            return SP_ERR_RANGE;
+        }
+        sp_truncate_block(dst + done * dst_width, &blk, vals, n, dst_width, action == SP_PACK && swap);
+    }
+    return SP_OK;
+}
+
+/* Check an expected constant on unpack, or write it on pack */
+static SPResult sp_const_field(const struct fmt_str_parser* p, enum sp_action action, uint8_t* buff_ptr) {
+    uint8_t value[8];
+    const uint8_t* expect = (const uint8_t*)p->current.literal;
+    size_t len = (size_t)p->current.arr_len;
+    if (!expect) {
+        parse_const_bytes(p, value);
+        expect = value;
+    }
+    if (action == SP_PACK) {
+        memcpy(buff_ptr, expect, len);
+        return SP_OK;
+    }
+    return (memcmp(buff_ptr, expect, len) == 0) ? SP_OK : SP_ERR_MISMATCH;
+}
+
+SPResult sp_format_size(const char* fmt_str, int num_fields, bool* strided, int* size) {
+    SPResult err = validate_format_str(fmt_str);
     if (err != SP_OK) {
         return err;
     }
@@ -237,76 +450,113 @@ static SPResult sp_pack_unpack_bin( enum sp_action action,
     if (err != SP_OK) {
         return err;
     }
-    int parsed_count = 0;
-    while (parse_next(&p) == 0) {
-        if (p.current.type != 'x') {
-            parsed_count++;
-        }
+    /* Parse to the end, to find how many offset list entries the format uses */
+    SPResult res;
+    size_t total = 0;
+    while ((res = parse_next(&p)) == SP_OK) {
+        total += (size_t)((p.current.arr_len > 0) ? p.current.arr_len : 1) * (size_t)sp_type_size(p.current.type);
     }
-    if (parsed_count != num_fields) {
+    if (res != SP_NULL_CHAR) {
+        return res;
+    }
+    if (num_fields >= 0 && p.num_slots != num_fields) {
         return SP_ERR_FIELD_CNT;
     }
-    reset_parser(&p);
-    SPResult res = SP_OK;
+    if (total > INT32_MAX) {
+        return SP_ERR_INT;
+    }
+    if (strided) {
+        *strided = p.has_strided;
+    }
+    if (size) {
+        *size = (int)total;
+    }
+    return SP_OK;
+}
+
+SPResult sp_pack_unpack_bin(enum sp_action action, 
+                            const char* fmt_str, 
+                            int num_fields,
+                            void** ptr_list, 
+                            const size_t* offset_list, 
+                            void* offset_base,
+                            void* buff, 
+                            int buff_len,
+                            int* used) 
+{
+    bool strided;
+    SPResult res = sp_format_size(fmt_str, num_fields, &strided, NULL);
+    if (res != SP_OK) {
+        return res;
+    }
+    /* Strided groups need offsets to step through an array of structs */
+    if (strided && !offset_list) {
+        return SP_ERR_UNSUPPORTED;
+    }
+    return sp_pack_unpack_fields(action, fmt_str, ptr_list, offset_list, offset_base, buff, buff_len, used);
+}
+
+SPResult sp_pack_unpack_fields(enum sp_action action,
+                               const char* fmt_str,
+                               void** ptr_list,
+                               const size_t* offset_list,
+                               void* offset_base,
+                               void* buff,
+                               int buff_len,
+                               int* used)
+{
+    SPResult res;
+    struct fmt_str_parser p = new_parser(fmt_str, &res);
+    if (res != SP_OK) {
+        return res;
+    }
     uint8_t* buff_ptr = (uint8_t*)buff;
     uint8_t* struct_ptr;
-    int off_index = 0;
     int len;
     while ((res = parse_next(&p)) == SP_OK) {
-        if ((buff_ptr - (uint8_t*)buff) > (ptrdiff_t)buff_len) {
+        len = 1;
+        if (p.current.arr_len > 0) {
+            len = p.current.arr_len;
+        }
+        if ((buff_ptr - (uint8_t*)buff) + (ptrdiff_t)len * sp_type_size(p.current.type) > (ptrdiff_t)buff_len) {
             return SP_ERR_BUFF_OVERRUN;
         }
+        if (p.current.type == 'x') {
+            if (p.current.constant) {
+                res = sp_const_field(&p, action, buff_ptr);
+                if (res != SP_OK) {
+                    return res;
+                }
+            }
+            buff_ptr += len;
+            continue;
+        }
         if (offset_list) {
-            struct_ptr = (uint8_t*)((char*)offset_base + offset_list[off_index]);
+            struct_ptr = (uint8_t*)((char*)offset_base + parse_struct_offset(&p, offset_list));
         } else {
-            struct_ptr = (uint8_t*)ptr_list[off_index];
-        }
-        len = 1;
-        if (p.current.arr_len > 0) {
-            len = p.current.arr_len;
+            struct_ptr = (uint8_t*)ptr_list[p.current.slot];
         }
-        switch (p.current.type) {
-            case 'x':
-                off_index--;
-                buff_ptr += len;
-                break;
-            case 'b':
-            case 'B':
-                sp_copy_8(struct_ptr, buff_ptr, len, action, false);
-                buff_ptr += len;
-                break;
-            case 'h':
-            case 'H':
-                sp_copy_16(struct_ptr, buff_ptr, len, p.endian, action, false);
-                buff_ptr += len * 2;
-                break;
-            case 'i':
-            case 'I':
-                sp_copy_32(struct_ptr, buff_ptr, len, p.endian, action, false);
-                buff_ptr += len * 4; 
-                break;
-            case 'q':
-            case 'Q':
-                sp_copy_64(struct_ptr, buff_ptr, len, p.endian, action);
-                buff_ptr += len * 8;
-                break;
-            case 's':
-                sp_copy_8(struct_ptr, buff_ptr, len, action, true);
-                buff_ptr += len;
-                break;
-            case 'w':
-                sp_copy_16(struct_ptr, buff_ptr, len, p.endian, action, true);
-                buff_ptr += len * 2;
-                break;
-            case 'u':
-                sp_copy_32(struct_ptr, buff_ptr, len, p.endian, action, true);
-                buff_ptr += len * 4;
-                break;
+        if (p.current.dest_width) {
+            res = sp_resize_field(p.current.type, len, p.current.dest_width, p.endian, action, struct_ptr, buff_ptr);
+            if (res != SP_OK) {
+                return res;
+            }
+            buff_ptr += len * sp_type_size(p.current.type);
+        } else if (p.current.utf8) {
+            res = sp_utf8_field(p.current.type, len, p.endian, action, struct_ptr, buff_ptr);
+            if (res != SP_OK) {
+                return res;
+            }
+            buff_ptr += len * sp_type_size(p.current.type);
+        } else {
+            buff_ptr += sp_copy_field(p.current.type, len, p.endian, action, struct_ptr, buff_ptr);
         }
-        off_index++;
     }
     if (res == SP_NULL_CHAR) {
         res = SP_OK;
+        if (used) {
+            *used = (int)(buff_ptr - (uint8_t*)buff);
+        }
     }
     return res;
 }
@@ -320,7 +570,7 @@ SPResult sp_unpack_bin_ptr( const char* fmt_str,
     if (!fmt_str || num_fields <= 0 || !ptr_list || !src_buff || buff_len <= 0) {
         return SP_ERR_MISSING_PARAMS;
     }
-    return sp_pack_unpack_bin(SP_UNPACK, fmt_str, num_fields, ptr_list, NULL, NULL, src_buff, buff_len);
+    return sp_pack_unpack_bin(SP_UNPACK, fmt_str, num_fields, ptr_list, NULL, NULL, src_buff, buff_len, NULL);
 }
 
 SPResult sp_pack_bin_ptr(const char* fmt_str, 
@@ -332,12 +582,12 @@ SPResult sp_pack_bin_ptr(const char* fmt_str,
     if (!fmt_str || num_fields <= 0 || !ptr_list || !dest_buff || buff_len <= 0) {
         return SP_ERR_MISSING_PARAMS;
     }
-    return sp_pack_unpack_bin(SP_PACK, fmt_str, num_fields, ptr_list, NULL, NULL, dest_buff, buff_len);
+    return sp_pack_unpack_bin(SP_PACK, fmt_str, num_fields, ptr_list, NULL, NULL, dest_buff, buff_len, NULL);
 }
 
 SPResult sp_unpack_bin_offset(  const char* fmt_str, 
                                 int num_fields, 
-                                size_t* offset_list, 
+                                const size_t* offset_list, 
                                 void* offset_base,
                                 void* src_buff, 
                                 int buff_len ) 
@@ -345,12 +595,12 @@ SPResult sp_unpack_bin_offset(  const char* fmt_str,
     if (!fmt_str || num_fields <= 0 || !offset_list || !offset_base || !src_buff || buff_len <= 0) {
         return SP_ERR_MISSING_PARAMS;
     }
-    return sp_pack_unpack_bin(SP_UNPACK, fmt_str, num_fields, NULL, offset_list, offset_base, src_buff, buff_len);
+    return sp_pack_unpack_bin(SP_UNPACK, fmt_str, num_fields, NULL, offset_list, offset_base, src_buff, buff_len, NULL);
 }
 
 SPResult sp_pack_bin_offset(const char* fmt_str, 
                             int num_fields, 
-                            size_t* offset_list, 
+                            const size_t* offset_list, 
                             void* offset_base,
                             void* dest_buff, 
                             int buff_len) 
@@ -358,5 +608,66 @@ SPResult sp_pack_bin_offset(const char* fmt_str,
     if (!fmt_str || num_fields <= 0 || !offset_list || !offset_base || !dest_buff || buff_len <= 0) {
         return SP_ERR_MISSING_PARAMS;
     }
-    return sp_pack_unpack_bin(SP_PACK, fmt_str, num_fields, NULL, offset_list, offset_base, dest_buff, buff_len);
+    return sp_pack_unpack_bin(SP_PACK, fmt_str, num_fields, NULL, offset_list, offset_base, dest_buff, buff_len, NULL);
+}
+
+SPResult sp_swap_inplace(const char* fmt_str,
+                         void* buff,
+                         int buff_len,
+                         int count)
+{
+    if (!fmt_str || !buff || buff_len <= 0 || count <= 0) {
+        return SP_ERR_MISSING_PARAMS;
+    }
+    SPResult err = validate_format_str(fmt_str);
+    if (err != SP_OK) {
+        return err;
+    }
+    struct fmt_str_parser p = new_parser(fmt_str, &err);
+    if (err != SP_OK) {
+        return err;
+    }
+    /* First pass determines the record size, so the whole buffer can be bounds checked up front */
+    SPResult res;
+    size_t rec_size = 0;
+    int len;
+    while ((res = parse_next(&p)) == SP_OK) {
+        len = (p.current.arr_len > 0) ? p.current.arr_len : 1;
+        rec_size += (size_t)len * sp_type_size(p.current.type);
+    }
+    if (res != SP_NULL_CHAR) {
+        return res;
+    }
+    if (rec_size * (size_t)count > (size_t)buff_len) {
+        return SP_ERR_BUFF_OVERRUN;
+    }
+    /* Data is already in host byte order */
+    if ((p.endian == SP_LITTLE_ENDIAN) == sp_host_little_endian()) {
+        return SP_OK;
+    }
+    /* Swap field by field across a block of records, so the format string is
+       only parsed once per block instead of once per record */
+    uint8_t* buff_ptr;
+    size_t field_off;
+    int start, n, r, size;
+    for (start = 0; start < count; start += SP_SWAP_BLOCK) {
+        n = (count - start < SP_SWAP_BLOCK) ? count - start : SP_SWAP_BLOCK;
+        reset_parser(&p);
+        field_off = 0;
+        while (parse_next(&p) == SP_OK) {
+            len = (p.current.arr_len > 0) ? p.current.arr_len : 1;
+            size = sp_type_size(p.current.type);
+            /* Integer constants are swapped like the integer they hold */
+            if (p.current.constant && !p.current.literal) {
+                size = len;
+                len = 1;
+            }
+            for (r = 0; r < n && size > 1; r++) {
+                buff_ptr = (uint8_t*)buff + (size_t)(start + r) * rec_size + field_off;
+                sp_swap_array(buff_ptr, buff_ptr, (size_t)len, size);
+            }
+            field_off += (size_t)len * size;
+        }
+    }
+    return SP_OK;
 }
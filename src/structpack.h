@@ -8,6 +8,7 @@
 #define STRUCTPACK_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "sp_struct_offsets.h"
 
 #if defined(_MSC_VER) 
@@ -16,6 +17,10 @@
 #define SP_API
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum {
     SP_OK,
     SP_NULL_CHAR,
@@ -26,9 +31,181 @@ typedef enum {
     SP_ERR_INVALID_FMT_STR,
     SP_ERR_INT,
     SP_ERR_FIELD_CNT,
-    SP_ERR_BUFF_OVERRUN
+    SP_ERR_BUFF_OVERRUN,
+    SP_ERR_ALLOC,
+    SP_ERR_UNSUPPORTED,
+    SP_ERR_RANGE,
+    SP_ERR_TAG,
+    SP_ERR_FRAME,
+    SP_ERR_ENCODING,
+    SP_ERR_MISMATCH,
+    SP_ERR_IO,
+    SP_ERR_NOT_FOUND,
+    SP_ERR_CORRUPT
 } SPResult;
 
+/*!
+ * \brief A format string and offset list compiled for repeated use
+ * 
+ * Created with sp_plan_compile, and released with sp_plan_free. A plan is
+ * not modified by packing or unpacking, and may be shared between threads.
+ * The one exception is a plan set to autotune on first use, which records
+ * its chosen kernel the first time it is used.
+ */
+typedef struct sp_plan sp_plan;
+
+/*!
+ * \brief Decodes messages made of a tag byte followed by a tag specific payload
+ * 
+ * Created with sp_dispatch_new, and released with sp_dispatch_free.
+ */
+typedef struct sp_dispatch sp_dispatch;
+
+/*!
+ * \brief Splits a byte stream of length prefixed frames, buffered in a fixed size ring
+ * 
+ * Created with sp_framer_new, and released with sp_framer_free.
+ */
+typedef struct sp_framer sp_framer;
+
+/*!
+ * \brief Fixed size records read from a file or memory with a plan
+ * 
+ * Created with sp_table_open or sp_table_open_mem, and released with
+ * sp_table_close. A table may not be used from several threads at once.
+ */
+typedef struct sp_table sp_table;
+
+/*!
+ * \brief A memory mapped output file of fixed size records
+ * 
+ * Created with sp_writer_open, and released with sp_writer_close.
+ */
+typedef struct sp_writer sp_writer;
+
+/*!
+ * \brief Compiled plans loaded from a blob saved by sp_plan_lib_build
+ * 
+ * Created with sp_plan_lib_open or sp_plan_lib_open_mem, and released with
+ * sp_plan_lib_close. A library is read only, and may be used from several
+ * threads at once.
+ */
+typedef struct sp_plan_lib sp_plan_lib;
+
+/*!
+ * \brief How sp_table_open reads a file
+ */
+typedef enum {
+    SP_TABLE_MAP,        /*!< Map the file into memory, reading through a buffer if it cannot be mapped */
+    SP_TABLE_BUFFERED    /*!< Always read records through a buffer */
+} sp_table_mode;
+
+/*!
+ * \brief Kind of key index built by sp_table_index
+ */
+typedef enum {
+    SP_INDEX_SORTED,     /*!< Sorted array of keys, searched by bisection */
+    SP_INDEX_HASH        /*!< Open addressing hash table */
+} sp_index_kind;
+
+/*!
+ * \brief Strategy a plan uses to pack and unpack records
+ * 
+ * Every kernel gives identical results, they differ only in speed.
+ */
+typedef enum {
+    SP_KERNEL_INTERP,    /*!< Interpret the plan a field at a time */
+    SP_KERNEL_SIMD,      /*!< As the interpreter, with arrays copied or byte swapped in bulk */
+    SP_KERNEL_COPY,      /*!< Adjacent fields coalesced into single copies and byte swaps */
+    SP_KERNEL_JIT        /*!< Native code generated by sp_plan_jit */
+} sp_kernel;
+
+#define SP_NUM_KERNELS 4
+
+/*!
+ * \brief A plan's kernel, and how it was chosen
+ */
+typedef struct {
+    sp_kernel kernel;                 /*!< Kernel in use */
+    int tuned;                        /*!< Non zero once the kernel has been chosen by autotuning */
+    int available[SP_NUM_KERNELS];    /*!< Non zero for kernels that can run the plan */
+    double ns[SP_NUM_KERNELS];        /*!< Nanoseconds to pack and unpack a record, measured when tuning, 0 if not timed */
+} sp_kernel_info;
+
+/*!
+ * \brief Allocator used by sp_buf
+ * 
+ * Behaves like realloc, except that a size of 0 frees ptr.
+ */
+typedef void* (*sp_realloc_fn)(void* ctx, void* ptr, size_t size);
+
+/*!
+ * \brief Growable output buffer that packed records are appended to
+ * 
+ * Initialize with sp_buf_init, and release with sp_buf_free. Packed data is
+ * in data[0] to data[len - 1].
+ */
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    sp_realloc_fn realloc_fn;
+    void* alloc_ctx;
+} sp_buf;
+
+/*!
+ * \brief Position within a buffer of back to back records
+ * 
+ * Initialize with sp_cursor_init. Records are read from or written to
+ * buf[pos], and pos is advanced past each one. pos never exceeds limit.
+ */
+typedef struct {
+    unsigned char* buf;
+    size_t pos;
+    size_t limit;
+} sp_cursor;
+
+/*!
+ * \brief Payload layout for a single tag value
+ */
+typedef struct {
+    int tag;               /*!< Tag byte value, 0 to 255 */
+    const char* fmt_str;   /*!< format string of the payload following the tag */
+    int num_fields;        /*!< Number of fields in offset_list */
+    const size_t* offset_list;   /*!< List of struct member offsets to unpack the payload to */
+} sp_dispatch_entry;
+
+/*!
+ * \brief Callbacks receiving the fields of a packed record from sp_visit
+ * 
+ * Any callback may be NULL, to skip fields of that kind. Returning anything
+ * other than 'SP_OK' stops the visit, and sp_visit returns it.
+ */
+typedef struct {
+    /*! 'b', 'h', 'i' and 'q' fields, sign extended */
+    SPResult (*on_signed)(void* ctx, int field, int first, const int64_t* values, int count);
+    /*! 'B', 'H', 'I' and 'Q' fields, and the code units of 'w' and 'u' fields */
+    SPResult (*on_unsigned)(void* ctx, int field, int first, const uint64_t* values, int count);
+    /*! 's' fields up to the first null byte, and 'w:s' and 'u:s' fields converted to UTF-8. Not null terminated */
+    SPResult (*on_string)(void* ctx, int field, const char* str, int len);
+} sp_visitor;
+
+/*!
+ * \brief Thresholds for the memory optimizations of large batches
+ * 
+ * Batches reading at least prefetch_min bytes prefetch the records
+ * prefetch_ahead bytes ahead of the one being converted. Batches and array
+ * fields writing at least stream_min bytes store their output with non
+ * temporal stores, which bypass the cache, so that output too large to stay
+ * cached does not evict the data still being read. Streaming stores are only
+ * used on x86 targets with SSE2.
+ */
+typedef struct {
+    size_t prefetch_min;   /*!< Smallest batch in bytes to prefetch for, SIZE_MAX to never prefetch */
+    size_t prefetch_ahead; /*!< Prefetch distance in bytes */
+    size_t stream_min;     /*!< Smallest output in bytes to write with streaming stores, SIZE_MAX to never stream */
+} sp_tuning;
+
 /*!
  * \brief Assign struct member offset(s) to an offset array
  *
@@ -42,6 +219,22 @@ typedef enum {
  */
 #define SP_ADD_STRUCT_OFFSET(arr, index, type, ...) EXPAND(GET_MACRO(__VA_ARGS__, SP_OFFSET16, SP_OFFSET15, SP_OFFSET14, SP_OFFSET13, SP_OFFSET12, SP_OFFSET11, SP_OFFSET10, SP_OFFSET9, SP_OFFSET8, SP_OFFSET7, SP_OFFSET6, SP_OFFSET5, SP_OFFSET4, SP_OFFSET3, SP_OFFSET2, SP_OFFSET1)(arr, index, type, __VA_ARGS__))
 
+/*!
+ * \brief Assign the offset and element stride of an array of structs to an offset array
+ *
+ * A strided group such as '8{4s 3i q}' takes two offset array entries for the
+ * array, followed by the offsets of the group's fields within one element,
+ * which can be added with SP_ADD_STRUCT_OFFSET.
+ * 
+ * \param arr : array of type size_t arr[]
+ * \param index : start index in arr to use. Two entries are used
+ * \param type : struct type, eg: 'struct somestruct'
+ * \param member : Array member of type holding the elements
+ */
+#define SP_ADD_STRIDE(arr, index, type, member) \
+    (arr)[(index)] = offsetof(type, member); \
+    (arr)[(index) + 1] = sizeof(((type*)0)->member[0])
+
 /*!
  * \brief Unpack binary data to a struct using pointers to struct members
  * 
@@ -93,7 +286,7 @@ SP_API SPResult sp_pack_bin_ptr(
 SP_API SPResult sp_unpack_bin_offset(
     const char* fmt_str, 
     int num_fields, 
-    size_t* offset_list, 
+    const size_t* offset_list, 
     void* offset_base,
     void* src_buff, 
     int buff_len
@@ -113,10 +306,900 @@ SP_API SPResult sp_unpack_bin_offset(
 SP_API SPResult sp_pack_bin_offset(
     const char* fmt_str, 
     int num_fields, 
-    size_t* offset_list, 
+    const size_t* offset_list, 
     void* offset_base,
     void* dest_buff, 
     int buff_len
 );
 
+/*!
+ * \brief Compile a format string and offset list into a plan
+ * 
+ * The format string is parsed once, and every field is resolved to a
+ * constant buffer and struct offset.
+ * 
+ * A plan compiled without an offset list can only be used to read packed
+ * data, with sp_visit, sp_hash and the like. Packing and unpacking with it
+ * returns 'SP_ERR_UNSUPPORTED'.
+ * 
+ * \param fmt_str : format string to compile
+ * \param num_fields : Number of fields in offset_list. Must match what fmt_str parses
+ * \param offset_list : List of struct member offsets, or NULL. Copied into the plan
+ * \param plan : Set to the new plan on success
+ * \return SPResult : Result will be 'SP_OK' if compilation was successful
+ */
+SP_API SPResult sp_plan_compile(
+    const char* fmt_str,
+    int num_fields,
+    const size_t* offset_list,
+    sp_plan** plan
+);
+
+/*!
+ * \brief Free a plan created with sp_plan_compile
+ */
+SP_API void sp_plan_free(sp_plan* plan);
+
+/*!
+ * \brief Number of bytes a single packed record described by the plan occupies
+ */
+SP_API int sp_plan_size(const sp_plan* plan);
+
+/*!
+ * \brief Unpack binary data to a struct using a compiled plan
+ * 
+ * \param plan : Plan to use
+ * \param offset_base : Address of structure to write into
+ * \param src_buff : Source buffer to read from
+ * \param buff_len : Source buffer length in bytes
+ * \return SPResult : Result will be 'SP_OK' if unpacking was successful
+ */
+SP_API SPResult sp_plan_unpack(
+    const sp_plan* plan,
+    void* offset_base,
+    void* src_buff,
+    int buff_len
+);
+
+/*!
+ * \brief Pack a struct to binary data using a compiled plan
+ * 
+ * \param plan : Plan to use
+ * \param offset_base : Address of structure to read from
+ * \param dest_buff : Destination buffer to write to
+ * \param buff_len : Destination buffer length in bytes
+ * \return SPResult : Result will be 'SP_OK' if packing was successful
+ */
+SP_API SPResult sp_plan_pack(
+    const sp_plan* plan,
+    void* offset_base,
+    void* dest_buff,
+    int buff_len
+);
+
+/*!
+ * \brief Generate native code for a plan
+ * 
+ * Once successful, sp_plan_unpack and sp_plan_pack run the generated code
+ * instead of interpreting the plan. Results are identical either way.
+ * Only available on x86-64 with System V calling conventions, elsewhere
+ * (or if executable memory cannot be mapped) the plan is left untouched.
+ * 
+ * \param plan : Plan to generate code for
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_UNSUPPORTED' if the interpreter is used instead
+ */
+SP_API SPResult sp_plan_jit(sp_plan* plan);
+
+/*!
+ * \brief Time each kernel on a plan, and keep the fastest
+ * 
+ * Each available kernel packs and unpacks a scratch record repeatedly, and
+ * the one with the lowest time is used by sp_plan_unpack and sp_plan_pack
+ * from then on. A plan is tuned at most once. Without autotuning the plan
+ * keeps the interpreter, or generated code after sp_plan_jit.
+ * 
+ * With on_first_use set, tuning is deferred to the first time the plan
+ * packs or unpacks a record, on whichever thread that is. Records handled
+ * by other threads while tuning is under way use the interpreter.
+ * 
+ * \param plan : Plan to tune
+ * \param on_first_use : Non zero to tune on first use, zero to tune now
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_UNSUPPORTED' for plans compiled without an offset list
+ */
+SP_API SPResult sp_plan_autotune(sp_plan* plan, int on_first_use);
+
+/*!
+ * \brief Force a plan to use a kernel, generating code for SP_KERNEL_JIT if needed
+ * 
+ * Replaces any kernel chosen or still to be chosen by autotuning. Like
+ * sp_plan_jit, this must not be called while the plan is in use on other
+ * threads.
+ * 
+ * \param plan : Plan to change
+ * \param kernel : Kernel to use
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_UNSUPPORTED' if the kernel cannot run the plan
+ */
+SP_API SPResult sp_plan_set_kernel(sp_plan* plan, sp_kernel kernel);
+
+/*!
+ * \brief Report the kernel a plan uses, and the timings it was chosen from
+ * 
+ * Before tuning, SP_KERNEL_JIT is only reported as available once code has
+ * been generated for the plan.
+ */
+SP_API void sp_plan_kernel_info(const sp_plan* plan, sp_kernel_info* info);
+
+/*!
+ * \brief Short name of a kernel, such as "interp" or "jit"
+ */
+SP_API const char* sp_kernel_name(sp_kernel kernel);
+
+/*!
+ * \brief Check the expected constants of a batch of records, without unpacking them
+ * 
+ * Records are back to back, each sp_plan_size bytes long. Bit 'i % 8' of
+ * byte 'i / 8' in bad_records is set if any constant of record 'i' differs.
+ * 
+ * \param plan : Plan to check against
+ * \param src_buff : Source buffer holding count records
+ * \param buff_len : Source buffer length in bytes
+ * \param count : Number of records to check
+ * \param bad_records : Bitmap of at least (count + 7) / 8 bytes
+ * \param num_bad : Number of records with a mismatched constant
+ * \return SPResult : Result will be 'SP_OK' if all records were checked
+ */
+SP_API SPResult sp_plan_validate(
+    const sp_plan* plan,
+    const void* src_buff,
+    int buff_len,
+    int count,
+    unsigned char* bad_records,
+    int* num_bad
+);
+
+/*!
+ * \brief Pack only the fields of a struct that changed since a previous version
+ * 
+ * The delta is a bitmap of (num_fields + 7) / 8 bytes, with bit 'i % 8' of
+ * byte 'i / 8' set if field 'i' changed, followed by the changed fields in
+ * the plan's wire format. At most the bitmap plus sp_plan_size bytes are
+ * written.
+ * 
+ * \param plan : Plan describing the struct
+ * \param prev : Previous version of the struct, or NULL to include every field
+ * \param cur : Current version of the struct
+ * \param dest_buff : Destination buffer to write the delta to
+ * \param buff_len : Destination buffer length in bytes
+ * \param delta_len : Set to the number of bytes written
+ * \return SPResult : Result will be 'SP_OK' if the delta was written
+ */
+SP_API SPResult sp_plan_delta_pack(
+    const sp_plan* plan,
+    void* prev,
+    void* cur,
+    void* dest_buff,
+    int buff_len,
+    int* delta_len
+);
+
+/*!
+ * \brief Apply a delta written by sp_plan_delta_pack to a struct
+ * 
+ * Only the fields present in the delta are unpacked, the rest of the struct
+ * is left as is.
+ * 
+ * \param plan : Plan the delta was packed with
+ * \param offset_base : Address of structure to update
+ * \param src_buff : Buffer starting with the delta
+ * \param buff_len : Source buffer length in bytes
+ * \param consumed : Set to the length of the delta in bytes
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_BUFF_OVERRUN' if the delta is truncated
+ */
+SP_API SPResult sp_plan_delta_apply(
+    const sp_plan* plan,
+    void* offset_base,
+    void* src_buff,
+    int buff_len,
+    int* consumed
+);
+
+/*!
+ * \brief Hash selected fields of a packed record, without unpacking it
+ * 
+ * Bit 'i' of field_mask selects field 'i' of the plan, counting each
+ * repetition of a repeated field or group as for sp_visit. Only the first 64
+ * fields can be selected. Padding and constants are never hashed.
+ * Integers hash by value, so the same fields hash the same way in big and
+ * little endian formats.
+ * 
+ * \param plan : Plan describing the record
+ * \param field_mask : Fields to hash
+ * \param record : Packed record, sp_plan_size bytes long
+ * \return uint64_t : Hash of the selected fields, or 0 if plan or record is NULL
+ */
+SP_API uint64_t sp_hash(const sp_plan* plan, uint64_t field_mask, const void* record);
+
+/*!
+ * \brief Hash selected fields of a batch of packed records
+ * 
+ * Gives the same hashes as sp_hash, working through one field of every
+ * record at a time.
+ * 
+ * \param plan : Plan describing a single record
+ * \param field_mask : Fields to hash
+ * \param src_buff : Source buffer of count back to back records
+ * \param buff_len : Source buffer length in bytes
+ * \param count : Number of records to hash
+ * \param hashes : Set to the hash of each record
+ * \return SPResult : Result will be 'SP_OK' if all records were hashed
+ */
+SP_API SPResult sp_hash_batch(
+    const sp_plan* plan,
+    uint64_t field_mask,
+    const void* src_buff,
+    int buff_len,
+    int count,
+    uint64_t* hashes
+);
+
+/*!
+ * \brief Compare selected fields of two packed records, without unpacking them
+ * 
+ * \param plan : Plan describing both records
+ * \param field_mask : Fields to compare, as for sp_hash
+ * \param a : First packed record
+ * \param b : Second packed record
+ * \return int : 1 if every selected field has the same bytes in both records, otherwise 0
+ */
+SP_API int sp_equal(const sp_plan* plan, uint64_t field_mask, const void* a, const void* b);
+
+/*!
+ * \brief Visit each field of a packed record, passing the decoded values to callbacks
+ * 
+ * field is the index of the field in the plan, counting each repetition of a
+ * repeated field or group. The value arrays are only valid until the callback
+ * returns. Values of an array field are passed in blocks, with first being
+ * the index of the first value in the block.
+ */
+SP_API SPResult sp_visit(
+    const sp_plan* plan,
+    const void* src_buff,
+    int buff_len,
+    const sp_visitor* visitor,
+    void* ctx
+);
+
+/*!
+ * \brief Create a dispatcher from a list of tag to payload layouts
+ * 
+ * Every payload format is compiled to a plan up front. Each tag may only
+ * appear once.
+ * 
+ * \param entries : List of payload layouts
+ * \param num_entries : Number of entries
+ * \param dispatch : Set to the new dispatcher on success
+ * \return SPResult : Result will be 'SP_OK' if all payload formats compiled
+ */
+SP_API SPResult sp_dispatch_new(
+    const sp_dispatch_entry* entries,
+    int num_entries,
+    sp_dispatch** dispatch
+);
+
+/*!
+ * \brief Free a dispatcher created with sp_dispatch_new
+ */
+SP_API void sp_dispatch_free(sp_dispatch* dispatch);
+
+/*!
+ * \brief Get the plan used for a tag, or NULL if the tag is unknown
+ * 
+ * The plan belongs to the dispatcher, and is freed with it.
+ */
+SP_API const sp_plan* sp_dispatch_plan(const sp_dispatch* dispatch, int tag);
+
+/*!
+ * \brief Unpack a single tagged message
+ * 
+ * \param dispatch : Dispatcher to use
+ * \param offset_base : Address of structure to write the payload into
+ * \param src_buff : Source buffer, starting with the tag byte
+ * \param buff_len : Source buffer length in bytes
+ * \param tag : Set to the tag byte read. May be NULL
+ * \param consumed : Set to the message length, including the tag. May be NULL
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_TAG' for an unknown tag
+ */
+SP_API SPResult sp_dispatch_unpack(
+    const sp_dispatch* dispatch,
+    void* offset_base,
+    void* src_buff,
+    int buff_len,
+    int* tag,
+    int* consumed
+);
+
+/*!
+ * \brief Unpack a stream of back to back tagged messages
+ * 
+ * Decoding stops after max_msgs messages, at an unknown tag, or when the
+ * remaining bytes do not hold a whole message. The unused remainder of the
+ * buffer starts at src_buff + consumed.
+ * 
+ * \param dispatch : Dispatcher to use
+ * \param out : Array of structures to write payloads into, typically of a union type
+ * \param out_stride : Distance in bytes between consecutive structures in out
+ * \param tags : Array of max_msgs tags, set to the tag of each message
+ * \param max_msgs : Maximum number of messages to unpack
+ * \param src_buff : Source buffer to read from
+ * \param buff_len : Source buffer length in bytes
+ * \param num_msgs : Set to the number of messages unpacked
+ * \param consumed : Set to the number of bytes of src_buff used
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_TAG' if stopped at an unknown tag
+ */
+SP_API SPResult sp_dispatch_unpack_batch(
+    const sp_dispatch* dispatch,
+    void* out,
+    size_t out_stride,
+    int* tags,
+    int max_msgs,
+    void* src_buff,
+    int buff_len,
+    int* num_msgs,
+    int* consumed
+);
+
+/*!
+ * \brief Create a framer for a stream of length prefixed records
+ * 
+ * Each frame is a length prefix, followed by that many payload bytes. The
+ * payload must be at least as long as the plan's packed size. Any extra
+ * payload bytes are skipped.
+ * 
+ * \param len_fmt : format string of the length prefix, a single integer. Eg: ">I"
+ * \param payload : Plan to unpack payloads with. Must outlive the framer
+ * \param capacity : Ring buffer size in bytes, rounded up to a power of two
+ * \param framer : Set to the new framer on success
+ * \return SPResult : Result will be 'SP_OK' if the framer was created
+ */
+SP_API SPResult sp_framer_new(
+    const char* len_fmt,
+    const sp_plan* payload,
+    int capacity,
+    sp_framer** framer
+);
+
+/*!
+ * \brief Free a framer created with sp_framer_new
+ */
+SP_API void sp_framer_free(sp_framer* framer);
+
+/*!
+ * \brief Number of bytes buffered, but not yet decoded
+ */
+SP_API int sp_framer_pending(const sp_framer* framer);
+
+/*!
+ * \brief Copy incoming stream data into the ring
+ * 
+ * \return int : Number of bytes copied. Less than len if the ring is full
+ */
+SP_API int sp_framer_write(sp_framer* framer, const void* data, int len);
+
+/*!
+ * \brief Get the largest contiguous free region of the ring, to receive into directly
+ * 
+ * Follow up with sp_framer_commit once data has been written to the region.
+ * 
+ * \param framer : Framer to use
+ * \param len : Set to the size of the free region in bytes. May be 0 if the ring is full
+ * \return void* : Start of the free region
+ */
+SP_API void* sp_framer_reserve(sp_framer* framer, int* len);
+
+/*!
+ * \brief Mark len bytes written to the region from sp_framer_reserve as buffered
+ * 
+ * len is clamped to the size of the free region sp_framer_reserve reports.
+ */
+SP_API void sp_framer_commit(sp_framer* framer, int len);
+
+/*!
+ * \brief Decode complete frames from the ring
+ * 
+ * Payloads are unpacked straight from the ring. Only payloads that wrap
+ * around the end of the ring are first copied to a preallocated scratch
+ * buffer. Incomplete frames are left buffered for the next call.
+ * 
+ * \param framer : Framer to use
+ * \param out : Array of structures to unpack payloads into
+ * \param out_stride : Distance in bytes between consecutive structures in out
+ * \param max_frames : Maximum number of frames to decode
+ * \param num_frames : Set to the number of frames decoded
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_FRAME' for a length prefix that is invalid for the payload or ring
+ */
+SP_API SPResult sp_framer_decode(
+    sp_framer* framer,
+    void* out,
+    size_t out_stride,
+    int max_frames,
+    int* num_frames
+);
+
+/*!
+ * \brief Calculate the number of bytes a record described by a format string packs to
+ * 
+ * \param fmt_str : format string to measure
+ * \param size : Set to the packed size in bytes
+ * \return SPResult : Result will be 'SP_OK' if fmt_str is valid
+ */
+SP_API SPResult sp_packed_size(const char* fmt_str, int* size);
+
+/*!
+ * \brief Initialize an empty output buffer
+ * 
+ * \param buf : Buffer to initialize
+ * \param realloc_fn : Allocator to use, or NULL for realloc and free
+ * \param alloc_ctx : Passed to realloc_fn
+ */
+SP_API void sp_buf_init(sp_buf* buf, sp_realloc_fn realloc_fn, void* alloc_ctx);
+
+/*!
+ * \brief Free the memory of an output buffer, leaving it empty
+ */
+SP_API void sp_buf_free(sp_buf* buf);
+
+/*!
+ * \brief Ensure at least additional bytes can be appended without reallocating
+ * 
+ * Capacity grows geometrically, so many small reservations only reallocate
+ * a logarithmic number of times.
+ */
+SP_API SPResult sp_buf_reserve(sp_buf* buf, size_t additional);
+
+/*!
+ * \brief Pack a struct to the end of an output buffer using struct member offsets
+ * 
+ * \param fmt_str : format string to use to format outgoing data
+ * \param num_fields  : Number of fields to read from. Must match what fmt_str parses
+ * \param offset_list : List of struct member offsets to read from
+ * \param offset_base : Address of structure to read from
+ * \param buf : Buffer to append to
+ * \return SPResult : Result will be 'SP_OK' if packing was successful
+ */
+SP_API SPResult sp_pack_bin_offset_append(
+    const char* fmt_str,
+    int num_fields,
+    const size_t* offset_list,
+    void* offset_base,
+    sp_buf* buf
+);
+
+/*!
+ * \brief Pack a struct to the end of an output buffer using a compiled plan
+ */
+SP_API SPResult sp_plan_pack_append(const sp_plan* plan, void* offset_base, sp_buf* buf);
+
+/*!
+ * \brief Pack an array of structs to the end of an output buffer using a compiled plan
+ * 
+ * Space for the whole batch is reserved once up front.
+ * 
+ * \param plan : Plan to use
+ * \param offset_bases : Address of the first structure to read from
+ * \param stride : Distance in bytes between consecutive structures
+ * \param count : Number of structures to pack
+ * \param buf : Buffer to append to
+ * \return SPResult : Result will be 'SP_OK' if packing was successful
+ */
+SP_API SPResult sp_plan_pack_batch_append(
+    const sp_plan* plan,
+    void* offset_bases,
+    size_t stride,
+    int count,
+    sp_buf* buf
+);
+
+/*!
+ * \brief Start a cursor at the beginning of a buffer
+ * 
+ * \param cur : Cursor to initialize
+ * \param buff : Buffer to read from or write to
+ * \param buff_len : Buffer length in bytes
+ */
+SP_API void sp_cursor_init(sp_cursor* cur, void* buff, size_t buff_len);
+
+/*!
+ * \brief Advance a cursor without reading or writing anything
+ * 
+ * \return SPResult : 'SP_ERR_BUFF_OVERRUN' if fewer than len bytes remain
+ */
+SP_API SPResult sp_cursor_skip(sp_cursor* cur, size_t len);
+
+/*!
+ * \brief Unpack the record at a cursor using struct member offsets, and advance past it
+ * 
+ * The cursor advances by the size of the record, including any trailing
+ * padding in fmt_str, and is left where it was if unpacking fails. A format
+ * with no fields, such as a constant, may be given num_fields 0 and a NULL
+ * offset_list.
+ * 
+ * \param cur : Cursor to read from
+ * \param fmt_str : format string to use to interpret incoming data
+ * \param num_fields  : Number of fields to unpack to. Must match what fmt_str parses
+ * \param offset_list : List of struct member offsets to unpack to
+ * \param offset_base : Address of structure to unpack to
+ * \return SPResult : Result will be 'SP_OK' if unpacking was successful
+ */
+SP_API SPResult sp_cursor_unpack(
+    sp_cursor* cur,
+    const char* fmt_str,
+    int num_fields,
+    const size_t* offset_list,
+    void* offset_base
+);
+
+/*!
+ * \brief Pack a struct at a cursor using struct member offsets, and advance past it
+ * 
+ * As sp_cursor_unpack, in the other direction.
+ */
+SP_API SPResult sp_cursor_pack(
+    sp_cursor* cur,
+    const char* fmt_str,
+    int num_fields,
+    const size_t* offset_list,
+    void* offset_base
+);
+
+/*!
+ * \brief Unpack the record at a cursor using a compiled plan, and advance past it
+ */
+SP_API SPResult sp_cursor_plan_unpack(sp_cursor* cur, const sp_plan* plan, void* offset_base);
+
+/*!
+ * \brief Pack a struct at a cursor using a compiled plan, and advance past it
+ */
+SP_API SPResult sp_cursor_plan_pack(sp_cursor* cur, const sp_plan* plan, void* offset_base);
+
+/*!
+ * \brief Convert packed records to host byte order, in place
+ * 
+ * Only multi-byte fields are swapped. Skipped 'x' bytes and byte sized
+ * fields are left untouched. Once converted, the buffer should no longer be
+ * interpreted using fmt_str.
+ * 
+ * \param fmt_str : format string describing a single record
+ * \param buff : Buffer of count back to back records to convert
+ * \param buff_len : Buffer length in bytes
+ * \param count : Number of records in buff
+ * \return SPResult : Result will be 'SP_OK' if conversion was successful
+ */
+SP_API SPResult sp_swap_inplace(
+    const char* fmt_str,
+    void* buff,
+    int buff_len,
+    int count
+);
+
+/*!
+ * \brief Convert packed records from one format to another, without an intermediate struct
+ * 
+ * Both formats must have the same number of fields (ignoring 'x'), and each
+ * pair of fields must have the same number of elements. Integers may change
+ * endianness, width and signedness. Strings may only be converted to strings.
+ * Padding bytes in the destination are zeroed.
+ * 
+ * \param src_fmt : format string describing a source record
+ * \param dest_fmt : format string describing a destination record
+ * \param src_buff : Source buffer of count back to back records
+ * \param src_len : Source buffer length in bytes
+ * \param dest_buff : Destination buffer to write count records to
+ * \param dest_len : Destination buffer length in bytes
+ * \param count : Number of records to convert
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_RANGE' if a value does not fit its destination field
+ */
+SP_API SPResult sp_transcode(
+    const char* src_fmt,
+    const char* dest_fmt,
+    void* src_buff,
+    int src_len,
+    void* dest_buff,
+    int dest_len,
+    int count
+);
+
+/*!
+ * \brief Open a file of back to back records for random access
+ * 
+ * Records start at offset bytes into the file, and are sp_plan_size bytes
+ * each. Trailing bytes too short to hold a whole record are ignored. The plan
+ * is not copied, and must outlive the table.
+ * 
+ * \param path : File to open
+ * \param offset : Offset of the first record in the file
+ * \param plan : Plan describing a single record
+ * \param mode : Whether to map the file, or read it through a buffer
+ * \param table : Set to the new table on success
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_IO' if the file could not be read
+ */
+SP_API SPResult sp_table_open(
+    const char* path,
+    uint64_t offset,
+    const sp_plan* plan,
+    sp_table_mode mode,
+    sp_table** table
+);
+
+/*!
+ * \brief Open back to back records already in memory for random access
+ * 
+ * \param data : Records, which must outlive the table
+ * \param len : Length of data in bytes
+ * \param plan : Plan describing a single record
+ * \param table : Set to the new table on success
+ * \return SPResult : Result will be 'SP_OK' if the table was created
+ */
+SP_API SPResult sp_table_open_mem(
+    const void* data,
+    size_t len,
+    const sp_plan* plan,
+    sp_table** table
+);
+
+/*!
+ * \brief Close a table, and free its index
+ */
+SP_API void sp_table_close(sp_table* table);
+
+/*!
+ * \brief Number of whole records in a table
+ */
+SP_API size_t sp_table_count(const sp_table* table);
+
+/*!
+ * \brief Unpack a single record of a table
+ * 
+ * \param table : Table to read from
+ * \param index : Record number, from 0
+ * \param offset_base : Address of structure to write into
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_RANGE' if index is past the last record
+ */
+SP_API SPResult sp_table_read(sp_table* table, size_t index, void* offset_base);
+
+/*!
+ * \brief Build an index on one integer field of a table
+ * 
+ * Only the key field of each record is decoded. Records are split between
+ * num_threads threads, both to read keys and to build the index. Any
+ * previous index is replaced.
+ * 
+ * \param table : Table to index
+ * \param field : Index of the key field in the plan, counting each repetition as for sp_visit. Must be a single integer
+ * \param kind : Sorted or hashed index
+ * \param num_threads : Number of threads to use, or 0 for one per processor
+ * \return SPResult : Result will be 'SP_OK' if the index was built
+ */
+SP_API SPResult sp_table_index(
+    sp_table* table,
+    int field,
+    sp_index_kind kind,
+    int num_threads
+);
+
+/*!
+ * \brief Find the first record with a given key, and unpack it
+ * 
+ * Uses the index built by sp_table_index. Signed keys are passed sign
+ * extended, eg: (uint64_t)(int64_t)-5. Only the matching record is unpacked.
+ * 
+ * \param table : Table to search
+ * \param key : Key value to look for
+ * \param offset_base : Address of structure to write into, or NULL to only look up the record number
+ * \param index : Set to the record number if not NULL
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_NOT_FOUND' if no record has the key
+ */
+SP_API SPResult sp_table_find(
+    sp_table* table,
+    uint64_t key,
+    void* offset_base,
+    size_t* index
+);
+
+/*!
+ * \brief Create an output file sized for a number of records, and map it for packing into
+ * 
+ * Any existing file is replaced. The file is offset + count * sp_plan_size
+ * bytes long, with records starting offset bytes in. The bytes before the
+ * first record are zero, and can be written through sp_writer_data. The plan
+ * is not copied, and must outlive the writer.
+ * 
+ * \param path : File to create
+ * \param offset : Number of bytes before the first record, eg: for a header
+ * \param plan : Plan describing a single record
+ * \param count : Number of records the file holds
+ * \param writer : Set to the new writer on success
+ * \return SPResult : 'SP_ERR_IO' if the file cannot be created, 'SP_ERR_UNSUPPORTED' if it cannot be mapped
+ */
+SP_API SPResult sp_writer_open(
+    const char* path,
+    uint64_t offset,
+    const sp_plan* plan,
+    size_t count,
+    sp_writer** writer
+);
+
+/*!
+ * \brief Start of a writer's mapping, which is offset bytes before the first record
+ */
+SP_API void* sp_writer_data(sp_writer* writer);
+
+/*!
+ * \brief Pack a struct straight into the file, as record number index
+ * 
+ * \return SPResult : 'SP_ERR_RANGE' if index is past the last record
+ */
+SP_API SPResult sp_writer_pack(sp_writer* writer, size_t index, void* offset_base);
+
+/*!
+ * \brief Pack an array of structs straight into the file, in parallel
+ * 
+ * The records are split into contiguous ranges, one per thread. Records
+ * may be packed in any order, and several batches may run at once from
+ * different threads as long as their ranges do not overlap.
+ * 
+ * \param writer : Writer to pack into
+ * \param first : Record number of the first structure
+ * \param offset_bases : Address of the first structure to read from
+ * \param stride : Distance in bytes between consecutive structures
+ * \param count : Number of structures to pack
+ * \param num_threads : Number of threads to use, or 0 for one per processor
+ * \return SPResult : Result will be 'SP_OK' if packing was successful
+ */
+SP_API SPResult sp_writer_pack_batch(
+    sp_writer* writer,
+    size_t first,
+    void* offset_bases,
+    size_t stride,
+    size_t count,
+    int num_threads
+);
+
+/*!
+ * \brief Flush the file to disk, unmap it and free the writer
+ * 
+ * \return SPResult : 'SP_ERR_IO' if the data could not be written
+ */
+SP_API SPResult sp_writer_close(sp_writer* writer);
+
+/*!
+ * \brief Save compiled plans to a compact blob appended to a buffer
+ * 
+ * The blob holds no pointers, so it can be written to a file and later
+ * mapped at any address by sp_plan_lib_open. Plans with the same format share
+ * one copy of their fields, and struct offsets are stored in 16 bits when they
+ * all fit, so the blob is far smaller than the compiled plans.
+ * 
+ * \param plans : Plans to save. Their index in the array is their index in the library
+ * \param num_plans : Number of plans
+ * \param out : Buffer the blob is appended to
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_RANGE' if a struct offset or the blob exceeds 32 bits
+ */
+SP_API SPResult sp_plan_lib_build(const sp_plan* const* plans, int num_plans, sp_buf* out);
+
+/*!
+ * \brief Map a file holding a blob built by sp_plan_lib_build
+ * 
+ * Every plan is checked against the blob's bounds when it is opened, so a
+ * damaged file is rejected up front. Nothing is parsed or copied.
+ * 
+ * \return SPResult : 'SP_ERR_IO' if the file cannot be read, 'SP_ERR_CORRUPT' if it is not a valid blob
+ */
+SP_API SPResult sp_plan_lib_open(const char* path, sp_plan_lib** lib);
+
+/*!
+ * \brief Open a blob built by sp_plan_lib_build that is already in memory
+ * 
+ * \param data : Blob, which must outlive the library. It need not be aligned
+ * \param len : Length of data in bytes
+ * \param lib : Set to the new library on success
+ * \return SPResult : 'SP_ERR_CORRUPT' if data is not a valid blob
+ */
+SP_API SPResult sp_plan_lib_open_mem(const void* data, size_t len, sp_plan_lib** lib);
+
+/*!
+ * \brief Release a library, unmapping its file
+ */
+SP_API void sp_plan_lib_close(sp_plan_lib* lib);
+
+/*!
+ * \brief Number of plans in a library
+ */
+SP_API int sp_plan_lib_count(const sp_plan_lib* lib);
+
+/*!
+ * \brief Packed size of a record of a library's plan, or 0 if index is out of range
+ */
+SP_API int sp_plan_lib_size(const sp_plan_lib* lib, int index);
+
+/*!
+ * \brief Unpack a record with a plan straight from a library, as sp_plan_unpack
+ * 
+ * \return SPResult : 'SP_ERR_RANGE' if index is out of range, 'SP_ERR_UNSUPPORTED' if the plan has no offsets
+ */
+SP_API SPResult sp_plan_lib_unpack(
+    const sp_plan_lib* lib,
+    int index,
+    void* offset_base,
+    void* src_buff,
+    int buff_len
+);
+
+/*!
+ * \brief Pack a record with a plan straight from a library, as sp_plan_pack
+ * 
+ * \return SPResult : 'SP_ERR_RANGE' if index is out of range, 'SP_ERR_UNSUPPORTED' if the plan has no offsets
+ */
+SP_API SPResult sp_plan_lib_pack(
+    const sp_plan_lib* lib,
+    int index,
+    void* offset_base,
+    void* dest_buff,
+    int buff_len
+);
+
+/*!
+ * \brief Rebuild a compiled plan from a library, for use with the rest of the API
+ * 
+ * The plan is independent of the library, and is freed with sp_plan_free.
+ * 
+ * \return SPResult : 'SP_ERR_RANGE' if index is out of range
+ */
+SP_API SPResult sp_plan_lib_plan(const sp_plan_lib* lib, int index, sp_plan** plan);
+
+/*!
+ * \brief Current thresholds for the memory optimizations of large batches
+ * 
+ * Until sp_tuning_set is called these are defaults chosen for the processor
+ * from its cache sizes.
+ */
+SP_API void sp_tuning_get(sp_tuning* tuning);
+
+/*!
+ * \brief Replace the thresholds for the memory optimizations of large batches
+ * 
+ * Applies to the whole process, and should be called before any batches
+ * are started on other threads.
+ * 
+ * \param tuning : New thresholds, or NULL to restore the processor's defaults
+ */
+SP_API void sp_tuning_set(const sp_tuning* tuning);
+
+/*!
+ * \brief Sort packed records in place by one integer field
+ * 
+ * Keys are read straight from the packed bytes, in the byte order of the
+ * plan, and records are never unpacked. Signed fields sort as signed, and
+ * records with equal keys keep their order. Reading the keys is split
+ * between num_threads threads, the rest of the sort runs on the calling
+ * thread. Needs 32 bytes of scratch memory per record.
+ * 
+ * \param plan : Plan describing a single record
+ * \param key_field : Index of the key field in the plan, counting each repetition as for sp_visit. Must be a single integer
+ * \param buff : count back to back records, each sp_plan_size bytes long
+ * \param count : Number of records to sort
+ * \param num_threads : Number of threads to read keys with, or 0 for one per processor
+ * \return SPResult : 'SP_OK' on success, 'SP_ERR_INVALID_PARAMS' if the key field is not a single integer
+ */
+SP_API SPResult sp_sort(
+    const sp_plan* plan,
+    int key_field,
+    void* buff,
+    size_t count,
+    int num_threads
+);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // STRUCTPACK_H
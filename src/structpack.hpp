@@ -0,0 +1,517 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STRUCTPACK_HPP
+#define STRUCTPACK_HPP
+
+/*
+ * Compile time variant of libstructpack for C++17 and later.
+ *
+ * The format string is parsed while compiling, using the same grammar as
+ * sp_parser.c, and each field is bound directly to a member pointer. The
+ * generated pack and unpack functions are straight line code with constant
+ * buffer offsets, so no format string is parsed at runtime.
+ *
+ *    static constexpr char fmt[] = ">Iq 12s";
+ *    using some_codec = sp::codec<fmt, &some_struct::a, &some_struct::b, &some_struct::str>;
+ *    SPResult res = some_codec::unpack(s, data, sizeof data);
+ *
+ * The format string must be a constexpr char array with static storage
+ * duration. Invalid format strings and mismatched members fail to compile.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "structpack.h"
+
+namespace sp {
+
+namespace detail {
+
+struct field_spec {
+    char type = '\0';
+    int len = 1;
+    bool is_arr = false;
+    /* Member element width when it differs from the field width, otherwise 0 */
+    std::size_t dest_width = 0;
+    std::size_t buf_off = 0;
+};
+
+/* Deepest group nesting accepted by validate_format_str() */
+constexpr int max_grp_depth = 10;
+
+/* Not constexpr. Reaching this during constant evaluation is a compile error */
+inline void format_error(const char*) {}
+
+constexpr bool is_ws(char c) { return c == ' ' || c == '\t'; }
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool is_str_type(char c) { return c == 's' || c == 'w' || c == 'u'; }
+constexpr bool is_signed_type(char c) { return c == 'b' || c == 'h' || c == 'i' || c == 'q'; }
+
+constexpr bool is_fmt_char(char c) {
+    switch (c) {
+        case 'x': case 'b': case 'B': case 'h': case 'H': case 'i':
+        case 'I': case 'q': case 'Q': case 's': case 'w': case 'u':
+            return true;
+        default:
+            return false;
+    }
+}
+
+constexpr std::size_t type_size(char c) {
+    switch (c) {
+        case 'h': case 'H': case 'w':
+            return 2;
+        case 'i': case 'I': case 'u':
+            return 4;
+        case 'q': case 'Q':
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+/* Mirrors the behaviour of parse_next(), expanding repeats and groups into a
+   flat list of fields. When out is null, fields are only counted. */
+struct fmt_walker {
+    const char* fmt;
+    std::size_t pos;
+    std::size_t buf_off;
+    std::size_t count;
+    field_spec* out;
+
+    constexpr void skip_ws() {
+        while (is_ws(fmt[pos])) {
+            pos++;
+        }
+    }
+
+    constexpr int read_num() {
+        if (!is_digit(fmt[pos])) {
+            format_error("expected a number");
+        }
+        long num = 0;
+        while (is_digit(fmt[pos])) {
+            num = num * 10 + (fmt[pos] - '0');
+            if (num > 0x7fffffffL) {
+                format_error("number too large");
+            }
+            pos++;
+        }
+        skip_ws();
+        return static_cast<int>(num);
+    }
+
+    /* Parse an optional ':n' member width following a format character */
+    constexpr std::size_t read_width(char type) {
+        if (fmt[pos] != ':') {
+            return 0;
+        }
+        next();
+        char c = fmt[pos];
+        if (c == 's' && (type == 'w' || type == 'u')) {
+            format_error("UTF-8 members are not supported by the C++ codec");
+        }
+        if (is_str_type(type) || type == 'x' || (c != '1' && c != '2' && c != '4' && c != '8')) {
+            format_error("invalid member width");
+        }
+        next();
+        std::size_t width = static_cast<std::size_t>(c - '0');
+        /* A width matching the field needs no conversion */
+        return (width == type_size(type)) ? 0 : width;
+    }
+
+    /* Add a field of len elements, without advancing the format string */
+    constexpr void emit(char type, int len, bool is_arr, std::size_t dest_width) {
+        if (!is_fmt_char(type)) {
+            format_error("invalid format character");
+        }
+        if (len <= 0) {
+            len = 1;
+            is_arr = false;
+        }
+        if (type != 'x') {
+            if (out) {
+                out[count].type = type;
+                out[count].len = len;
+                out[count].is_arr = is_arr;
+                out[count].dest_width = dest_width;
+                out[count].buf_off = buf_off;
+            }
+            count++;
+        }
+        buf_off += type_size(type) * static_cast<std::size_t>(len);
+    }
+
+    constexpr void next() {
+        pos++;
+        skip_ws();
+    }
+
+    constexpr void walk_seq(int depth) {
+        while (fmt[pos] != '\0') {
+            char c = fmt[pos];
+            if (c == ')') {
+                if (depth == 0) {
+                    format_error("unbalanced ')'");
+                }
+                return;
+            } else if (is_fmt_char(c)) {
+                next();
+                emit(c, 0, false, read_width(c));
+            } else if (c == '[') {
+                next();
+                int num = read_num();
+                if (fmt[pos] != ']') {
+                    format_error("expected ']'");
+                }
+                next();
+                char type = fmt[pos];
+                next();
+                emit(type, num, true, read_width(type));
+            } else if (is_digit(c)) {
+                int num = read_num();
+                char type = fmt[pos];
+                if (is_str_type(type)) {
+                    /* Strings are special. They are always treated as arrays */
+                    next();
+                    emit(type, num, true, read_width(type));
+                } else if (is_fmt_char(type)) {
+                    next();
+                    std::size_t width = read_width(type);
+                    for (int i = 0; i < num; i++) {
+                        emit(type, 0, false, width);
+                    }
+                } else if (fmt[pos] == '(') {
+                    if (depth + 1 > max_grp_depth) {
+                        format_error("groups nested too deep");
+                    }
+                    next();
+                    std::size_t start = pos;
+                    for (int i = 0; i < num; i++) {
+                        pos = start;
+                        walk_seq(depth + 1);
+                    }
+                    if (num <= 0) {
+                        format_error("group must repeat at least once");
+                    }
+                    if (fmt[pos] != ')') {
+                        format_error("expected ')'");
+                    }
+                    next();
+                } else if (fmt[pos] == '{') {
+                    format_error("strided groups are not supported by the C++ codec");
+                } else {
+                    format_error("expected a format character or '(' after number");
+                }
+            } else if (c == '\'' || c == '=') {
+                format_error("constants are not supported by the C++ codec");
+            } else if (c == '@' || c == '%') {
+                next();
+                std::size_t num = static_cast<std::size_t>(read_num());
+                if (c == '@') {
+                    if (num < buf_off) {
+                        format_error("offset is before the current position");
+                    }
+                    buf_off = num;
+                } else {
+                    if (num == 0) {
+                        format_error("alignment must be positive");
+                    }
+                    buf_off += (num - buf_off % num) % num;
+                }
+            } else {
+                format_error("invalid format character");
+            }
+        }
+        if (depth != 0) {
+            format_error("unbalanced '('");
+        }
+    }
+
+    constexpr bool walk() {
+        bool little = false;
+        if (fmt[0] == '<') {
+            little = true;
+            pos = 1;
+        } else if (fmt[0] == '>') {
+            pos = 1;
+        }
+        skip_ws();
+        if (fmt[pos] == '\0') {
+            format_error("empty format string");
+        }
+        walk_seq(0);
+        return little;
+    }
+};
+
+constexpr std::size_t count_fields(const char* fmt) {
+    fmt_walker w{fmt, 0, 0, 0, nullptr};
+    w.walk();
+    return w.count;
+}
+
+constexpr std::size_t packed_size(const char* fmt) {
+    fmt_walker w{fmt, 0, 0, 0, nullptr};
+    w.walk();
+    return w.buf_off;
+}
+
+constexpr bool is_little(const char* fmt) {
+    fmt_walker w{fmt, 0, 0, 0, nullptr};
+    return w.walk();
+}
+
+template <std::size_t N>
+constexpr std::array<field_spec, N> build_fields(const char* fmt) {
+    std::array<field_spec, N> fields{};
+    fmt_walker w{fmt, 0, 0, 0, fields.data()};
+    w.walk();
+    return fields;
+}
+
+template <std::size_t Size> struct uint_of;
+template <> struct uint_of<1> { using type = std::uint8_t; };
+template <> struct uint_of<2> { using type = std::uint16_t; };
+template <> struct uint_of<4> { using type = std::uint32_t; };
+template <> struct uint_of<8> { using type = std::uint64_t; };
+
+/* Byte wise loads and stores are endian agnostic, and are recognised by
+   compilers as a single load or store, plus a byte swap where required */
+template <std::size_t Size, bool Little>
+inline typename uint_of<Size>::type load(const unsigned char* p) noexcept {
+    using U = typename uint_of<Size>::type;
+    U v = 0;
+    for (std::size_t i = 0; i < Size; i++) {
+        v = static_cast<U>(v | static_cast<U>(static_cast<U>(p[i]) << (8 * (Little ? i : Size - 1 - i))));
+    }
+    return v;
+}
+
+template <std::size_t Size, bool Little>
+inline void store(unsigned char* p, typename uint_of<Size>::type v) noexcept {
+    for (std::size_t i = 0; i < Size; i++) {
+        p[i] = static_cast<unsigned char>(v >> (8 * (Little ? i : Size - 1 - i)));
+    }
+}
+
+template <typename T> struct member_traits;
+template <typename C, typename T> struct member_traits<T C::*> {
+    using class_type = C;
+    using member_type = T;
+};
+
+template <typename T>
+constexpr bool is_int_like = std::is_integral<T>::value || std::is_enum<T>::value;
+
+/* Sign or zero extend a value of From bytes, and narrow it to To bytes if it fits */
+template <std::size_t From, std::size_t To, bool Signed>
+inline bool resize(typename uint_of<From>::type v, typename uint_of<To>::type& out) noexcept {
+    using S = std::make_signed_t<typename uint_of<From>::type>;
+    std::uint64_t wide = Signed ? static_cast<std::uint64_t>(static_cast<std::int64_t>(static_cast<S>(v)))
+                                : static_cast<std::uint64_t>(v);
+    if constexpr (To < From) {
+        if constexpr (Signed) {
+            constexpr std::int64_t max = (std::int64_t(1) << (8 * To - 1)) - 1;
+            std::int64_t s = static_cast<std::int64_t>(wide);
+            if (s < -max - 1 || s > max) {
+                return false;
+            }
+        } else {
+            if (wide > (std::uint64_t(1) << (8 * To)) - 1) {
+                return false;
+            }
+        }
+    }
+    out = static_cast<typename uint_of<To>::type>(wide);
+    return true;
+}
+
+template <char Type, int Len, bool IsArr, std::size_t DestWidth, typename M>
+constexpr bool member_matches() {
+    constexpr std::size_t size = DestWidth ? DestWidth : type_size(Type);
+    using E = std::remove_extent_t<M>;
+    if constexpr (is_str_type(Type)) {
+        /* Strings are null terminated, so need room for one more element */
+        return std::rank<M>::value == 1 && std::extent<M>::value >= static_cast<std::size_t>(Len) + 1 &&
+               is_int_like<E> && sizeof(E) == size;
+    } else if constexpr (IsArr) {
+        return std::rank<M>::value == 1 && std::extent<M>::value == static_cast<std::size_t>(Len) &&
+               is_int_like<E> && sizeof(E) == size;
+    } else {
+        return std::rank<M>::value == 0 && is_int_like<M> && sizeof(M) == size;
+    }
+}
+
+template <char Type, int Len, std::size_t Off, bool Little, std::size_t DestWidth, typename M>
+inline bool unpack_field(M& member, const unsigned char* buf) noexcept {
+    constexpr std::size_t size = type_size(Type);
+    using U = typename uint_of<size>::type;
+    const unsigned char* p = buf + Off;
+    if constexpr (DestWidth != 0) {
+        using MU = typename uint_of<DestWidth>::type;
+        unsigned char* dst = reinterpret_cast<unsigned char*>(&member);
+        for (int i = 0; i < Len; i++) {
+            MU v;
+            if (!resize<size, DestWidth, is_signed_type(Type)>(load<size, Little>(p + i * size), v)) {
+                return false;
+            }
+            std::memcpy(dst + i * DestWidth, &v, DestWidth);
+        }
+    } else if constexpr (std::rank<M>::value == 0) {
+        U v = load<size, Little>(p);
+        std::memcpy(&member, &v, size);
+    } else {
+        unsigned char* dst = reinterpret_cast<unsigned char*>(&member[0]);
+        if constexpr (size == 1) {
+            std::memcpy(dst, p, static_cast<std::size_t>(Len));
+        } else {
+            for (int i = 0; i < Len; i++) {
+                U v = load<size, Little>(p + i * size);
+                std::memcpy(dst + i * size, &v, size);
+            }
+        }
+        if constexpr (is_str_type(Type)) {
+            std::memset(dst + Len * size, 0, size);
+        }
+    }
+    return true;
+}
+
+template <char Type, int Len, std::size_t Off, bool Little, std::size_t DestWidth, typename M>
+inline bool pack_field(const M& member, unsigned char* buf) noexcept {
+    constexpr std::size_t size = type_size(Type);
+    using U = typename uint_of<size>::type;
+    unsigned char* p = buf + Off;
+    if constexpr (DestWidth != 0) {
+        using MU = typename uint_of<DestWidth>::type;
+        const unsigned char* src = reinterpret_cast<const unsigned char*>(&member);
+        for (int i = 0; i < Len; i++) {
+            MU mv;
+            U v;
+            std::memcpy(&mv, src + i * DestWidth, DestWidth);
+            if (!resize<DestWidth, size, is_signed_type(Type)>(mv, v)) {
+                return false;
+            }
+            store<size, Little>(p + i * size, v);
+        }
+    } else if constexpr (std::rank<M>::value == 0) {
+        U v;
+        std::memcpy(&v, &member, size);
+        store<size, Little>(p, v);
+    } else {
+        const unsigned char* src = reinterpret_cast<const unsigned char*>(&member[0]);
+        if constexpr (size == 1) {
+            std::memcpy(p, src, static_cast<std::size_t>(Len));
+        } else {
+            for (int i = 0; i < Len; i++) {
+                U v;
+                std::memcpy(&v, src + i * size, size);
+                store<size, Little>(p + i * size, v);
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace detail
+
+/*!
+ * \brief Compile time codec binding a format string to struct members
+ *
+ * \tparam Fmt : format string, refer to README.md for format string documentation
+ * \tparam Members : One member pointer per field parsed from Fmt, in order
+ */
+template <const char* Fmt, auto... Members>
+class codec {
+    static constexpr std::size_t num_fields = detail::count_fields(Fmt);
+    static constexpr bool little = detail::is_little(Fmt);
+    static constexpr auto fields = detail::build_fields<num_fields>(Fmt);
+
+    static_assert(sizeof...(Members) > 0, "at least one member must be bound");
+    static_assert(sizeof...(Members) == num_fields, "member count does not match the format string");
+
+    template <auto Member>
+    using member_t = typename detail::member_traits<decltype(Member)>::member_type;
+
+    template <std::size_t... I>
+    static constexpr bool members_match(std::index_sequence<I...>) {
+        return (detail::member_matches<fields[I].type, fields[I].len, fields[I].is_arr, fields[I].dest_width,
+                                         member_t<Members>>() && ...);
+    }
+    static_assert(members_match(std::make_index_sequence<num_fields>{}), "member type does not match format character");
+
+public:
+    using struct_type = typename detail::member_traits<
+        std::tuple_element_t<0, std::tuple<decltype(Members)...>>>::class_type;
+
+    /*! \brief Number of bytes a packed record occupies */
+    static constexpr std::size_t size = detail::packed_size(Fmt);
+
+    /*!
+     * \brief Unpack binary data to a struct
+     *
+     * \param s : Structure to write into
+     * \param src_buff : Source buffer to read from
+     * \param buff_len : Source buffer length in bytes
+     * \return SPResult : Result will be 'SP_OK' if unpacking was successful, 'SP_ERR_RANGE' if a value
+     *                    does not fit a narrower member
+     */
+    static SPResult unpack(struct_type& s, const void* src_buff, std::size_t buff_len) noexcept {
+        if (!src_buff) {
+            return SP_ERR_MISSING_PARAMS;
+        }
+        if (buff_len < size) {
+            return SP_ERR_BUFF_OVERRUN;
+        }
+        return unpack_impl(s, static_cast<const unsigned char*>(src_buff), std::make_index_sequence<num_fields>{})
+                   ? SP_OK : SP_ERR_RANGE;
+    }
+
+    /*!
+     * \brief Pack a struct to binary data
+     *
+     * \param s : Structure to read from
+     * \param dest_buff : Destination buffer to write to
+     * \param buff_len : Destination buffer length in bytes
+     * \return SPResult : Result will be 'SP_OK' if packing was successful, 'SP_ERR_RANGE' if a value
+     *                    does not fit a narrower field
+     */
+    static SPResult pack(const struct_type& s, void* dest_buff, std::size_t buff_len) noexcept {
+        if (!dest_buff) {
+            return SP_ERR_MISSING_PARAMS;
+        }
+        if (buff_len < size) {
+            return SP_ERR_BUFF_OVERRUN;
+        }
+        return pack_impl(s, static_cast<unsigned char*>(dest_buff), std::make_index_sequence<num_fields>{})
+                   ? SP_OK : SP_ERR_RANGE;
+    }
+
+private:
+    template <std::size_t... I>
+    static bool unpack_impl(struct_type& s, const unsigned char* buf, std::index_sequence<I...>) noexcept {
+        return (detail::unpack_field<fields[I].type, fields[I].len, fields[I].buf_off, little, fields[I].dest_width>(
+                    s.*Members, buf) && ...);
+    }
+
+    template <std::size_t... I>
+    static bool pack_impl(const struct_type& s, unsigned char* buf, std::index_sequence<I...>) noexcept {
+        return (detail::pack_field<fields[I].type, fields[I].len, fields[I].buf_off, little, fields[I].dest_width>(
+                    s.*Members, buf) && ...);
+    }
+};
+
+} // namespace sp
+
+#endif // STRUCTPACK_HPP
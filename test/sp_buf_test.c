@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+/* Every heap allocation the library makes, not just those through an sp_buf's allocator. Counting
+   needs glibc, whose allocator can be replaced by defining these, and not under a sanitizer */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define SP_COUNT_HEAP
+static int heap_allocs = 0;
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+void* malloc(size_t size) {
+    heap_allocs++;
+    return __libc_malloc(size);
+}
+void* calloc(size_t n, size_t size) {
+    heap_allocs++;
+    return __libc_calloc(n, size);
+}
+void* realloc(void* ptr, size_t size) {
+    heap_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+struct rec {
+    uint32_t id;
+    int16_t val;
+    char tag[5];
+};
+const char rec_fmt[] = ">I h 2x 4s";
+
+static int allocs = 0;
+
+static void* counting_realloc(void* ctx, void* ptr, size_t size) {
+    (void)ctx;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    allocs++;
+    return realloc(ptr, size);
+}
+
+static int rv = 0;
+
+int main(void) {
+    size_t offsets[3] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct rec, id, val, tag);
+    int size = 0;
+    SP_TEST_ASSERT(rv, sp_packed_size(rec_fmt, &size) == SP_OK && size == 12, "packed size");
+    SP_TEST_ASSERT(rv, sp_packed_size(">12s IqiQhH 3(qI) [5]h b 5w 5u", &size) == SP_OK && size == 117, "packed size with groups");
+    SP_TEST_ASSERT(rv, sp_packed_size(">I Z", &size) != SP_OK, "packed size of invalid format");
+
+    struct rec recs[1000];
+    for (int i = 0; i < 1000; ++i) {
+        recs[i].id = (uint32_t)i;
+        recs[i].val = (int16_t)-i;
+        memcpy(recs[i].tag, "abcd", 5);
+    }
+    uint8_t expect[12];
+    memset(expect, 0, sizeof expect);
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(rec_fmt, 3, offsets, &recs[999], expect, (int)sizeof expect) == SP_OK, "pack reference record");
+
+    /* Appending one at a time grows geometrically */
+    sp_buf buf;
+    sp_buf_init(&buf, counting_realloc, NULL);
+    int ok = 1;
+    for (int i = 0; i < 1000; ++i) {
+        if (sp_pack_bin_offset_append(rec_fmt, 3, offsets, &recs[i], &buf) != SP_OK) {
+            ok = 0;
+        }
+    }
+    SP_TEST_ASSERT(rv, ok && buf.len == 12000, "append records");
+    SP_TEST_ASSERT(rv, allocs <= 10, "amortized allocations");
+#ifdef SP_COUNT_HEAP
+    /* Once the buffer has room, appending allocates nothing at all */
+    buf.len = 0;
+    heap_allocs = 0;
+    for (int i = 0; i < 1000; ++i) {
+        sp_pack_bin_offset_append(rec_fmt, 3, offsets, &recs[i], &buf);
+    }
+    SP_TEST_ASSERT(rv, heap_allocs == 0 && sp_packed_size(rec_fmt, &size) == SP_OK && heap_allocs == 0, "no allocation per append");
+#endif
+    SP_TEST_ASSERT(rv, memcmp(buf.data + 999 * 12, expect, sizeof expect) == 0, "compare appended record");
+    sp_buf_free(&buf);
+    SP_TEST_ASSERT(rv, buf.data == NULL && buf.len == 0, "free buffer");
+
+    /* Batches reserve once */
+    sp_plan *plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(rec_fmt, 3, offsets, &plan) == SP_OK, "compile plan");
+    allocs = 0;
+    sp_buf_init(&buf, counting_realloc, NULL);
+    SP_TEST_ASSERT(rv, sp_plan_pack_batch_append(plan, recs, sizeof recs[0], 1000, &buf) == SP_OK, "append batch");
+    SP_TEST_ASSERT(rv, allocs == 1 && buf.len == 12000, "batch allocates once");
+    SP_TEST_ASSERT(rv, memcmp(buf.data + 999 * 12, expect, sizeof expect) == 0, "compare batch record");
+    SP_TEST_ASSERT(rv, sp_plan_pack_append(plan, &recs[999], &buf) == SP_OK && buf.len == 12012, "append single with plan");
+    SP_TEST_ASSERT(rv, memcmp(buf.data + 12000, expect, sizeof expect) == 0, "compare single record");
+    sp_buf_free(&buf);
+
+    /* Padding is zeroed, whatever the reserved space held before */
+    sp_buf_init(&buf, NULL, NULL);
+    SP_TEST_ASSERT(rv, sp_buf_reserve(&buf, 24036) == SP_OK, "reserve for padding");
+    memset(buf.data, 0xaa, buf.cap);
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset_append(rec_fmt, 3, offsets, &recs[999], &buf) == SP_OK &&
+                       sp_plan_pack_append(plan, &recs[999], &buf) == SP_OK &&
+                       sp_plan_pack_batch_append(plan, recs, sizeof recs[0], 1000, &buf) == SP_OK, "append over stale bytes");
+    SP_TEST_ASSERT(rv, memcmp(buf.data, expect, sizeof expect) == 0 && memcmp(buf.data + 12, expect, sizeof expect) == 0 &&
+                       memcmp(buf.data + 24 + 999 * 12, expect, sizeof expect) == 0, "padding zeroed");
+    sp_buf_free(&buf);
+
+    /* Default allocator */
+    sp_buf_init(&buf, NULL, NULL);
+    SP_TEST_ASSERT(rv, sp_buf_reserve(&buf, 100) == SP_OK && buf.cap >= 100, "reserve with default allocator");
+    sp_buf_free(&buf);
+
+    sp_plan_free(plan);
+    return rv;
+}
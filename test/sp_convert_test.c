@@ -0,0 +1,80 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Runs the sp_convert tool, whose path is the only argument */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sp_test.h"
+
+#define REC_SIZE 14
+/* Several batches of the small batch size below, so every worker sees some */
+#define NUM_RECS 1000
+
+static int rv = 0;
+
+static const char be_name[] = "sp_convert_test_be.bin";
+static const char le_name[] = "sp_convert_test_le.bin";
+static const char back_name[] = "sp_convert_test_back.bin";
+
+static int write_file(const char* name, const uint8_t* data, size_t len) {
+    FILE* f = fopen(name, "wb");
+    if (!f) {
+        return 0;
+    }
+    size_t n = fwrite(data, 1, len, f);
+    return fclose(f) == 0 && n == len;
+}
+
+/* Whole file into buff, which must hold one more byte than expected so a longer file is caught */
+static size_t read_file(const char* name, uint8_t* buff, size_t cap) {
+    FILE* f = fopen(name, "rb");
+    if (!f) {
+        return 0;
+    }
+    size_t n = fread(buff, 1, cap, f);
+    fclose(f);
+    return n;
+}
+
+static int convert(const char* tool, const char* src_fmt, const char* dest_fmt, const char* in, const char* out) {
+    char cmd[4096];
+    int n = snprintf(cmd, sizeof cmd, "\"%s\" -j 3 -b 64 \"%s\" \"%s\" %s %s", tool, src_fmt, dest_fmt, in, out);
+    return n > 0 && (size_t)n < sizeof cmd && system(cmd) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: sp_convert_test path_to_sp_convert\n");
+        return 1;
+    }
+    static uint8_t be[NUM_RECS * REC_SIZE], le[NUM_RECS * REC_SIZE], out[NUM_RECS * REC_SIZE + 1];
+    srand(11);
+    for (size_t i = 0; i < sizeof be; i++) {
+        be[i] = (uint8_t)rand();
+    }
+    /* Each field of the little endian record is the big endian one reversed */
+    const int field_off[3] = {0, 4, 6}, field_len[3] = {4, 2, 8};
+    for (int r = 0; r < NUM_RECS; r++) {
+        for (int f = 0; f < 3; f++) {
+            for (int b = 0; b < field_len[f]; b++) {
+                le[r * REC_SIZE + field_off[f] + b] = be[r * REC_SIZE + field_off[f] + field_len[f] - 1 - b];
+            }
+        }
+    }
+    SP_TEST_ASSERT(rv, write_file(be_name, be, sizeof be), "write input");
+    SP_TEST_ASSERT(rv, convert(argv[1], ">Ihq", "<Ihq", be_name, le_name), "convert to little endian");
+    SP_TEST_ASSERT(rv, read_file(le_name, out, sizeof out) == sizeof le && memcmp(out, le, sizeof le) == 0, "compare little endian");
+    SP_TEST_ASSERT(rv, convert(argv[1], "<Ihq", ">Ihq", le_name, back_name), "convert back to big endian");
+    SP_TEST_ASSERT(rv, read_file(back_name, out, sizeof out) == sizeof be && memcmp(out, be, sizeof be) == 0, "compare round trip");
+    remove(be_name);
+    remove(le_name);
+    remove(back_name);
+    return rv;
+}
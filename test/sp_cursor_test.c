@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+/* A header, followed by a variable number of two kinds of record and a trailer */
+struct header {
+    uint16_t num_samples;
+    uint16_t num_names;
+};
+const char header_fmt[] = "> 'SPLG' H H";
+#define HEADER_SIZE 8
+
+struct sample {
+    uint8_t channel;
+    int32_t value;
+};
+const char sample_fmt[] = "> B i 3x";
+#define SAMPLE_SIZE 8
+
+struct name {
+    uint8_t channel;
+    char label[7];
+};
+const char name_fmt[] = "> B 6s";
+#define NAME_SIZE 7
+
+const char trailer_fmt[] = "'END'";
+
+static int rv = 0;
+
+int main(void) {
+    size_t header_offsets[2] = {0}, sample_offsets[2] = {0}, name_offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(header_offsets, 0, struct header, num_samples, num_names);
+    SP_ADD_STRUCT_OFFSET(sample_offsets, 0, struct sample, channel, value);
+    SP_ADD_STRUCT_OFFSET(name_offsets, 0, struct name, channel, label);
+    sp_plan* name_plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(name_fmt, 2, name_offsets, &name_plan) == SP_OK, "compile name plan");
+
+    struct header hdr = {3, 2};
+    struct sample samples[3] = {{1, -5}, {2, 70000}, {1, 12}};
+    struct name names[2] = {{1, "inlet"}, {2, "outlet"}};
+    uint8_t buf[64];
+    memset(buf, 0xaa, sizeof buf);
+    sp_cursor cur;
+    sp_cursor_init(&cur, buf, sizeof buf);
+    int ok = sp_cursor_pack(&cur, header_fmt, 2, header_offsets, &hdr) == SP_OK && cur.pos == HEADER_SIZE;
+    for (int i = 0; i < 3; i++) {
+        ok = ok && sp_cursor_pack(&cur, sample_fmt, 2, sample_offsets, &samples[i]) == SP_OK;
+    }
+    for (int i = 0; i < 2; i++) {
+        ok = ok && sp_cursor_plan_pack(&cur, name_plan, &names[i]) == SP_OK;
+    }
+    ok = ok && sp_cursor_pack(&cur, trailer_fmt, 0, NULL, NULL) == SP_OK;
+    const size_t total = HEADER_SIZE + 3 * SAMPLE_SIZE + 2 * NAME_SIZE + 3;
+    SP_TEST_ASSERT(rv, ok && cur.pos == total, "pack records with cursor");
+
+    uint8_t expect[64];
+    memset(expect, 0xaa, sizeof expect);
+    sp_pack_bin_offset(header_fmt, 2, header_offsets, &hdr, expect, HEADER_SIZE);
+    for (int i = 0; i < 3; i++) {
+        sp_pack_bin_offset(sample_fmt, 2, sample_offsets, &samples[i], expect + HEADER_SIZE + i * SAMPLE_SIZE, SAMPLE_SIZE);
+    }
+    for (int i = 0; i < 2; i++) {
+        sp_plan_pack(name_plan, &names[i], expect + HEADER_SIZE + 3 * SAMPLE_SIZE + i * NAME_SIZE, NAME_SIZE);
+    }
+    memcpy(expect + total - 3, "END", 3);
+    SP_TEST_ASSERT(rv, memcmp(buf, expect, sizeof buf) == 0, "compare cursor pack");
+
+    /* Decode in one pass, with counts taken from the header */
+    struct header hdr_up;
+    struct sample samples_up[3];
+    struct name names_up[2];
+    sp_cursor_init(&cur, buf, total);
+    ok = sp_cursor_unpack(&cur, header_fmt, 2, header_offsets, &hdr_up) == SP_OK && hdr_up.num_samples == 3 && hdr_up.num_names == 2;
+    for (int i = 0; ok && i < hdr_up.num_samples; i++) {
+        ok = sp_cursor_unpack(&cur, sample_fmt, 2, sample_offsets, &samples_up[i]) == SP_OK;
+    }
+    for (int i = 0; ok && i < hdr_up.num_names; i++) {
+        ok = sp_cursor_plan_unpack(&cur, name_plan, &names_up[i]) == SP_OK;
+    }
+    ok = ok && sp_cursor_unpack(&cur, trailer_fmt, 0, NULL, NULL) == SP_OK;
+    SP_TEST_ASSERT(rv, ok && cur.pos == cur.limit, "unpack records with cursor");
+    SP_TEST_ASSERT(rv, samples_up[1].value == 70000 && samples_up[2].channel == 1 && names_up[1].channel == 2 &&
+                       strcmp(names_up[0].label, "inlet") == 0 && strcmp(names_up[1].label, "outlet") == 0, "compare cursor unpack");
+
+    /* Failures leave the cursor where it was */
+    struct sample s;
+    SP_TEST_ASSERT(rv, sp_cursor_unpack(&cur, sample_fmt, 2, sample_offsets, &s) == SP_ERR_BUFF_OVERRUN && cur.pos == total, "unpack past limit");
+    SP_TEST_ASSERT(rv, sp_cursor_plan_unpack(&cur, name_plan, &names_up[0]) == SP_ERR_BUFF_OVERRUN && cur.pos == total, "plan unpack past limit");
+    sp_cursor_init(&cur, buf, total);
+    SP_TEST_ASSERT(rv, sp_cursor_skip(&cur, HEADER_SIZE + SAMPLE_SIZE) == SP_OK && cur.pos == HEADER_SIZE + SAMPLE_SIZE, "skip record");
+    SP_TEST_ASSERT(rv, sp_cursor_unpack(&cur, sample_fmt, 2, sample_offsets, &s) == SP_OK && s.value == 70000, "unpack after skip");
+    SP_TEST_ASSERT(rv, sp_cursor_unpack(&cur, header_fmt, 2, header_offsets, &hdr_up) == SP_ERR_MISMATCH &&
+                       cur.pos == HEADER_SIZE + 2 * SAMPLE_SIZE, "mismatched constant");
+    SP_TEST_ASSERT(rv, sp_cursor_skip(&cur, total) == SP_ERR_BUFF_OVERRUN, "skip past limit");
+    SP_TEST_ASSERT(rv, sp_cursor_unpack(&cur, sample_fmt, 1, sample_offsets, &s) == SP_ERR_FIELD_CNT, "cursor field count");
+
+    sp_plan_free(name_plan);
+    return rv;
+}
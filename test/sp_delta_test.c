@@ -0,0 +1,87 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct state {
+    uint32_t seq;
+    int64_t pos;              /* 16 bit in the data */
+    uint16_t levels[12];
+    char label[9];
+    char owner[8 * 3 + 1];    /* UTF-8, 8 code units in the data */
+    uint8_t mode;
+};
+const char state_fmt[] = ">I h:8 [12]H 8s 2x 8w:s B";
+#define STATE_SIZE 57
+#define NUM_FIELDS 6
+#define MAP_LEN 1
+
+static int rv = 0;
+
+static int same_state(const struct state* a, const struct state* b) {
+    return a->seq == b->seq && a->pos == b->pos && memcmp(a->levels, b->levels, sizeof a->levels) == 0 &&
+           strcmp(a->label, b->label) == 0 && strcmp(a->owner, b->owner) == 0 && a->mode == b->mode;
+}
+
+int main(void) {
+    size_t offsets[NUM_FIELDS] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct state, seq, pos, levels, label, owner, mode);
+    sp_plan* plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(state_fmt, NUM_FIELDS, offsets, &plan) == SP_OK && sp_plan_size(plan) == STATE_SIZE, "compile state plan");
+
+    struct state prev, cur, remote;
+    memset(&prev, 0, sizeof prev);
+    prev.seq = 1;
+    prev.pos = -300;
+    for (int i = 0; i < 12; i++) {
+        prev.levels[i] = (uint16_t)(i * 100);
+    }
+    strcpy(prev.label, "pump");
+    strcpy(prev.owner, "J\xc3\xbcrgen");
+    prev.mode = 2;
+
+    uint8_t delta[MAP_LEN + STATE_SIZE];
+    int len = 0, used = 0;
+    memset(&remote, 0, sizeof remote);
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, NULL, &prev, delta, sizeof delta, &len) == SP_OK &&
+                       len == MAP_LEN + STATE_SIZE - 2 && delta[0] == 0x3f, "full delta without a previous struct");
+    SP_TEST_ASSERT(rv, sp_plan_delta_apply(plan, &remote, delta, len, &used) == SP_OK && used == len && same_state(&remote, &prev), "apply full delta");
+
+    cur = prev;
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, &prev, &cur, delta, sizeof delta, &len) == SP_OK && len == MAP_LEN && delta[0] == 0, "unchanged struct is just a bitmap");
+
+    cur.seq = 2;
+    cur.levels[11] = 7;
+    cur.mode = 3;
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, &prev, &cur, delta, sizeof delta, &len) == SP_OK &&
+                       len == MAP_LEN + 4 + 24 + 1 && delta[0] == 0x25, "only changed fields are packed");
+    SP_TEST_ASSERT(rv, delta[1] == 0 && delta[4] == 2 && delta[27] == 0 && delta[28] == 7 && delta[29] == 3, "changed fields in wire format");
+
+    struct state before = remote;
+    SP_TEST_ASSERT(rv, sp_plan_delta_apply(plan, &remote, delta, len - 1, &used) == SP_ERR_BUFF_OVERRUN && same_state(&remote, &before), "truncated delta is not applied");
+    SP_TEST_ASSERT(rv, sp_plan_delta_apply(plan, &remote, delta, len, &used) == SP_OK && used == len && same_state(&remote, &cur), "apply partial delta");
+
+    /* Fixed length strings differ if any packed byte does, UTF-8 members only up to the terminator */
+    prev = cur;
+    strcpy(cur.owner, "Ann");
+    memcpy(cur.label, "pump\0xyz", 8);
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, &prev, &cur, delta, sizeof delta, &len) == SP_OK && delta[0] == 0x18 &&
+                       len == MAP_LEN + 8 + 16, "strings compared as packed");
+    SP_TEST_ASSERT(rv, sp_plan_delta_apply(plan, &remote, delta, len, &used) == SP_OK && strcmp(remote.owner, "Ann") == 0, "apply UTF-8 field");
+
+    cur.pos = 40000;
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, &prev, &cur, delta, sizeof delta, &len) == SP_ERR_RANGE, "narrowing range error");
+    SP_TEST_ASSERT(rv, sp_plan_delta_pack(plan, NULL, &prev, delta, 10, &len) == SP_ERR_BUFF_OVERRUN, "destination too short");
+    delta[0] = 0x40;
+    SP_TEST_ASSERT(rv, sp_plan_delta_apply(plan, &remote, delta, sizeof delta, &used) == SP_ERR_INVALID_PARAMS, "unknown field bit");
+
+    sp_plan_free(plan);
+    return rv;
+}
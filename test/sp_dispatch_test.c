@@ -0,0 +1,86 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct msg_pos {
+    int32_t x;
+    int32_t y;
+};
+
+struct msg_name {
+    uint16_t id;
+    char name[9];
+};
+
+union msg {
+    struct msg_pos pos;
+    struct msg_name name;
+};
+
+/* pos(1, -2), name(7, "abcdefgh"), pos(3, 4), then a partial pos */
+uint8_t stream[] = {
+    0x01, 0x00, 0x00, 0x00, 0x01, 0xff, 0xff, 0xff, 0xfe,
+    0x02, 0x00, 0x07, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h',
+    0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04,
+    0x01, 0x00, 0x00
+};
+
+static int rv = 0;
+
+int main(void) {
+    size_t pos_offsets[2] = {0};
+    size_t name_offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(pos_offsets, 0, struct msg_pos, x, y);
+    SP_ADD_STRUCT_OFFSET(name_offsets, 0, struct msg_name, id, name);
+    sp_dispatch_entry entries[] = {
+        {1, ">2i", 2, pos_offsets},
+        {2, ">H 8s", 2, name_offsets}
+    };
+    sp_dispatch *d = NULL;
+    SP_TEST_ASSERT(rv, sp_dispatch_new(entries, 2, &d) == SP_OK, "create dispatcher");
+    SP_TEST_ASSERT(rv, sp_dispatch_plan(d, 2) != NULL && sp_dispatch_plan(d, 3) == NULL, "dispatcher plans");
+
+    /* Single messages */
+    union msg m = {0};
+    int tag = 0, consumed = 0;
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack(d, &m, stream, (int)sizeof stream, &tag, &consumed) == SP_OK, "unpack message");
+    SP_TEST_ASSERT(rv, tag == 1 && consumed == 9 && m.pos.x == 1 && m.pos.y == -2, "compare pos message");
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack(d, &m, stream + 9, (int)sizeof stream - 9, &tag, &consumed) == SP_OK, "unpack message");
+    SP_TEST_ASSERT(rv, tag == 2 && consumed == 11 && m.name.id == 7 && strcmp(m.name.name, "abcdefgh") == 0, "compare name message");
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack(d, &m, stream + 29, 3, &tag, &consumed) == SP_ERR_BUFF_OVERRUN, "unpack partial message");
+
+    /* Batches stop at a partial message */
+    union msg msgs[8];
+    int tags[8];
+    int num_msgs = 0;
+    memset(msgs, 0, sizeof msgs);
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack_batch(d, msgs, sizeof msgs[0], tags, 8, stream, (int)sizeof stream, &num_msgs, &consumed) == SP_OK, "unpack batch");
+    SP_TEST_ASSERT(rv, num_msgs == 3 && consumed == 29, "batch count");
+    SP_TEST_ASSERT(rv, tags[0] == 1 && tags[1] == 2 && tags[2] == 1, "batch tags");
+    SP_TEST_ASSERT(rv, msgs[2].pos.x == 3 && msgs[2].pos.y == 4, "compare batch message");
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack_batch(d, msgs, sizeof msgs[0], tags, 2, stream, (int)sizeof stream, &num_msgs, &consumed) == SP_OK, "unpack limited batch");
+    SP_TEST_ASSERT(rv, num_msgs == 2 && consumed == 20, "limited batch count");
+
+    /* Unknown tags */
+    uint8_t bad[] = {0x01, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x06, 0x09, 0x00};
+    SP_TEST_ASSERT(rv, sp_dispatch_unpack_batch(d, msgs, sizeof msgs[0], tags, 8, bad, (int)sizeof bad, &num_msgs, &consumed) == SP_ERR_TAG, "batch unknown tag");
+    SP_TEST_ASSERT(rv, num_msgs == 1 && consumed == 9 && tags[1] == 9, "batch stops at unknown tag");
+
+    sp_dispatch_entry dup[] = {
+        {1, ">2i", 2, pos_offsets},
+        {1, ">H 8s", 2, name_offsets}
+    };
+    sp_dispatch *d2 = NULL;
+    SP_TEST_ASSERT(rv, sp_dispatch_new(dup, 2, &d2) == SP_ERR_INVALID_PARAMS, "duplicate tag");
+
+    sp_dispatch_free(d);
+    return rv;
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct rec {
+    int32_t val;
+    uint16_t seq;
+};
+
+static int rv = 0;
+
+int main(void) {
+    size_t offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct rec, val, seq);
+    sp_plan *plan = NULL;
+    sp_framer *f = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(">i H", 2, offsets, &plan) == SP_OK, "compile payload plan");
+    SP_TEST_ASSERT(rv, sp_framer_new("B", plan, 30, &f) == SP_OK, "create framer");
+    SP_TEST_ASSERT(rv, sp_framer_new("4s", plan, 30, &(sp_framer*){NULL}) == SP_ERR_INVALID_FMT_STR, "invalid length format");
+
+    /* Frames of 7 or 9 bytes in a 32 byte ring, fed in 5 byte chunks, wrap at every position */
+    uint8_t stream[64 * 9];
+    size_t stream_len = 0;
+    for (int i = 0; i < 64; ++i) {
+        uint8_t payload_len = (i % 3 == 0) ? 8 : 6;
+        int32_t val = -1000 * i;
+        stream[stream_len++] = payload_len;
+        stream[stream_len++] = (uint8_t)((uint32_t)val >> 24);
+        stream[stream_len++] = (uint8_t)((uint32_t)val >> 16);
+        stream[stream_len++] = (uint8_t)((uint32_t)val >> 8);
+        stream[stream_len++] = (uint8_t)val;
+        stream[stream_len++] = 0;
+        stream[stream_len++] = (uint8_t)i;
+        if (payload_len == 8) {
+            stream[stream_len++] = 0xee;
+            stream[stream_len++] = 0xee;
+        }
+    }
+    struct rec recs[8];
+    int decoded = 0, num_frames = 0, ok = 1;
+    size_t fed = 0;
+    while (decoded < 64 && ok) {
+        if (fed < stream_len) {
+            int chunk = (stream_len - fed < 5) ? (int)(stream_len - fed) : 5;
+            fed += (size_t)sp_framer_write(f, stream + fed, chunk);
+        }
+        if (sp_framer_decode(f, recs, sizeof recs[0], 8, &num_frames) != SP_OK) {
+            ok = 0;
+        }
+        for (int i = 0; i < num_frames; ++i) {
+            if (recs[i].val != -1000 * decoded || recs[i].seq != decoded) {
+                ok = 0;
+            }
+            decoded++;
+        }
+    }
+    SP_TEST_ASSERT(rv, ok && decoded == 64, "decode wrapping frames");
+    SP_TEST_ASSERT(rv, sp_framer_pending(f) == 0, "all bytes consumed");
+
+    /* Receive directly into the ring */
+    int len = 0;
+    uint8_t *dst = sp_framer_reserve(f, &len);
+    SP_TEST_ASSERT(rv, dst != NULL && len > 0, "reserve ring space");
+    uint8_t frame[] = {6, 0x00, 0x00, 0x01, 0x00, 0x00, 0x2a};
+    int n = (len < (int)sizeof frame) ? len : (int)sizeof frame;
+    memcpy(dst, frame, (size_t)n);
+    sp_framer_commit(f, n);
+    sp_framer_write(f, frame + n, (int)sizeof frame - n);
+    SP_TEST_ASSERT(rv, sp_framer_decode(f, recs, sizeof recs[0], 8, &num_frames) == SP_OK, "decode reserved frame");
+    SP_TEST_ASSERT(rv, num_frames == 1 && recs[0].val == 256 && recs[0].seq == 42, "compare reserved frame");
+
+    /* A length prefix shorter than the payload plan is an error */
+    uint8_t bad[] = {3, 0, 0, 0};
+    sp_framer_write(f, bad, (int)sizeof bad);
+    SP_TEST_ASSERT(rv, sp_framer_decode(f, recs, sizeof recs[0], 8, &num_frames) == SP_ERR_FRAME, "short frame");
+
+    /* Committing more than the free region cannot overrun unread bytes */
+    int pending = sp_framer_pending(f);
+    dst = sp_framer_reserve(f, &len);
+    sp_framer_commit(f, len + 100);
+    SP_TEST_ASSERT(rv, dst != NULL && sp_framer_pending(f) == pending + len, "commit clamped to free space");
+
+    sp_framer_free(f);
+    sp_plan_free(plan);
+    return rv;
+}
@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct rec {
+    uint32_t id;
+    int16_t val;
+    uint16_t samples[40];
+    char tag[5];
+    int64_t stamp;
+};
+/* The same fields in both byte orders, with different padding */
+const char be_fmt[] = ">I 2x h [40]H 4s q";
+const char le_fmt[] = "<I h [40]H 4s 6x q";
+#define BE_SIZE 100
+#define LE_SIZE 104
+#define NUM_RECS 64
+
+#define F_ID (UINT64_C(1) << 0)
+#define F_VAL (UINT64_C(1) << 1)
+#define F_SAMPLES (UINT64_C(1) << 2)
+#define F_TAG (UINT64_C(1) << 3)
+#define F_STAMP (UINT64_C(1) << 4)
+
+static int rv = 0;
+
+int main(void) {
+    size_t offsets[5] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct rec, id, val, samples, tag, stamp);
+    sp_plan *be = NULL, *le = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(be_fmt, 5, offsets, &be) == SP_OK && sp_plan_size(be) == BE_SIZE, "compile big endian plan");
+    SP_TEST_ASSERT(rv, sp_plan_compile(le_fmt, 5, offsets, &le) == SP_OK && sp_plan_size(le) == LE_SIZE, "compile little endian plan");
+
+    /* Every other record repeats the id and tag of the one before, with a new stamp */
+    uint8_t be_buf[NUM_RECS * BE_SIZE], le_buf[NUM_RECS * LE_SIZE];
+    int ok = 1;
+    for (int i = 0; i < NUM_RECS; i++) {
+        struct rec r;
+        memset(&r, 0, sizeof r);
+        r.id = (uint32_t)(i / 2) * 0x01010101u;
+        r.val = (int16_t)(-i / 2);
+        for (int j = 0; j < 40; j++) {
+            r.samples[j] = (uint16_t)(j * 1000 + i / 2);
+        }
+        memcpy(r.tag, "tag", 4);
+        r.tag[3] = (char)('a' + i / 2 % 26);
+        r.stamp = -1000000000000LL * i;
+        if (sp_plan_pack(be, &r, be_buf + i * BE_SIZE, BE_SIZE) != SP_OK ||
+            sp_plan_pack(le, &r, le_buf + i * LE_SIZE, LE_SIZE) != SP_OK) {
+            ok = 0;
+        }
+        /* Padding is never looked at */
+        be_buf[i * BE_SIZE + 4] = (uint8_t)i;
+        le_buf[i * LE_SIZE + 92] = (uint8_t)i;
+    }
+    SP_TEST_ASSERT(rv, ok, "pack records");
+
+    const uint64_t all = F_ID | F_VAL | F_SAMPLES | F_TAG | F_STAMP;
+    const uint64_t masks[] = {F_ID, F_VAL, F_SAMPLES, F_TAG, F_STAMP, F_ID | F_TAG, all};
+    ok = 1;
+    for (size_t m = 0; m < sizeof masks / sizeof masks[0]; m++) {
+        for (int i = 0; i < NUM_RECS; i++) {
+            if (sp_hash(be, masks[m], be_buf + i * BE_SIZE) != sp_hash(le, masks[m], le_buf + i * LE_SIZE)) {
+                ok = 0;
+            }
+        }
+    }
+    SP_TEST_ASSERT(rv, ok, "hash is independent of byte order and padding");
+
+    const uint64_t key = F_ID | F_VAL | F_SAMPLES | F_TAG;
+    SP_TEST_ASSERT(rv, sp_equal(be, key, be_buf, be_buf + BE_SIZE) && sp_hash(be, key, be_buf) == sp_hash(be, key, be_buf + BE_SIZE), "duplicate key fields are equal");
+    SP_TEST_ASSERT(rv, !sp_equal(be, all, be_buf, be_buf + BE_SIZE) && sp_hash(be, all, be_buf) != sp_hash(be, all, be_buf + BE_SIZE), "stamp makes records differ");
+    SP_TEST_ASSERT(rv, !sp_equal(le, F_SAMPLES, le_buf, le_buf + 2 * LE_SIZE) && sp_hash(le, F_SAMPLES, le_buf) != sp_hash(le, F_SAMPLES, le_buf + 2 * LE_SIZE), "arrays differ");
+    SP_TEST_ASSERT(rv, sp_equal(le, 0, le_buf, le_buf + 2 * LE_SIZE) && sp_hash(le, 0, le_buf) == sp_hash(le, 0, le_buf + 2 * LE_SIZE), "empty mask");
+
+    uint64_t be_hashes[NUM_RECS], le_hashes[NUM_RECS];
+    SP_TEST_ASSERT(rv, sp_hash_batch(be, key, be_buf, sizeof be_buf, NUM_RECS, be_hashes) == SP_OK, "hash big endian batch");
+    SP_TEST_ASSERT(rv, sp_hash_batch(le, key, le_buf, sizeof le_buf, NUM_RECS, le_hashes) == SP_OK, "hash little endian batch");
+    ok = 1;
+    int distinct = 0;
+    for (int i = 0; i < NUM_RECS; i++) {
+        if (be_hashes[i] != sp_hash(be, key, be_buf + i * BE_SIZE) || be_hashes[i] != le_hashes[i]) {
+            ok = 0;
+        }
+        if (i == 0 || be_hashes[i] != be_hashes[i - 1]) {
+            distinct++;
+        }
+    }
+    SP_TEST_ASSERT(rv, ok, "batch matches single hashes");
+    SP_TEST_ASSERT(rv, distinct == NUM_RECS / 2, "dedupe by hash");
+    SP_TEST_ASSERT(rv, sp_hash_batch(be, key, be_buf, BE_SIZE, 2, be_hashes) == SP_ERR_BUFF_OVERRUN, "batch overrun");
+
+    sp_plan_free(be);
+    sp_plan_free(le);
+    return rv;
+}
@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+/* The first four members are laid out as in the buffer, so the copy kernel can coalesce them */
+struct rec {
+    uint32_t a;
+    uint32_t b;
+    uint16_t arr[4];
+    int64_t q;
+    char name[6];
+    uint8_t bytes[3];
+    int32_t small;
+    char text[4 * 3 + 1];
+    /* Large enough to be streamed, which every kernel leaves to the interpreter */
+    uint32_t big[1100];
+};
+const char rec_be_fmt[] = ">I I [4]H q 5s 'K' [3]B b:4 4w:s [1100]I";
+const char rec_le_fmt[] = "<I I [4]H q 5s 'K' [3]B b:4 4w:s [1100]I";
+#define REC_SIZE 4442
+#define REC_CONST_OFF 29
+
+static int rv = 0;
+
+static void fill(uint8_t* src) {
+    srand(7);
+    for (size_t i = 0; i < REC_SIZE; i++) {
+        src[i] = (uint8_t)rand();
+    }
+    src[REC_CONST_OFF] = 'K';
+}
+
+/* Every kernel must unpack and pack exactly as the interpreter does, errors included */
+static void test_parity(const char* fmt, const size_t* offsets) {
+    static uint8_t src[REC_SIZE], expect_buf[REC_SIZE], buf[REC_SIZE];
+    static struct rec expect, r;
+    sp_plan *interp = NULL, *plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt, 9, offsets, &interp) == SP_OK &&
+                       sp_plan_compile(fmt, 9, offsets, &plan) == SP_OK && sp_plan_size(plan) == REC_SIZE, fmt);
+    fill(src);
+    memset(&expect, 0, sizeof expect);
+    memset(expect_buf, 0x55, sizeof expect_buf);
+    SP_TEST_ASSERT(rv, sp_plan_unpack(interp, &expect, src, REC_SIZE) == SP_OK &&
+                       sp_plan_pack(interp, &expect, expect_buf, REC_SIZE) == SP_OK, "interpreter reference");
+    for (int k = 0; k < SP_NUM_KERNELS; k++) {
+        if (sp_plan_set_kernel(plan, (sp_kernel)k) != SP_OK) {
+            SP_TEST_ASSERT(rv, k == SP_KERNEL_JIT, "only generated code may be unavailable");
+            printf("[SKIP] %s kernel not available\n", sp_kernel_name((sp_kernel)k));
+            continue;
+        }
+        sp_kernel_info info;
+        sp_plan_kernel_info(plan, &info);
+        SP_TEST_ASSERT(rv, info.kernel == (sp_kernel)k && info.available[k] && !info.tuned, "forced kernel reported");
+        memset(&r, 0, sizeof r);
+        memset(buf, 0x55, sizeof buf);
+        SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &r, src, REC_SIZE) == SP_OK && memcmp(&r, &expect, sizeof r) == 0, sp_kernel_name((sp_kernel)k));
+        SP_TEST_ASSERT(rv, sp_plan_pack(plan, &r, buf, REC_SIZE) == SP_OK && memcmp(buf, expect_buf, REC_SIZE) == 0, "pack matches");
+
+        r.small = 1000;
+        SP_TEST_ASSERT(rv, sp_plan_pack(plan, &r, buf, REC_SIZE) == SP_ERR_RANGE, "resized field out of range");
+        src[REC_CONST_OFF] = 'X';
+        memset(&r, 0, sizeof r);
+        SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &r, src, REC_SIZE) == SP_ERR_MISMATCH && r.a == 0, "constant checked first");
+        src[REC_CONST_OFF] = 'K';
+    }
+    sp_plan_free(interp);
+    sp_plan_free(plan);
+}
+
+int main(void) {
+    size_t offsets[9] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct rec, a, b, arr, q, name, bytes, small, text, big);
+    test_parity(rec_be_fmt, offsets);
+    test_parity(rec_le_fmt, offsets);
+
+    SP_TEST_ASSERT(rv, strcmp(sp_kernel_name(SP_KERNEL_INTERP), "interp") == 0 && strcmp(sp_kernel_name(SP_KERNEL_JIT), "jit") == 0 &&
+                       strcmp(sp_kernel_name((sp_kernel)SP_NUM_KERNELS), "unknown") == 0, "kernel names");
+
+    /* Deterministic until tuned */
+    sp_plan* plan = NULL;
+    sp_kernel_info info;
+    SP_TEST_ASSERT(rv, sp_plan_compile(rec_be_fmt, 9, offsets, &plan) == SP_OK, "compile plan");
+    sp_plan_kernel_info(plan, &info);
+    SP_TEST_ASSERT(rv, info.kernel == SP_KERNEL_INTERP && !info.tuned && info.available[SP_KERNEL_INTERP] &&
+                       info.available[SP_KERNEL_SIMD] && info.available[SP_KERNEL_COPY] && info.ns[SP_KERNEL_INTERP] == 0, "untuned plan");
+    SP_TEST_ASSERT(rv, sp_plan_set_kernel(plan, (sp_kernel)SP_NUM_KERNELS) == SP_ERR_RANGE, "kernel out of range");
+
+    SP_TEST_ASSERT(rv, sp_plan_autotune(plan, 0) == SP_OK, "autotune now");
+    sp_plan_kernel_info(plan, &info);
+    SP_TEST_ASSERT(rv, info.tuned && info.available[info.kernel] && info.ns[SP_KERNEL_INTERP] > 0 &&
+                       info.ns[SP_KERNEL_COPY] > 0 && info.ns[info.kernel] <= info.ns[SP_KERNEL_INTERP], "fastest kernel kept");
+    for (int k = 0; k < SP_NUM_KERNELS; k++) {
+        printf("%-7s %s %8.1f ns\n", sp_kernel_name((sp_kernel)k), k == (int)info.kernel ? "*" : " ", info.ns[k]);
+    }
+    sp_kernel winner = info.kernel;
+    SP_TEST_ASSERT(rv, sp_plan_autotune(plan, 0) == SP_OK && (sp_plan_kernel_info(plan, &info), info.kernel == winner), "tuned once");
+    SP_TEST_ASSERT(rv, sp_plan_set_kernel(plan, SP_KERNEL_INTERP) == SP_OK && (sp_plan_kernel_info(plan, &info), !info.tuned),
+                   "forced kernel replaces tuning");
+    sp_plan_free(plan);
+
+    /* Tuned on first use, without changing the result */
+    static uint8_t src[REC_SIZE];
+    static struct rec expect, r;
+    fill(src);
+    SP_TEST_ASSERT(rv, sp_plan_compile(rec_be_fmt, 9, offsets, &plan) == SP_OK && sp_plan_unpack(plan, &expect, src, REC_SIZE) == SP_OK,
+                   "reference unpack");
+    SP_TEST_ASSERT(rv, sp_plan_autotune(plan, 1) == SP_OK && (sp_plan_kernel_info(plan, &info), !info.tuned), "tuning deferred");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &r, src, REC_SIZE) == SP_OK && memcmp(&r, &expect, sizeof r) == 0, "first use");
+    sp_plan_kernel_info(plan, &info);
+    SP_TEST_ASSERT(rv, info.tuned && info.ns[SP_KERNEL_INTERP] > 0, "tuned on first use");
+    sp_plan_free(plan);
+
+    SP_TEST_ASSERT(rv, sp_plan_compile(rec_be_fmt, 9, NULL, &plan) == SP_OK && sp_plan_autotune(plan, 0) == SP_ERR_UNSUPPORTED &&
+                       sp_plan_set_kernel(plan, SP_KERNEL_COPY) == SP_ERR_UNSUPPORTED, "plan without offsets");
+    sp_plan_free(plan);
+    SP_TEST_ASSERT(rv, sp_plan_autotune(NULL, 0) == SP_ERR_MISSING_PARAMS, "missing plan");
+    return rv;
+}
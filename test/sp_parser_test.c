@@ -36,5 +36,95 @@ int main(void) {
     fmt_str = ">4s h i 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q 4(4B Q))))))))))";
     SP_TEST_ASSERT(rv, validate_format_str(fmt_str) != SP_OK, "parse beyond max group depth");
     
+    /* Trailing repeated fields are all parsed */
+    SPResult err;
+    struct fmt_str_parser p = new_parser(">h 3I", &err);
+    int count = 0;
+    while (parse_next(&p) == SP_OK) {
+        count++;
+    }
+    SP_TEST_ASSERT(rv, count == 4, "parse trailing repeat");
+    reset_parser(&p);
+    count = 0;
+    while (parse_next(&p) == SP_OK) {
+        count++;
+    }
+    SP_TEST_ASSERT(rv, count == 4, "parse trailing repeat after reset");
+
+    /* Member widths apply to every repeat, and are dropped when matching the field */
+    fmt_str = ">2h:4 I:4 [3]B:8";
+    SP_TEST_ASSERT(rv, validate_format_str(fmt_str) == SP_OK, "validate member widths");
+    p = new_parser(fmt_str, &err);
+    int widths[4] = {0};
+    count = 0;
+    while (parse_next(&p) == SP_OK && count < 4) {
+        widths[count++] = p.current.dest_width;
+    }
+    SP_TEST_ASSERT(rv, count == 4 && widths[0] == 4 && widths[1] == 4 && widths[2] == 0 && widths[3] == 8, "parse member widths");
+
+    /* Offsets, alignment and runs of 'x' each resolve to a single skip */
+    fmt_str = ">b @8 h %8 100x 2(b %4) @ 140";
+    SP_TEST_ASSERT(rv, validate_format_str(fmt_str) == SP_OK, "validate offset and alignment");
+    p = new_parser(fmt_str, &err);
+    int skips[10] = {0};
+    count = 0;
+    while (parse_next(&p) == SP_OK && count < 10) {
+        skips[count++] = (p.current.type == 'x') ? p.current.arr_len : 0;
+    }
+    SP_TEST_ASSERT(rv, count == 10 && skips[1] == 7 && skips[3] == 6 && skips[4] == 100 && skips[6] == 3 && skips[8] == 3 && skips[9] == 16, "parse offset and alignment");
+    SP_TEST_ASSERT(rv, p.offset == 140, "parse offset after directives");
+    p = new_parser(">I @2", &err);
+    while ((err = parse_next(&p)) == SP_OK) {
+    }
+    SP_TEST_ASSERT(rv, err == SP_ERR_INVALID_FMT_STR, "parse backwards offset");
+
+    /* Constants are yielded as skips, and may contain characters that are otherwise invalid */
+    fmt_str = ">'<(x]) 9' h H=0xfffe 2(b=-2) i=010";
+    SP_TEST_ASSERT(rv, validate_format_str(fmt_str) == SP_OK, "validate constants");
+    p = new_parser(fmt_str, &err);
+    count = 0;
+    int consts = 0;
+    while (parse_next(&p) == SP_OK) {
+        count++;
+        consts += p.current.constant ? 1 : 0;
+    }
+    SP_TEST_ASSERT(rv, count == 6 && consts == 5 && p.offset == 17 && p.current.value == 10, "parse constants");
+    SP_TEST_ASSERT(rv, validate_format_str(">h 'abc") != SP_OK, "validate unterminated literal");
+    SP_TEST_ASSERT(rv, validate_format_str(">h ''") != SP_OK, "validate empty literal");
+    /* A constant ends where its number does */
+    p = new_parser(">H=65534B i=-2h", &err);
+    count = 0;
+    while (parse_next(&p) == SP_OK) {
+        count++;
+    }
+    SP_TEST_ASSERT(rv, count == 4 && p.offset == 9 && p.current.type == 'h', "parse unspaced constants");
+    const char* bad_consts[] = {">B=256", ">b=-129", ">H=-1", ">2I=5", ">[2]I=5", ">I=0x", ">I=12ab", ">s=1"};
+    for (int k = 0; k < 8; k++) {
+        p = new_parser(bad_consts[k], &err);
+        while ((err = parse_next(&p)) == SP_OK) {
+        }
+        SP_TEST_ASSERT(rv, err != SP_NULL_CHAR, bad_consts[k]);
+    }
+
+    /* Strided groups use two offset list entries, then reuse the body's entries for every element */
+    fmt_str = ">B 3{h 2{I b} 2(H)} q";
+    SP_TEST_ASSERT(rv, validate_format_str(fmt_str) == SP_OK, "validate strided groups");
+    size_t st_offsets[11] = {1000, 100, 40, 0, 10, 4, 0, 2, 20, 30, 2000};
+    size_t st_expect[] = {1000, 100, 110, 112, 114, 116, 120, 130,
+                                140, 150, 152, 154, 156, 160, 170,
+                                180, 190, 192, 194, 196, 200, 210, 2000};
+    p = new_parser(fmt_str, &err);
+    count = 0;
+    int st_ok = 1;
+    while (parse_next(&p) == SP_OK) {
+        if (count >= 23 || parse_struct_offset(&p, st_offsets) != st_expect[count]) {
+            st_ok = 0;
+        }
+        count++;
+    }
+    SP_TEST_ASSERT(rv, st_ok && count == 23 && p.num_slots == 11 && p.has_strided, "parse strided groups");
+    SP_TEST_ASSERT(rv, validate_format_str(">B 3{h)") != SP_OK, "validate mismatched group brackets");
+    SP_TEST_ASSERT(rv, validate_format_str("{h} B") != SP_OK, "validate opening '{'");
+
     return rv;
 }
@@ -0,0 +1,148 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct quote {
+    uint32_t id;
+    int64_t bid;
+    int64_t ask;
+    char sym[9];
+};
+const char quote_fmt[] = "<I q q 8s 'Q'";
+
+/* Same format as quote, different struct */
+struct quote_copy {
+    char sym[9];
+    int64_t ask;
+    int64_t bid;
+    uint32_t id;
+};
+
+/* Members beyond 64 KB need 32 bit offsets, and fields may be resized or UTF-8 */
+struct blob {
+    uint8_t pad[70000];
+    int32_t small;
+    char name[4 * 3 + 1];
+    uint16_t vals[3];
+};
+const char blob_fmt[] = ">b:4 4w:s 2x [3]H";
+
+static const char lib_path[] = "sp_plan_lib_test.bin";
+
+static int rv = 0;
+
+int main(void) {
+    size_t quote_offsets[4] = {0}, copy_offsets[4] = {0}, blob_offsets[3] = {0};
+    SP_ADD_STRUCT_OFFSET(quote_offsets, 0, struct quote, id, bid, ask, sym);
+    SP_ADD_STRUCT_OFFSET(copy_offsets, 0, struct quote_copy, id, bid, ask, sym);
+    SP_ADD_STRUCT_OFFSET(blob_offsets, 0, struct blob, small, name, vals);
+    sp_plan* plans[5] = {NULL};
+    SP_TEST_ASSERT(rv, sp_plan_compile(quote_fmt, 4, quote_offsets, &plans[0]) == SP_OK &&
+                       sp_plan_compile(quote_fmt, 4, copy_offsets, &plans[1]) == SP_OK &&
+                       sp_plan_compile(blob_fmt, 3, blob_offsets, &plans[2]) == SP_OK &&
+                       sp_plan_compile(quote_fmt, 4, NULL, &plans[3]) == SP_OK &&
+                       sp_plan_compile(quote_fmt, 4, quote_offsets, &plans[4]) == SP_OK, "compile plans");
+
+    /* Duplicates share their chunks, adding only a table entry */
+    sp_buf one, all;
+    sp_buf_init(&one, NULL, NULL);
+    sp_buf_init(&all, NULL, NULL);
+    SP_TEST_ASSERT(rv, sp_plan_lib_build((const sp_plan* const*)plans, 1, &one) == SP_OK &&
+                       sp_plan_lib_build((const sp_plan* const*)plans, 5, &all) == SP_OK, "build libraries");
+    SP_TEST_ASSERT(rv, one.len == 16 + 12 + (12 + 4 * 12 + 12 + 4) + 4 * 2, "compact encoding");
+    SP_TEST_ASSERT(rv, all.len == one.len + 4 * 12 + 4 * 2 + (12 + 3 * 12) + 3 * 4, "shared sequences and offsets");
+
+    sp_plan_lib* lib = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_lib_open_mem(all.data, all.len, &lib) == SP_OK && sp_plan_lib_count(lib) == 5 &&
+                       sp_plan_lib_size(lib, 0) == 29 && sp_plan_lib_size(lib, 2) == 17 && sp_plan_lib_size(lib, 5) == 0, "open library");
+
+    struct quote q = {7, -100, 250, "ACME"};
+    uint8_t expect[29], buf[29];
+    sp_plan_pack(plans[0], &q, expect, sizeof expect);
+    memset(buf, 0, sizeof buf);
+    SP_TEST_ASSERT(rv, sp_plan_lib_pack(lib, 0, &q, buf, sizeof buf) == SP_OK && memcmp(buf, expect, sizeof buf) == 0, "pack from library");
+    struct quote_copy qc;
+    memset(&qc, 0, sizeof qc);
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 1, &qc, expect, sizeof expect) == SP_OK && qc.id == 7 && qc.bid == -100 &&
+                       qc.ask == 250 && strcmp(qc.sym, "ACME") == 0, "unpack with shared sequence");
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 3, &qc, expect, sizeof expect) == SP_ERR_UNSUPPORTED, "plan without offsets");
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 5, &qc, expect, sizeof expect) == SP_ERR_RANGE, "index out of range");
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 1, &qc, expect, 28) == SP_ERR_BUFF_OVERRUN, "unpack overrun");
+    expect[28] = 'X';
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 1, &qc, expect, sizeof expect) == SP_ERR_MISMATCH, "constants checked");
+
+    struct blob* b = calloc(2, sizeof *b);
+    uint8_t blob_expect[17], blob_buf[17];
+    if (!b) {
+        return 1;
+    }
+    b[0].small = -5;
+    strcpy(b[0].name, "h\xc3\xa9ll");
+    b[0].vals[2] = 0xbeef;
+    /* Packing leaves the 2x padding untouched, so both outputs start zeroed */
+    memset(blob_expect, 0, sizeof blob_expect);
+    SP_TEST_ASSERT(rv, sp_plan_pack(plans[2], &b[0], blob_expect, sizeof blob_expect) == SP_OK, "pack blob");
+    memset(blob_buf, 0, sizeof blob_buf);
+    SP_TEST_ASSERT(rv, sp_plan_lib_pack(lib, 2, &b[0], blob_buf, sizeof blob_buf) == SP_OK &&
+                       memcmp(blob_buf, blob_expect, sizeof blob_buf) == 0, "pack with 32 bit offsets");
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 2, &b[1], blob_expect, sizeof blob_expect) == SP_OK && b[1].small == -5 &&
+                       strcmp(b[1].name, "h\xc3\xa9ll") == 0 && b[1].vals[2] == 0xbeef, "unpack with 32 bit offsets");
+
+    /* A plan rebuilt from the library works with the rest of the API, after the library is gone */
+    sp_plan *rebuilt = NULL, *rebuilt_quote = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_lib_plan(lib, 2, &rebuilt) == SP_OK && sp_plan_size(rebuilt) == 17 &&
+                       sp_plan_lib_plan(lib, 1, &rebuilt_quote) == SP_OK, "rebuild plans");
+    sp_plan_lib_close(lib);
+    memset(&b[1], 0, sizeof b[1]);
+    SP_TEST_ASSERT(rv, rebuilt && sp_plan_unpack(rebuilt, &b[1], blob_expect, sizeof blob_expect) == SP_OK && b[1].small == -5 &&
+                       strcmp(b[1].name, "h\xc3\xa9ll") == 0, "unpack with rebuilt plan");
+    SP_TEST_ASSERT(rv, rebuilt_quote && sp_plan_unpack(rebuilt_quote, &qc, expect, sizeof expect) == SP_ERR_MISMATCH, "rebuilt plan keeps constants");
+    sp_plan_free(rebuilt);
+    sp_plan_free(rebuilt_quote);
+
+    /* Mapped from a file */
+    FILE* f = fopen(lib_path, "wb");
+    SP_TEST_ASSERT(rv, f && fwrite(all.data, all.len, 1, f) == 1 && fclose(f) == 0, "save library");
+    SP_TEST_ASSERT(rv, sp_plan_lib_open(lib_path, &lib) == SP_OK && sp_plan_lib_count(lib) == 5, "map library");
+    memset(&q, 0, sizeof q);
+    expect[28] = 'Q';
+    SP_TEST_ASSERT(rv, sp_plan_lib_unpack(lib, 4, &q, expect, sizeof expect) == SP_OK && q.ask == 250, "unpack from mapped library");
+    sp_plan_lib_close(lib);
+    remove(lib_path);
+    SP_TEST_ASSERT(rv, sp_plan_lib_open(lib_path, &lib) == SP_ERR_IO, "missing file");
+
+    /* Damaged blobs are rejected when opened */
+    uint8_t* bad = malloc(all.len);
+    if (!bad) {
+        return 1;
+    }
+    memcpy(bad, all.data, all.len);
+    bad[0] = 'X';
+    SP_TEST_ASSERT(rv, sp_plan_lib_open_mem(bad, all.len, &lib) == SP_ERR_CORRUPT, "bad magic");
+    SP_TEST_ASSERT(rv, sp_plan_lib_open_mem(all.data, all.len - 4, &lib) == SP_ERR_CORRUPT, "truncated blob");
+    memcpy(bad, all.data, all.len);
+    bad[16 + 12 + 8] = 3;
+    SP_TEST_ASSERT(rv, sp_plan_lib_open_mem(bad, all.len, &lib) == SP_ERR_CORRUPT, "bad offset width");
+    memcpy(bad, all.data, all.len);
+    bad[16 + 5 * 12 + 12 + 8] = 0xff;
+    SP_TEST_ASSERT(rv, sp_plan_lib_open_mem(bad, all.len, &lib) == SP_ERR_CORRUPT, "field past end of record");
+    free(bad);
+
+    free(b);
+    sp_buf_free(&one);
+    sp_buf_free(&all);
+    for (int i = 0; i < 5; i++) {
+        sp_plan_free(plans[i]);
+    }
+    return rv;
+}
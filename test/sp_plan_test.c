@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+#define ARR_LEN(arr) sizeof arr / sizeof arr[0]
+
+struct sp_pack_unpack {
+    char hello[13];
+    uint32_t spu32;
+    int64_t spi64;
+    int32_t spi32;
+    uint64_t spu64;
+    int16_t spi16;
+    uint16_t spu16;
+    struct {
+        int64_t spsti64;
+        uint32_t spstu32;
+    }s_arr[3];
+    int16_t spi16arr[5];
+    char spchar;
+    uint16_t helloW[6];
+    uint32_t worldU[6];
+};
+const char fmt_str_be[] = ">12s IqiQhH 3(qI) [5]h b 5w 5u";
+const char fmt_str_le[] = "<12s IqiQhH 3(qI) [5]h b 5w 5u";
+
+uint8_t bytes_be[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0x00, 0x01, 0x86, 0xa0, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0xff, 0xfe, 0x79, 0x60, 0x00, 0x00, 0x00, 0x01, 0xdc, 0xd6, 0x50, 0x00, 0x8a, 0xd0, 0xea, 0x60, 0xff, 0xff, 0xff, 0xfe, 0x5e, 0xc4, 0x7a, 0x00, 0x00, 0x03, 0x0d, 0x40, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0x00, 0x04, 0x93, 0xe0, 0xff, 0xff, 0xff, 0xfd, 0xe7, 0x8e, 0xe6, 0x00, 0x00, 0x06, 0x1a, 0x80, 0x03, 0xe8, 0x07, 0xd0, 0x0b, 0xb8, 0x0f, 0xa0, 0x13, 0x88, 0x73, 0x00, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64};
+uint8_t bytes_le[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0xa0, 0x86, 0x01, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0x60, 0x79, 0xfe, 0xff, 0x00, 0x50, 0xd6, 0xdc, 0x01, 0x00, 0x00, 0x00, 0xd0, 0x8a, 0x60, 0xea, 0x00, 0x7a, 0xc4, 0x5e, 0xfe, 0xff, 0xff, 0xff, 0x40, 0x0d, 0x03, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0xe0, 0x93, 0x04, 0x00, 0x00, 0xe6, 0x8e, 0xe7, 0xfd, 0xff, 0xff, 0xff, 0x80, 0x1a, 0x06, 0x00, 0xe8, 0x03, 0xd0, 0x07, 0xb8, 0x0b, 0xa0, 0x0f, 0x88, 0x13, 0x73, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00};
+
+/* Exercises every load/store width, and arrays long enough for vector swaps */
+struct sp_arrays {
+    int16_t h[19];
+    uint32_t i[9];
+    uint64_t q[5];
+    uint8_t b[37];
+    char s[24];
+    uint16_t w[8];
+    uint32_t u[4];
+};
+const char fmt_arr_be[] = ">[19]h 3x [9]I [5]Q [37]B 23s x 7w 3u";
+const char fmt_arr_le[] = "<[19]h 3x [9]I [5]Q [37]B 23s x 7w 3u";
+
+static int rv = 0;
+
+static void test_jit_parity(const char* fmt, size_t* offsets, int num_fields, const char* name) {
+    sp_plan *interp = NULL, *jit = NULL;
+    uint8_t src[512], interp_buff[512], jit_buff[512];
+    struct sp_arrays interp_s, jit_s;
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt, num_fields, offsets, &interp) == SP_OK, name);
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt, num_fields, offsets, &jit) == SP_OK, name);
+    if (sp_plan_jit(jit) != SP_OK) {
+        printf("[SKIP] JIT not available\n");
+        sp_plan_free(interp);
+        sp_plan_free(jit);
+        return;
+    }
+    srand(1);
+    for (size_t i = 0; i < sizeof src; i++) {
+        src[i] = (uint8_t)rand();
+    }
+    memset(&interp_s, 0xaa, sizeof interp_s);
+    memset(&jit_s, 0xaa, sizeof jit_s);
+    SP_TEST_ASSERT(rv, sp_plan_unpack(interp, &interp_s, src, (int)sizeof src) == SP_OK, "interpreter unpack");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(jit, &jit_s, src, (int)sizeof src) == SP_OK, "JIT unpack");
+    SP_TEST_ASSERT(rv, memcmp(&interp_s, &jit_s, sizeof jit_s) == 0, "compare JIT unpack");
+    memset(interp_buff, 0x55, sizeof interp_buff);
+    memset(jit_buff, 0x55, sizeof jit_buff);
+    SP_TEST_ASSERT(rv, sp_plan_pack(interp, &interp_s, interp_buff, (int)sizeof interp_buff) == SP_OK, "interpreter pack");
+    SP_TEST_ASSERT(rv, sp_plan_pack(jit, &jit_s, jit_buff, (int)sizeof jit_buff) == SP_OK, "JIT pack");
+    SP_TEST_ASSERT(rv, memcmp(interp_buff, jit_buff, sizeof jit_buff) == 0, "compare JIT pack");
+    sp_plan_free(interp);
+    sp_plan_free(jit);
+}
+
+int main(void) {
+    size_t offsets[17] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct sp_pack_unpack, hello, spu32, spi64, spi32, spu64, spi16, spu16);
+    for (int i = 0; i < 3; ++i) {
+        SP_ADD_STRUCT_OFFSET(offsets, 7 + (2 * i), struct sp_pack_unpack, s_arr[i].spsti64, s_arr[i].spstu32);
+    }
+    SP_ADD_STRUCT_OFFSET(offsets, 13, struct sp_pack_unpack, spi16arr, spchar, helloW, worldU);
+
+    /* Compare plans against the format string API */
+    const char *fmts[] = {fmt_str_be, fmt_str_le};
+    uint8_t *bytes[] = {bytes_be, bytes_le};
+    int b_sz = (int)(sizeof bytes_be);
+    for (int i = 0; i < 2; ++i) {
+        printf("\nTesting plan with %s\n", fmts[i]);
+        sp_plan *plan = NULL;
+        struct sp_pack_unpack expect = {0}, up = {0};
+        uint8_t pack_buff[sizeof bytes_be] = {0};
+        SP_TEST_ASSERT(rv, sp_plan_compile(fmts[i], ARR_LEN(offsets), offsets, &plan) == SP_OK, "compile plan");
+        SP_TEST_ASSERT(rv, sp_plan_size(plan) == b_sz, "plan size");
+        SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmts[i], ARR_LEN(offsets), offsets, &expect, bytes[i], b_sz) == SP_OK, "unpack with format string");
+        SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &up, bytes[i], b_sz) == SP_OK, "unpack with plan");
+        SP_TEST_ASSERT(rv, memcmp(&expect, &up, sizeof up) == 0, "compare plan unpack");
+        SP_TEST_ASSERT(rv, sp_plan_pack(plan, &up, pack_buff, b_sz) == SP_OK, "pack with plan");
+        SP_TEST_ASSERT(rv, memcmp(pack_buff, bytes[i], sizeof pack_buff) == 0, "compare plan pack");
+        SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &up, bytes[i], b_sz - 1) == SP_ERR_BUFF_OVERRUN, "plan overrun");
+        sp_plan_free(plan);
+
+        printf("\nTesting JIT with %s\n", fmts[i]);
+        SP_TEST_ASSERT(rv, sp_plan_compile(fmts[i], ARR_LEN(offsets), offsets, &plan) == SP_OK, "compile plan");
+        if (sp_plan_jit(plan) == SP_OK) {
+            memset(&up, 0, sizeof up);
+            memset(pack_buff, 0, sizeof pack_buff);
+            SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &up, bytes[i], b_sz) == SP_OK, "unpack with JIT");
+            SP_TEST_ASSERT(rv, memcmp(&expect, &up, sizeof up) == 0, "compare JIT unpack");
+            SP_TEST_ASSERT(rv, sp_plan_pack(plan, &up, pack_buff, b_sz) == SP_OK, "pack with JIT");
+            SP_TEST_ASSERT(rv, memcmp(pack_buff, bytes[i], sizeof pack_buff) == 0, "compare JIT pack");
+        } else {
+            printf("[SKIP] JIT not available\n");
+        }
+        sp_plan_free(plan);
+    }
+
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt_str_be, 16, offsets, &(sp_plan*){NULL}) == SP_ERR_FIELD_CNT, "plan field count");
+
+    size_t arr_offsets[7] = {0};
+    SP_ADD_STRUCT_OFFSET(arr_offsets, 0, struct sp_arrays, h, i, q, b, s, w, u);
+    printf("\nTesting JIT and interpreter parity\n");
+    test_jit_parity(fmt_arr_be, arr_offsets, ARR_LEN(arr_offsets), "compile BE arrays");
+    test_jit_parity(fmt_arr_le, arr_offsets, ARR_LEN(arr_offsets), "compile LE arrays");
+
+    printf("\nTesting plan with member widths\n");
+    struct sp_arrays wide = {0}, narrow = {0};
+    uint8_t arr_buff[512] = {0};
+    sp_plan *wplan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt_arr_be, 7, arr_offsets, &wplan) == SP_OK, "compile plan");
+    for (int i = 0; i < 19; i++) {
+        wide.h[i] = (int16_t)(i * -1000);
+    }
+    SP_TEST_ASSERT(rv, sp_plan_pack(wplan, &wide, arr_buff, (int)sizeof arr_buff) == SP_OK, "pack arrays");
+    sp_plan_free(wplan);
+    /* Same wire layout, with the 16 bit array narrowed to bytes */
+    SP_TEST_ASSERT(rv, sp_plan_compile(">[19]h:1 3x [9]I [5]Q [37]B 23s x 7w 3u", 7, arr_offsets, &wplan) == SP_OK, "compile narrowing plan");
+    SP_TEST_ASSERT(rv, sp_plan_jit(wplan) == SP_ERR_UNSUPPORTED, "JIT declines width conversions");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(wplan, &narrow, arr_buff, (int)sizeof arr_buff) == SP_ERR_RANGE, "unpack out of range");
+    for (int i = 0; i < 19; i++) {
+        wide.h[i] = (int16_t)(i * -5);
+    }
+    sp_plan_free(wplan);
+    SP_TEST_ASSERT(rv, sp_plan_compile(fmt_arr_be, 7, arr_offsets, &wplan) == SP_OK, "compile plan");
+    SP_TEST_ASSERT(rv, sp_plan_pack(wplan, &wide, arr_buff, (int)sizeof arr_buff) == SP_OK, "pack arrays");
+    sp_plan_free(wplan);
+    SP_TEST_ASSERT(rv, sp_plan_compile(">[19]h:1 3x [9]I [5]Q [37]B 23s x 7w 3u", 7, arr_offsets, &wplan) == SP_OK, "compile narrowing plan");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(wplan, &narrow, arr_buff, (int)sizeof arr_buff) == SP_OK, "unpack narrowed");
+    int8_t* narrowed = (int8_t*)narrow.h;
+    SP_TEST_ASSERT(rv, narrowed[0] == 0 && narrowed[18] == -90, "compare narrowed values");
+    sp_plan_free(wplan);
+
+    printf("\nTesting plan with constants\n");
+    size_t c_offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(c_offsets, 0, struct sp_pack_unpack, spu32, spi64);
+    sp_plan *cplan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(">'Hello World!' I q i=-100000 Q=8000000000 @40", 2, c_offsets, &cplan) == SP_OK, "compile constants");
+    SP_TEST_ASSERT(rv, sp_plan_size(cplan) == 40, "constants plan size");
+    struct sp_pack_unpack c_up = {0};
+    SP_TEST_ASSERT(rv, sp_plan_unpack(cplan, &c_up, bytes_be, b_sz) == SP_OK, "unpack constants");
+    SP_TEST_ASSERT(rv, c_up.spu32 == 100000 && c_up.spi64 == -8000000000, "compare constants unpack");
+    uint8_t recs[5 * 40];
+    for (int i = 0; i < 5; i++) {
+        memcpy(recs + i * 40, bytes_be, 40);
+    }
+    recs[40 * 1 + 3] = 'x';
+    recs[40 * 4 + 35] ^= 1;
+    unsigned char bad[1];
+    int num_bad = 0;
+    SP_TEST_ASSERT(rv, sp_plan_validate(cplan, recs, (int)sizeof recs, 5, bad, &num_bad) == SP_OK, "validate records");
+    SP_TEST_ASSERT(rv, num_bad == 2 && bad[0] == 0x12, "compare bad record bitmap");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(cplan, &c_up, recs + 40, 40) == SP_ERR_MISMATCH, "unpack bad record");
+    SP_TEST_ASSERT(rv, sp_plan_validate(cplan, recs, (int)sizeof recs - 1, 5, bad, &num_bad) == SP_ERR_BUFF_OVERRUN, "validate overrun");
+    if (sp_plan_jit(cplan) == SP_OK) {
+        memset(recs, 0, 40);
+        SP_TEST_ASSERT(rv, sp_plan_pack(cplan, &c_up, recs, 40) == SP_OK, "pack constants with JIT");
+        SP_TEST_ASSERT(rv, memcmp(recs, bytes_be, 36) == 0, "compare constants JIT pack");
+        SP_TEST_ASSERT(rv, sp_plan_unpack(cplan, &c_up, recs + 40, 40) == SP_ERR_MISMATCH, "unpack bad record with JIT");
+    } else {
+        printf("[SKIP] JIT not available\n");
+    }
+    sp_plan_free(cplan);
+
+    /* Strided groups are expanded into one op per element when compiling */
+    size_t st_offsets[13] = {0};
+    SP_ADD_STRUCT_OFFSET(st_offsets, 0, struct sp_pack_unpack, hello, spu32, spi64, spi32, spu64, spi16, spu16);
+    SP_ADD_STRIDE(st_offsets, 7, struct sp_pack_unpack, s_arr);
+    st_offsets[9] = offsetof(struct sp_pack_unpack, s_arr[0].spsti64) - offsetof(struct sp_pack_unpack, s_arr);
+    st_offsets[10] = offsetof(struct sp_pack_unpack, s_arr[0].spstu32) - offsetof(struct sp_pack_unpack, s_arr);
+    SP_ADD_STRUCT_OFFSET(st_offsets, 11, struct sp_pack_unpack, spi16arr, spchar);
+    sp_plan* splan = NULL;
+    struct sp_pack_unpack st_up = {0};
+    SP_TEST_ASSERT(rv, sp_plan_compile(">12s IqiQhH 3{qI} [5]h b", 13, st_offsets, &splan) == SP_OK && sp_plan_size(splan) == 87, "compile strided group");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(splan, &st_up, bytes_be, b_sz) == SP_OK, "unpack strided group");
+    SP_TEST_ASSERT(rv, st_up.s_arr[2].spsti64 == -9000000000 && st_up.s_arr[2].spstu32 == 400000 && st_up.spchar == 's', "compare strided group");
+    sp_plan_free(splan);
+
+    return rv;
+}
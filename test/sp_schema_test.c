@@ -0,0 +1,95 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include <sp_schema.h>
+#include "sp_test.h"
+
+#define NAME_LEN 8
+
+#define SENSOR_FIELDS(F, S)                         \
+    F(S, uint32_t, id,      ,               I, 1)   \
+    F(S, int8_t,   kind,    ,               b, 1)   \
+    F(S, int16_t,  temp,    ,               h, 1)   \
+    F(S, uint16_t, levels,  [12],           H, 12)  \
+    F(S, char,     name,    [NAME_LEN + 1], s, NAME_LEN) \
+    F(S, uint16_t, label,   [5],            w, 4)   \
+    F(S, int64_t,  stamp,   ,               q, 1)
+
+SP_SCHEMA(sensor, BIG, SENSOR_FIELDS);
+
+/* Twenty fields, beyond what SP_ADD_STRUCT_OFFSET can list */
+#define WIDE_FIELDS(F, S)                                                   \
+    F(S, uint8_t, f0, , B, 1) F(S, uint8_t, f1, , B, 1) F(S, uint8_t, f2, , B, 1)     \
+    F(S, uint8_t, f3, , B, 1) F(S, uint8_t, f4, , B, 1) F(S, uint8_t, f5, , B, 1)     \
+    F(S, uint8_t, f6, , B, 1) F(S, uint8_t, f7, , B, 1) F(S, uint8_t, f8, , B, 1)     \
+    F(S, uint8_t, f9, , B, 1) F(S, uint8_t, f10, , B, 1) F(S, uint8_t, f11, , B, 1)   \
+    F(S, uint8_t, f12, , B, 1) F(S, uint8_t, f13, , B, 1) F(S, uint8_t, f14, , B, 1)  \
+    F(S, uint8_t, f15, , B, 1) F(S, uint8_t, f16, , B, 1) F(S, uint8_t, f17, , B, 1)  \
+    F(S, uint8_t, f18, , B, 1) F(S, uint32_t, f19, , I, 1)
+
+SP_SCHEMA(wide, LITTLE, WIDE_FIELDS);
+
+static int rv = 0;
+
+int main(void) {
+    SP_TEST_ASSERT(rv, sensor_num_fields == 7 && wide_num_fields == 20, "field counts");
+    SP_TEST_ASSERT(rv, strcmp(sensor_fmt, "> [1]I [1]b [1]h [12]H 8s 4w [1]q") == 0, "generated format string");
+    SP_TEST_ASSERT(rv, sp_plan_size(sensor_plan) == 4 + 1 + 2 + 24 + 8 + 8 + 8 && sizeof(struct sensor_wire) == 55, "static plan size");
+    SP_TEST_ASSERT(rv, sensor_offsets[3] == offsetof(struct sensor, levels) && sensor_offsets[6] == offsetof(struct sensor, stamp), "offset table");
+
+    struct sensor s, out;
+    memset(&s, 0, sizeof s);
+    s.id = 0x01020304;
+    s.kind = -3;
+    s.temp = -200;
+    for (int i = 0; i < 12; i++) {
+        s.levels[i] = (uint16_t)(i * 257);
+    }
+    strcpy(s.name, "boiler");
+    s.label[0] = 'a';
+    s.label[1] = 0x263a;
+    s.stamp = -1234567890123LL;
+
+    /* The static plan packs exactly as a plan compiled from the generated format and offsets */
+    sp_plan* compiled = NULL;
+    uint8_t a[55], b[55];
+    SP_TEST_ASSERT(rv, sp_plan_compile(sensor_fmt, sensor_num_fields, sensor_offsets, &compiled) == SP_OK, "compile generated format");
+    SP_TEST_ASSERT(rv, sp_plan_pack(sensor_plan, &s, a, sizeof a) == SP_OK && sp_plan_pack(compiled, &s, b, sizeof b) == SP_OK &&
+                       memcmp(a, b, sizeof a) == 0, "static plan matches compiled plan");
+    SP_TEST_ASSERT(rv, a[0] == 1 && a[3] == 4 && a[4] == 0xfd && a[offsetof(struct sensor_wire, name)] == 'b', "packed bytes");
+    memset(&out, 0x55, sizeof out);
+    SP_TEST_ASSERT(rv, sp_plan_unpack(sensor_plan, &out, a, sizeof a) == SP_OK && out.id == s.id && out.kind == s.kind &&
+                       out.temp == s.temp && memcmp(out.levels, s.levels, sizeof s.levels) == 0 && strcmp(out.name, "boiler") == 0 &&
+                       out.label[1] == 0x263a && out.label[4] == 0 && out.stamp == s.stamp, "static plan round trip");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(sensor_fmt, sensor_num_fields, sensor_offsets, &out, a, sizeof a) == SP_OK && out.stamp == s.stamp,
+                   "offset table with format string");
+
+    /* Code generation works on static plans, and freeing one only drops the generated code */
+    SPResult jit = sp_plan_jit(sensor_plan);
+    SP_TEST_ASSERT(rv, jit == SP_OK || jit == SP_ERR_UNSUPPORTED, "jit static plan");
+    memset(&out, 0, sizeof out);
+    SP_TEST_ASSERT(rv, sp_plan_unpack(sensor_plan, &out, a, sizeof a) == SP_OK && out.stamp == s.stamp, "unpack after jit");
+    sp_plan_free(sensor_plan);
+    memset(&out, 0, sizeof out);
+    SP_TEST_ASSERT(rv, sp_plan_unpack(sensor_plan, &out, a, sizeof a) == SP_OK && out.stamp == s.stamp, "static plan usable after free");
+
+    struct wide w, w_out;
+    memset(&w, 0, sizeof w);
+    w.f0 = 1;
+    w.f18 = 18;
+    w.f19 = 0xdeadbeef;
+    uint8_t wb[23];
+    memset(&w_out, 0, sizeof w_out);
+    SP_TEST_ASSERT(rv, sp_plan_size(wide_plan) == 23 && sp_plan_pack(wide_plan, &w, wb, sizeof wb) == SP_OK && wb[19] == 0xef &&
+                       sp_plan_unpack(wide_plan, &w_out, wb, sizeof wb) == SP_OK && w_out.f18 == 18 && w_out.f19 == 0xdeadbeef, "wide schema");
+
+    sp_plan_free(compiled);
+    return rv;
+}
@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct order {
+    uint32_t seq;
+    int16_t venue;
+    int64_t price;
+    char sym[5];
+};
+const char order_be_fmt[] = ">I h q 4s 'O'";
+const char order_le_fmt[] = "<I h q 4s 'O'";
+#define ORDER_SIZE 19
+#define NUM_ORDERS 20000
+
+static int rv = 0;
+
+/* Orders by price, then by original position */
+static int order_cmp(const void* a, const void* b) {
+    const struct order* x = a;
+    const struct order* y = b;
+    if (x->price != y->price) {
+        return x->price < y->price ? -1 : 1;
+    }
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int venue_cmp(const void* a, const void* b) {
+    const struct order* x = a;
+    const struct order* y = b;
+    if (x->venue != y->venue) {
+        return x->venue < y->venue ? -1 : 1;
+    }
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* Sort packed orders by one field, and compare with qsort of the unpacked structs */
+static void test_sort(const char* fmt, int key_field, int (*cmp)(const void*, const void*), int num_threads, const char* name) {
+    size_t offsets[4] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct order, seq, venue, price, sym);
+    sp_plan* plan = NULL;
+    struct order* orders = calloc(NUM_ORDERS, sizeof *orders);
+    uint8_t* packed = malloc((size_t)NUM_ORDERS * ORDER_SIZE);
+    uint8_t* expect = malloc((size_t)NUM_ORDERS * ORDER_SIZE);
+    if (!orders || !packed || !expect || sp_plan_compile(fmt, 4, offsets, &plan) != SP_OK) {
+        exit(1);
+    }
+    srand(3);
+    for (int i = 0; i < NUM_ORDERS; i++) {
+        orders[i].seq = (uint32_t)i;
+        orders[i].venue = (int16_t)(rand() % 64 - 32);
+        /* Both signs, many duplicates, and some values needing all eight bytes */
+        orders[i].price = (int64_t)(rand() % 2000 - 1000) * ((i % 7 == 0) ? INT64_C(4000000000000) : 1);
+        memcpy(orders[i].sym, i % 3 ? "ACME" : "INIT", 4);
+        sp_plan_pack(plan, &orders[i], packed + (size_t)i * ORDER_SIZE, ORDER_SIZE);
+    }
+    qsort(orders, NUM_ORDERS, sizeof *orders, cmp);
+    for (int i = 0; i < NUM_ORDERS; i++) {
+        sp_plan_pack(plan, &orders[i], expect + (size_t)i * ORDER_SIZE, ORDER_SIZE);
+    }
+    SP_TEST_ASSERT(rv, sp_sort(plan, key_field, packed, NUM_ORDERS, num_threads) == SP_OK &&
+                       memcmp(packed, expect, (size_t)NUM_ORDERS * ORDER_SIZE) == 0, name);
+    /* Sorting again changes nothing */
+    SP_TEST_ASSERT(rv, sp_sort(plan, key_field, packed, NUM_ORDERS, num_threads) == SP_OK &&
+                       memcmp(packed, expect, (size_t)NUM_ORDERS * ORDER_SIZE) == 0, "already sorted");
+    sp_plan_free(plan);
+    free(orders);
+    free(packed);
+    free(expect);
+}
+
+int main(void) {
+    test_sort(order_be_fmt, 2, order_cmp, 1, "big endian price, single thread");
+    test_sort(order_be_fmt, 2, order_cmp, 4, "big endian price, four threads");
+    test_sort(order_le_fmt, 2, order_cmp, 0, "little endian price, thread per processor");
+    test_sort(order_le_fmt, 1, venue_cmp, 3, "signed 16 bit venue");
+
+    /* Unsigned keys, and keys that differ in only one byte */
+    sp_plan* plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(">I B", 2, NULL, &plan) == SP_OK, "compile key plan");
+    uint8_t recs[4 * 5] = {0x80, 0, 0, 0, 'a', 0, 0, 0, 2, 'b', 0x7f, 0xff, 0xff, 0xff, 'c', 0, 0, 0, 1, 'd'};
+    const uint8_t sorted[4 * 5] = {0, 0, 0, 1, 'd', 0, 0, 0, 2, 'b', 0x7f, 0xff, 0xff, 0xff, 'c', 0x80, 0, 0, 0, 'a'};
+    SP_TEST_ASSERT(rv, sp_sort(plan, 0, recs, 4, 1) == SP_OK && memcmp(recs, sorted, sizeof recs) == 0, "unsigned key");
+    uint8_t same[3 * 5] = {0, 0, 0, 7, 'c', 0, 0, 0, 7, 'a', 0, 0, 0, 7, 'b'};
+    SP_TEST_ASSERT(rv, sp_sort(plan, 1, same, 3, 1) == SP_OK && memcmp(same, "\0\0\0\7a\0\0\0\7b\0\0\0\7c", sizeof same) == 0,
+                   "single byte key");
+    SP_TEST_ASSERT(rv, sp_sort(plan, 0, same, 3, 1) == SP_OK && memcmp(same, "\0\0\0\7a\0\0\0\7b\0\0\0\7c", sizeof same) == 0,
+                   "equal keys keep their order");
+    SP_TEST_ASSERT(rv, sp_sort(plan, 0, same, 0, 1) == SP_OK && sp_sort(plan, 0, same, 1, 1) == SP_OK, "nothing to sort");
+    SP_TEST_ASSERT(rv, sp_sort(plan, 2, same, 3, 1) == SP_ERR_INVALID_PARAMS && sp_sort(plan, -1, same, 3, 1) == SP_ERR_INVALID_PARAMS,
+                   "key field out of range");
+    SP_TEST_ASSERT(rv, sp_sort(NULL, 0, same, 3, 1) == SP_ERR_MISSING_PARAMS && sp_sort(plan, 0, NULL, 3, 1) == SP_ERR_MISSING_PARAMS,
+                   "missing params");
+    sp_plan_free(plan);
+
+    /* Strided groups take two offset list entries, but key fields count each element once, so q is field 2 */
+    SP_TEST_ASSERT(rv, sp_plan_compile(">2{h} q", 4, NULL, &plan) == SP_OK && sp_plan_size(plan) == 12, "compile strided plan");
+    uint8_t grouped[3 * 12] = {0, 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 9,
+                               0, 3, 0, 4, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                               0, 5, 0, 6, 0, 0, 0, 0, 0, 0, 0, 3};
+    const uint8_t grouped_sorted[3 * 12] = {0, 3, 0, 4, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                            0, 5, 0, 6, 0, 0, 0, 0, 0, 0, 0, 3,
+                                            0, 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 9};
+    SP_TEST_ASSERT(rv, sp_sort(plan, 2, grouped, 3, 1) == SP_OK && memcmp(grouped, grouped_sorted, sizeof grouped) == 0,
+                   "key after strided group");
+    SP_TEST_ASSERT(rv, sp_sort(plan, 3, grouped, 3, 1) == SP_ERR_INVALID_PARAMS, "offset list slot is not a field");
+    sp_plan_free(plan);
+
+    SP_TEST_ASSERT(rv, sp_plan_compile(">[2]I 4s", 2, NULL, &plan) == SP_OK, "compile array plan");
+    SP_TEST_ASSERT(rv, sp_sort(plan, 0, recs, 1, 1) == SP_ERR_INVALID_PARAMS && sp_sort(plan, 1, recs, 1, 1) == SP_ERR_INVALID_PARAMS,
+                   "key must be a single integer");
+    sp_plan_free(plan);
+    return rv;
+}
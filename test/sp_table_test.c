@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct rec {
+    uint32_t id;
+    int16_t temp;
+    char name[9];
+};
+const char rec_fmt[] = "<I h 8s 2x";
+#define REC_SIZE 16
+#define NUM_RECS 20000
+
+static const char table_path[] = "sp_table_test.bin";
+
+static int rv = 0;
+
+/* Ids are a permutation of 0 to NUM_RECS - 1, temps repeat */
+static void make_rec(struct rec* r, int i) {
+    r->id = (uint32_t)(((uint64_t)i * 7919) % NUM_RECS);
+    r->temp = (int16_t)(i % 200 - 100);
+    snprintf(r->name, sizeof r->name, "r%d", i);
+}
+
+/* Check lookups on both key fields, after indexing them with the given kind and threads */
+static int check_table(sp_table* t, sp_index_kind kind, int threads) {
+    struct rec r;
+    size_t index;
+    int ok = 1;
+    if (sp_table_index(t, 0, kind, threads) != SP_OK) {
+        return 0;
+    }
+    for (int i = 0; i < NUM_RECS; i += 97) {
+        struct rec want;
+        make_rec(&want, i);
+        memset(&r, 0, sizeof r);
+        if (sp_table_find(t, want.id, &r, &index) != SP_OK || index != (size_t)i ||
+            r.id != want.id || r.temp != want.temp || strcmp(r.name, want.name) != 0) {
+            ok = 0;
+        }
+    }
+    if (sp_table_find(t, NUM_RECS, &r, NULL) != SP_ERR_NOT_FOUND ||
+        sp_table_find(t, UINT64_C(1) << 32, NULL, NULL) != SP_ERR_NOT_FOUND) {
+        ok = 0;
+    }
+    /* Signed keys with duplicates find the first record holding them */
+    if (sp_table_index(t, 1, kind, threads) != SP_OK ||
+        sp_table_find(t, (uint64_t)(int64_t)-100, NULL, &index) != SP_OK || index != 0 ||
+        sp_table_find(t, (uint64_t)(int64_t)-1, NULL, &index) != SP_OK || index != 99 ||
+        sp_table_find(t, 99, NULL, &index) != SP_OK || index != 199 ||
+        sp_table_find(t, 100, NULL, NULL) != SP_ERR_NOT_FOUND ||
+        sp_table_find(t, (uint64_t)(int64_t)-40000, NULL, NULL) != SP_ERR_NOT_FOUND) {
+        ok = 0;
+    }
+    return ok;
+}
+
+int main(void) {
+    size_t offsets[3] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct rec, id, temp, name);
+    sp_plan* plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(rec_fmt, 3, offsets, &plan) == SP_OK, "compile record plan");
+
+    /* A header before the records, and a partial record after them */
+    uint8_t* data = calloc(1, 64 + NUM_RECS * REC_SIZE + 5);
+    int ok = 1;
+    for (int i = 0; i < NUM_RECS; i++) {
+        struct rec r;
+        make_rec(&r, i);
+        if (sp_plan_pack(plan, &r, data + 64 + i * REC_SIZE, REC_SIZE) != SP_OK) {
+            ok = 0;
+        }
+    }
+    SP_TEST_ASSERT(rv, ok, "pack records");
+    FILE* f = fopen(table_path, "wb");
+    SP_TEST_ASSERT(rv, f && fwrite(data, 1, 64 + NUM_RECS * REC_SIZE + 5, f) == 64 + NUM_RECS * REC_SIZE + 5, "write table file");
+    if (f) {
+        fclose(f);
+    }
+
+    sp_table* t = NULL;
+    SP_TEST_ASSERT(rv, sp_table_open_mem(data + 64, NUM_RECS * REC_SIZE + 5, plan, &t) == SP_OK, "open table in memory");
+    SP_TEST_ASSERT(rv, sp_table_count(t) == NUM_RECS, "record count ignores partial record");
+    struct rec r;
+    SP_TEST_ASSERT(rv, sp_table_read(t, 1234, &r) == SP_OK && r.id == (1234 * 7919) % NUM_RECS && strcmp(r.name, "r1234") == 0, "read record by number");
+    SP_TEST_ASSERT(rv, sp_table_read(t, NUM_RECS, &r) == SP_ERR_RANGE, "read past last record");
+    SP_TEST_ASSERT(rv, sp_table_find(t, 1, &r, NULL) == SP_ERR_INVALID_PARAMS, "find without index");
+    SP_TEST_ASSERT(rv, sp_table_index(t, 2, SP_INDEX_SORTED, 1) == SP_ERR_INVALID_PARAMS, "string key rejected");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_SORTED, 1), "sorted index, one thread");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_SORTED, 3), "sorted index, three threads");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_HASH, 1), "hash index, one thread");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_HASH, 4), "hash index, four threads");
+    sp_table_close(t);
+
+    t = NULL;
+    SP_TEST_ASSERT(rv, sp_table_open(table_path, 64, plan, SP_TABLE_MAP, &t) == SP_OK && sp_table_count(t) == NUM_RECS, "open mapped table");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_SORTED, 0), "mapped sorted index");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_HASH, 0), "mapped hash index");
+    sp_table_close(t);
+
+    t = NULL;
+    SP_TEST_ASSERT(rv, sp_table_open(table_path, 64, plan, SP_TABLE_BUFFERED, &t) == SP_OK && sp_table_count(t) == NUM_RECS, "open buffered table");
+    SP_TEST_ASSERT(rv, sp_table_read(t, NUM_RECS - 1, &r) == SP_OK && strcmp(r.name, "r19999") == 0, "buffered read");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_SORTED, 4), "buffered sorted index");
+    SP_TEST_ASSERT(rv, check_table(t, SP_INDEX_HASH, 2), "buffered hash index");
+    sp_table_close(t);
+
+    SP_TEST_ASSERT(rv, sp_table_open("sp_table_test_missing.bin", 0, plan, SP_TABLE_MAP, &t) == SP_ERR_IO, "missing file");
+    t = NULL;
+    SP_TEST_ASSERT(rv, sp_table_open_mem(data, 0, plan, &t) == SP_OK && sp_table_index(t, 0, SP_INDEX_HASH, 2) == SP_OK &&
+                       sp_table_find(t, 0, NULL, NULL) == SP_ERR_NOT_FOUND, "empty table");
+    sp_table_close(t);
+
+    remove(table_path);
+    free(data);
+    sp_plan_free(plan);
+    return rv;
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+const char fmt_str_be[] = ">12s IqiQhH 3(qI) [5]h b 5w 5u";
+const char fmt_str_le[] = "<12s IqiQhH 3(qI) [5]h b 5w 5u";
+
+uint8_t bytes_be[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0x00, 0x01, 0x86, 0xa0, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0xff, 0xfe, 0x79, 0x60, 0x00, 0x00, 0x00, 0x01, 0xdc, 0xd6, 0x50, 0x00, 0x8a, 0xd0, 0xea, 0x60, 0xff, 0xff, 0xff, 0xfe, 0x5e, 0xc4, 0x7a, 0x00, 0x00, 0x03, 0x0d, 0x40, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0x00, 0x04, 0x93, 0xe0, 0xff, 0xff, 0xff, 0xfd, 0xe7, 0x8e, 0xe6, 0x00, 0x00, 0x06, 0x1a, 0x80, 0x03, 0xe8, 0x07, 0xd0, 0x0b, 0xb8, 0x0f, 0xa0, 0x13, 0x88, 0x73, 0x00, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64};
+uint8_t bytes_le[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0xa0, 0x86, 0x01, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0x60, 0x79, 0xfe, 0xff, 0x00, 0x50, 0xd6, 0xdc, 0x01, 0x00, 0x00, 0x00, 0xd0, 0x8a, 0x60, 0xea, 0x00, 0x7a, 0xc4, 0x5e, 0xfe, 0xff, 0xff, 0xff, 0x40, 0x0d, 0x03, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0xe0, 0x93, 0x04, 0x00, 0x00, 0xe6, 0x8e, 0xe7, 0xfd, 0xff, 0xff, 0xff, 0x80, 0x1a, 0x06, 0x00, 0xe8, 0x03, 0xd0, 0x07, 0xb8, 0x0b, 0xa0, 0x0f, 0x88, 0x13, 0x73, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00};
+
+static int rv = 0;
+
+int main(void) {
+    int b_sz = (int)(sizeof bytes_be);
+
+    /* Endianness change over a batch of records */
+    printf("\nTesting BE to LE transcode\n");
+    uint8_t src[3 * sizeof bytes_be];
+    uint8_t dst[3 * sizeof bytes_be];
+    for (int i = 0; i < 3; ++i) {
+        memcpy(src + i * b_sz, bytes_be, sizeof bytes_be);
+    }
+    memset(dst, 0, sizeof dst);
+    SP_TEST_ASSERT(rv, sp_transcode(fmt_str_be, fmt_str_le, src, (int)sizeof src, dst, (int)sizeof dst, 3) == SP_OK, "transcode BE to LE");
+    for (int i = 0; i < 3; ++i) {
+        SP_TEST_ASSERT(rv, memcmp(dst + i * b_sz, bytes_le, sizeof bytes_le) == 0, "compare LE record");
+    }
+    SP_TEST_ASSERT(rv, sp_transcode(fmt_str_le, fmt_str_be, dst, (int)sizeof dst, src, (int)sizeof src, 3) == SP_OK, "transcode LE to BE");
+    SP_TEST_ASSERT(rv, memcmp(src + 2 * b_sz, bytes_be, sizeof bytes_be) == 0, "compare BE record");
+    SP_TEST_ASSERT(rv, sp_transcode(fmt_str_be, fmt_str_le, src, (int)sizeof src, dst, (int)sizeof dst, 4) == SP_ERR_BUFF_OVERRUN, "transcode overrun");
+
+    /* Widening, dropping padding, and long arrays */
+    printf("\nTesting widening transcode\n");
+    uint8_t wide_src[] = {0xff, 0x85, 0x00, 0x00, 0xea, 0x60, 0xaa, 0xbb,
+                          0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04, 0x00, 0x05,
+                          0x00, 0x06, 0x00, 0x07, 0x00, 0x08, 0x00, 0x09, 0x00, 0x0a};
+    uint8_t wide_expect[] = {0x85, 0xff, 0xff, 0xff, 0x60, 0xea, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                             0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04, 0x00, 0x05, 0x00,
+                             0x06, 0x00, 0x07, 0x00, 0x08, 0x00, 0x09, 0x00, 0x0a, 0x00, 0x00, 0x00};
+    uint8_t wide_dst[sizeof wide_expect];
+    memset(wide_dst, 0xcc, sizeof wide_dst);
+    SP_TEST_ASSERT(rv, sp_transcode(">h I 2x [10]H", "<i Q [10]H 2x", wide_src, (int)sizeof wide_src, wide_dst, (int)sizeof wide_dst, 1) == SP_OK, "transcode widening");
+    SP_TEST_ASSERT(rv, memcmp(wide_dst, wide_expect, sizeof wide_expect) == 0, "compare widened record");
+
+    /* Narrowing is range checked */
+    printf("\nTesting narrowing transcode\n");
+    uint8_t narrow_src[] = {0xff, 0xff, 0xff, 0xfb};
+    uint8_t narrow_dst[4] = {0};
+    SP_TEST_ASSERT(rv, sp_transcode(">i", "<b", narrow_src, 4, narrow_dst, 4, 1) == SP_OK, "narrow in range");
+    SP_TEST_ASSERT(rv, narrow_dst[0] == 0xfb, "compare narrowed value");
+    SP_TEST_ASSERT(rv, sp_transcode(">i", "<H", narrow_src, 4, narrow_dst, 4, 1) == SP_ERR_RANGE, "negative to unsigned");
+    SP_TEST_ASSERT(rv, sp_transcode(">I", "<h", narrow_src, 4, narrow_dst, 4, 1) == SP_ERR_RANGE, "narrow out of range");
+
+    printf("\nTesting transcode with constants\n");
+    uint8_t magic_src[] = {'V', '1', 0x00, 0x05};
+    uint8_t magic_dst[8] = {0};
+    SP_TEST_ASSERT(rv, sp_transcode(">'V1' h", "<H=2 i", magic_src, 4, magic_dst, 8, 1) == SP_OK, "transcode constants");
+    SP_TEST_ASSERT(rv, magic_dst[0] == 2 && magic_dst[1] == 0 && magic_dst[2] == 5, "compare transcoded constants");
+    magic_src[1] = '2';
+    SP_TEST_ASSERT(rv, sp_transcode(">'V1' h", "<H=2 i", magic_src, 4, magic_dst, 8, 1) == SP_ERR_MISMATCH, "transcode mismatched constant");
+
+    /* Incompatible formats */
+    SP_TEST_ASSERT(rv, sp_transcode(">[3]h", "<[4]h", wide_src, (int)sizeof wide_src, wide_dst, (int)sizeof wide_dst, 1) == SP_ERR_INVALID_PARAMS, "array length mismatch");
+    SP_TEST_ASSERT(rv, sp_transcode(">4s", "<I", wide_src, (int)sizeof wide_src, wide_dst, (int)sizeof wide_dst, 1) == SP_ERR_INVALID_PARAMS, "string to integer");
+    SP_TEST_ASSERT(rv, sp_transcode(">hh", "<h", wide_src, (int)sizeof wide_src, wide_dst, (int)sizeof wide_dst, 1) == SP_ERR_FIELD_CNT, "field count mismatch");
+
+    return rv;
+}
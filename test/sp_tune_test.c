@@ -0,0 +1,191 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct tick {
+    uint64_t time;
+    int32_t price;
+    uint16_t size;
+    char venue[5];
+};
+const char tick_fmt[] = ">Q i H 4s 'T'";
+const char tick_le_fmt[] = "<Q i H 4s 'T'";
+#define TICK_SIZE 19
+/* Packing never writes padding, so batches must clear it the same way whether they stream or not */
+const char padded_fmt[] = ">Q i 2x H 4s 'T'";
+const char padded_le_fmt[] = "<Q i 2x H 4s 'T'";
+#define PADDED_SIZE 21
+#define NUM_TICKS 5000
+#define NUM_SAMPLES 20000
+
+static const char tune_path[] = "sp_tune_test.bin";
+
+static int rv = 0;
+
+/* Everything each batch path produces, to compare with the optimizations on and off */
+struct outputs {
+    uint8_t* transcoded;
+    sp_buf appended;
+    uint32_t* samples;
+    uint64_t hashes[NUM_TICKS];
+    uint8_t* written;
+    size_t written_len;
+    SPResult narrow_res;
+    uint8_t narrowed[NUM_TICKS];
+    sp_buf padded;
+    uint8_t* padded_transcoded;
+};
+
+static void run_batches(const sp_plan* plan, const sp_plan* padded_plan, struct tick* ticks, const uint8_t* packed, const uint8_t* samples_buf, struct outputs* out) {
+    out->transcoded = malloc((size_t)NUM_TICKS * TICK_SIZE);
+    out->samples = malloc(NUM_SAMPLES * sizeof *out->samples);
+    out->written = malloc((size_t)NUM_TICKS * TICK_SIZE + 1);
+    out->padded_transcoded = malloc((size_t)NUM_TICKS * PADDED_SIZE);
+    sp_buf_init(&out->appended, NULL, NULL);
+    sp_buf_init(&out->padded, NULL, NULL);
+    if (!out->transcoded || !out->samples || !out->written || !out->padded_transcoded ||
+        sp_buf_reserve(&out->padded, (size_t)NUM_TICKS * PADDED_SIZE) != SP_OK) {
+        exit(1);
+    }
+    memset(out->transcoded, 0xcc, (size_t)NUM_TICKS * TICK_SIZE);
+    SP_TEST_ASSERT(rv, sp_transcode(tick_fmt, tick_le_fmt, (void*)packed, NUM_TICKS * TICK_SIZE, out->transcoded,
+                                    NUM_TICKS * TICK_SIZE, NUM_TICKS) == SP_OK, "transcode batch");
+    SP_TEST_ASSERT(rv, sp_plan_pack_batch_append(plan, ticks, sizeof ticks[0], NUM_TICKS, &out->appended) == SP_OK &&
+                       out->appended.len == (size_t)NUM_TICKS * TICK_SIZE, "append batch");
+    SP_TEST_ASSERT(rv, sp_hash_batch(plan, 0x5, packed, NUM_TICKS * TICK_SIZE, NUM_TICKS, out->hashes) == SP_OK, "hash batch");
+
+    /* Padded records, over space holding stale bytes */
+    memset(out->padded.data, 0xaa, out->padded.cap);
+    memset(out->padded_transcoded, 0xcc, (size_t)NUM_TICKS * PADDED_SIZE);
+    SP_TEST_ASSERT(rv, sp_plan_pack_batch_append(padded_plan, ticks, sizeof ticks[0], NUM_TICKS, &out->padded) == SP_OK &&
+                       sp_transcode(padded_fmt, padded_le_fmt, out->padded.data, NUM_TICKS * PADDED_SIZE, out->padded_transcoded,
+                                    NUM_TICKS * PADDED_SIZE, NUM_TICKS) == SP_OK, "padded batches");
+
+    /* A single large array field */
+    char samples_fmt[32];
+    size_t samples_off[1] = {0};
+    snprintf(samples_fmt, sizeof samples_fmt, ">[%d]I", NUM_SAMPLES);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(samples_fmt, 1, samples_off, out->samples, (void*)samples_buf,
+                                            NUM_SAMPLES * 4) == SP_OK, "unpack large array");
+
+    /* Records before a failure are still written */
+    memset(out->narrowed, 0, sizeof out->narrowed);
+    out->narrow_res = sp_transcode(">I", "<B", (void*)samples_buf, NUM_TICKS * 4, out->narrowed, NUM_TICKS, NUM_TICKS);
+
+    sp_writer* w = NULL;
+    SP_TEST_ASSERT(rv, sp_writer_open(tune_path, 0, plan, NUM_TICKS, &w) == SP_OK &&
+                       sp_writer_pack_batch(w, 0, ticks, sizeof ticks[0], NUM_TICKS, 2) == SP_OK &&
+                       sp_writer_close(w) == SP_OK, "writer batch");
+    FILE* f = fopen(tune_path, "rb");
+    out->written_len = f ? fread(out->written, 1, (size_t)NUM_TICKS * TICK_SIZE + 1, f) : 0;
+    if (f) {
+        fclose(f);
+    }
+    remove(tune_path);
+}
+
+static void free_outputs(struct outputs* out) {
+    free(out->transcoded);
+    free(out->samples);
+    free(out->written);
+    free(out->padded_transcoded);
+    sp_buf_free(&out->appended);
+    sp_buf_free(&out->padded);
+}
+
+int main(void) {
+    sp_tuning defaults, t;
+    sp_tuning_get(&defaults);
+    SP_TEST_ASSERT(rv, defaults.prefetch_ahead > 0 && defaults.prefetch_min > 0 && defaults.stream_min > 0, "default tuning");
+    sp_tuning custom = {1000, 256, 5000};
+    sp_tuning_set(&custom);
+    sp_tuning_get(&t);
+    SP_TEST_ASSERT(rv, t.prefetch_min == 1000 && t.prefetch_ahead == 256 && t.stream_min == 5000, "set tuning");
+    sp_tuning_set(NULL);
+    sp_tuning_get(&t);
+    SP_TEST_ASSERT(rv, t.prefetch_min == defaults.prefetch_min && t.prefetch_ahead == defaults.prefetch_ahead &&
+                       t.stream_min == defaults.stream_min, "restore default tuning");
+
+    size_t offsets[4] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct tick, time, price, size, venue);
+    sp_plan *plan = NULL, *padded_plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(tick_fmt, 4, offsets, &plan) == SP_OK && sp_plan_size(plan) == TICK_SIZE, "compile tick plan");
+    SP_TEST_ASSERT(rv, sp_plan_compile(padded_fmt, 4, offsets, &padded_plan) == SP_OK && sp_plan_size(padded_plan) == PADDED_SIZE,
+                   "compile padded plan");
+
+    struct tick* ticks = malloc(NUM_TICKS * sizeof *ticks);
+    uint8_t* packed = malloc((size_t)NUM_TICKS * TICK_SIZE);
+    uint8_t* samples_buf = malloc(NUM_SAMPLES * 4);
+    if (!ticks || !packed || !samples_buf) {
+        return 1;
+    }
+    for (int i = 0; i < NUM_TICKS; i++) {
+        memset(&ticks[i], 0, sizeof ticks[i]);
+        ticks[i].time = 1600000000000ull + (uint64_t)i * 977;
+        ticks[i].price = 10000 - i;
+        ticks[i].size = (uint16_t)(i * 13);
+        memcpy(ticks[i].venue, i % 2 ? "XNYS" : "BATS", 4);
+        sp_plan_pack(plan, &ticks[i], packed + (size_t)i * TICK_SIZE, TICK_SIZE);
+    }
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        uint32_t v = (uint32_t)i * 2654435761u;
+        /* Small values up to the last few ticks, so narrowing fails part way through */
+        if (i < NUM_TICKS - 3) {
+            v &= 0xff;
+        }
+        samples_buf[i * 4] = (uint8_t)(v >> 24);
+        samples_buf[i * 4 + 1] = (uint8_t)(v >> 16);
+        samples_buf[i * 4 + 2] = (uint8_t)(v >> 8);
+        samples_buf[i * 4 + 3] = (uint8_t)v;
+    }
+
+    /* Every optimization forced on, then forced off, must give the same output */
+    struct outputs on, off;
+    sp_tuning always = {0, 64, 0};
+    sp_tuning never = {SIZE_MAX, 0, SIZE_MAX};
+    sp_tuning_set(&always);
+    run_batches(plan, padded_plan, ticks, packed, samples_buf, &on);
+    sp_tuning_set(&never);
+    run_batches(plan, padded_plan, ticks, packed, samples_buf, &off);
+    sp_tuning_set(NULL);
+
+    const size_t total = (size_t)NUM_TICKS * TICK_SIZE;
+    SP_TEST_ASSERT(rv, memcmp(on.transcoded, off.transcoded, total) == 0, "transcoded output matches");
+    SP_TEST_ASSERT(rv, on.transcoded[TICK_SIZE] == 0xd1 && on.transcoded[2 * TICK_SIZE - 1] == 'T', "transcoded to little endian");
+    SP_TEST_ASSERT(rv, memcmp(on.appended.data, packed, total) == 0 && memcmp(off.appended.data, packed, total) == 0, "appended output matches");
+    SP_TEST_ASSERT(rv, memcmp(on.hashes, off.hashes, sizeof on.hashes) == 0, "hashes match");
+    SP_TEST_ASSERT(rv, memcmp(on.samples, off.samples, NUM_SAMPLES * sizeof *on.samples) == 0 &&
+                       on.samples[NUM_SAMPLES - 1] == (uint32_t)(NUM_SAMPLES - 1) * 2654435761u, "large array matches");
+    SP_TEST_ASSERT(rv, on.narrow_res == SP_ERR_RANGE && off.narrow_res == SP_ERR_RANGE &&
+                       memcmp(on.narrowed, off.narrowed, sizeof on.narrowed) == 0 && on.narrowed[NUM_TICKS - 4] == (uint8_t)((NUM_TICKS - 4) * 2654435761u),
+                   "records before a failure written");
+    SP_TEST_ASSERT(rv, on.written_len == total && off.written_len == total && memcmp(on.written, packed, total) == 0 &&
+                       memcmp(off.written, packed, total) == 0, "written file matches");
+
+    const size_t padded_total = (size_t)NUM_TICKS * PADDED_SIZE;
+    SP_TEST_ASSERT(rv, on.padded.len == padded_total && off.padded.len == padded_total &&
+                       memcmp(on.padded.data, off.padded.data, padded_total) == 0, "padded output matches");
+    SP_TEST_ASSERT(rv, on.padded.data[12] == 0 && on.padded.data[13] == 0 && on.padded.data[padded_total - 8] == 0 &&
+                       on.padded.data[padded_total - 9] == 0, "padding zeroed");
+    SP_TEST_ASSERT(rv, memcmp(on.padded_transcoded, off.padded_transcoded, padded_total) == 0 &&
+                       on.padded_transcoded[12] == 0 && on.padded_transcoded[padded_total - 9] == 0, "padded transcode matches");
+
+    free_outputs(&on);
+    free_outputs(&off);
+    free(samples_buf);
+    free(packed);
+    free(ticks);
+    sp_plan_free(plan);
+    sp_plan_free(padded_plan);
+    return rv;
+}
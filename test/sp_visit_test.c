@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct reading {
+    uint32_t id;
+    int16_t temp;
+    uint16_t samples[600];
+    char label[7];
+    char owner[4 * 3 + 1];
+    uint32_t codes[3];
+    int8_t trend;
+};
+const char reading_fmt[] = ">I h [600]H 6s 'OK' 4w:s 3u b";
+#define NUM_FIELDS 7
+
+/* Rebuilds each field as text, and checks blocks arrive in order */
+struct collect {
+    char text[256];
+    int calls[NUM_FIELDS];
+    int next_first[NUM_FIELDS];
+    uint64_t sample_sum;
+    int in_order;
+    int stop_at;
+};
+
+static void append(struct collect* c, const char* s) {
+    size_t used = strlen(c->text);
+    snprintf(c->text + used, sizeof c->text - used, "%s", s);
+}
+
+static SPResult on_signed(void* ctx, int field, int first, const int64_t* values, int count) {
+    struct collect* c = ctx;
+    char num[32];
+    c->calls[field]++;
+    c->in_order &= first == c->next_first[field];
+    c->next_first[field] = first + count;
+    for (int i = 0; i < count; i++) {
+        snprintf(num, sizeof num, "%lld,", (long long)values[i]);
+        append(c, num);
+    }
+    return field == c->stop_at ? SP_ERR_RANGE : SP_OK;
+}
+
+static SPResult on_unsigned(void* ctx, int field, int first, const uint64_t* values, int count) {
+    struct collect* c = ctx;
+    char num[32];
+    c->calls[field]++;
+    c->in_order &= first == c->next_first[field];
+    c->next_first[field] = first + count;
+    for (int i = 0; i < count; i++) {
+        if (field == 2) {
+            c->sample_sum += values[i];
+        } else {
+            snprintf(num, sizeof num, "%llu,", (unsigned long long)values[i]);
+            append(c, num);
+        }
+    }
+    return field == c->stop_at ? SP_ERR_RANGE : SP_OK;
+}
+
+static SPResult on_string(void* ctx, int field, const char* str, int len) {
+    struct collect* c = ctx;
+    char s[64];
+    c->calls[field]++;
+    snprintf(s, sizeof s, "%.*s,", len, str);
+    append(c, s);
+    return field == c->stop_at ? SP_ERR_RANGE : SP_OK;
+}
+
+static int rv = 0;
+
+int main(void) {
+    size_t offsets[NUM_FIELDS] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct reading, id, temp, samples, label, owner, codes, trend);
+    sp_plan *pack_plan = NULL, *plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(reading_fmt, NUM_FIELDS, offsets, &pack_plan) == SP_OK, "compile packing plan");
+    SP_TEST_ASSERT(rv, sp_plan_compile(reading_fmt, NUM_FIELDS, NULL, &plan) == SP_OK, "compile plan without offsets");
+
+    struct reading r;
+    memset(&r, 0, sizeof r);
+    r.id = 4000000000u;
+    r.temp = -40;
+    uint64_t expect_sum = 0;
+    for (int i = 0; i < 600; i++) {
+        r.samples[i] = (uint16_t)(i * 97);
+        expect_sum += r.samples[i];
+    }
+    strcpy(r.label, "tank");
+    strcpy(r.owner, "J\xc3\xb8rn");
+    r.codes[0] = 1;
+    r.codes[1] = 70000;
+    r.codes[2] = 0xffffffffu;
+    r.trend = -3;
+    uint8_t buf[1300];
+    SP_TEST_ASSERT(rv, sp_plan_pack(pack_plan, &r, buf, (int)sizeof buf) == SP_OK, "pack reading");
+    SP_TEST_ASSERT(rv, sp_plan_unpack(plan, &r, buf, (int)sizeof buf) == SP_ERR_UNSUPPORTED, "plan without offsets cannot unpack");
+
+    sp_visitor visitor = {on_signed, on_unsigned, on_string};
+    struct collect c;
+    memset(&c, 0, sizeof c);
+    c.in_order = 1;
+    c.stop_at = -1;
+    SP_TEST_ASSERT(rv, sp_visit(plan, buf, sp_plan_size(plan), &visitor, &c) == SP_OK, "visit reading");
+    SP_TEST_ASSERT(rv, strcmp(c.text, "4000000000,-40,tank,J\xc3\xb8rn,1,70000,4294967295,-3,") == 0, "compare visited values");
+    SP_TEST_ASSERT(rv, c.sample_sum == expect_sum && c.calls[2] == 3 && c.next_first[2] == 600 && c.in_order, "large array visited in blocks");
+    SP_TEST_ASSERT(rv, c.calls[5] == 1 && c.next_first[5] == 3, "code units visited as one array");
+
+    /* Callbacks can be left out, and can stop the visit */
+    sp_visitor strings_only = {NULL, NULL, on_string};
+    memset(&c, 0, sizeof c);
+    c.stop_at = -1;
+    SP_TEST_ASSERT(rv, sp_visit(plan, buf, sp_plan_size(plan), &strings_only, &c) == SP_OK && strcmp(c.text, "tank,J\xc3\xb8rn,") == 0, "visit strings only");
+    memset(&c, 0, sizeof c);
+    c.stop_at = 3;
+    SP_TEST_ASSERT(rv, sp_visit(plan, buf, sp_plan_size(plan), &visitor, &c) == SP_ERR_RANGE && c.calls[4] == 0, "callback stops visit");
+
+    SP_TEST_ASSERT(rv, sp_visit(plan, buf, sp_plan_size(plan) - 1, &visitor, &c) == SP_ERR_BUFF_OVERRUN, "visit overrun");
+    buf[1213] = 'X';
+    SP_TEST_ASSERT(rv, sp_visit(plan, buf, sp_plan_size(plan), &visitor, &c) == SP_ERR_MISMATCH, "visit checks constants");
+
+    sp_plan_free(pack_plan);
+    sp_plan_free(plan);
+    return rv;
+}
@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_test.h"
+
+struct order {
+    uint64_t id;
+    int32_t qty;
+    uint16_t items[6];
+    char sku[9];
+};
+const char order_fmt[] = ">Q i [6]H 8s 'E'";
+#define ORDER_SIZE 33
+#define NUM_RECS 20000
+#define HEADER_LEN 16
+
+static const char writer_path[] = "sp_writer_test.bin";
+
+static int rv = 0;
+
+static void make_order(struct order* o, int i) {
+    memset(o, 0, sizeof *o);
+    o->id = (uint64_t)i * 0x100000001ull;
+    o->qty = -i;
+    for (int j = 0; j < 6; j++) {
+        o->items[j] = (uint16_t)(i + j);
+    }
+    snprintf(o->sku, sizeof o->sku, "S%07d", i);
+}
+
+int main(void) {
+    size_t offsets[4] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct order, id, qty, items, sku);
+    sp_plan* plan = NULL;
+    SP_TEST_ASSERT(rv, sp_plan_compile(order_fmt, 4, offsets, &plan) == SP_OK && sp_plan_size(plan) == ORDER_SIZE, "compile order plan");
+
+    struct order* orders = malloc(NUM_RECS * sizeof *orders);
+    uint8_t* expect = malloc(HEADER_LEN + (size_t)NUM_RECS * ORDER_SIZE);
+    if (!orders || !expect) {
+        return 1;
+    }
+    memset(expect, 0, HEADER_LEN);
+    memcpy(expect, "ORDERS", 6);
+    for (int i = 0; i < NUM_RECS; i++) {
+        make_order(&orders[i], i);
+        sp_plan_pack(plan, &orders[i], expect + HEADER_LEN + (size_t)i * ORDER_SIZE, ORDER_SIZE);
+    }
+
+    /* The first record on its own, a parallel batch out of order, then a serial batch */
+    sp_writer* w = NULL;
+    SP_TEST_ASSERT(rv, sp_writer_open(writer_path, HEADER_LEN, plan, NUM_RECS, &w) == SP_OK, "open writer");
+    memcpy(sp_writer_data(w), "ORDERS", 6);
+    SP_TEST_ASSERT(rv, sp_writer_pack(w, 0, &orders[0]) == SP_OK, "pack single record");
+    SP_TEST_ASSERT(rv, sp_writer_pack_batch(w, 5000, &orders[5000], sizeof orders[0], NUM_RECS - 5000, 4) == SP_OK, "pack parallel batch");
+    SP_TEST_ASSERT(rv, sp_writer_pack_batch(w, 1, &orders[1], sizeof orders[0], 4999, 1) == SP_OK, "pack serial batch");
+    SP_TEST_ASSERT(rv, sp_writer_pack(w, NUM_RECS, &orders[0]) == SP_ERR_RANGE, "pack past last record");
+    SP_TEST_ASSERT(rv, sp_writer_pack_batch(w, NUM_RECS - 1, &orders[0], sizeof orders[0], 2, 0) == SP_ERR_RANGE, "batch past last record");
+    SP_TEST_ASSERT(rv, sp_writer_close(w) == SP_OK, "close writer");
+
+    FILE* f = fopen(writer_path, "rb");
+    uint8_t* got = malloc(HEADER_LEN + (size_t)NUM_RECS * ORDER_SIZE + 1);
+    size_t got_len = (f && got) ? fread(got, 1, HEADER_LEN + (size_t)NUM_RECS * ORDER_SIZE + 1, f) : 0;
+    if (f) {
+        fclose(f);
+    }
+    SP_TEST_ASSERT(rv, got_len == HEADER_LEN + (size_t)NUM_RECS * ORDER_SIZE && memcmp(got, expect, got_len) == 0, "compare written file");
+
+    sp_table* t = NULL;
+    struct order o;
+    SP_TEST_ASSERT(rv, sp_table_open(writer_path, HEADER_LEN, plan, SP_TABLE_MAP, &t) == SP_OK && sp_table_count(t) == NUM_RECS, "read back as table");
+    SP_TEST_ASSERT(rv, sp_table_read(t, 12345, &o) == SP_OK && o.id == orders[12345].id && strcmp(o.sku, "S0012345") == 0, "compare table record");
+    sp_table_close(t);
+
+    /* An empty file, and a writer replacing it */
+    SP_TEST_ASSERT(rv, sp_writer_open(writer_path, 0, plan, 0, &w) == SP_OK && sp_writer_pack(w, 0, &orders[0]) == SP_ERR_RANGE &&
+                       sp_writer_close(w) == SP_OK, "empty writer");
+    f = fopen(writer_path, "rb");
+    SP_TEST_ASSERT(rv, f && fread(got, 1, 1, f) == 0, "empty file written");
+    if (f) {
+        fclose(f);
+    }
+    SP_TEST_ASSERT(rv, sp_writer_open("no_such_dir/sp_writer_test.bin", 0, plan, 1, &w) == SP_ERR_IO, "create failure");
+
+    remove(writer_path);
+    free(got);
+    free(expect);
+    free(orders);
+    sp_plan_free(plan);
+    return rv;
+}
@@ -0,0 +1,160 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <structpack.hpp>
+#include <sp_struct_offsets.h>
+#include "sp_test.h"
+
+#define ARR_LEN(arr) sizeof arr / sizeof arr[0]
+
+/* Same layout as in structpack_test.c, with the repeated group flattened,
+   as member pointers cannot refer into arrays of structs */
+struct sp_pack_unpack {
+    char hello[13];
+    uint32_t spu32;
+    int64_t spi64;
+    int32_t spi32;
+    uint64_t spu64;
+    int16_t spi16;
+    uint16_t spu16;
+    int64_t s0_i64;
+    uint32_t s0_u32;
+    int64_t s1_i64;
+    uint32_t s1_u32;
+    int64_t s2_i64;
+    uint32_t s2_u32;
+    int16_t spi16arr[5];
+    char spchar;
+    uint16_t helloW[6];
+    uint32_t worldU[6];
+};
+static constexpr char fmt_str_be[] = ">12s IqiQhH 3(qI) [5]h b 5w 5u";
+static constexpr char fmt_str_le[] = "<12s IqiQhH 3(qI) [5]h b 5w 5u";
+static constexpr char fmt_str_skip[] = ">24x iQhH 3(qI) [5]h b 5w 5u";
+
+#define SP_ALL_MEMBERS &sp_pack_unpack::hello, &sp_pack_unpack::spu32, &sp_pack_unpack::spi64, \
+    &sp_pack_unpack::spi32, &sp_pack_unpack::spu64, &sp_pack_unpack::spi16, &sp_pack_unpack::spu16, \
+    &sp_pack_unpack::s0_i64, &sp_pack_unpack::s0_u32, &sp_pack_unpack::s1_i64, &sp_pack_unpack::s1_u32, \
+    &sp_pack_unpack::s2_i64, &sp_pack_unpack::s2_u32, &sp_pack_unpack::spi16arr, &sp_pack_unpack::spchar, \
+    &sp_pack_unpack::helloW, &sp_pack_unpack::worldU
+
+using codec_be = sp::codec<fmt_str_be, SP_ALL_MEMBERS>;
+using codec_le = sp::codec<fmt_str_le, SP_ALL_MEMBERS>;
+using codec_skip = sp::codec<fmt_str_skip, &sp_pack_unpack::spi32, &sp_pack_unpack::spu64, &sp_pack_unpack::spi16,
+    &sp_pack_unpack::spu16, &sp_pack_unpack::s0_i64, &sp_pack_unpack::s0_u32, &sp_pack_unpack::s1_i64,
+    &sp_pack_unpack::s1_u32, &sp_pack_unpack::s2_i64, &sp_pack_unpack::s2_u32, &sp_pack_unpack::spi16arr,
+    &sp_pack_unpack::spchar, &sp_pack_unpack::helloW, &sp_pack_unpack::worldU>;
+
+static constexpr char fmt_str_seek[] = ">@16 q %4 %76 [5]h @ 87 5w @128";
+using codec_seek = sp::codec<fmt_str_seek, &sp_pack_unpack::spi64, &sp_pack_unpack::spi16arr, &sp_pack_unpack::helloW>;
+static_assert(codec_seek::size == 128, "offset directive sets the record size");
+
+/* Fields resized to differently sized members */
+struct sp_widths {
+    int64_t h_wide;
+    uint32_t H_wide;
+    int8_t i_narrow;
+    int32_t arr[3];
+};
+static constexpr char fmt_str_widths[] = "<h:8 H:4 i:1 [3]h:4";
+using codec_widths = sp::codec<fmt_str_widths, &sp_widths::h_wide, &sp_widths::H_wide, &sp_widths::i_narrow,
+    &sp_widths::arr>;
+
+uint8_t bytes_be[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0x00, 0x01, 0x86, 0xa0, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0xff, 0xfe, 0x79, 0x60, 0x00, 0x00, 0x00, 0x01, 0xdc, 0xd6, 0x50, 0x00, 0x8a, 0xd0, 0xea, 0x60, 0xff, 0xff, 0xff, 0xfe, 0x5e, 0xc4, 0x7a, 0x00, 0x00, 0x03, 0x0d, 0x40, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0x00, 0x04, 0x93, 0xe0, 0xff, 0xff, 0xff, 0xfd, 0xe7, 0x8e, 0xe6, 0x00, 0x00, 0x06, 0x1a, 0x80, 0x03, 0xe8, 0x07, 0xd0, 0x0b, 0xb8, 0x0f, 0xa0, 0x13, 0x88, 0x73, 0x00, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64};
+uint8_t bytes_le[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0xa0, 0x86, 0x01, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0x60, 0x79, 0xfe, 0xff, 0x00, 0x50, 0xd6, 0xdc, 0x01, 0x00, 0x00, 0x00, 0xd0, 0x8a, 0x60, 0xea, 0x00, 0x7a, 0xc4, 0x5e, 0xfe, 0xff, 0xff, 0xff, 0x40, 0x0d, 0x03, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0xe0, 0x93, 0x04, 0x00, 0x00, 0xe6, 0x8e, 0xe7, 0xfd, 0xff, 0xff, 0xff, 0x80, 0x1a, 0x06, 0x00, 0xe8, 0x03, 0xd0, 0x07, 0xb8, 0x0b, 0xa0, 0x0f, 0x88, 0x13, 0x73, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00};
+
+static int rv = 0;
+
+int main(void) {
+    size_t offsets[17] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets, 0, struct sp_pack_unpack, hello, spu32, spi64, spi32, spu64, spi16, spu16,
+        s0_i64, s0_u32, s1_i64, s1_u32, s2_i64, s2_u32, spi16arr, spchar, helloW);
+    SP_OFFSET1(offsets, 16, struct sp_pack_unpack, worldU);
+    size_t offsets_skip[14] = {0};
+    SP_ADD_STRUCT_OFFSET(offsets_skip, 0, struct sp_pack_unpack, spi32, spu64, spi16, spu16,
+        s0_i64, s0_u32, s1_i64, s1_u32, s2_i64, s2_u32, spi16arr, spchar, helloW, worldU);
+
+    static_assert(codec_be::size == sizeof bytes_be, "packed size");
+
+    /* Unpack parity with the C API */
+    sp_pack_unpack c_be, cpp_be, c_le, cpp_le, c_skip, cpp_skip;
+    std::memset(&c_be, 0, sizeof c_be);
+    std::memset(&cpp_be, 0, sizeof cpp_be);
+    std::memset(&c_le, 0, sizeof c_le);
+    std::memset(&cpp_le, 0, sizeof cpp_le);
+    std::memset(&c_skip, 0, sizeof c_skip);
+    std::memset(&cpp_skip, 0, sizeof cpp_skip);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_be, ARR_LEN(offsets), offsets, &c_be, bytes_be, (int)sizeof bytes_be) == SP_OK, "C unpack BE");
+    SP_TEST_ASSERT(rv, codec_be::unpack(cpp_be, bytes_be, sizeof bytes_be) == SP_OK, "C++ unpack BE");
+    SP_TEST_ASSERT(rv, std::memcmp(&c_be, &cpp_be, sizeof c_be) == 0, "compare BE unpack");
+    SP_TEST_ASSERT(rv, std::strcmp(cpp_be.hello, "Hello World!") == 0 && cpp_be.s2_i64 == -9000000000, "check BE values");
+
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_le, ARR_LEN(offsets), offsets, &c_le, bytes_le, (int)sizeof bytes_le) == SP_OK, "C unpack LE");
+    SP_TEST_ASSERT(rv, codec_le::unpack(cpp_le, bytes_le, sizeof bytes_le) == SP_OK, "C++ unpack LE");
+    SP_TEST_ASSERT(rv, std::memcmp(&c_le, &cpp_le, sizeof c_le) == 0, "compare LE unpack");
+    SP_TEST_ASSERT(rv, std::memcmp(&cpp_be, &cpp_le, sizeof cpp_be) == 0, "compare BE and LE unpack");
+
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_skip, ARR_LEN(offsets_skip), offsets_skip, &c_skip, bytes_be, (int)sizeof bytes_be) == SP_OK, "C unpack skip");
+    SP_TEST_ASSERT(rv, codec_skip::unpack(cpp_skip, bytes_be, sizeof bytes_be) == SP_OK, "C++ unpack skip");
+    SP_TEST_ASSERT(rv, std::memcmp(&c_skip, &cpp_skip, sizeof c_skip) == 0, "compare skip unpack");
+
+    SP_TEST_ASSERT(rv, codec_be::unpack(cpp_be, bytes_be, sizeof bytes_be - 1) == SP_ERR_BUFF_OVERRUN, "C++ unpack overrun");
+
+    /* Pack parity with the C API */
+    uint8_t c_buff[sizeof bytes_be] = {0};
+    uint8_t cpp_buff[sizeof bytes_be] = {0};
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_be, ARR_LEN(offsets), offsets, &c_be, c_buff, (int)sizeof c_buff) == SP_OK, "C pack BE");
+    SP_TEST_ASSERT(rv, codec_be::pack(c_be, cpp_buff, sizeof cpp_buff) == SP_OK, "C++ pack BE");
+    SP_TEST_ASSERT(rv, std::memcmp(c_buff, cpp_buff, sizeof c_buff) == 0, "compare BE pack");
+    SP_TEST_ASSERT(rv, std::memcmp(cpp_buff, bytes_be, sizeof cpp_buff) == 0, "compare BE pack with source");
+
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_le, ARR_LEN(offsets), offsets, &c_le, c_buff, (int)sizeof c_buff) == SP_OK, "C pack LE");
+    SP_TEST_ASSERT(rv, codec_le::pack(c_le, cpp_buff, sizeof cpp_buff) == SP_OK, "C++ pack LE");
+    SP_TEST_ASSERT(rv, std::memcmp(c_buff, cpp_buff, sizeof c_buff) == 0, "compare LE pack");
+    SP_TEST_ASSERT(rv, std::memcmp(cpp_buff, bytes_le, sizeof cpp_buff) == 0, "compare LE pack with source");
+
+    /* Offset and alignment parity with the C API */
+    size_t seek_offsets[3] = {0};
+    SP_ADD_STRUCT_OFFSET(seek_offsets, 0, sp_pack_unpack, spi64, spi16arr, helloW);
+    uint8_t seek_bytes[128] = {0};
+    std::memcpy(seek_bytes, bytes_be, sizeof bytes_be);
+    std::memset(&c_be, 0, sizeof c_be);
+    std::memset(&cpp_be, 0, sizeof cpp_be);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_seek, 3, seek_offsets, &c_be, seek_bytes, (int)sizeof seek_bytes) == SP_OK, "C unpack offsets");
+    SP_TEST_ASSERT(rv, codec_seek::unpack(cpp_be, seek_bytes, sizeof seek_bytes) == SP_OK, "C++ unpack offsets");
+    SP_TEST_ASSERT(rv, std::memcmp(&c_be, &cpp_be, sizeof c_be) == 0 && cpp_be.spi16arr[4] == 5000, "compare offsets unpack");
+    uint8_t c_seek_buff[128], cpp_seek_buff[128];
+    std::memset(c_seek_buff, 0x55, sizeof c_seek_buff);
+    std::memset(cpp_seek_buff, 0x55, sizeof cpp_seek_buff);
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_seek, 3, seek_offsets, &c_be, c_seek_buff, (int)sizeof c_seek_buff) == SP_OK, "C pack offsets");
+    SP_TEST_ASSERT(rv, codec_seek::pack(cpp_be, cpp_seek_buff, sizeof cpp_seek_buff) == SP_OK, "C++ pack offsets");
+    SP_TEST_ASSERT(rv, std::memcmp(c_seek_buff, cpp_seek_buff, sizeof c_seek_buff) == 0, "compare offsets pack");
+    SP_TEST_ASSERT(rv, codec_seek::pack(cpp_be, cpp_seek_buff, sizeof cpp_seek_buff - 1) == SP_ERR_BUFF_OVERRUN, "C++ pack offsets overrun");
+
+    /* Member width parity with the C API */
+    size_t w_offsets[4] = {0};
+    SP_ADD_STRUCT_OFFSET(w_offsets, 0, sp_widths, h_wide, H_wide, i_narrow, arr);
+    uint8_t w_bytes[codec_widths::size] = {0x38, 0xff, 0x60, 0xea, 0x80, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x80, 0x01, 0x00};
+    sp_widths c_w, cpp_w;
+    std::memset(&c_w, 0, sizeof c_w);
+    std::memset(&cpp_w, 0, sizeof cpp_w);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_widths, 4, w_offsets, &c_w, w_bytes, (int)sizeof w_bytes) == SP_OK, "C unpack widths");
+    SP_TEST_ASSERT(rv, codec_widths::unpack(cpp_w, w_bytes, sizeof w_bytes) == SP_OK, "C++ unpack widths");
+    SP_TEST_ASSERT(rv, std::memcmp(&c_w, &cpp_w, sizeof c_w) == 0, "compare widths unpack");
+    SP_TEST_ASSERT(rv, cpp_w.h_wide == -200 && cpp_w.H_wide == 60000 && cpp_w.i_narrow == -128 && cpp_w.arr[1] == -32768, "check widths values");
+    uint8_t w_pack[codec_widths::size] = {0};
+    SP_TEST_ASSERT(rv, codec_widths::pack(cpp_w, w_pack, sizeof w_pack) == SP_OK, "C++ pack widths");
+    SP_TEST_ASSERT(rv, std::memcmp(w_pack, w_bytes, sizeof w_pack) == 0, "compare widths pack with source");
+    cpp_w.arr[2] = 40000;
+    SP_TEST_ASSERT(rv, codec_widths::pack(cpp_w, w_pack, sizeof w_pack) == SP_ERR_RANGE, "C++ pack out of range");
+    w_bytes[7] = 0x00;
+    SP_TEST_ASSERT(rv, codec_widths::unpack(cpp_w, w_bytes, sizeof w_bytes) == SP_ERR_RANGE, "C++ unpack out of range");
+
+    return rv;
+}
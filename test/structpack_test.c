@@ -43,6 +43,23 @@ const char fmt_str_skip[] = ">24x iQhH 3(qI) [5]h b 5w 5u";
 uint8_t bytes_be[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0x00, 0x01, 0x86, 0xa0, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0xff, 0xfe, 0x79, 0x60, 0x00, 0x00, 0x00, 0x01, 0xdc, 0xd6, 0x50, 0x00, 0x8a, 0xd0, 0xea, 0x60, 0xff, 0xff, 0xff, 0xfe, 0x5e, 0xc4, 0x7a, 0x00, 0x00, 0x03, 0x0d, 0x40, 0xff, 0xff, 0xff, 0xfe, 0x23, 0x29, 0xb0, 0x00, 0x00, 0x04, 0x93, 0xe0, 0xff, 0xff, 0xff, 0xfd, 0xe7, 0x8e, 0xe6, 0x00, 0x00, 0x06, 0x1a, 0x80, 0x03, 0xe8, 0x07, 0xd0, 0x0b, 0xb8, 0x0f, 0xa0, 0x13, 0x88, 0x73, 0x00, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64};
 uint8_t bytes_le[] = {0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0xa0, 0x86, 0x01, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0x60, 0x79, 0xfe, 0xff, 0x00, 0x50, 0xd6, 0xdc, 0x01, 0x00, 0x00, 0x00, 0xd0, 0x8a, 0x60, 0xea, 0x00, 0x7a, 0xc4, 0x5e, 0xfe, 0xff, 0xff, 0xff, 0x40, 0x0d, 0x03, 0x00, 0x00, 0xb0, 0x29, 0x23, 0xfe, 0xff, 0xff, 0xff, 0xe0, 0x93, 0x04, 0x00, 0x00, 0xe6, 0x8e, 0xe7, 0xfd, 0xff, 0xff, 0xff, 0x80, 0x1a, 0x06, 0x00, 0xe8, 0x03, 0xd0, 0x07, 0xb8, 0x0b, 0xa0, 0x0f, 0x88, 0x13, 0x73, 0x48, 0x00, 0x65, 0x00, 0x6c, 0x00, 0x6c, 0x00, 0x6f, 0x00, 0x57, 0x00, 0x00, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x72, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00};
 
+/* Fields resized to differently sized members */
+struct sp_widths {
+    int64_t h_wide;
+    uint32_t H_wide;
+    int8_t i_narrow;
+    uint16_t I_narrow;
+    int32_t arr[300];
+};
+const char fmt_str_widths[] = ">h:8 H:4 i:1 I:2 [300]h:4";
+
+/* UTF-16 and UTF-32 fields unpacked to UTF-8 members */
+struct sp_utf8 {
+    char name[16 * 3 + 1];
+    char label[8 * 4 + 1];
+};
+const char fmt_str_utf8[] = ">16w:s 8u:s";
+
 static int rv = 0;
 
 int main(void) {
@@ -136,5 +153,143 @@ int main(void) {
     SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_le, ARR_LEN(offsets), offsets, &pack, pack_buff, b_sz) == SP_OK, "pack LE");
     SP_TEST_ASSERT(rv, memcmp(pack_buff, bytes_le, sizeof pack_buff) == 0, "compare LE buffer");
 
+    /* Test in place byte order conversion */
+    printf("\nTesting in place swap\n");
+    const uint16_t probe = 1;
+    uint8_t *host_bytes = (*(const uint8_t*)&probe == 1) ? bytes_le : bytes_be;
+    uint8_t swap_buff[2 * sizeof bytes_be] = {0};
+    memcpy(swap_buff, bytes_be, sizeof bytes_be);
+    memcpy(swap_buff + sizeof bytes_be, bytes_be, sizeof bytes_be);
+    SP_TEST_ASSERT(rv, sp_swap_inplace(fmt_str_be, swap_buff, (int)(sizeof swap_buff), 2) == SP_OK, "swap BE records");
+    SP_TEST_ASSERT(rv, memcmp(swap_buff, host_bytes, b_sz) == 0, "compare swapped record 1");
+    SP_TEST_ASSERT(rv, memcmp(swap_buff + b_sz, host_bytes, b_sz) == 0, "compare swapped record 2");
+    SP_TEST_ASSERT(rv, sp_swap_inplace(fmt_str_be, swap_buff, (int)(sizeof swap_buff), 3) == SP_ERR_BUFF_OVERRUN, "swap overrun");
+
+    /* Test member width conversions */
+    printf("\nTesting member widths\n");
+    size_t w_offsets[5] = {0};
+    SP_ADD_STRUCT_OFFSET(w_offsets, 0, struct sp_widths, h_wide, H_wide, i_narrow, I_narrow, arr);
+    uint8_t w_bytes[2 + 2 + 4 + 4 + 600] = {0xff, 0x38, 0xea, 0x60, 0xff, 0xff, 0xff, 0x80, 0x00, 0x00, 0xff, 0xff};
+    int j;
+    for (j = 0; j < 300; j++) {
+        w_bytes[12 + 2 * j] = (uint8_t)((j - 150) >> 8);
+        w_bytes[13 + 2 * j] = (uint8_t)(j - 150);
+    }
+    struct sp_widths w = {0};
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_widths, 5, w_offsets, &w, w_bytes, (int)(sizeof w_bytes)) == SP_OK, "unpack widths");
+    SP_TEST_ASSERT(rv, w.h_wide == -200, "sign extend h to 8 bytes");
+    SP_TEST_ASSERT(rv, w.H_wide == 60000, "zero extend H to 4 bytes");
+    SP_TEST_ASSERT(rv, w.i_narrow == -128, "narrow i to 1 byte");
+    SP_TEST_ASSERT(rv, w.I_narrow == 65535, "narrow I to 2 bytes");
+    int arr_ok = 1;
+    for (j = 0; j < 300; j++) {
+        arr_ok = arr_ok && w.arr[j] == j - 150;
+    }
+    SP_TEST_ASSERT(rv, arr_ok, "sign extend [300]h to 4 bytes");
+
+    uint8_t w_pack[sizeof w_bytes] = {0};
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_widths, 5, w_offsets, &w, w_pack, (int)(sizeof w_pack)) == SP_OK, "pack widths");
+    SP_TEST_ASSERT(rv, memcmp(w_pack, w_bytes, sizeof w_bytes) == 0, "compare widths buffer");
+
+    w.h_wide = 40000;
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_widths, 5, w_offsets, &w, w_pack, (int)(sizeof w_pack)) == SP_ERR_RANGE, "pack out of range");
+    w.h_wide = -1;
+    w.arr[299] = -32769;
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_widths, 5, w_offsets, &w, w_pack, (int)(sizeof w_pack)) == SP_ERR_RANGE, "pack array out of range");
+    w_bytes[4] = 0x00;
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_widths, 5, w_offsets, &w, w_bytes, (int)(sizeof w_bytes)) == SP_ERR_RANGE, "unpack out of range");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">s:4", 1, w_offsets, &w, w_bytes, (int)(sizeof w_bytes)) == SP_ERR_INVALID_FMT_STR, "width on string");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">h:3", 1, w_offsets, &w, w_bytes, (int)(sizeof w_bytes)) == SP_ERR_INVALID_FMT_STR, "invalid width");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">:4h", 1, w_offsets, &w, w_bytes, (int)(sizeof w_bytes)) == SP_ERR_INVALID_FMT_STR, "width without type");
+
+    /* Test offset and alignment directives against the equivalent padding */
+    printf("\nTesting offset and alignment\n");
+    struct sp_pack_unpack seek = {0};
+    size_t seek_offsets[3] = {0};
+    SP_ADD_STRUCT_OFFSET(seek_offsets, 0, struct sp_pack_unpack, spi64, spi16arr, helloW);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">@16 q %4 %76 [5]h @ 87 5w", 3, seek_offsets, &seek, bytes_be, b_sz) == SP_OK, "unpack with offsets");
+    SP_TEST_ASSERT(rv, seek.spi64 == -8000000000 && seek.spi16arr[4] == 5000 && seek.helloW[4] == 'o', "compare offset unpack");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">@16 q @ 512", 1, seek_offsets, &seek, bytes_be, b_sz) == SP_ERR_BUFF_OVERRUN, "offset overrun");
+
+    /* Test UTF-8 members */
+    printf("\nTesting UTF-8 members\n");
+    size_t u_offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(u_offsets, 0, struct sp_utf8, name, label);
+    const uint16_t name_units[16] = {'T', 'h', 'e', ' ', 'q', 'u', 'i', 'c', 'k', ' ', 'w', 0xf6, 'r', 0xd83d, 0xde00, 0};
+    const uint32_t label_units[8] = {'A', 0x10ffff, 0x110000, 0xdc00, 'B', 0, 0, 0};
+    uint8_t u_bytes[16 * 2 + 8 * 4] = {0};
+    for (j = 0; j < 16; j++) {
+        u_bytes[2 * j] = (uint8_t)(name_units[j] >> 8);
+        u_bytes[2 * j + 1] = (uint8_t)name_units[j];
+    }
+    for (j = 0; j < 8; j++) {
+        u_bytes[33 + 4 * j] = (uint8_t)(label_units[j] >> 16);
+        u_bytes[34 + 4 * j] = (uint8_t)(label_units[j] >> 8);
+        u_bytes[35 + 4 * j] = (uint8_t)label_units[j];
+    }
+    struct sp_utf8 u = {{0}, {0}};
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_str_utf8, 2, u_offsets, &u, u_bytes, (int)(sizeof u_bytes)) == SP_OK, "unpack UTF-8");
+    SP_TEST_ASSERT(rv, strcmp(u.name, "The quick w\xc3\xb6r\xf0\x9f\x98\x80") == 0, "compare UTF-16 to UTF-8");
+    SP_TEST_ASSERT(rv, strcmp(u.label, "A\xf4\x8f\xbf\xbf\xef\xbf\xbd\xef\xbf\xbd" "B") == 0, "compare UTF-32 to UTF-8");
+
+    uint8_t u_pack[sizeof u_bytes] = {0};
+    strcpy(u.label, "A\xf4\x8f\xbf\xbf" "B");
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_utf8, 2, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_OK, "pack UTF-8");
+    SP_TEST_ASSERT(rv, memcmp(u_pack, u_bytes, 32) == 0, "compare UTF-8 to UTF-16");
+    SP_TEST_ASSERT(rv, memcmp(u_pack + 32, u_bytes + 32, 8) == 0 && memcmp(u_pack + 40, u_bytes + 48, 4) == 0, "compare UTF-8 to UTF-32");
+    strcpy(u.label, "bad \xc0\xaf");
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_utf8, 2, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_ERR_ENCODING, "pack overlong UTF-8");
+    strcpy(u.label, "\xed\xa0\x80");
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_utf8, 2, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_ERR_ENCODING, "pack encoded surrogate");
+    strcpy(u.label, "ninechars");
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_str_utf8, 2, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_ERR_RANGE, "pack too many code units");
+    strcpy(u.name, "Little endian ASCII, and \xc3\xa9");
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset("<16w:s", 1, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_ERR_RANGE, "pack LE too many code units");
+    u.name[15] = '\0';
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset("<16w:s", 1, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_OK, "pack LE UTF-8");
+    SP_TEST_ASSERT(rv, u_pack[0] == 'L' && u_pack[1] == 0 && u_pack[28] == 'A' && u_pack[30] == 0, "compare LE UTF-16");
+    memset(u.name, 'z', sizeof u.name);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset("<16w:s", 1, u_offsets, &u, u_pack, (int)(sizeof u_pack)) == SP_OK, "unpack LE UTF-8");
+    SP_TEST_ASSERT(rv, strcmp(u.name, "Little endian A") == 0, "compare LE UTF-8");
+
+    /* Test expected constants */
+    printf("\nTesting constants\n");
+    const char fmt_const[] = ">'Hello World!' I q i=-100000";
+    size_t c_offsets[2] = {0};
+    SP_ADD_STRUCT_OFFSET(c_offsets, 0, struct sp_pack_unpack, spu32, spi64);
+    struct sp_pack_unpack c_up = {0};
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_const, 2, c_offsets, &c_up, bytes_be, b_sz) == SP_OK, "unpack constants");
+    SP_TEST_ASSERT(rv, c_up.spu32 == 100000 && c_up.spi64 == -8000000000, "compare constants unpack");
+    uint8_t c_pack[28] = {0};
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_const, 2, c_offsets, &c_up, c_pack, (int)(sizeof c_pack)) == SP_OK, "pack constants");
+    SP_TEST_ASSERT(rv, memcmp(c_pack, bytes_be, sizeof c_pack) == 0, "compare constants pack");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">'Hello World?' I q", 2, c_offsets, &c_up, bytes_be, b_sz) == SP_ERR_MISMATCH, "unpack mismatched literal");
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(">12x I q i=100000", 2, c_offsets, &c_up, bytes_be, b_sz) == SP_ERR_MISMATCH, "unpack mismatched integer");
+    memcpy(swap_buff, bytes_be, 28);
+    SP_TEST_ASSERT(rv, sp_swap_inplace(fmt_const, swap_buff, 28, 1) == SP_OK, "swap constants");
+    SP_TEST_ASSERT(rv, memcmp(swap_buff + 24, host_bytes + 24, 4) == 0 && memcmp(swap_buff, "Hello World!", 12) == 0, "compare swapped constants");
+
+    /* Test strided groups, with one set of offsets for every element of s_arr */
+    printf("\nTesting strided groups\n");
+    const char fmt_strided[] = ">12s IqiQhH 3{qI} [5]h b 5w 5u";
+    size_t st_offsets[13] = {0};
+    SP_ADD_STRUCT_OFFSET(st_offsets, 0, struct sp_pack_unpack, hello, spu32, spi64, spi32, spu64, spi16, spu16);
+    SP_ADD_STRIDE(st_offsets, 7, struct sp_pack_unpack, s_arr);
+    st_offsets[9] = offsetof(struct sp_pack_unpack, s_arr[0].spsti64) - offsetof(struct sp_pack_unpack, s_arr);
+    st_offsets[10] = offsetof(struct sp_pack_unpack, s_arr[0].spstu32) - offsetof(struct sp_pack_unpack, s_arr);
+    SP_ADD_STRUCT_OFFSET(st_offsets, 11, struct sp_pack_unpack, spi16arr, spchar);
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_strided, 13, st_offsets, &c_up, bytes_be, b_sz) == SP_ERR_FIELD_CNT, "strided group field count");
+    const char fmt_strided_short[] = ">12s IqiQhH 3{qI} [5]h b";
+    struct sp_pack_unpack st = {0};
+    SP_TEST_ASSERT(rv, sp_unpack_bin_offset(fmt_strided_short, 13, st_offsets, &st, bytes_be, b_sz) == SP_OK, "unpack strided group");
+    SP_TEST_ASSERT(rv, st.s_arr[0].spsti64 == -7000000000 && st.s_arr[0].spstu32 == 200000 && st.s_arr[1].spsti64 == -8000000000 &&
+                       st.s_arr[1].spstu32 == 300000 && st.s_arr[2].spsti64 == -9000000000 && st.s_arr[2].spstu32 == 400000, "compare strided group");
+    SP_TEST_ASSERT(rv, st.spi16arr[4] == 5000 && st.spchar == 's' && st.spu16 == 60000, "fields around strided group");
+    uint8_t st_pack[87] = {0};
+    SP_TEST_ASSERT(rv, sp_pack_bin_offset(fmt_strided_short, 13, st_offsets, &st, st_pack, (int)(sizeof st_pack)) == SP_OK, "pack strided group");
+    SP_TEST_ASSERT(rv, memcmp(st_pack, bytes_be, sizeof st_pack) == 0, "compare strided group pack");
+    void* st_ptrs[13] = {0};
+    SP_TEST_ASSERT(rv, sp_unpack_bin_ptr(fmt_strided_short, 13, st_ptrs, bytes_be, b_sz) == SP_ERR_UNSUPPORTED, "strided group needs offsets");
+
     return rv;
 }
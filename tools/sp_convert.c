@@ -0,0 +1,311 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2019-2021 Sherman Perry
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Convert a file of back to back records from one format to another.
+ *
+ *   sp_convert [-j workers] [-b batch_records] src_fmt dest_fmt input output
+ *
+ * The conversion is a pipeline of a reader on the main thread, a number of
+ * workers, and a writer. Batches of records are read into a fixed pool of
+ * buffers, handed to the workers in turn, and collected by the writer in the
+ * same order, so the output keeps the order of the input. Emptied buffers go
+ * back to the reader. Every handoff is a lock-free single producer, single
+ * consumer queue, so no stage ever takes a lock.
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <structpack.h>
+#include "sp_os.h"
+
+#define SP_CONVERT_MAX_WORKERS 64
+/* Buffers in flight per worker, so the reader and writer stay ahead of the workers */
+#define SP_CONVERT_BUFFERS_PER_WORKER 4
+/* Default size of a batch of input records */
+#define SP_CONVERT_BATCH_BYTES (1 << 20)
+
+struct batch {
+    unsigned char* src;
+    unsigned char* dest;
+    int count;
+    SPResult res;
+};
+
+/* Bounded ring of batch pointers. head is only written by the consumer and tail only by the producer */
+struct spsc {
+    struct batch** slots;
+    size_t mask;
+    volatile size_t head;
+    volatile size_t tail;
+};
+
+struct convert {
+    const char* src_fmt;
+    const char* dest_fmt;
+    int src_size;
+    int dest_size;
+    int num_workers;
+    FILE* out;
+    /* Reader to each worker, each worker to the writer, and the writer back to the reader */
+    struct spsc to_worker[SP_CONVERT_MAX_WORKERS];
+    struct spsc to_writer[SP_CONVERT_MAX_WORKERS];
+    struct spsc free_batches;
+    /* Set by any stage that fails, to stop the others */
+    volatile size_t stop;
+    unsigned long long records;
+    const char* error;
+};
+
+static int spsc_init(struct spsc* q, size_t min_cap) {
+    size_t cap = 1;
+    while (cap < min_cap) {
+        cap *= 2;
+    }
+    q->slots = malloc(cap * sizeof *q->slots);
+    q->mask = cap - 1;
+    q->head = 0;
+    q->tail = 0;
+    return q->slots != NULL;
+}
+
+static bool spsc_try_push(struct spsc* q, struct batch* b) {
+    size_t tail = q->tail;
+    if (tail - sp_load_acquire(&q->head) > q->mask) {
+        return false;
+    }
+    q->slots[tail & q->mask] = b;
+    sp_store_release(&q->tail, tail + 1);
+    return true;
+}
+
+static bool spsc_try_pop(struct spsc* q, struct batch** b) {
+    size_t head = q->head;
+    if (head == sp_load_acquire(&q->tail)) {
+        return false;
+    }
+    *b = q->slots[head & q->mask];
+    sp_store_release(&q->head, head + 1);
+    return true;
+}
+
+static bool stopped(struct convert* c) {
+    return sp_load_acquire(&c->stop) != 0;
+}
+
+/* Only the first stage to claim the stop flag records its error */
+static void fail(struct convert* c, const char* error) {
+    if (sp_cas(&c->stop, 0, 1)) {
+        c->error = error;
+    }
+}
+
+/* Blocking push and pop. Both give up, returning false, once another stage has failed */
+static bool push(struct convert* c, struct spsc* q, struct batch* b) {
+    while (!spsc_try_push(q, b)) {
+        if (stopped(c)) {
+            return false;
+        }
+        sp_yield();
+    }
+    return true;
+}
+
+static bool pop(struct convert* c, struct spsc* q, struct batch** b) {
+    while (!spsc_try_pop(q, b)) {
+        if (stopped(c)) {
+            return false;
+        }
+        sp_yield();
+    }
+    return true;
+}
+
+/* A NULL batch marks the end of the input */
+static void worker(void* ctx, int w) {
+    struct convert* c = ctx;
+    struct batch* b;
+    while (pop(c, &c->to_worker[w], &b)) {
+        if (b) {
+            b->res = sp_transcode(c->src_fmt, c->dest_fmt, b->src, b->count * c->src_size,
+                                  b->dest, b->count * c->dest_size, b->count);
+        }
+        if (!push(c, &c->to_writer[w], b) || !b) {
+            return;
+        }
+    }
+}
+
+static void writer(void* ctx, int task) {
+    struct convert* c = ctx;
+    struct batch* b;
+    (void)task;
+    for (int w = 0; pop(c, &c->to_writer[w], &b); w = (w + 1) % c->num_workers) {
+        if (!b) {
+            return;
+        }
+        if (b->res != SP_OK) {
+            fail(c, b->res == SP_ERR_RANGE ? "a value does not fit its output field" : "formats cannot be converted");
+            return;
+        }
+        if (fwrite(b->dest, (size_t)c->dest_size, (size_t)b->count, c->out) != (size_t)b->count) {
+            fail(c, "failure to write output");
+            return;
+        }
+        c->records += (unsigned long long)b->count;
+        if (!push(c, &c->free_batches, b)) {
+            return;
+        }
+    }
+}
+
+static void reader(struct convert* c, FILE* in, int batch_records) {
+    const size_t batch_bytes = (size_t)batch_records * (size_t)c->src_size;
+    int w = 0;
+    struct batch* b;
+    while (pop(c, &c->free_batches, &b)) {
+        size_t got = fread(b->src, 1, batch_bytes, in);
+        if (got % (size_t)c->src_size != 0) {
+            fail(c, "input ends part way through a record");
+            return;
+        }
+        if (got == 0) {
+            break;
+        }
+        b->count = (int)(got / (size_t)c->src_size);
+        if (!push(c, &c->to_worker[w], b)) {
+            return;
+        }
+        w = (w + 1) % c->num_workers;
+    }
+    if (ferror(in)) {
+        fail(c, "failure to read input");
+        return;
+    }
+    for (int i = 0; i < c->num_workers; i++) {
+        if (!push(c, &c->to_worker[i], NULL)) {
+            return;
+        }
+    }
+}
+
+static int usage(void) {
+    fprintf(stderr, "Usage: sp_convert [-j workers] [-b batch_records] src_fmt dest_fmt input output\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    int num_workers = sp_cpu_count() > 2 ? sp_cpu_count() - 2 : 1;
+    int batch_records = 0;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "-j") == 0) {
+            num_workers = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            batch_records = atoi(argv[arg + 1]);
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 4 || num_workers < 1 || batch_records < 0) {
+        return usage();
+    }
+    if (num_workers > SP_CONVERT_MAX_WORKERS) {
+        num_workers = SP_CONVERT_MAX_WORKERS;
+    }
+
+    struct convert c;
+    memset(&c, 0, sizeof c);
+    c.src_fmt = argv[arg];
+    c.dest_fmt = argv[arg + 1];
+    c.num_workers = num_workers;
+    if (sp_packed_size(c.src_fmt, &c.src_size) != SP_OK || sp_packed_size(c.dest_fmt, &c.dest_size) != SP_OK) {
+        fprintf(stderr, "Invalid format string\n");
+        return EXIT_FAILURE;
+    }
+    if (batch_records == 0) {
+        batch_records = SP_CONVERT_BATCH_BYTES / c.src_size > 0 ? SP_CONVERT_BATCH_BYTES / c.src_size : 1;
+    }
+    if (batch_records > INT_MAX / c.src_size || batch_records > INT_MAX / c.dest_size) {
+        return usage();
+    }
+    FILE* in = fopen(argv[arg + 2], "rb");
+    if (!in) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg + 2]);
+        return EXIT_FAILURE;
+    }
+    c.out = fopen(argv[arg + 3], "wb");
+    if (!c.out) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg + 3]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    /* Every buffer is either free or in exactly one queue, so no queue can hold more than all of them */
+    const int num_batches = num_workers * SP_CONVERT_BUFFERS_PER_WORKER;
+    struct batch* batches = calloc((size_t)num_batches, sizeof *batches);
+    bool ok = batches && spsc_init(&c.free_batches, (size_t)num_batches + 1);
+    for (int i = 0; ok && i < num_workers; i++) {
+        ok = spsc_init(&c.to_worker[i], (size_t)num_batches + 1) && spsc_init(&c.to_writer[i], (size_t)num_batches + 1);
+    }
+    for (int i = 0; ok && i < num_batches; i++) {
+        batches[i].src = malloc((size_t)batch_records * (size_t)c.src_size);
+        batches[i].dest = malloc((size_t)batch_records * (size_t)c.dest_size);
+        ok = batches[i].src && batches[i].dest && spsc_try_push(&c.free_batches, &batches[i]);
+    }
+
+    struct sp_thread* threads[SP_CONVERT_MAX_WORKERS + 1] = {0};
+    int num_threads = 0;
+    double start = sp_seconds();
+    if (!ok) {
+        fail(&c, "out of memory");
+    } else if (sp_thread_start(&threads[num_threads++], writer, &c, 0) != SP_OK) {
+        fail(&c, "unable to start threads");
+    }
+    for (int w = 0; w < num_workers && !stopped(&c); w++) {
+        if (sp_thread_start(&threads[num_threads++], worker, &c, w) != SP_OK) {
+            fail(&c, "unable to start threads");
+        }
+    }
+    if (!stopped(&c)) {
+        reader(&c, in, batch_records);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        sp_thread_join(threads[i]);
+    }
+    double elapsed = sp_seconds() - start;
+
+    fclose(in);
+    if (fclose(c.out) != 0) {
+        fail(&c, "failure to write output");
+    }
+    for (int i = 0; batches && i < num_batches; i++) {
+        free(batches[i].src);
+        free(batches[i].dest);
+    }
+    free(batches);
+    free(c.free_batches.slots);
+    for (int i = 0; i < num_workers; i++) {
+        free(c.to_worker[i].slots);
+        free(c.to_writer[i].slots);
+    }
+    if (c.error) {
+        fprintf(stderr, "Conversion failed: %s\n", c.error);
+        return EXIT_FAILURE;
+    }
+
+    double in_mb = (double)c.records * c.src_size / 1e6;
+    double out_mb = (double)c.records * c.dest_size / 1e6;
+    if (elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+    fprintf(stderr, "%llu records, %.1f MB in, %.1f MB out, %.3f s, %.1f MB/s in, %.1f MB/s out, %d workers\n",
+            c.records, in_mb, out_mb, elapsed, in_mb / elapsed, out_mb / elapsed, num_workers);
+    return EXIT_SUCCESS;
+}